@@ -13,6 +13,9 @@
 #include <filesystem>
 #include <GLFW/glfw3.h>  // Include GLFW for OpenGL window management
 #include <GL/gl.h>
+#include <thread>
+#include <memory>
+#include "../Common/FrameSourceOptions.h"  // Camera, synthetic and replay frame sources
 
 using namespace Spinnaker;
 using namespace Spinnaker::GenApi;
@@ -60,16 +63,18 @@ class Tracker
 public:
     // Constructor
     Tracker(const string& mouse_ID, const string& start_time, const string& path,
-        int cam_no, float FPS, int windowWidth, int windowHeight)
+        int cam_no, float FPS, int windowWidth, int windowHeight,
+        const FrameSourceOptions& sourceOptions = FrameSourceOptions())
         : mouse_ID(mouse_ID), start_time(start_time), path(path),
         cam_no(cam_no), FPS(FPS), windowWidth(windowWidth),
         windowHeight(windowHeight), frame_count(0)
     {
-        system = System::GetInstance();
-        CameraList camList = system->GetCameras();
-
         // Set serial number based on cam_no
-        if (cam_no == 1) {
+        if (sourceOptions.type != FrameSourceType::Camera) {
+            // No camera involved; keep the rig number for signal files and don't cap the rate
+            max_FPS = FPS;
+        }
+        else if (cam_no == 1) {
             camSerial = "22181614";
             max_FPS = 170.0;
         }
@@ -105,43 +110,16 @@ public:
         windowTitle << "Rig " << cam_no << ". Press 'Esc' to stop session.";
         title = windowTitle.str();
 
-        // Use GetBySerial to get the camera
-        pCam = camList.GetBySerial(camSerial);
-
-        if (!pCam) {
-            cerr << "Error: Camera can't open\nexit" << endl;
-            throw runtime_error("Camera can't open");
-        }
-
-        pCam->Init();
-        setCameraFrameRate(FPS);    // Set the frame rate
-        setGPIOLine2ToOutput();     // Set GPIO Line 2 to output
-        setExposureTimeLowerLimit(4000.0);  // Set exposure time lower limit
-
-        INodeMap& nodeMap = pCam->GetNodeMap();
-
-        // Set acquisition mode to continuous
-        CEnumerationPtr ptrAcquisitionMode = nodeMap.GetNode("AcquisitionMode");
-        if (!IsReadable(ptrAcquisitionMode) || !IsWritable(ptrAcquisitionMode)) {
-            cerr << "Error: Unable to set acquisition mode to continuous." << endl;
-            throw runtime_error("Unable to set acquisition mode to continuous");
-        }
-
-        CEnumEntryPtr ptrAcquisitionModeContinuous =
-            ptrAcquisitionMode->GetEntryByName("Continuous");
-        if (!IsReadable(ptrAcquisitionModeContinuous)) {
-            cerr << "Error: Unable to get or set acquisition mode to continuous." << endl;
-            throw runtime_error("Unable to set acquisition mode to continuous");
-        }
-
-        const int64_t acquisitionModeContinuous = ptrAcquisitionModeContinuous->GetValue();
-        ptrAcquisitionMode->SetIntValue(acquisitionModeContinuous);
+        // Open the camera (or synthetic/replay source) and apply its settings
+        source = createFrameSource(sourceOptions, camSerial, FPS);
+        cout << "Frame source: " << source->description() << endl;
+        this->FPS = static_cast<float>(source->frameRate());  // Rate actually in use, e.g. after the camera's cap
 
-        pCam->BeginAcquisition();
+        source->beginAcquisition();
 
-        imageWidth = pCam->Width.GetValue();
-        imageHeight = pCam->Height.GetValue();
-        pixelFormat = pCam->PixelFormat.GetCurrentEntry()->GetSymbolic();
+        imageWidth = source->width();
+        imageHeight = source->height();
+        pixelFormat = source->pixelFormat();
 
         // Open the binary file for writing
         stringstream binFilename;
@@ -156,15 +134,10 @@ public:
     // Destructor
     ~Tracker()
     {
-        if (pCam) {
-            pCam->EndAcquisition();
-            pCam->DeInit();
-            pCam = nullptr;
-        }
+        source.reset();  // Ends acquisition and releases the camera
         if (imageFile.is_open()) {
             imageFile.close();
         }
-        system->ReleaseInstance();
     }
 
     void startTracking(bool show_frame, bool save_video)
@@ -193,8 +166,7 @@ private:
     size_t frame_count;
     string camSerial;
     float max_FPS;
-    CameraPtr pCam;
-    SystemPtr system;
+    unique_ptr<FrameSource> source;
     vector<uint64_t> frame_IDs;
     vector<uint64_t> frame_IDs_mem;
     high_resolution_clock::time_point timer_start_time;
@@ -260,10 +232,17 @@ private:
         while (keepRunning) {
             try {
 
-                ImagePtr pResultImage = pCam->GetNextImage(1000);
+                GrabbedFrame frame;
+                bool grabbed = source->grabFrame(frame, 1000);
+
+                if (!grabbed && source->finished()) {
+                    cout << "Frame source finished." << endl;
+                    keepRunning = false;
+                    break;
+                }
 
-                if (!pResultImage || pResultImage->IsIncomplete()) {
-                    if (pResultImage) pResultImage->Release();
+                if (!grabbed || frame.incomplete) {
+                    if (grabbed) source->releaseFrame(frame);
 
                     cerr << "Error: Image incomplete or null" << endl;
 
@@ -282,19 +261,19 @@ private:
 
                 if (save_video) {
                     // Write raw image data to the binary file
-                    const char* imageData = reinterpret_cast<const char*>(pResultImage->GetData());
-                    size_t imageSize = pResultImage->GetImageSize();
+                    const char* imageData = reinterpret_cast<const char*>(frame.data);
+                    size_t imageSize = frame.size;
 
                     imageFile.write(imageData, imageSize);
                     if (!imageFile.good()) {
                         cerr << "Error: Failed to write image data to binary file." << endl;
-                        pResultImage->Release();
+                        source->releaseFrame(frame);
                         keepRunning = false;
                         break;
                     }
 
                     // Add frame ID to the list
-                    uint64_t frameID = pResultImage->GetFrameID();
+                    uint64_t frameID = frame.frameID;
                     frame_IDs.push_back(frameID);       // Save to frame_IDs
                     frame_IDs_mem.push_back(frameID);   // Save to frame_IDs_mem
 
@@ -316,7 +295,7 @@ private:
                     if (elapsedTime >= frame_skip) {
                         // Convert image to OpenGL texture format
                         cv::Mat image(cv::Size(imageWidth, imageHeight), CV_8UC1,
-                            pResultImage->GetData(), pResultImage->GetStride());
+                            const_cast<void*>(frame.data), frame.stride);
 
                         // Resize the image to fit the OpenGL window
                         cv::Mat resizedImage;
@@ -350,11 +329,11 @@ private:
                     }
                 }
 
-                pResultImage->Release();
+                source->releaseFrame(frame);
                 frame_count++;
 
             }
-            catch (Spinnaker::Exception& e) {
+            catch (const std::exception& e) {
                 cerr << "Camera error: " << e.what() << endl;
 
                 if (!attemptRecovery()) {
@@ -391,42 +370,16 @@ private:
             return false;
         }
 
-        try {
-            cerr << "Attempting camera recovery (attempt " << recoveryAttempts + 1 << " of " << MAX_RECOVERY_ATTEMPTS << ")..." << endl;
-
-            pCam->EndAcquisition();
-            std::this_thread::sleep_for(std::chrono::milliseconds(500));
-
-            // Reset camera settings
-            pCam->DeInit();
-            std::this_thread::sleep_for(std::chrono::milliseconds(500));
-
-            pCam->Init();
-            setCameraFrameRate(FPS);
-            setGPIOLine2ToOutput();
-            setExposureTimeLowerLimit(4000.0);
-
-            pCam->BeginAcquisition();
-
-            // Test if camera is working
-            ImagePtr testImage = pCam->GetNextImage(1000);
-            if (testImage && !testImage->IsIncomplete()) {
-                testImage->Release();
-                cerr << "Camera recovered successfully" << endl;
-                recoveryAttempts = 0;  // Reset counter on successful recovery
-                return true;
-            }
-            testImage->Release();
-
-            recoveryAttempts++;
-            return false;
+        cerr << "Attempting camera recovery (attempt " << recoveryAttempts + 1 << " of " << MAX_RECOVERY_ATTEMPTS << ")..." << endl;
 
+        // Counted until a complete frame arrives: a camera that re-initialises
+        // but never delivers one must still run out of attempts
+        recoveryAttempts++;
+        if (source->recover()) {
+            cerr << "Camera re-initialised; waiting for a complete frame" << endl;
+            return true;
         }
-        catch (Spinnaker::Exception& e) {
-            cerr << "Recovery attempt failed: " << e.what() << endl;
-            recoveryAttempts++;
-            return false;
-        }
+        return false;
     }
 
     bool checkForStopSignal() {
@@ -510,6 +463,7 @@ private:
         data["image_height"] = imageHeight;
         data["image_width"] = imageWidth;
         data["pixel_format"] = pixelFormat;
+        data["source"] = source->description();
         data["frame_IDs"] = frame_IDs_mem;
 
         ofstream file(path + "/" + file_name);
@@ -528,61 +482,6 @@ private:
         return string(buffer);
     }
 
-    void setCameraFrameRate(double frameRate)
-    {
-        INodeMap& nodeMap = pCam->GetNodeMap();
-        CBooleanPtr ptrFrameRateEnable = nodeMap.GetNode("AcquisitionFrameRateEnable");
-        if (IsWritable(ptrFrameRateEnable)) {
-            ptrFrameRateEnable->SetValue(true);
-        }
-        else {
-            throw runtime_error("Unable to enable frame rate");
-        }
-
-        CFloatPtr ptrFrameRate = nodeMap.GetNode("AcquisitionFrameRate");
-        if (IsWritable(ptrFrameRate)) {
-            ptrFrameRate->SetValue(frameRate);
-        }
-        else {
-            throw runtime_error("Unable to set frame rate");
-        }
-    }
-
-    void setGPIOLine2ToOutput()
-    {
-        INodeMap& nodeMap = pCam->GetNodeMap();
-
-        // Select Line 2
-        CEnumerationPtr ptrLineSelector = nodeMap.GetNode("LineSelector");
-        if (IsWritable(ptrLineSelector)) {
-            CEnumEntryPtr ptrLine2 = ptrLineSelector->GetEntryByName("Line2");
-            if (IsReadable(ptrLine2)) {
-                ptrLineSelector->SetIntValue(ptrLine2->GetValue());
-            }
-            else {
-                throw runtime_error("Unable to select Line 2");
-            }
-        }
-        else {
-            throw runtime_error("Unable to access LineSelector");
-        }
-
-        // Set Line Mode to Output
-        CEnumerationPtr ptrLineMode = nodeMap.GetNode("LineMode");
-        if (IsWritable(ptrLineMode)) {
-            CEnumEntryPtr ptrOutput = ptrLineMode->GetEntryByName("Output");
-            if (IsReadable(ptrOutput)) {
-                ptrLineMode->SetIntValue(ptrOutput->GetValue());
-            }
-            else {
-                throw runtime_error("Unable to set line mode to output");
-            }
-        }
-        else {
-            throw runtime_error("Unable to access LineMode");
-        }
-    }
-
     void createSignalFile()
     {
         // Create the signal file in the specified path
@@ -590,44 +489,6 @@ private:
         ofstream file(signal_file);
         file.close();
     }
-
-    void setExposureTimeLowerLimit(double exposureTimeLowerLimit)
-    {
-        INodeMap& nodeMap = pCam->GetNodeMap();
-
-        // Set ExposureAuto to Continuous
-        CEnumerationPtr ptrExposureAuto = nodeMap.GetNode("ExposureAuto");
-        if (IsWritable(ptrExposureAuto)) {
-            CEnumEntryPtr ptrExposureAutoContinuous =
-                ptrExposureAuto->GetEntryByName("Continuous");
-            if (IsReadable(ptrExposureAutoContinuous)) {
-                ptrExposureAuto->SetIntValue(ptrExposureAutoContinuous->GetValue());
-            }
-            else {
-                throw runtime_error("Unable to set ExposureAuto to Continuous");
-            }
-        }
-        else {
-            throw runtime_error("Unable to access ExposureAuto");
-        }
-
-        // Set AutoExposureExposureTimeLowerLimit
-        CFloatPtr ptrExposureTimeLowerLimit =
-            nodeMap.GetNode("AutoExposureExposureTimeLowerLimit");
-        if (!IsAvailable(ptrExposureTimeLowerLimit) || !IsWritable(ptrExposureTimeLowerLimit)) {
-            throw runtime_error("Unable to access AutoExposureExposureTimeLowerLimit");
-        }
-
-        double minExposureTimeLowerLimit = ptrExposureTimeLowerLimit->GetMin();
-        double maxExposureTimeLowerLimit = ptrExposureTimeLowerLimit->GetMax();
-
-        if (exposureTimeLowerLimit < minExposureTimeLowerLimit)
-            exposureTimeLowerLimit = minExposureTimeLowerLimit;
-        else if (exposureTimeLowerLimit > maxExposureTimeLowerLimit)
-            exposureTimeLowerLimit = maxExposureTimeLowerLimit;
-
-        ptrExposureTimeLowerLimit->SetValue(exposureTimeLowerLimit);
-    }
 };
 
 // Main function
@@ -640,6 +501,7 @@ int main(int argc, char** argv)
     float FPS = 60.0f;
     int windowWidth = 800;  // Default window width
     int windowHeight = 600; // Default window height
+    FrameSourceOptions sourceOptions;
 
     // Parse command-line arguments
     for (int i = 1; i < argc; i += 2) {
@@ -666,6 +528,9 @@ int main(int argc, char** argv)
         else if (arg == "--windowHeight" && i + 1 < argc) {
             windowHeight = stoi(argv[i + 1]);
         }
+        else if (i + 1 < argc && parseFrameSourceOption(arg, argv[i + 1], sourceOptions)) {
+            // --source, --sim_* and --replay_* options
+        }
     }
 
     if (date_time.empty()) {
@@ -689,7 +554,7 @@ int main(int argc, char** argv)
     }
 
     try {
-        Tracker camera(mouse_ID, date_time, path, cam, FPS, windowWidth, windowHeight);
+        Tracker camera(mouse_ID, date_time, path, cam, FPS, windowWidth, windowHeight, sourceOptions);
         camera.startTracking(true, true);
     }
     catch (const std::exception& e) {
@@ -11,8 +11,32 @@
 #include "nlohmann/json.hpp"  // Include the nlohmann/json library
 #include <direct.h>           // Include for _mkdir on Windows
 #include <filesystem>
-#include <GLFW/glfw3.h>  // Include GLFW for OpenGL window management
-#include <GL/gl.h>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <map>
+#include <cstring>
+#include "../Common/FrameRing.h"  // Frame queue between acquisition and writer threads
+#include "../Common/FrameSourceOptions.h"  // Camera, synthetic and replay frame sources
+#include "../Common/FileSink.h"
+#include "../Common/DirectFileSink.h"  // Preallocated, unbuffered block writer for the .bin
+#include "../Common/AsyncFileSink.h"  // io_uring / overlapped writer with several writes in flight
+#include "../Common/RecordingFormat.h"  // .camrec container with per-frame records and an index
+#include "../Common/FrameCompressor.h"  // Lossless compression on worker threads before the writer
+#include "../Common/PreviewWindow.h"  // Preview drawn on its own thread, fed the latest frame
+#include "../Common/ControlChannel.h"  // stop/pause/resume/mark commands and the stop signal file
+#include "../Common/FrameJournal.h"  // Binary per-frame journal for rebuilding the metadata after a crash
+#include "../Common/FrameTable.h"  // Per-frame IDs and timestamps, by column, next to the JSON
+#include "../Common/FrameDropMonitor.h"  // Frame ID gaps, incomplete frames and the camera's stream counters
+#include "../Common/ClockSync.h"  // Camera clock latched against the host clocks, for aligning frames with other data
+#include "../Common/LatencyHistogram.h"  // Per-stage timings of the capture and writer threads
+#include "../Common/TraceRecorder.h"  // Opt-in per-frame timeline of every thread, as Chrome trace JSON
+#include "../Common/WorkerPool.h"  // Compression threads shared by several cameras
+#include "../Common/WriterPool.h"  // Writer threads shared by several cameras
+#include "../Common/StartGate.h"  // Starts several cameras' acquisition together and measures the skew
+#include "../Common/RecoveryPolicy.h"  // Skip, restart the stream or re-initialise the camera after a fault
+#include "../Common/FrameRateGovernor.h"  // Exposure limits for the frame rate, and a check that it is delivered
+#include "../Common/SharedFrameRing.h"  // Frames in shared memory for online analysis in other processes
 
 using namespace Spinnaker;
 using namespace Spinnaker::GenApi;
@@ -22,29 +46,6 @@ using namespace std::chrono;
 using json = nlohmann::json;
 namespace fs = std::filesystem;
 
-GLFWwindow* initializeOpenGL(int width, int height, const std::string& title)
-{
-    // Initialize GLFW
-    if (!glfwInit())
-    {
-        std::cerr << "Failed to initialize GLFW" << std::endl;
-        exit(EXIT_FAILURE);
-    }
-
-    // Create a GLFW window
-    GLFWwindow* window = glfwCreateWindow(width, height, title.c_str(), NULL, NULL);
-    if (!window)
-    {
-        std::cerr << "Failed to create GLFW window" << std::endl;
-        glfwTerminate();
-        exit(EXIT_FAILURE);
-    }
-
-    glfwMakeContextCurrent(window);
-    glViewport(0, 0, width, height);
-    return window;
-}
-
 void causeSpinnakerException() {
     throw Spinnaker::Exception(
         __LINE__,                          // Current line number
@@ -55,21 +56,59 @@ void causeSpinnakerException() {
     );
 }
 
+// Settings for the path from acquisition to disk
+struct RecordingOptions
+{
+    size_t queueFrames = 0;  // 0 = size the queue from a fixed memory budget
+    RingFullPolicy queuePolicy = RingFullPolicy::Block;
+    string format = "raw";  // "raw" (headerless .bin, what existing scripts read) or "container" (.camrec)
+    string writer = "buffered";  // "buffered", "direct" or "async"
+    size_t writeBlockMB = 8;  // Block size for the direct and async writers
+    size_t writeDepth = 4;  // Writes the async writer keeps in flight
+    double expectedDurationMin = 0;  // Used to preallocate the .bin (0 = don't preallocate)
+    string compression = "none";  // "none" or "lossless" (container format only)
+    size_t compressThreads = 0;  // 0 = half the hardware threads
+    string control;  // Control socket / pipe; empty = default for the rig, "none" = signal file only
+    string trace;  // Chrome trace of every stage of every frame; empty = no tracing
+    string publish;  // Shared memory name other processes read frames from; empty = not published
+    size_t publishEvery = 1;  // Publish every Nth frame
+    size_t publishSlots = 8;  // Frames a reader can fall behind before it misses some
+};
+
+// What the cameras share when several record from one process (--serial_numbers)
+struct SharedCapture
+{
+    WriterPool* writers = nullptr;  // Writes every camera's frames; null = a writer thread of its own
+    WorkerPool* compressors = nullptr;  // Compresses every camera's frames; null = threads of its own
+    StartGate* start = nullptr;  // Acquisition starts when every camera is ready; null = straight away
+    size_t cameraIndex = 0;
+    vector<string> cameras;  // Serial numbers of all of them, for the metadata
+    TraceRecorder* tracer = nullptr;  // One trace for the process; null = per --trace
+};
+
 class Tracker
 {
 public:
     // Constructor
     Tracker(const string& mouse_ID, const string& start_time, const string& path,
-        const string& serial_number, float FPS, int windowWidth, int windowHeight)
+        const string& serial_number, float FPS, int windowWidth, int windowHeight,
+        const FrameSourceOptions& sourceOptions = FrameSourceOptions(),
+        const RecordingOptions& recording = RecordingOptions(),
+        const SharedCapture& shared = SharedCapture())
         : mouse_ID(mouse_ID), start_time(start_time), path(path),
         camSerial(serial_number), FPS(FPS), windowWidth(windowWidth),
-        windowHeight(windowHeight), frame_count(0)
+        windowHeight(windowHeight), frame_count(0), recording(recording), shared(shared)
     {
-        system = System::GetInstance();
-        CameraList camList = system->GetCameras();
-
         // Set serial number based on cam_no
-        if (camSerial == "22181614") { // rig 1
+        if (sourceOptions.type != FrameSourceType::Camera) {
+            // No camera involved; name the "rig" after the source and don't cap the rate
+            rig = frameSourceTypeName(sourceOptions.type);
+            if (shared.start) {
+                rig += "_" + serial_number;  // Several of them: keep their status files and control endpoints apart
+            }
+            max_FPS = FPS;
+        }
+        else if (camSerial == "22181614") { // rig 1
             max_FPS = 170.0;
             rig = "1";
         }
@@ -109,82 +148,107 @@ public:
         windowTitle << "Rig " << rig << ". Press 'Esc' to stop session.";
         title = windowTitle.str();
 
-        // Use GetBySerial to get the camera
-        pCam = camList.GetBySerial(camSerial);
-
-        if (!pCam) {
-            cerr << "Error: Camera can't open\nexit" << endl;
-            throw runtime_error("Camera can't open");
+        // Open the camera (or synthetic/replay source) and apply its settings;
+        // acquisition starts just before the capture loop
+        source = createFrameSource(sourceOptions, camSerial, FPS);
+        cout << "Frame source: " << source->description() << endl;
+        this->FPS = static_cast<float>(source->frameRate());  // Rate actually in use, e.g. after the camera's cap
+        recovery = make_unique<RecoveryPolicy>(this->FPS);
+        frameRate = make_unique<FrameRateGovernor>(this->FPS);
+
+        imageWidth = source->width();
+        imageHeight = source->height();
+        pixelFormat = source->pixelFormat();
+
+        // Allocate the frame queue up front; slots grow on first use if the
+        // source delivers more than expected.
+        size_t frameBytes = imageWidth * imageHeight * bytesPerPixel(pixelFormat);
+        size_t queueFrames = this->recording.queueFrames;
+        if (queueFrames == 0) {
+            queueFrames = QUEUE_MEMORY_BUDGET / (frameBytes > 0 ? frameBytes : 1);
+            if (queueFrames < MIN_QUEUE_FRAMES) queueFrames = MIN_QUEUE_FRAMES;
         }
+        frameRing = make_unique<FrameRing>(queueFrames, frameBytes, this->recording.queuePolicy);
 
-        pCam->Init();
-
-        // Print host controller information
-        cout << "===== Host Controller Information =====" << endl;
-        printHostControllerInfo();
-        cout << "=======================================" << endl;
-
-        setCameraFrameRate(FPS);    // Set the frame rate
-        setGPIOLine2ToOutput();     // Set GPIO Line 2 to output
-        setExposureTimeLowerLimit(4000.0);  // Set exposure time lower limit
-
-        INodeMap& nodeMap = pCam->GetNodeMap();
-
-        // Set acquisition mode to continuous
-        CEnumerationPtr ptrAcquisitionMode = nodeMap.GetNode("AcquisitionMode");
-        if (!IsReadable(ptrAcquisitionMode) || !IsWritable(ptrAcquisitionMode)) {
-            cerr << "Error: Unable to set acquisition mode to continuous." << endl;
-            throw runtime_error("Unable to set acquisition mode to continuous");
+        // Open the binary file for writing
+        stringstream binFilename;
+        if (this->recording.format == "raw") {
+            binFilename << path << "/" + start_time + "_" + mouse_ID + "_binary_video.bin";
         }
-
-        CEnumEntryPtr ptrAcquisitionModeContinuous =
-            ptrAcquisitionMode->GetEntryByName("Continuous");
-        if (!IsReadable(ptrAcquisitionModeContinuous)) {
-            cerr << "Error: Unable to get or set acquisition mode to continuous." << endl;
-            throw runtime_error("Unable to set acquisition mode to continuous");
+        else {
+            binFilename << path << "/" + start_time + "_" + mouse_ID + "_video.camrec";
+        }
+        imageSink = openVideoSink(binFilename.str(), frameBytes);
+        if (!imageSink) {
+            cerr << "Error: Could not open binary file for writing." << endl;
+            throw runtime_error("Could not open binary file for writing");
         }
 
-        const int64_t acquisitionModeContinuous = ptrAcquisitionModeContinuous->GetValue();
-        ptrAcquisitionMode->SetIntValue(acquisitionModeContinuous);
-
-        pCam->BeginAcquisition();
+        if (this->recording.format != "raw") {
+            // Geometry goes in the file header, so the recording is usable even if the JSON is never written
+            camrec::RecordingInfo info;
+            info.width = static_cast<uint32_t>(imageWidth);
+            info.height = static_cast<uint32_t>(imageHeight);
+            info.bytesPerPixel = static_cast<uint32_t>(bytesPerPixel(pixelFormat));
+            info.pixelFormat = pixelFormat;
+            info.frameRate = this->FPS;
+            info.startTimeNs = static_cast<uint64_t>(duration_cast<nanoseconds>(system_clock::now().time_since_epoch()).count());
+            recordingWriter = make_unique<camrec::RecordingWriter>(*imageSink, info);
+        }
 
-        imageWidth = pCam->Width.GetValue();
-        imageHeight = pCam->Height.GetValue();
-        pixelFormat = pCam->PixelFormat.GetCurrentEntry()->GetSymbolic();
+        tracer = shared.tracer;
+        if (!tracer && !this->recording.trace.empty()) {
+            ownTracer = make_unique<TraceRecorder>(this->recording.trace, "Camera_to_binary rig " + rig);
+            if (!ownTracer->isOpen()) {
+                cerr << "Error: Could not open trace file " << this->recording.trace << endl;
+                throw runtime_error("Could not open trace file");
+            }
+            tracer = ownTracer.get();
+        }
+        if (shared.tracer) {
+            queueCounterName = "write_queue rig " + rig;
+        }
 
-        // Open the binary file for writing
-        stringstream binFilename;
-        binFilename << path << "/" + start_time + "_" + mouse_ID + "_binary_video.bin";
-        imageFile.open(binFilename.str(), ios::binary | ios::out);
-        if (!imageFile.is_open()) {
-            cerr << "Error: Could not open binary file for writing." << endl;
-            throw runtime_error("Could not open binary file for writing");
+        lossless::Layout layout(imageWidth, imageHeight, pixelFormat);
+        if (this->recording.compression == "lossless" && shared.compressors) {
+            compressor = make_unique<FrameCompressor>(layout, *shared.compressors, tracer);
+            cout << "Compression: lossless, sharing " << shared.compressors->threads() << " threads" << endl;
+        }
+        else if (this->recording.compression == "lossless") {
+            size_t threads = this->recording.compressThreads;
+            if (threads == 0) {
+                threads = max<size_t>(1, thread::hardware_concurrency() / 2);
+            }
+            compressor = make_unique<FrameCompressor>(layout, threads, tracer);
+            cout << "Compression: lossless, " << threads << " threads" << endl;
         }
     }
 
     // Destructor
     ~Tracker()
     {
-        if (pCam) {
-            pCam->EndAcquisition();
-            pCam->DeInit();
-            pCam = nullptr;
-        }
-        if (imageFile.is_open()) {
-            imageFile.close();
-        }
-        system->ReleaseInstance();
+        source.reset();  // Ends acquisition and releases the camera
+        imageSink.reset();  // Writes out anything still buffered
     }
 
     void startTracking(bool show_frame, bool save_video)
     {
-        frame_IDs.clear();
         timer_start_time = high_resolution_clock::now();
         saveData();
 
-        // Start the capture loop
-        captureFrames(show_frame, save_video);
+        // Start the capture loop. Whatever happens, the other cameras mustn't wait for this one to start.
+        try {
+            captureFrames(show_frame, save_video);
+        }
+        catch (...) {
+            if (shared.start) {
+                shared.start->leave(shared.cameraIndex);
+            }
+            throw;
+        }
+        if (shared.start) {
+            shared.start->leave(shared.cameraIndex);
+        }
 
         end_time = currentDateTime();
         saveData();
@@ -203,10 +267,10 @@ private:
     float FPS;
     size_t frame_count;
     float max_FPS;
-    CameraPtr pCam;
-    SystemPtr system;
-    vector<uint64_t> frame_IDs;
-    vector<uint64_t> frame_IDs_mem;
+    unique_ptr<FrameSource> source;
+    uint64_t framesSaved = 0;  // Summary for the JSON; the frames themselves are listed in the frame table
+    uint64_t firstFrameID = 0;
+    uint64_t lastFrameID = 0;
     high_resolution_clock::time_point timer_start_time;
     ostringstream windowTitle;
     string title;
@@ -215,386 +279,1189 @@ private:
     size_t imageWidth;
     size_t imageHeight;
     string pixelFormat;
-    ofstream imageFile;  // Binary file to store image data
-    const int SIGNAL_CHECK_INTERVAL = 30;  // Check for signal every 30 frames
-
-    const size_t bufferSize = 200;
-
-    int recoveryAttempts = 0;
-    const int MAX_RECOVERY_ATTEMPTS = 3;
-    const std::chrono::seconds RECOVERY_COOLDOWN{ 5 };
-
-    const size_t FRAMES_BEFORE_TEST_ERROR = 300; // Will trigger error after ~3 seconds at 60 FPS
-    size_t test_error_counter = 0;
-    bool test_error_triggered = false;
-
-
+    unique_ptr<FileSink> imageSink;  // Binary file to store image data
+    unique_ptr<camrec::RecordingWriter> recordingWriter;  // Frames go through this unless --format raw
+    AsyncFileSink* asyncImageSink = nullptr;  // Set when imageSink is asynchronous, for latency reports
+    unique_ptr<FileSink> journalSink;  // Frame journal file, written by the writer thread
+    unique_ptr<journal::Writer> frameJournal;  // What salvage_recording rebuilds the metadata from
+    bool journalFailed = false;
+    unique_ptr<FileSink> frameTableSink;
+    unique_ptr<frametable::Writer> frameTable;  // Written by the writer thread as frames are saved
+    string frameTableName;
+    bool frameTableFailed = false;
+    unique_ptr<FileSink> clockSyncSink;
+    unique_ptr<clocksync::Writer> clockSync;  // Sync points latched by the capture thread
+    string clockSyncName;
+    bool clockSyncFailed = false;
+    uint64_t syncPoints = 0;
+    clocksync::SyncPoint firstSync = {};
+    clocksync::SyncPoint lastSync = {};
+    uint32_t maxSyncUncertaintyNs = 0;
+    const std::chrono::seconds CLOCK_SYNC_INTERVAL{ 5 };
+    const int QUEUE_CHECK_INTERVAL = 30;  // Look at the queue report timer every 30 frames
+
+    // Acquisition -> writer queue
+    RecordingOptions recording;
+    SharedCapture shared;
+    unique_ptr<TraceRecorder> ownTracer;  // Opened for --trace unless the process shares one
+    TraceRecorder* tracer = nullptr;  // Timeline of every stage; null when not tracing
+    string queueCounterName = "write_queue";  // Trace counter; named after the rig when cameras share a trace
+    unique_ptr<FrameRing> frameRing;
+    unique_ptr<FrameCompressor> compressor;  // Between the ring and the writer when --compress is given
+    atomic<bool> writeFailed{ false };
+    unique_ptr<ControlChannel> control;  // Listens for commands while capturing
+    unique_ptr<SharedFramePublisher> publisher;  // Frames for other processes, with --publish
+    string publishName;
+    vector<ControlEvent> controlEvents;  // What it received, for the metadata
+    const size_t QUEUE_MEMORY_BUDGET = size_t(512) << 20;  // Default queue size when --queue_frames is not given
+    const size_t MIN_QUEUE_FRAMES = 16;
+    const std::chrono::seconds QUEUE_REPORT_INTERVAL{ 10 };
+    const size_t WRITE_BATCH_FRAMES = 32;  // Frames a writer step takes before a pool thread moves on
+
+    // Drops between the camera and the host, checked once a second while capturing
+    FrameDropMonitor drops;
+    uint64_t reportedMissing = 0;
+    uint64_t reportedGaps = 0;
+    uint64_t reportedIncomplete = 0;
+    map<string, int64_t> reportedCounters;
+    const std::chrono::seconds DROP_REPORT_INTERVAL{ 1 };
+
+    // Rate the camera delivers and frames are recorded at, checked with the drops
+    unique_ptr<FrameRateGovernor> frameRate;
+    ExposureState exposure;
+    bool haveExposure = false;
+
+    // How long each stage takes per frame, summarised to the stage latency file every LATENCY_REPORT_INTERVAL
+    LatencyHistogram grabWaitTime;         // Capture thread: waiting in grabFrame()
+    LatencyHistogram queueCopyTime;        // Capture thread: copying a frame into the write queue
+    LatencyHistogram previewTime;          // Capture thread: shrinking a frame for the preview
+    LatencyHistogram publishTime;          // Capture thread: copying a frame into shared memory
+    LatencyHistogram loopTime;             // Capture thread: one pass of the loop
+    LatencyHistogram writeTime;            // Writer thread: handing a frame to the video file
+    LatencyHistogram logTime;              // Writer thread: frame table and journal entries
+    LatencyHistogram grabToWriteTime;      // Grabbed to written: time in the queue (and compressor)
+    LatencyHistogram exposureToWriteTime;  // Camera timestamp to written, once the camera clock is synced
+    atomic<int64_t> deviceToSteadyNs{ 0 };  // Host steady clock minus camera clock, at the last sync point
+    atomic<bool> deviceClockSynced{ false };
+    map<string, LatencyHistogram::Counts> reportedLatency;  // As of the last report, for the interval figures
+    json stageLatency;  // Final summary, for the metadata
+    const std::chrono::seconds LATENCY_REPORT_INTERVAL{ 10 };
+
+    unique_ptr<RecoveryPolicy> recovery;  // How to get frames flowing again after a fault, and a log of each time
+    const uint64_t FIRST_FRAME_TIMEOUT_MS = 1000;  // Grab timeout until a (re)started stream has delivered a frame
+    const uint64_t MIN_GRAB_TIMEOUT_MS = 100;  // Otherwise three frame periods, but no less than this
 
     void captureFrames(bool show_frame, bool save_video) {
         auto prev = high_resolution_clock::now();
+        auto lastQueueReport = prev;
+        auto lastDropReport = prev;
+        auto lastClockSync = prev - CLOCK_SYNC_INTERVAL;  // Latch straight away
+        auto lastLatencyReport = prev;
         int displayFPS = 30;  // Maximum display FPS
-        int frame_skip = int(1000 / displayFPS);  // Frame skip duration in ms
+        int frame_skip = int(1000 / displayFPS);  // Window events are polled this often (ms)
 
-        // Open the frame ID file in append mode
-        ofstream frameIDFile(path + "/" + start_time + "_" + mouse_ID + "_frame_ids_backup.txt", ios_base::app);
-        if (!frameIDFile.is_open()) {
-            cerr << "Error: Could not open frame ID file for writing." << endl;
+        // Journal of every frame written, starting with what the metadata would hold so far
+        journalSink = openJournalSink(path + "/" + start_time + "_" + mouse_ID + "_frame_journal.camjournal");
+        if (!journalSink) {
+            cerr << "Error: Could not open frame journal for writing." << endl;
             return;
         }
+        frameJournal = make_unique<journal::Writer>(*journalSink, sessionInfo().dump());
+
+        frameTableName = start_time + "_" + mouse_ID + "_frames.camtable";
+        auto tableSink = make_unique<BufferedFileSink>(path + "/" + frameTableName);
+        if (!tableSink->isOpen()) {
+            cerr << "Error: Could not open frame table for writing." << endl;
+            return;
+        }
+        frameTableSink = move(tableSink);
+        frameTable = make_unique<frametable::Writer>(*frameTableSink);
+
+        clockSyncName = start_time + "_" + mouse_ID + "_clock_sync.camclock";
+        auto syncSink = make_unique<BufferedFileSink>(path + "/" + clockSyncName);
+        if (!syncSink->isOpen()) {
+            cerr << "Error: Could not open clock sync file for writing." << endl;
+            return;
+        }
+        clockSyncSink = move(syncSink);
+        clockSync = make_unique<clocksync::Writer>(*clockSyncSink);
 
         bool keepRunning = true;
+        if (tracer) {
+            tracer->nameThread(shared.tracer ? "capture rig " + rig : string("capture"));
+        }
+
+        // Commands and the stop signal file are handled on their own thread;
+        // the loop below only checks its flags
+        string endpoint = recording.control.empty() ? ControlChannel::defaultEndpoint(rig) : recording.control;
+        if (shared.start && !recording.control.empty() && endpoint != "none") {
+            endpoint += "_" + rig;  // One endpoint per camera, as with the defaults
+        }
+        control = make_unique<ControlChannel>(endpoint == "none" ? "" : endpoint,
+            fs::path(path).string(), "stop_camera_" + rig + ".signal");
+        if (!control->listeningOn().empty()) {
+            cout << "Control commands on " << control->listeningOn() << endl;
+        }
 
-        // OpenGL: Initialize GLFW for OpenGL window management
-        GLFWwindow* window = nullptr;
+        // Preview window, drawn on its own thread from the newest published frame
+        unique_ptr<PreviewWindow> preview;
         if (show_frame) {
-            if (!glfwInit()) {
-                cerr << "Error: Failed to initialize GLFW" << endl;
+            preview = make_unique<PreviewWindow>(windowWidth, windowHeight, title, displayFPS, tracer);
+            if (!preview->isOpen()) {
                 return;
             }
+        }
 
-            // Create a GLFW window
-            window = glfwCreateWindow(windowWidth, windowHeight, title.c_str(), NULL, NULL);
-            if (!window) {
-                cerr << "Error: Failed to create GLFW window" << endl;
-                glfwTerminate();
-                return;
+        // Frames for online analysis; readers attach by name and never hold up capture
+        if (!recording.publish.empty()) {
+            publishName = shared.start ? recording.publish + "_" + rig : recording.publish;  // One region per camera
+            publisher = make_unique<SharedFramePublisher>(publishName, recording.publishSlots, imageWidth, imageHeight,
+                bytesPerPixel(pixelFormat), pixelFormat, FPS, recording.publishEvery);
+            if (publisher->isOpen()) {
+                cout << "Publishing every " << recording.publishEvery << " frame(s) to shared memory as " << publishName
+                    << " (" << publisher->slots() << " slots)" << endl;
+            }
+            else {
+                cerr << "Warning: Unable to publish frames as " << publishName << ": " << publisher->error()
+                    << ". Recording without them." << endl;
+                publisher.reset();
             }
+        }
 
-            glfwMakeContextCurrent(window);
-            glViewport(0, 0, windowWidth, windowHeight);
+        startAcquisition();
 
-            // Set OpenGL clear color (background)
-            glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+        // Disk writes happen on their own thread (or the shared writer pool) so a slow write never delays GetNextImage
+        thread writerThread;
+        size_t writerStream = 0;
+        if (shared.writers) {
+            writerStream = shared.writers->add([this] { return writeStep(milliseconds(0)); });
+        }
+        else {
+            writerThread = thread(&Tracker::writerLoop, this);
         }
 
         while (keepRunning) {
+            if (control->stopRequested()) {
+                control->acknowledgeStop();
+                cout << "Stop requested." << endl;
+                if (tracer) {
+                    tracer->instant("stop_requested");
+                }
+                break;
+            }
+
             try {
 
-                ImagePtr pResultImage = pCam->GetNextImage(1000);
+                auto loopStart = steady_clock::now();
 
-                if (!pResultImage || pResultImage->IsIncomplete()) {
-                    if (pResultImage) pResultImage->Release();
+                // Runs on timeouts too, so an operator hears about a stalled camera within a second
+                auto checkTime = high_resolution_clock::now();
+                if (checkTime - lastDropReport >= DROP_REPORT_INTERVAL) {
+                    TraceSpan span(tracer, "check_drops");
+                    checkDrops();
+                    lastDropReport = checkTime;
+                }
+                if (checkTime - lastClockSync >= CLOCK_SYNC_INTERVAL) {
+                    TraceSpan span(tracer, "clock_sync");
+                    syncClock();
+                    lastClockSync = checkTime;
+                }
+                if (checkTime - lastLatencyReport >= LATENCY_REPORT_INTERVAL) {
+                    TraceSpan span(tracer, "latency_report");
+                    writeStageLatency(preview.get(), false);
+                    lastLatencyReport = checkTime;
+                }
+
+                GrabbedFrame frame;
+                auto grabStart = steady_clock::now();
+                bool grabbed = source->grabFrame(frame, grabTimeoutMs());
+                auto grabEnd = steady_clock::now();
+                if (grabbed) {
+                    grabWaitTime.record(grabEnd - grabStart);
+                }
+                if (tracer) {
+                    tracer->span(grabbed ? "grab" : "grab_timeout", grabStart, grabEnd,
+                        grabbed ? static_cast<int64_t>(frame.frameID) : TraceRecorder::NO_FRAME);
+                }
+
+                if (!grabbed && source->finished()) {
+                    cout << "Frame source finished." << endl;
+                    keepRunning = false;
+                    break;
+                }
+
+                uint64_t hostTimestamp = static_cast<uint64_t>(duration_cast<nanoseconds>(system_clock::now().time_since_epoch()).count());
+                uint64_t steadyTimestamp = static_cast<uint64_t>(duration_cast<nanoseconds>(grabEnd.time_since_epoch()).count());
+                if (grabbed) {
+                    drops.frame(frame.frameID, frame.incomplete, hostTimestamp);
+                    frameRate->frame(frame.frameID, frame.timestamp, steadyTimestamp);
+                    if (shared.start && drops.stats().received == 1) {
+                        shared.start->firstFrame(shared.cameraIndex, grabEnd);
+                    }
+                }
 
-                    cerr << "Error: Image incomplete or null" << endl;
+                if (!grabbed || frame.incomplete) {
+                    if (grabbed) source->releaseFrame(frame);
 
-                    if (!attemptRecovery()) {
+                    RecoveryPolicy::Fault fault = grabbed ? RecoveryPolicy::Fault::Incomplete : RecoveryPolicy::Fault::Timeout;
+                    if (!recoverFrom(fault, "", hostTimestamp, steadyTimestamp)) {
                         cerr << "Unable to recover camera. Stopping recording." << endl;
                         keepRunning = false;
                         break;
                     }
-
-                    std::this_thread::sleep_for(RECOVERY_COOLDOWN);
                     continue;
                 }
 
-                // Reset recovery attempts on successful frame
-                recoveryAttempts = 0;
-
-                if (save_video) {
-                    // Write raw image data to the binary file
-                    const char* imageData = reinterpret_cast<const char*>(pResultImage->GetData());
-                    size_t imageSize = pResultImage->GetImageSize();
+                // A complete frame ends any recovery in progress
+                if (recovery->frame(frame.frameID, steadyTimestamp)) {
+                    reportRecovery(recovery->lastEvent());
+                }
 
-                    imageFile.write(imageData, imageSize);
-                    if (!imageFile.good()) {
+                if (save_video && !control->paused()) {
+                    if (writeFailed.load(memory_order_relaxed)) {
                         cerr << "Error: Failed to write image data to binary file." << endl;
-                        pResultImage->Release();
+                        source->releaseFrame(frame);
                         keepRunning = false;
                         break;
                     }
 
-                    // Add frame ID to the list
-                    uint64_t frameID = pResultImage->GetFrameID();
-                    frame_IDs.push_back(frameID);       // Save to frame_IDs
-                    frame_IDs_mem.push_back(frameID);   // Save to frame_IDs_mem
-
-                    // Flush frame IDs to file if buffer is full
-                    if (frame_IDs.size() >= bufferSize) {
-                        for (const auto& id : frame_IDs) {
-                            frameIDFile << id << std::endl;
+                    // Copy the frame into the queue; the writer thread takes it from there
+                    auto copyStart = steady_clock::now();
+                    FrameSlot* slot = frameRing->beginWrite();
+                    if (slot) {
+                        if (slot->data.size() < frame.size) {
+                            slot->data.resize(frame.size);
                         }
-                        frameIDFile.flush();
-                        frame_IDs.clear();
+                        memcpy(slot->data.data(), frame.data, frame.size);
+                        slot->size = frame.size;
+                        slot->frameID = frame.frameID;
+                        slot->timestamp = frame.timestamp;
+                        slot->hostTimestamp = hostTimestamp;
+                        slot->steadyTimestamp = steadyTimestamp;
+                        frameRing->commitWrite();
+                        if (shared.writers) {
+                            shared.writers->wake();
+                        }
+                    }
+                    auto copyEnd = steady_clock::now();
+                    queueCopyTime.record(copyEnd - copyStart);
+                    if (tracer) {
+                        // A long queue_copy with the queue at capacity is the writer holding up acquisition
+                        tracer->span(slot ? "queue_copy" : "queue_dropped", copyStart, copyEnd, static_cast<int64_t>(frame.frameID));
+                        tracer->counter(queueCounterName.c_str(), static_cast<int64_t>(frameRing->depth()));
                     }
                 }
 
-                // Display frames at the specified display FPS
-                if (show_frame) {
-                    auto now = high_resolution_clock::now();
-                    double elapsedTime = duration_cast<milliseconds>(now - prev).count();
-
-                    if (elapsedTime >= frame_skip) {
-                        // Convert image to OpenGL texture format
-                        cv::Mat image(cv::Size(imageWidth, imageHeight), CV_8UC1,
-                            pResultImage->GetData(), pResultImage->GetStride());
-
-                        // Resize the image to fit the OpenGL window
-                        cv::Mat resizedImage;
-                        cv::resize(image, resizedImage, cv::Size(windowWidth, windowHeight));
-
-                        // Clear the OpenGL buffer
-                        glClear(GL_COLOR_BUFFER_BIT);
-
-                        // Use glDrawPixels to display the image
-                        glPixelZoom(1.0f, -1.0f);  // Flip the image vertically
-                        glRasterPos2i(-1, 1);      // Set image position
-                        glDrawPixels(resizedImage.cols, resizedImage.rows, GL_LUMINANCE, GL_UNSIGNED_BYTE, resizedImage.data);
-
-                        // Swap buffers to display the image
-                        glfwSwapBuffers(window);
-
-                        // Poll for input events
-                        glfwPollEvents();
+                // Readers copy what they need out of shared memory themselves; publishing never waits for them
+                if (publisher && frame_count % recording.publishEvery == 0) {
+                    auto publishStart = steady_clock::now();
+                    publisher->publish(frame.data, frame.size, frame.stride, frame.frameID, frame.timestamp,
+                        hostTimestamp, steadyTimestamp);
+                    auto publishEnd = steady_clock::now();
+                    publishTime.record(publishEnd - publishStart);
+                    if (tracer) {
+                        tracer->span("shm_publish", publishStart, publishEnd, static_cast<int64_t>(frame.frameID));
+                    }
+                }
 
-                        // check for signal file from startup program
-                        if (checkForStopSignal()) {
-                            keepRunning = false;
+                // Hand a shrunken copy to the preview; how often depends on how far behind the writer is
+                if (preview) {
+                    double queueFill = save_video ? frameRing->fill() : 0.0;
+                    if (preview->due(queueFill)) {
+                        auto previewStart = steady_clock::now();
+                        preview->publish(frame.data, imageWidth, imageHeight, frame.stride,
+                            bytesPerPixel(pixelFormat), frame.frameID);
+                        auto previewEnd = steady_clock::now();
+                        previewTime.record(previewEnd - previewStart);
+                        if (tracer) {
+                            tracer->span("preview_publish", previewStart, previewEnd, static_cast<int64_t>(frame.frameID));
                         }
+                    }
 
+                    auto now = high_resolution_clock::now();
+                    if (duration_cast<milliseconds>(now - prev).count() >= frame_skip) {
                         // Check if the user pressed the 'Esc' key or closed the window
-                        if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS || glfwWindowShouldClose(window)) {
+                        if (!preview->pollEvents()) {
                             keepRunning = false;
                         }
 
-                        prev = now;  // Reset the previous time for the next displayed frame
+                        prev = now;
                     }
                 }
 
-                pResultImage->Release();
+                source->releaseFrame(frame);
                 frame_count++;
+                loopTime.record(steady_clock::now() - loopStart);
+
+                // Periodically report how far behind the writer is
+                if (save_video && frame_count % QUEUE_CHECK_INTERVAL == 0) {
+                    auto now = high_resolution_clock::now();
+                    if (now - lastQueueReport >= QUEUE_REPORT_INTERVAL) {
+                        printQueueStats();
+                        lastQueueReport = now;
+                    }
+                }
 
             }
-            catch (Spinnaker::Exception& e) {
+            catch (const std::exception& e) {
                 cerr << "Camera error: " << e.what() << endl;
 
-                if (!attemptRecovery()) {
+                uint64_t hostTimestamp = static_cast<uint64_t>(duration_cast<nanoseconds>(system_clock::now().time_since_epoch()).count());
+                uint64_t steadyTimestamp = static_cast<uint64_t>(duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count());
+                if (!recoverFrom(RecoveryPolicy::Fault::Error, e.what(), hostTimestamp, steadyTimestamp)) {
                     cerr << "Unable to recover from error. Stopping recording." << endl;
                     keepRunning = false;
                     break;
                 }
+            }
+        }
+        recovery->finish(static_cast<uint64_t>(duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count()));
+
+        try {
+            checkDrops();  // Final counts and clock reading, while the camera can still be asked
+            syncClock();
+            source->endAcquisition();
+        }
+        catch (const std::exception& e) {
+            cerr << "Error ending acquisition: " << e.what() << endl;
+        }
+        frameRate->finish();
+        if (publisher) {
+            publisher->close();  // Readers see the session is over
+        }
+
+        // Let the writer drain whatever is still queued, then stop it
+        frameRing->close();
+        if (shared.writers) {
+            shared.writers->waitFinished(writerStream);
+        }
+        else {
+            writerThread.join();
+        }
+        printQueueStats();
+
+        if (recordingWriter && !recordingWriter->finish()) {
+            cerr << "Error: Failed to write the recording index." << endl;
+        }
+        if (!imageSink->close()) {
+            cerr << "Error: Failed to finish writing the binary file." << endl;
+        }
+
+        // After the loop, write out the last journal block and table chunk
+        flushJournal();
+        if (!frameTable->finish() || !frameTableSink->close()) {
+            cerr << "Error: Failed to write the frame table." << endl;
+        }
+        clockSyncSink->close();
+
+        controlEvents = control->events();
+        control.reset();
+
+        writeStageLatency(preview.get(), true);
+
+        // Close the preview window
+        if (preview) {
+            printPreviewStats(*preview);
+            preview.reset();
+        }
+
+        // Every thread that records into the trace is done (compressor workers are idle)
+        if (ownTracer) {
+            finishTrace();
+        }
+
+        journalSink->close();
+    }
+
+    // Starts the camera; with other cameras in the process, at the same moment as theirs
+    void startAcquisition() {
+        if (shared.start) {
+            shared.start->arriveAndWait(shared.cameraIndex);
+        }
+        source->beginAcquisition();
+        if (shared.start && shared.start->started(shared.cameraIndex, steady_clock::now())) {
+            StartGate::Skew skew = shared.start->skew();
+            cout << "Acquisition started on " << skew.started << " cameras within " << skew.startUs << " us" << endl;
+        }
+    }
+
+    // Writer thread: drains the frame queue in order and writes each frame to disk
+    void writerLoop() {
+        if (tracer) {
+            tracer->nameThread("writer");
+        }
+        while (writeStep(milliseconds(100)) != WriterPool::Step::Finished) {
+        }
+    }
+
+    // Writes up to WRITE_BATCH_FRAMES queued frames, waiting up to `wait` for
+    // the first. Runs on the writer thread, or on the shared writer pool.
+    WriterPool::Step writeStep(milliseconds wait) {
+        bool ok = true;
+        size_t frames = 0;
+        while (ok && frames < WRITE_BATCH_FRAMES) {
+            auto waitStart = steady_clock::now();
+            FrameSlot* frame = frameRing->beginRead(frames == 0 ? wait : milliseconds(0));
+            if (!frame) {
+                if (frameRing->drained()) {
+                    return finishWriting(true);
+                }
+                ok = saveCompressedFrames(false);
+                if (!frameJournal->flushIfDue()) {
+                    reportJournalFailure();
+                }
+                if (ok) {
+                    return frames > 0 ? WriterPool::Step::Wrote : WriterPool::Step::Idle;
+                }
+                break;
+            }
+            if (tracer && wait.count() > 0) {
+                tracer->span("wait_for_frame", waitStart, steady_clock::now(), static_cast<int64_t>(frame->frameID));
+            }
 
-                std::this_thread::sleep_for(RECOVERY_COOLDOWN);
+            if (compressor) {
+                // Write out whatever is finished; wait for the oldest only when every job is busy
+                ok = saveCompressedFrames(compressor->full());
+                if (ok) {
+                    compressor->submit(*frame);
+                }
+            }
+            else {
+                ok = saveFrame(*frame);
             }
+            frameRing->endRead();
+            frames++;
+        }
+        return ok ? WriterPool::Step::Wrote : finishWriting(false);
+    }
+
+    // The queue is drained (or writing failed): write what the compressor still holds
+    WriterPool::Step finishWriting(bool ok) {
+        while (ok && compressor && compressor->next(true)) {
+            ok = saveCompressedFrames(true);
         }
 
-        if (pCam) {
-            pCam->EndAcquisition();
+        if (!ok) {
+            // Stop taking frames so a blocked acquisition thread is released
+            writeFailed.store(true);
+            frameRing->close();
         }
+        return WriterPool::Step::Finished;
+    }
 
-        // After the loop, flush any remaining frame IDs in the buffer
-        if (!frame_IDs.empty()) {
-            for (const auto& frameID : frame_IDs) {
-                frameIDFile << frameID << std::endl;
+    // Writes compressed frames in the order they were submitted
+    bool saveCompressedFrames(bool waitForOne) {
+        if (!compressor) {
+            return true;
+        }
+        while (CompressedFrame* done = compressor->next(waitForOne)) {
+            waitForOne = false;
+            bool ok = done->compressed
+                ? saveFrame(done->frame, camrec::Codec::Lossless, done->encoded.data(), done->encodedBytes)
+                : saveFrame(done->frame);
+            compressor->release();
+            if (!ok) {
+                return false;
             }
-            frameIDFile.flush();
-            frame_IDs.clear();
         }
+        return true;
+    }
 
-        // Cleanup OpenGL resources
-        if (window) {
-            glfwDestroyWindow(window);
-            glfwTerminate();
+    void printQueueStats() {
+        FrameRing::Stats stats = frameRing->stats();
+        cout << "Write queue: depth " << stats.depth << "/" << stats.capacity
+            << ", high-water " << stats.highWater
+            << ", written " << stats.popped
+            << ", dropped " << stats.droppedNewest + stats.droppedOldest
+            << " (newest " << stats.droppedNewest << ", oldest " << stats.droppedOldest << ")"
+            << ", blocked " << stats.blockedMs << " ms" << endl;
+
+        if (compressor) {
+            FrameCompressor::Stats compression = compressor->stats();
+            cout << "Compression: ratio " << compression.ratio()
+                << " (" << (compression.rawBytes >> 20) << " MB -> " << (compression.encodedBytes >> 20) << " MB)"
+                << ", encode mean " << compression.meanEncodeMs << " ms, max " << compression.maxEncodeMs << " ms"
+                << " per frame on " << compression.threads << " threads"
+                << ", stored uncompressed " << compression.storedRaw << endl;
         }
 
-        frameIDFile.close();
+        if (asyncImageSink) {
+            WriteLatencyStats latency = asyncImageSink->latencyStats();
+            cout << "Disk writes: " << latency.completed << " blocks, latency mean "
+                << latency.meanUs / 1000.0 << " ms, p99 " << latency.p99Us / 1000.0
+                << " ms, max " << latency.maxUs / 1000.0 << " ms"
+                << "; a block fills every " << blockFillMs() << " ms"
+                << ", in flight " << latency.inFlight << "/" << latency.queueDepth
+                << " (high-water " << latency.inFlightHighWater << ")" << endl;
+        }
     }
 
-    bool attemptRecovery() {
-        if (recoveryAttempts >= MAX_RECOVERY_ATTEMPTS) {
-            cerr << "Max recovery attempts reached. Camera error persists." << endl;
-            return false;
+    void printPreviewStats(const PreviewWindow& preview) {
+        PreviewWindow::Stats stats = preview.stats();
+        cout << "Preview: " << stats.displayed << " frames shown of " << stats.published << " published"
+            << ", " << stats.overwritten << " replaced before drawing"
+            << ", rate " << stats.fps << " fps" << (stats.decimating ? " (decimating)" : "") << endl;
+    }
+
+    // Time the camera takes to fill one write block: the latency budget per write
+    double blockFillMs() const {
+        double frameBytes = double(imageWidth) * imageHeight * bytesPerPixel(pixelFormat);
+        if (FPS <= 0 || frameBytes <= 0) {
+            return 0;
         }
+        return double(recording.writeBlockMB << 20) / frameBytes / FPS * 1000.0;
+    }
 
-        try {
-            cerr << "Attempting camera recovery (attempt " << recoveryAttempts + 1 << " of " << MAX_RECOVERY_ATTEMPTS << ")..." << endl;
+    static json latencyJson(const LatencySummary& summary) {
+        return {
+            {"count", summary.count},
+            {"mean_us", summary.meanUs},
+            {"p50_us", summary.p50Us},
+            {"p99_us", summary.p99Us},
+            {"p99_9_us", summary.p999Us},
+            {"max_us", summary.maxUs}
+        };
+    }
 
-            pCam->EndAcquisition();
-            std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    // Rewrites the stage latency file: each stage since the start and over the
+    // last interval. The final call also prints the totals and keeps them for the metadata.
+    void writeStageLatency(const PreviewWindow* preview, bool final) {
+        vector<pair<string, const LatencyHistogram*>> stages = {
+            {"grab_wait", &grabWaitTime},
+            {"queue_copy", &queueCopyTime},
+            {"preview_shrink", &previewTime},
+            {"shm_publish", &publishTime},
+            {"loop", &loopTime},
+            {"write", &writeTime},
+            {"frame_log", &logTime},
+            {"grab_to_write", &grabToWriteTime},
+            {"exposure_to_write", &exposureToWriteTime}
+        };
+        if (preview) {
+            stages.push_back({ "preview_draw", &preview->drawLatency() });
+        }
 
-            // Reset camera settings
-            pCam->DeInit();
-            std::this_thread::sleep_for(std::chrono::milliseconds(500));
+        json sinceStart = json::object();
+        json lastInterval = json::object();
+        for (const auto& stage : stages) {
+            LatencyHistogram::Counts counts = stage.second->snapshot();
+            LatencySummary total = counts.summary();
+            sinceStart[stage.first] = latencyJson(total);
+            auto previous = reportedLatency.find(stage.first);
+            lastInterval[stage.first] = latencyJson(previous == reportedLatency.end()
+                ? total : (counts - previous->second).summary());
+            reportedLatency[stage.first] = move(counts);
+
+            if (final && total.count > 0) {
+                cout << "Stage " << stage.first << ": p50 " << total.p50Us << " us, p99 " << total.p99Us
+                    << " us, p99.9 " << total.p999Us << " us, max " << total.maxUs << " us (" << total.count << ")" << endl;
+            }
+        }
 
-            pCam->Init();
-            setCameraFrameRate(FPS);
-            setGPIOLine2ToOutput();
-            setExposureTimeLowerLimit(4000.0);
+        json report;
+        report["updated"] = currentDateTime();
+        report["frame_budget_us"] = FPS > 0 ? 1e6 / FPS : 0.0;
+        report["since_start"] = sinceStart;
+        report["last_interval"] = lastInterval;
+        if (final) {
+            stageLatency = sinceStart;
+        }
 
-            pCam->BeginAcquisition();
+        // Written aside and renamed, like the status file
+        string latencyFile = path + "/" + start_time + "_" + mouse_ID + "_stage_latency.json";
+        string partFile = latencyFile + ".part";
+        {
+            ofstream file(partFile);
+            file << report.dump(4);
+            if (!file) {
+                return;
+            }
+        }
+        std::error_code error;
+        fs::rename(partFile, latencyFile, error);
+    }
 
-            // Test if camera is working
-            ImagePtr testImage = pCam->GetNextImage(1000);
-            if (testImage && !testImage->IsIncomplete()) {
-                testImage->Release();
-                cerr << "Camera recovered successfully" << endl;
-                recoveryAttempts = 0;  // Reset counter on successful recovery
-                return true;
+    // Frame drop counts for the status file and the metadata
+    json dropSummary() {
+        const FrameDropMonitor::Stats& stats = drops.stats();
+        return {
+            {"received", stats.received},
+            {"missing", stats.missing},
+            {"gaps", stats.gaps},
+            {"longest_gap", stats.longestGap},
+            {"incomplete", stats.incomplete},
+            {"id_restarts", stats.restarts},
+            {"stream_counters", stats.streamCounters}
+        };
+    }
+
+    // Polls the source's stream counters, warns about anything dropped since
+    // the last check and rewrites the live status file
+    void checkDrops() {
+        drops.streamCounters(source->streamCounters());
+        const FrameDropMonitor::Stats& stats = drops.stats();
+
+        if (stats.missing > reportedMissing || stats.incomplete > reportedIncomplete) {
+            cerr << "Warning: " << stats.missing - reportedMissing << " frames dropped before reaching the host in "
+                << stats.gaps - reportedGaps << " gaps, " << stats.incomplete - reportedIncomplete << " incomplete; "
+                << stats.missing << " missing of " << stats.received + stats.missing << " so far"
+                << " (longest gap " << stats.longestGap << ")" << endl;
+        }
+        for (const auto& counter : stats.streamCounters) {
+            // Any counter going up is a drop, except the buffer count, which only says how many there are
+            int64_t previous = reportedCounters.count(counter.first) ? reportedCounters[counter.first] : 0;
+            if (counter.first != "StreamTotalBufferCount" && counter.second > previous) {
+                cerr << "Warning: camera stream " << counter.first << " +" << counter.second - previous
+                    << " (" << counter.second << " in total)" << endl;
             }
-            testImage->Release();
+        }
+        reportedMissing = stats.missing;
+        reportedGaps = stats.gaps;
+        reportedIncomplete = stats.incomplete;
+        reportedCounters = stats.streamCounters;
 
-            recoveryAttempts++;
-            return false;
+        checkFrameRate();
+        writeStatusFile();
+    }
+
+    // Measures the last second's frame rate and warns when it falls short of
+    // the one asked for, and again when it is back
+    void checkFrameRate() {
+        haveExposure = source->exposureState(exposure) || haveExposure;
+        uint64_t steadyTimestamp = static_cast<uint64_t>(duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count());
+        uint64_t hostTimestamp = static_cast<uint64_t>(duration_cast<nanoseconds>(system_clock::now().time_since_epoch()).count());
+        if (!frameRate->check(steadyTimestamp, hostTimestamp, haveExposure ? &exposure : nullptr)) {
+            return;
+        }
 
+        const FrameRateGovernor::Deviation& deviation = frameRate->lastChange();
+        if (frameRate->deviating()) {
+            if (tracer) {
+                tracer->instant("frame_rate_short");
+            }
+            cerr << "Warning: frame rate below the " << FPS << " fps requested: camera "
+                << frameRate->lastCameraFps() << " fps, recorded " << frameRate->lastRecordedFps() << " fps";
+            if (haveExposure) {
+                cerr << " (exposure " << exposure.exposureUs << " us, gain " << exposure.gainDb << " dB";
+                if (exposure.resultingFrameRate > 0) {
+                    cerr << ", camera says " << exposure.resultingFrameRate << " fps";
+                }
+                cerr << ")";
+            }
+            cerr << endl;
         }
-        catch (Spinnaker::Exception& e) {
-            cerr << "Recovery attempt failed: " << e.what() << endl;
-            recoveryAttempts++;
-            return false;
+        else {
+            cout << "Frame rate back to " << FPS << " fps after " << deviation.durationS << " s (lowest: camera "
+                << deviation.lowestCameraFps << " fps, recorded " << deviation.lowestRecordedFps << " fps)" << endl;
+        }
+    }
+
+    // Frame rate measurements for the status file and the metadata
+    json frameRateSummary() {
+        FrameRateGovernor::Stats stats = frameRate->stats();
+        json summary = {
+            {"requested_fps", stats.requestedFps},
+            {"camera_fps", stats.cameraFps},  // From frame IDs and camera timestamps
+            {"recorded_fps", stats.recordedFps},  // Frames grabbed per second of host time
+            {"lowest_camera_fps", stats.lowestCameraFps},  // Of any one-second window
+            {"lowest_recorded_fps", stats.lowestRecordedFps},
+            {"deviations", stats.deviations},
+            {"seconds_short", stats.secondsShort}
+        };
+        if (haveExposure) {
+            summary["exposure_us"] = exposure.exposureUs;
+            summary["gain_db"] = exposure.gainDb;
+            summary["resulting_fps"] = exposure.resultingFrameRate;
+            summary["exposure_upper_limit_us"] = exposure.exposureUpperLimitUs;
+            summary["gain_upper_limit_db"] = exposure.gainUpperLimitDb;
         }
+        return summary;
     }
 
-    bool checkForStopSignal() {
-        if (frame_count % SIGNAL_CHECK_INTERVAL != 0) {
-            return false;  // Only check every Nth frame
+    // rig_<n>_camera_status.json, replaced once a second so other programs can watch a session
+    void writeStatusFile() {
+        json status;
+        status["start_time"] = start_time;
+        status["mouse_id"] = mouse_ID;
+        status["updated"] = currentDateTime();
+        status["paused"] = control && control->paused();
+        status["frame_drops"] = dropSummary();
+        status["frame_rate_check"] = frameRateSummary();
+        if (frameRing) {
+            FrameRing::Stats queueStats = frameRing->stats();
+            status["write_queue"] = {
+                {"depth", queueStats.depth},
+                {"capacity", queueStats.capacity},
+                {"written", queueStats.popped},
+                {"dropped", queueStats.droppedNewest + queueStats.droppedOldest}
+            };
         }
 
-        string stop_signal_path = fs::path(path).string() + "/stop_camera_" + rig + ".signal";
-        return fs::exists(stop_signal_path);
+        // Written aside and renamed over the old one, so readers never see half a file
+        string statusFile = fs::path(path).string() + "/rig_" + rig + "_camera_status.json";
+        string partFile = statusFile + ".part";
+        {
+            ofstream file(partFile);
+            file << status.dump(4);
+            if (!file) {
+                return;
+            }
+        }
+        std::error_code error;
+        fs::rename(partFile, statusFile, error);
     }
 
-    GLFWwindow* setupOpenGLWindow() {
-        if (!glfwInit()) {
-            cerr << "Error: Failed to initialize GLFW" << endl;
-            return nullptr;
+    // Latches the camera clock between readings of the host clocks and appends the result to the sync file
+    void syncClock() {
+        clocksync::SyncPoint point;
+        try {
+            if (!clocksync::latch(*source, point)) {
+                return;
+            }
+        }
+        catch (const std::exception& e) {
+            if (!clockSyncFailed) {
+                cerr << "Warning: Could not latch the camera clock: " << e.what() << endl;
+                clockSyncFailed = true;
+            }
+            return;
+        }
+
+        if (syncPoints == 0) {
+            firstSync = point;
+        }
+        lastSync = point;
+        syncPoints++;
+        deviceToSteadyNs.store(static_cast<int64_t>(point.steadyTimestamp - point.deviceTimestamp));
+        deviceClockSynced.store(true);
+        maxSyncUncertaintyNs = max(maxSyncUncertaintyNs, point.uncertaintyNs);
+        if (!clockSync->append(point) && !clockSyncFailed) {
+            cerr << "Error: Failed to write the clock sync file." << endl;
+            clockSyncFailed = true;
+        }
+    }
+
+    // A stalled stream is noticed after a few missed frames; a (re)started one gets longer for its first
+    uint64_t grabTimeoutMs() const {
+        if (FPS <= 0 || recovery->recovering() || drops.stats().received == 0) {
+            return FIRST_FRAME_TIMEOUT_MS;
+        }
+        return max(MIN_GRAB_TIMEOUT_MS, static_cast<uint64_t>(3000.0 / FPS));
+    }
+
+    // Does what the recovery policy says about a fault, escalating when a
+    // step fails. False once it gives up.
+    bool recoverFrom(RecoveryPolicy::Fault fault, const string& detail, uint64_t hostTimestamp, uint64_t steadyTimestamp) {
+        RecoveryPolicy::Action action = recovery->fault(fault, detail, hostTimestamp, steadyTimestamp);
+        while (true) {
+            bool ok = false;
+            switch (action) {
+            case RecoveryPolicy::Action::Skip:
+                return true;  // Counted by the drop monitor; capture carries on
+
+            case RecoveryPolicy::Action::RestartStream: {
+                cerr << "Restarting the camera stream..." << endl;
+                TraceSpan span(tracer, "restart_stream");
+                try {
+                    ok = source->restartStream();
+                }
+                catch (const std::exception& e) {
+                    cerr << "Stream restart failed: " << e.what() << endl;
+                }
+                break;
+            }
+
+            case RecoveryPolicy::Action::Reinitialise: {
+                milliseconds wait = recovery->backoff();
+                cerr << "Re-initialising the camera in " << wait.count() << " ms (attempt " << recovery->reinitAttempt()
+                    << " of " << recovery->limits().maxReinits << ")..." << endl;
+                if (!sleepUnlessStopped(wait)) {
+                    return true;  // The loop sees the stop request next
+                }
+                TraceSpan span(tracer, "reinitialise");
+                try {
+                    ok = source->recover();
+                }
+                catch (const std::exception& e) {
+                    cerr << "Re-initialisation failed: " << e.what() << endl;
+                }
+                break;
+            }
+
+            case RecoveryPolicy::Action::GiveUp:
+            default:
+                cerr << "Max recovery attempts reached. Camera error persists." << endl;
+                return false;
+            }
+
+            // Whether frames really flow again shows on the next grab
+            if (ok) {
+                return true;
+            }
+            action = recovery->fault(RecoveryPolicy::Fault::Error, "recovery step failed", hostTimestamp, steadyTimestamp);
+        }
+    }
+
+    // False if a stop was requested meanwhile
+    bool sleepUnlessStopped(milliseconds wait) {
+        auto until = steady_clock::now() + wait;
+        while (steady_clock::now() < until) {
+            if (control->stopRequested()) {
+                return false;
+            }
+            std::this_thread::sleep_for(min<steady_clock::duration>(milliseconds(50), until - steady_clock::now()));
+        }
+        return true;
+    }
+
+    void reportRecovery(const RecoveryPolicy::Event& event) {
+        if (tracer) {
+            tracer->instant("recovered");
+        }
+        if (event.tier == RecoveryPolicy::Action::Skip) {
+            return;  // Incomplete frames are reported with the drop counts
+        }
+        cout << "Camera recovered (" << RecoveryPolicy::actionName(event.tier) << ") in " << event.durationMs
+            << " ms; " << event.missingFrames << " frames missed" << (event.idReset ? " (estimated, frame IDs restarted)" : "")
+            << endl;
+    }
+
+    unique_ptr<FileSink> openVideoSink(const string& fileName, size_t frameBytes) {
+        if (recording.writer == "direct") {
+            // Reserve the whole session up front: fps x duration x frame size
+            uint64_t preallocateBytes = static_cast<uint64_t>(
+                FPS * recording.expectedDurationMin * 60.0 * frameBytes);
+            auto sink = make_unique<DirectFileSink>(fileName, recording.writeBlockMB << 20, preallocateBytes);
+            if (!sink->isOpen()) {
+                return nullptr;
+            }
+            cout << "Video writer: " << sink->description() << endl;
+            return sink;
         }
 
-        GLFWwindow* window = glfwCreateWindow(windowWidth, windowHeight, title.c_str(), NULL, NULL);
-        if (!window) {
-            cerr << "Error: Failed to create GLFW window" << endl;
-            glfwTerminate();
+        if (recording.writer == "async") {
+            auto sink = make_unique<AsyncFileSink>(fileName, recording.writeBlockMB << 20, recording.writeDepth, true);
+            if (sink->isOpen()) {
+                cout << "Video writer: " << sink->description() << endl;
+                asyncImageSink = sink.get();
+                return sink;
+            }
+            cerr << "Warning: Asynchronous writer unavailable, using buffered writes." << endl;
+        }
+
+        auto sink = make_unique<BufferedFileSink>(fileName);
+        if (!sink->isOpen()) {
             return nullptr;
         }
+        return sink;
+    }
 
-        glfwMakeContextCurrent(window);
-        glViewport(0, 0, windowWidth, windowHeight);
-        glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+    unique_ptr<FileSink> openJournalSink(const string& fileName) {
+        if (recording.writer == "async") {
+            // Small blocks: each journal block is submitted as it is
+            auto sink = make_unique<AsyncFileSink>(fileName, size_t(64) << 10, 2, false, true);
+            if (sink->isOpen()) {
+                return sink;
+            }
+        }
 
-        return window;
+        auto sink = make_unique<BufferedFileSink>(fileName, true);
+        if (!sink->isOpen()) {
+            return nullptr;
+        }
+        return sink;
     }
 
-    bool saveFrame(ImagePtr& pResultImage, ofstream& frameIDFile) {
-        const char* imageData = reinterpret_cast<const char*>(pResultImage->GetData());
-        size_t imageSize = pResultImage->GetImageSize();
+    bool saveFrame(const FrameSlot& frame) {
+        return saveFrame(frame, camrec::Codec::Raw, frame.data.data(), frame.size);
+    }
 
-        imageFile.write(imageData, imageSize);
-        if (!imageFile.good()) {
+    // payload is the frame as stored: the pixels themselves, or their encoding for a compressed frame
+    bool saveFrame(const FrameSlot& frame, camrec::Codec codec, const char* payload, size_t payloadBytes) {
+        journal::Record entry;
+        entry.offset = recordingWriter ? recordingWriter->bytesWritten() : imageSink->bytesWritten();
+        entry.bytes = payloadBytes;
+
+        auto writeStart = steady_clock::now();
+        if (recordingWriter) {
+            camrec::FrameInfo info;
+            info.frameID = frame.frameID;
+            info.deviceTimestamp = frame.timestamp;
+            info.hostTimestamp = frame.hostTimestamp;
+            info.codec = codec;
+            info.rawBytes = static_cast<uint32_t>(frame.size);
+            if (!recordingWriter->writeFrame(info, payload, payloadBytes)) {
+                return false;
+            }
+        }
+        else if (!imageSink->write(payload, payloadBytes)) {
             return false;
         }
+        auto written = steady_clock::now();
+        writeTime.record(written - writeStart);
+        if (tracer) {
+            tracer->span("write", writeStart, written, static_cast<int64_t>(frame.frameID));
+        }
+        uint64_t writtenNs = static_cast<uint64_t>(duration_cast<nanoseconds>(written.time_since_epoch()).count());
+        grabToWriteTime.record(writtenNs - min(writtenNs, frame.steadyTimestamp));
+        if (deviceClockSynced.load()) {
+            int64_t exposed = static_cast<int64_t>(frame.timestamp) + deviceToSteadyNs.load();
+            exposureToWriteTime.record(static_cast<uint64_t>(max<int64_t>(static_cast<int64_t>(writtenNs) - exposed, 0)));
+        }
 
-        uint64_t frameID = pResultImage->GetFrameID();
-        frame_IDs.push_back(frameID);
-        frame_IDs_mem.push_back(frameID);
+        if (framesSaved == 0) {
+            firstFrameID = frame.frameID;
+        }
+        lastFrameID = frame.frameID;
+        framesSaved++;
+        if (!frameTable->append(frame.frameID, frame.timestamp, frame.hostTimestamp, frame.steadyTimestamp) && !frameTableFailed) {
+            cerr << "Error: Failed to write the frame table." << endl;
+            frameTableFailed = true;
+        }
 
-        if (frame_IDs.size() >= bufferSize) {
-            for (const auto& id : frame_IDs) {
-                frameIDFile << id << std::endl;
-            }
-            frameIDFile.flush();
-            frame_IDs.clear();
+        // The journal is a backup: losing it is reported but doesn't stop the recording
+        entry.frameID = frame.frameID;
+        entry.deviceTimestamp = frame.timestamp;
+        entry.hostTimestamp = frame.hostTimestamp;
+        if (!frameJournal->append(entry)) {
+            reportJournalFailure();
+        }
+        auto logged = steady_clock::now();
+        logTime.record(logged - written);
+        if (tracer) {
+            tracer->span("frame_log", written, logged, static_cast<int64_t>(frame.frameID));
         }
 
         return true;
     }
 
-    void cleanupCapture(ofstream& frameIDFile, GLFWwindow* window) {
-        if (!frame_IDs.empty()) {
-            for (const auto& frameID : frame_IDs) {
-                frameIDFile << frameID << std::endl;
-            }
-            frameIDFile.flush();
-            frame_IDs.clear();
+    void finishTrace() {
+        TraceRecorder::Stats stats = ownTracer->finish();
+        cout << "Trace: " << stats.events << " events from " << stats.threads << " threads written to "
+            << recording.trace << endl;
+        if (stats.dropped > 0) {
+            cerr << "Warning: " << stats.dropped << " trace events dropped because the trace file fell behind." << endl;
+        }
+        if (ownTracer->failed()) {
+            cerr << "Error: Failed to write the trace file " << recording.trace << endl;
         }
+    }
 
-        frameIDFile.close();
+    void flushJournal() {
+        if (!frameJournal->flush()) {
+            reportJournalFailure();
+        }
+    }
 
-        if (window) {
-            glfwDestroyWindow(window);
-            glfwTerminate();
+    void reportJournalFailure() {
+        if (!journalFailed) {
+            cerr << "Error: Failed to write the frame journal." << endl;
+            journalFailed = true;
         }
     }
 
-    void saveData()
+    // Metadata known before the first frame; also the session header of the frame journal
+    json sessionInfo()
     {
-        string file_name = start_time + "_" + mouse_ID + "_Tracker_data.json";
         json data;
-
         data["frame_rate"] = FPS;
         data["start_time"] = start_time;
         data["end_time"] = end_time;
         data["image_height"] = imageHeight;
         data["image_width"] = imageWidth;
         data["pixel_format"] = pixelFormat;
-        data["frame_IDs"] = frame_IDs_mem;
-
-        ofstream file(path + "/" + file_name);
-        file << data.dump(4);  // Pretty print with 4 spaces
-        file.close();
+        data["source"] = source->description();
+        data["rig"] = rig;  // Names the status and signal files, for readers of the journal
+        data["video_writer"] = imageSink->description();
+        data["recording_format"] = recording.format;
+        return data;
     }
 
-    string currentDateTime()
-    {
-        auto now = system_clock::now();
-        time_t now_time = system_clock::to_time_t(now);
-        char buffer[80];
-        tm localTime;
-        localtime_s(&localTime, &now_time);
-        strftime(buffer, sizeof(buffer), "%y%m%d_%H%M%S", &localTime);
-        return string(buffer);
-    }
-
-    void setCameraFrameRate(double frameRate)
+    void saveData()
     {
-        INodeMap& nodeMap = pCam->GetNodeMap();
-        CBooleanPtr ptrFrameRateEnable = nodeMap.GetNode("AcquisitionFrameRateEnable");
-        if (IsWritable(ptrFrameRateEnable)) {
-            ptrFrameRateEnable->SetValue(true);
+        string file_name = start_time + "_" + mouse_ID + "_Tracker_data.json";
+        json data = sessionInfo();
+        data["frame_count"] = framesSaved;
+        data["first_frame_id"] = firstFrameID;
+        data["last_frame_id"] = lastFrameID;
+        if (!frameTableName.empty()) {
+            data["frame_table"] = frameTableName;  // Relative to this file
         }
-        else {
-            throw runtime_error("Unable to enable frame rate");
+
+        FrameRing::Stats queueStats = frameRing->stats();
+        data["write_queue"] = {
+            {"capacity", queueStats.capacity},
+            {"policy", ringFullPolicyName(recording.queuePolicy)},
+            {"high_water", queueStats.highWater},
+            {"dropped_newest", queueStats.droppedNewest},
+            {"dropped_oldest", queueStats.droppedOldest},
+            {"blocked_ms", queueStats.blockedMs}
+        };
+
+        if (syncPoints > 0) {
+            // How far the camera clock ran fast (+) or slow (-) of the host's steady clock
+            double hostNs = double(lastSync.steadyTimestamp - firstSync.steadyTimestamp);
+            double deviceNs = double(int64_t(lastSync.deviceTimestamp - firstSync.deviceTimestamp));
+            data["clock_sync"] = clockSyncName;  // Relative to this file
+            data["clock_sync_summary"] = {
+                {"points", syncPoints},
+                {"drift_ppm", hostNs > 0 ? (deviceNs - hostNs) / hostNs * 1e6 : 0.0},
+                {"max_latch_us", maxSyncUncertaintyNs / 1000.0}
+            };
         }
 
-        CFloatPtr ptrFrameRate = nodeMap.GetNode("AcquisitionFrameRate");
-        if (IsWritable(ptrFrameRate)) {
-            ptrFrameRate->SetValue(frameRate);
+        if (!stageLatency.empty()) {
+            data["stage_latency"] = stageLatency;
         }
-        else {
-            throw runtime_error("Unable to set frame rate");
+        if (ownTracer) {
+            data["trace"] = recording.trace;
+        }
+        if (publisher) {
+            data["frame_publisher"] = {
+                {"name", publishName},
+                {"slots", publisher->slots()},
+                {"every", recording.publishEvery},
+                {"published", publisher->published()},
+                {"oversized", publisher->oversized()}  // Larger than the geometry; not published
+            };
+        }
+        if (shared.start) {
+            StartGate::Skew skew = shared.start->skew();
+            data["multi_camera"] = {
+                {"cameras", shared.cameras},
+                {"index", shared.cameraIndex},
+                {"writer_threads", shared.writers ? shared.writers->threads() : 1},
+                {"compress_threads", shared.compressors ? shared.compressors->threads() : 0},
+                {"acquisition_started_steady_ns", shared.start->startedNs(shared.cameraIndex)},
+                {"first_frame_steady_ns", shared.start->firstFrameNs(shared.cameraIndex)},
+                {"start_skew_us", skew.startUs},  // Spread of BeginAcquisition() across the cameras
+                {"first_frame_skew_us", skew.firstFrameUs}  // Spread of their first frames' arrival
+            };
         }
-    }
-
-    void setGPIOLine2ToOutput()
-    {
-        INodeMap& nodeMap = pCam->GetNodeMap();
 
-        // Select Line 2
-        CEnumerationPtr ptrLineSelector = nodeMap.GetNode("LineSelector");
-        if (IsWritable(ptrLineSelector)) {
-            CEnumEntryPtr ptrLine2 = ptrLineSelector->GetEntryByName("Line2");
-            if (IsReadable(ptrLine2)) {
-                ptrLineSelector->SetIntValue(ptrLine2->GetValue());
-            }
-            else {
-                throw runtime_error("Unable to select Line 2");
+        // Each time the camera had to be brought back: how (skip, restart_stream, reinitialise), how long and the frames lost
+        const RecoveryPolicy::Totals& recoveryTotals = recovery->totals();
+        json recoveryEvents = json::array();
+        for (const RecoveryPolicy::Event& event : recovery->events()) {
+            recoveryEvents.push_back({
+                {"tier", RecoveryPolicy::actionName(event.tier)},
+                {"first_fault", event.firstFault},
+                {"host_timestamp", event.hostTimestamp},
+                {"last_frame_id", event.lastFrameID},
+                {"next_frame_id", event.nextFrameID},
+                {"missing_frames", event.missingFrames},
+                {"frame_id_reset", event.idReset},
+                {"skipped", event.skipped},
+                {"stream_restarts", event.restarts},
+                {"reinitialisations", event.reinits},
+                {"duration_ms", event.durationMs},
+                {"recovered", event.recovered}
+            });
+        }
+        data["recovery"] = {
+            {"episodes", recoveryTotals.episodes},
+            {"unrecovered", recoveryTotals.unrecovered},
+            {"skipped_frames", recoveryTotals.skipped},
+            {"stream_restarts", recoveryTotals.restarts},
+            {"reinitialisations", recoveryTotals.reinits},
+            {"missing_frames", recoveryTotals.missingFrames},
+            {"max_duration_ms", recoveryTotals.maxDurationMs},
+            {"total_duration_ms", recoveryTotals.totalDurationMs},
+            {"events", recoveryEvents}  // The first RecoveryPolicy::MAX_LISTED_EVENTS
+        };
+
+        // Whether the camera kept to the requested rate, and each stretch where it didn't
+        data["frame_rate_check"] = frameRateSummary();
+        json deviations = json::array();
+        for (const FrameRateGovernor::Deviation& deviation : frameRate->stats().listed) {
+            deviations.push_back({
+                {"host_timestamp", deviation.hostTimestamp},
+                {"cause", deviation.cause},
+                {"duration_s", deviation.durationS},
+                {"lowest_camera_fps", deviation.lowestCameraFps},
+                {"lowest_recorded_fps", deviation.lowestRecordedFps},
+                {"longest_exposure_us", deviation.longestExposureUs},
+                {"highest_gain_db", deviation.highestGainDb},
+                {"ended", deviation.ended}
+            });
+        }
+        data["frame_rate_check"]["first_deviations"] = deviations;
+
+        // Frames lost between the camera and the host, as opposed to those the write queue dropped
+        data["frame_drops"] = dropSummary();
+        const FrameDropMonitor::Stats& dropStats = drops.stats();
+        json gapLengths = json::object();
+        for (size_t i = 0; i < FrameDropMonitor::LENGTH_BUCKETS; ++i) {
+            if (dropStats.gapLengths[i] > 0) {
+                gapLengths[FrameDropMonitor::lengthBucketName(i)] = dropStats.gapLengths[i];
             }
         }
-        else {
-            throw runtime_error("Unable to access LineSelector");
+        data["frame_drops"]["gap_lengths"] = gapLengths;
+        json gaps = json::array();
+        for (const FrameDropMonitor::Gap& gap : dropStats.firstGaps) {
+            gaps.push_back({
+                {"after_frame_id", gap.afterFrameID},
+                {"missing", gap.missing},
+                {"host_timestamp", gap.hostTimestamp}
+            });
+        }
+        data["frame_drops"]["first_gaps"] = gaps;
+
+        if (compressor) {
+            FrameCompressor::Stats compression = compressor->stats();
+            data["compression"] = {
+                {"codec", "lossless"},
+                {"threads", compression.threads},
+                {"ratio", compression.ratio()},
+                {"raw_bytes", compression.rawBytes},
+                {"stored_bytes", compression.encodedBytes},
+                {"stored_uncompressed", compression.storedRaw},
+                {"mean_encode_ms", compression.meanEncodeMs},
+                {"max_encode_ms", compression.maxEncodeMs}
+            };
         }
 
-        // Set Line Mode to Output
-        CEnumerationPtr ptrLineMode = nodeMap.GetNode("LineMode");
-        if (IsWritable(ptrLineMode)) {
-            CEnumEntryPtr ptrOutput = ptrLineMode->GetEntryByName("Output");
-            if (IsReadable(ptrOutput)) {
-                ptrLineMode->SetIntValue(ptrOutput->GetValue());
-            }
-            else {
-                throw runtime_error("Unable to set line mode to output");
+        if (!controlEvents.empty()) {
+            json events = json::array();
+            for (const ControlEvent& event : controlEvents) {
+                events.push_back({
+                    {"command", event.command},
+                    {"label", event.label},
+                    {"source", event.source},
+                    {"host_timestamp", event.hostTimestamp}
+                });
             }
+            data["control_events"] = events;
         }
-        else {
-            throw runtime_error("Unable to access LineMode");
+
+        if (asyncImageSink) {
+            WriteLatencyStats latency = asyncImageSink->latencyStats();
+            data["write_latency"] = {
+                {"blocks", latency.completed},
+                {"mean_us", latency.meanUs},
+                {"p99_us", latency.p99Us},
+                {"p999_us", latency.p999Us},
+                {"max_us", latency.maxUs},
+                {"block_fill_ms", blockFillMs()},
+                {"queue_depth", latency.queueDepth},
+                {"in_flight_high_water", latency.inFlightHighWater}
+            };
         }
+
+        ofstream file(path + "/" + file_name);
+        file << data.dump(4);  // Pretty print with 4 spaces
+        file.close();
+    }
+
+    string currentDateTime()
+    {
+        auto now = system_clock::now();
+        time_t now_time = system_clock::to_time_t(now);
+        char buffer[80];
+        tm localTime;
+        localtime_s(&localTime, &now_time);
+        strftime(buffer, sizeof(buffer), "%y%m%d_%H%M%S", &localTime);
+        return string(buffer);
     }
 
     void createSignalFile()
@@ -604,84 +1471,130 @@ private:
         ofstream file(signal_file);
         file.close();
     }
+};
 
-    void setExposureTimeLowerLimit(double exposureTimeLowerLimit)
-    {
-        INodeMap& nodeMap = pCam->GetNodeMap();
-
-        // Set ExposureAuto to Continuous
-        CEnumerationPtr ptrExposureAuto = nodeMap.GetNode("ExposureAuto");
-        if (IsWritable(ptrExposureAuto)) {
-            CEnumEntryPtr ptrExposureAutoContinuous =
-                ptrExposureAuto->GetEntryByName("Continuous");
-            if (IsReadable(ptrExposureAutoContinuous)) {
-                ptrExposureAuto->SetIntValue(ptrExposureAutoContinuous->GetValue());
-            }
-            else {
-                throw runtime_error("Unable to set ExposureAuto to Continuous");
-            }
-        }
-        else {
-            throw runtime_error("Unable to access ExposureAuto");
-        }
-
-        // Set AutoExposureExposureTimeLowerLimit
-        CFloatPtr ptrExposureTimeLowerLimit =
-            nodeMap.GetNode("AutoExposureExposureTimeLowerLimit");
-        if (!IsAvailable(ptrExposureTimeLowerLimit) || !IsWritable(ptrExposureTimeLowerLimit)) {
-            throw runtime_error("Unable to access AutoExposureExposureTimeLowerLimit");
-        }
-
-        double minExposureTimeLowerLimit = ptrExposureTimeLowerLimit->GetMin();
-        double maxExposureTimeLowerLimit = ptrExposureTimeLowerLimit->GetMax();
+// "a,b,c" -> {"a", "b", "c"}
+vector<string> splitList(const string& list)
+{
+    vector<string> items;
+    stringstream stream(list);
+    string item;
+    while (getline(stream, item, ',')) {
+        items.push_back(item);
+    }
+    return items;
+}
 
-        if (exposureTimeLowerLimit < minExposureTimeLowerLimit)
-            exposureTimeLowerLimit = minExposureTimeLowerLimit;
-        else if (exposureTimeLowerLimit > maxExposureTimeLowerLimit)
-            exposureTimeLowerLimit = maxExposureTimeLowerLimit;
+// Where a session goes when no path is given; empty if the folder can't be made
+// Where a session goes without --path; `name` is <date_time>_<mouse_ID>
+string defaultSessionFolder(const string& name)
+{
+    string path = "E:\\test_vid_output";  // Change this to your desired default path
+    return path + "\\" + name;
+}
 
-        ptrExposureTimeLowerLimit->SetValue(exposureTimeLowerLimit);
+string defaultSessionPath(const string& date_time, const string& mouse_ID)
+{
+    string path = defaultSessionFolder(date_time + "_" + mouse_ID);
+    if (_mkdir(path.c_str()) != 0) {
+        cerr << "Error: Unable to create directory " << path << endl;
+        return "";
     }
+    return path;
+}
 
-    void printHostControllerInfo()
-    {
-        // Access the Transport Layer node map
-        INodeMap& TLNodeMap = pCam->GetTLDeviceNodeMap();
+// Several cameras from one process: a capture thread per camera, with the
+// writers and compression threads shared between them and acquisition
+// started together. Each camera keeps its own files, metadata, status file,
+// control endpoint and stop signal, exactly as if it ran alone; only the
+// preview windows are left out, since GLFW wants the main thread.
+int recordCameras(const vector<string>& serials, const vector<string>& ids, const vector<string>& paths,
+    const string& date_time, float FPS, const FrameSourceOptions& sourceOptions, const RecordingOptions& recording,
+    size_t writerThreads)
+{
+    size_t cameras = serials.size();
 
-        // Get HostAdapterName
-        CStringPtr ptrHostAdapterName = TLNodeMap.GetNode("HostAdapterName");
-        if (IsReadable(ptrHostAdapterName))
-        {
-            cout << "Host Adapter Name: " << ptrHostAdapterName->GetValue() << endl;
-        }
-        else
-        {
-            cout << "Host Adapter Name: Not available" << endl;
+    unique_ptr<TraceRecorder> tracer;
+    if (!recording.trace.empty()) {
+        tracer = make_unique<TraceRecorder>(recording.trace, "Camera_to_binary, " + to_string(cameras) + " cameras");
+        if (!tracer->isOpen()) {
+            cerr << "Error: Could not open trace file " << recording.trace << endl;
+            return -1;
         }
+    }
+    RecordingOptions cameraRecording = recording;
+    cameraRecording.trace.clear();  // One trace for the process, not one per camera
 
-        // Get HostAdapterVendor
-        CStringPtr ptrHostAdapterVendor = TLNodeMap.GetNode("HostAdapterVendor");
-        if (IsReadable(ptrHostAdapterVendor))
-        {
-            cout << "Host Adapter Vendor: " << ptrHostAdapterVendor->GetValue() << endl;
+    // One disk is usually the limit; two writers keep it busy while a frame is being gathered
+    if (writerThreads == 0) {
+        writerThreads = min<size_t>(cameras, 2);
+    }
+    WriterPool writers(writerThreads, tracer.get());
+    unique_ptr<WorkerPool> compressors;
+    if (recording.compression == "lossless") {
+        size_t threads = recording.compressThreads;
+        if (threads == 0) {
+            threads = max<size_t>(1, thread::hardware_concurrency() / 2);
         }
-        else
-        {
-            cout << "Host Adapter Vendor: Not available" << endl;
+        compressors = make_unique<WorkerPool>(threads, "compress pool", tracer.get());
+    }
+    StartGate gate(cameras);
+
+    // Cameras are opened one at a time; if any can't be, nothing is recorded
+    vector<unique_ptr<Tracker>> trackers;
+    for (size_t i = 0; i < cameras; ++i) {
+        SharedCapture shared;
+        shared.writers = &writers;
+        shared.compressors = compressors.get();
+        shared.start = &gate;
+        shared.cameraIndex = i;
+        shared.cameras = serials;
+        shared.tracer = tracer.get();
+        try {
+            trackers.push_back(make_unique<Tracker>(ids[i], date_time, paths[i], serials[i], FPS, 800, 600,
+                sourceOptions, cameraRecording, shared));
+        }
+        catch (const std::exception& e) {
+            cerr << "Error: Camera " << serials[i] << ": " << e.what() << endl;
+            return -1;
         }
+    }
+    cout << "Recording " << cameras << " cameras with " << writers.threads() << " writer threads";
+    if (compressors) {
+        cout << " and " << compressors->threads() << " compression threads";
+    }
+    cout << endl;
 
-        // Get HostAdapterDriverVersion
-        CStringPtr ptrHostAdapterDriverVersion = TLNodeMap.GetNode("HostAdapterDriverVersion");
-        if (IsReadable(ptrHostAdapterDriverVersion))
-        {
-            cout << "Host Adapter Driver Version: " << ptrHostAdapterDriverVersion->GetValue() << endl;
+    vector<thread> captureThreads;
+    atomic<int> failures{ 0 };
+    for (size_t i = 0; i < cameras; ++i) {
+        captureThreads.emplace_back([&, i] {
+            try {
+                trackers[i]->startTracking(false, true);
+            }
+            catch (const std::exception& e) {
+                cerr << "Error: Camera " << serials[i] << ": " << e.what() << endl;
+                failures++;
+            }
+        });
+    }
+    for (auto& captureThread : captureThreads) {
+        captureThread.join();
+    }
+
+    if (tracer) {
+        TraceRecorder::Stats stats = tracer->finish();
+        cout << "Trace: " << stats.events << " events from " << stats.threads << " threads written to "
+            << recording.trace << endl;
+        if (stats.dropped > 0) {
+            cerr << "Warning: " << stats.dropped << " trace events dropped because the trace file fell behind." << endl;
         }
-        else
-        {
-            cout << "Host Adapter Driver Version: Not available" << endl;
+        if (tracer->failed()) {
+            cerr << "Error: Failed to write the trace file " << recording.trace << endl;
         }
     }
-};
+    return failures > 0 ? -1 : 0;
+}
 
 // Main function
 int main(int argc, char** argv)
@@ -693,6 +1606,12 @@ int main(int argc, char** argv)
     float FPS = 60.0f;
     int windowWidth = 800;  // Default window width
     int windowHeight = 600; // Default window height
+    RecordingOptions recording;
+    FrameSourceOptions sourceOptions;
+    vector<string> serial_numbers;  // Several cameras in this process
+    vector<string> mouse_IDs;
+    vector<string> paths;
+    size_t writerThreads = 0;
 
     // Parse command-line arguments
     for (int i = 1; i < argc; i += 2) {
@@ -718,6 +1637,84 @@ int main(int argc, char** argv)
         else if (arg == "--windowHeight" && i + 1 < argc) {
             windowHeight = stoi(argv[i + 1]);
         }
+        else if (i + 1 < argc && parseFrameSourceOption(arg, argv[i + 1], sourceOptions)) {
+            // --source, --sim_* and --replay_* options
+        }
+        else if (arg == "--queue_frames" && i + 1 < argc) {
+            recording.queueFrames = stoul(argv[i + 1]);
+        }
+        else if (arg == "--queue_policy" && i + 1 < argc) {
+            if (!parseRingFullPolicy(argv[i + 1], recording.queuePolicy)) {
+                cerr << "Error: --queue_policy must be block, drop_newest or drop_oldest" << endl;
+                return -1;
+            }
+        }
+        else if (arg == "--format" && i + 1 < argc) {
+            recording.format = argv[i + 1];
+            if (recording.format != "container" && recording.format != "raw") {
+                cerr << "Error: --format must be container or raw" << endl;
+                return -1;
+            }
+        }
+        else if (arg == "--writer" && i + 1 < argc) {
+            recording.writer = argv[i + 1];
+            if (recording.writer != "buffered" && recording.writer != "direct" && recording.writer != "async") {
+                cerr << "Error: --writer must be buffered, direct or async" << endl;
+                return -1;
+            }
+        }
+        else if (arg == "--write_block_mb" && i + 1 < argc) {
+            recording.writeBlockMB = stoul(argv[i + 1]);
+        }
+        else if (arg == "--write_depth" && i + 1 < argc) {
+            recording.writeDepth = stoul(argv[i + 1]);
+        }
+        else if (arg == "--expected_duration_min" && i + 1 < argc) {
+            recording.expectedDurationMin = stod(argv[i + 1]);
+        }
+        else if (arg == "--compress" && i + 1 < argc) {
+            recording.compression = argv[i + 1];
+            if (recording.compression != "none" && recording.compression != "lossless") {
+                cerr << "Error: --compress must be none or lossless" << endl;
+                return -1;
+            }
+        }
+        else if (arg == "--compress_threads" && i + 1 < argc) {
+            recording.compressThreads = stoul(argv[i + 1]);
+        }
+        else if (arg == "--control" && i + 1 < argc) {
+            recording.control = argv[i + 1];
+        }
+        else if (arg == "--trace" && i + 1 < argc) {
+            recording.trace = argv[i + 1];
+        }
+        else if (arg == "--publish" && i + 1 < argc) {
+            recording.publish = argv[i + 1];
+        }
+        else if (arg == "--publish_every" && i + 1 < argc) {
+            recording.publishEvery = max<size_t>(1, stoul(argv[i + 1]));
+        }
+        else if (arg == "--publish_slots" && i + 1 < argc) {
+            recording.publishSlots = stoul(argv[i + 1]);
+        }
+        else if (arg == "--serial_numbers" && i + 1 < argc) {
+            serial_numbers = splitList(argv[i + 1]);
+        }
+        else if (arg == "--ids" && i + 1 < argc) {
+            mouse_IDs = splitList(argv[i + 1]);
+        }
+        else if (arg == "--paths" && i + 1 < argc) {
+            paths = splitList(argv[i + 1]);
+        }
+        else if (arg == "--writer_threads" && i + 1 < argc) {
+            writerThreads = stoul(argv[i + 1]);
+        }
+    }
+
+    if (recording.compression != "none" && recording.format == "raw") {
+        // A headerless .bin has nowhere to record each frame's compressed size
+        cerr << "Error: --compress needs --format container" << endl;
+        return -1;
     }
 
     if (date_time.empty()) {
@@ -730,18 +1727,58 @@ int main(int argc, char** argv)
         date_time = string(buffer);
     }
 
+    if (!serial_numbers.empty()) {
+        // One ID and one folder per camera; --path puts them all in the same folder
+        size_t cameras = serial_numbers.size();
+        if (mouse_IDs.empty()) {
+            mouse_IDs.assign(cameras, mouse_ID);
+        }
+        if (paths.empty() && !path.empty()) {
+            paths.assign(cameras, path);
+        }
+        if (mouse_IDs.size() != cameras || (!paths.empty() && paths.size() != cameras)) {
+            cerr << "Error: --ids and --paths need one entry per camera in --serial_numbers" << endl;
+            return -1;
+        }
+        // Default folders carry the serial number too, so cameras sharing an ID don't collide
+        bool defaultPaths = paths.empty();
+        if (defaultPaths) {
+            for (size_t i = 0; i < cameras; ++i) {
+                paths.push_back(defaultSessionFolder(date_time + "_" + mouse_IDs[i] + "_" + serial_numbers[i]));
+            }
+        }
+        // Checked before any folder is made, so a bad command leaves nothing behind
+        for (size_t i = 0; i < cameras; ++i) {
+            for (size_t j = 0; j < i; ++j) {
+                if (paths[j] == paths[i] && mouse_IDs[j] == mouse_IDs[i]) {
+                    cerr << "Error: Cameras " << serial_numbers[j] << " and " << serial_numbers[i]
+                        << " would write the same files; give them different --ids or --paths" << endl;
+                    return -1;
+                }
+            }
+        }
+        if (defaultPaths) {
+            for (const string& cameraPath : paths) {
+                if (_mkdir(cameraPath.c_str()) != 0) {
+                    cerr << "Error: Unable to create directory " << cameraPath << endl;
+                    return -1;
+                }
+            }
+        }
+        return recordCameras(serial_numbers, mouse_IDs, paths, date_time, FPS, sourceOptions, recording, writerThreads);
+    }
+
     if (path.empty()) {
         // Default path if none is provided
-        path = "E:\\test_vid_output";  // Change this to your desired default path
-        path += "\\" + date_time + "_" + mouse_ID;
-        if (_mkdir(path.c_str()) != 0) {
-            cerr << "Error: Unable to create directory " << path << endl;
+        path = defaultSessionPath(date_time, mouse_ID);
+        if (path.empty()) {
             return -1;
         }
     }
 
     try {
-        Tracker camera(mouse_ID, date_time, path, serial_number, FPS, windowWidth, windowHeight);
+        Tracker camera(mouse_ID, date_time, path, serial_number, FPS, windowWidth, windowHeight,
+            sourceOptions, recording);
         camera.startTracking(true, true);
     }
     catch (const std::exception& e) {
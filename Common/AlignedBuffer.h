@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+// Heap buffer with a guaranteed start alignment, as direct (unbuffered) file
+// I/O requires sector-aligned memory.
+class AlignedBuffer
+{
+public:
+    AlignedBuffer() = default;
+
+    AlignedBuffer(size_t size, size_t alignment)
+    {
+        allocate(size, alignment);
+    }
+
+    ~AlignedBuffer()
+    {
+        release();
+    }
+
+    AlignedBuffer(const AlignedBuffer&) = delete;
+    AlignedBuffer& operator=(const AlignedBuffer&) = delete;
+
+    AlignedBuffer(AlignedBuffer&& other) noexcept
+        : ptr(other.ptr), bytes(other.bytes)
+    {
+        other.ptr = nullptr;
+        other.bytes = 0;
+    }
+
+    AlignedBuffer& operator=(AlignedBuffer&& other) noexcept
+    {
+        if (this != &other) {
+            release();
+            ptr = other.ptr;
+            bytes = other.bytes;
+            other.ptr = nullptr;
+            other.bytes = 0;
+        }
+        return *this;
+    }
+
+    void allocate(size_t size, size_t alignment)
+    {
+        release();
+#ifdef _WIN32
+        ptr = static_cast<char*>(_aligned_malloc(size, alignment));
+#else
+        void* p = nullptr;
+        if (posix_memalign(&p, alignment, size) != 0) {
+            p = nullptr;
+        }
+        ptr = static_cast<char*>(p);
+#endif
+        if (!ptr) {
+            throw std::bad_alloc();
+        }
+        bytes = size;
+    }
+
+    char* data() { return ptr; }
+    const char* data() const { return ptr; }
+    size_t size() const { return bytes; }
+
+private:
+    char* ptr = nullptr;
+    size_t bytes = 0;
+
+    void release()
+    {
+        if (ptr) {
+#ifdef _WIN32
+            _aligned_free(ptr);
+#else
+            free(ptr);
+#endif
+        }
+        ptr = nullptr;
+        bytes = 0;
+    }
+};
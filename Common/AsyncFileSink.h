@@ -0,0 +1,578 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "AlignedBuffer.h"
+#include "FileSink.h"
+#include "LatencyHistogram.h"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+// Submission-to-completion time of the writes an AsyncFileSink has finished
+struct WriteLatencyStats
+{
+    uint64_t completed = 0;
+    double meanUs = 0;
+    double p99Us = 0;
+    double p999Us = 0;
+    double maxUs = 0;
+    size_t inFlight = 0;
+    size_t inFlightHighWater = 0;
+    size_t queueDepth = 0;
+};
+
+// Writes a stream in fixed-size blocks with several writes in flight at once,
+// so the calling thread only waits on storage when every block is still
+// queued at the disk. Uses io_uring on Linux (with the block buffers
+// registered with the kernel once, up front) and overlapped I/O on an I/O
+// completion port on Windows.
+//
+// With unbuffered = true the blocks bypass the page cache as in
+// DirectFileSink, and flush() cannot write a partial block; otherwise flush()
+// submits whatever has been gathered so far.
+class AsyncFileSink : public FileSink
+{
+public:
+    AsyncFileSink(const std::string& filePath, size_t blockBytes, size_t queueDepth,
+        bool unbuffered, bool append = false)
+        : filePath(filePath)
+    {
+        if (!(unbuffered && openFile(true, append)) && !openFile(false, append)) {
+            return;
+        }
+        if (unbuffered && !direct) {
+            std::cerr << "Warning: Direct I/O not available for " << filePath
+                << ", using buffered asynchronous writes." << std::endl;
+        }
+
+        alignment = direct ? queryAlignment() : 1;
+        blockBytes = std::max(blockBytes, alignment);
+        blockBytes = (blockBytes + alignment - 1) / alignment * alignment;
+
+        blocks.resize(std::max<size_t>(queueDepth, 2));
+        for (auto& block : blocks) {
+            block.buffer.allocate(blockBytes, std::max<size_t>(alignment, 4096));
+        }
+
+        if (!startQueue()) {
+            closeFile();
+            return;
+        }
+        ready = true;
+    }
+
+    ~AsyncFileSink() override
+    {
+        close();
+    }
+
+    bool isOpen() const { return ready; }
+    bool usingDirectIO() const { return direct; }
+
+    bool write(const void* data, size_t size) override
+    {
+        if (!ready || failed) {
+            return false;
+        }
+
+        const char* src = static_cast<const char*>(data);
+        while (size > 0) {
+            Block& block = blocks[current];
+            size_t n = std::min(size, block.buffer.size() - block.length);
+            memcpy(block.buffer.data() + block.length, src, n);
+            block.length += n;
+            src += n;
+            size -= n;
+
+            if (block.length == block.buffer.size() && !submitCurrent()) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool flush() override
+    {
+        if (!ready || failed) {
+            return false;
+        }
+        // Direct I/O can only write whole sectors; the tail waits for close()
+        if (direct || blocks[current].length == 0) {
+            return true;
+        }
+        return submitCurrent();
+    }
+
+    bool close() override
+    {
+        if (!ready) {
+            return !failed;
+        }
+
+        uint64_t logicalSize = nextOffset + blocks[current].length;
+        Block& tail = blocks[current];
+        if (!failed && tail.length > 0) {
+            if (direct) {
+                // Pad to a whole sector and trim the file back afterwards
+                size_t padded = (tail.length + alignment - 1) / alignment * alignment;
+                memset(tail.buffer.data() + tail.length, 0, padded - tail.length);
+                tail.length = padded;
+            }
+            submitCurrent();
+        }
+
+        while (inFlight > 0 && waitForCompletion()) {}
+
+        if (direct && !truncateTo(logicalSize)) {
+            failed = true;
+        }
+        stopQueue();
+        closeFile();
+        ready = false;
+        return !failed;
+    }
+
+    uint64_t bytesWritten() const override { return nextOffset - startOffset + (ready ? blocks[current].length : 0); }
+
+    std::string description() const override
+    {
+#ifdef _WIN32
+        std::string api = "overlapped";
+#else
+        std::string api = registered ? "io_uring, registered buffers" : "io_uring";
+#endif
+        return std::string("async ") + (direct ? "direct" : "buffered") + " (" + api + ", " +
+            std::to_string(blocks.size()) + " x " + std::to_string(blocks.empty() ? 0 : blocks[0].buffer.size() >> 10) + " KB)";
+    }
+
+    WriteLatencyStats latencyStats() const
+    {
+        std::lock_guard<std::mutex> lock(statsMutex);
+        WriteLatencyStats stats;
+        LatencySummary summary = latency.summary();
+        stats.completed = summary.count;
+        stats.meanUs = summary.meanUs;
+        stats.p99Us = summary.p99Us;
+        stats.p999Us = summary.p999Us;
+        stats.maxUs = summary.maxUs;
+        stats.inFlight = inFlight;
+        stats.inFlightHighWater = inFlightHighWater;
+        stats.queueDepth = blocks.size();
+        return stats;
+    }
+
+private:
+    struct Block
+    {
+#ifdef _WIN32
+        OVERLAPPED overlapped = {};  // Must stay first: completions hand back this pointer
+#endif
+        AlignedBuffer buffer;
+        size_t length = 0;    // Bytes gathered in the buffer
+        size_t done = 0;      // Bytes the disk has confirmed
+        uint64_t offset = 0;
+        bool busy = false;
+        std::chrono::steady_clock::time_point submitted;
+    };
+
+    std::string filePath;
+    std::vector<Block> blocks;
+    size_t current = 0;  // Block being filled
+    size_t alignment = 1;
+    uint64_t startOffset = 0;
+    uint64_t nextOffset = 0;  // File offset of the block being filled
+    bool direct = false;
+    bool ready = false;
+    bool failed = false;
+
+    mutable std::mutex statsMutex;
+    size_t inFlight = 0;
+    size_t inFlightHighWater = 0;
+    LatencyHistogram latency;  // Submission to completion
+
+    // Hand the block being filled to the disk and move on to the next one,
+    // waiting only if that one is still being written
+    bool submitCurrent()
+    {
+        Block& block = blocks[current];
+        block.offset = nextOffset;
+        block.done = 0;
+        block.busy = true;
+        block.submitted = std::chrono::steady_clock::now();
+        nextOffset += block.length;
+
+        {
+            std::lock_guard<std::mutex> lock(statsMutex);
+            inFlight++;
+            inFlightHighWater = std::max(inFlightHighWater, inFlight);
+        }
+
+        if (!submit(current)) {
+            std::cerr << "Error: Could not queue a write to " << filePath << std::endl;
+            block.busy = false;
+            finishWrite(block, false);
+            return false;
+        }
+
+        current = (current + 1) % blocks.size();
+        while (blocks[current].busy) {
+            if (!waitForCompletion()) {
+                return false;
+            }
+        }
+        blocks[current].length = 0;
+        return !failed;
+    }
+
+    // Called for each completion; resubmits the rest of a short write
+    void completed(size_t index, bool ok, size_t bytes)
+    {
+        Block& block = blocks[index];
+        if (ok) {
+            block.done += bytes;
+            if (block.done < block.length && bytes > 0) {
+                if (submit(index)) {
+                    return;
+                }
+                ok = false;
+            }
+            else if (block.done < block.length) {
+                ok = false;
+            }
+        }
+        if (!ok) {
+            std::cerr << "Error: Asynchronous write to " << filePath << " failed at offset "
+                << block.offset + block.done << std::endl;
+        }
+        block.busy = false;
+        finishWrite(block, ok);
+    }
+
+    void finishWrite(const Block& block, bool ok)
+    {
+        std::chrono::steady_clock::duration took = std::chrono::steady_clock::now() - block.submitted;
+
+        std::lock_guard<std::mutex> lock(statsMutex);
+        inFlight--;
+        if (!ok) {
+            failed = true;
+            return;
+        }
+        latency.record(took);
+    }
+
+#ifdef _WIN32
+    HANDLE handle = INVALID_HANDLE_VALUE;
+    HANDLE port = NULL;
+
+    bool openFile(bool unbuffered, bool append)
+    {
+        DWORD flags = FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED | (unbuffered ? FILE_FLAG_NO_BUFFERING : 0);
+        handle = CreateFileA(filePath.c_str(), GENERIC_WRITE, FILE_SHARE_READ, NULL,
+            append ? OPEN_ALWAYS : CREATE_ALWAYS, flags, NULL);
+        if (handle == INVALID_HANDLE_VALUE) {
+            return false;
+        }
+
+        LARGE_INTEGER size = {};
+        if (append && GetFileSizeEx(handle, &size)) {
+            startOffset = nextOffset = static_cast<uint64_t>(size.QuadPart);
+        }
+        if (unbuffered && startOffset % 4096 != 0) {
+            // Appending direct writes must start on a sector boundary
+            closeFile();
+            return false;
+        }
+        direct = unbuffered;
+        return true;
+    }
+
+    void closeFile()
+    {
+        if (handle != INVALID_HANDLE_VALUE) {
+            CloseHandle(handle);
+            handle = INVALID_HANDLE_VALUE;
+        }
+    }
+
+    size_t queryAlignment()
+    {
+        FILE_STORAGE_INFO storageInfo = {};
+        if (GetFileInformationByHandleEx(handle, FileStorageInfo, &storageInfo, sizeof(storageInfo))) {
+            return std::max<size_t>(4096, storageInfo.PhysicalBytesPerSectorForPerformance);
+        }
+        return 4096;
+    }
+
+    bool truncateTo(uint64_t size)
+    {
+        FILE_END_OF_FILE_INFO endOfFileInfo = {};
+        endOfFileInfo.EndOfFile.QuadPart = static_cast<LONGLONG>(size);
+        return SetFileInformationByHandle(handle, FileEndOfFileInfo, &endOfFileInfo, sizeof(endOfFileInfo)) != 0;
+    }
+
+    bool startQueue()
+    {
+        port = CreateIoCompletionPort(handle, NULL, 0, 1);
+        return port != NULL;
+    }
+
+    void stopQueue()
+    {
+        if (port) {
+            CloseHandle(port);
+            port = NULL;
+        }
+    }
+
+    bool submit(size_t index)
+    {
+        Block& block = blocks[index];
+        uint64_t offset = block.offset + block.done;
+        block.overlapped = {};
+        block.overlapped.Offset = static_cast<DWORD>(offset);
+        block.overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+
+        // Even when WriteFile finishes immediately the completion is still
+        // posted to the port, so every write is reaped in one place
+        if (!WriteFile(handle, block.buffer.data() + block.done, static_cast<DWORD>(block.length - block.done),
+            NULL, &block.overlapped) && GetLastError() != ERROR_IO_PENDING) {
+            return false;
+        }
+        return true;
+    }
+
+    bool waitForCompletion()
+    {
+        DWORD bytes = 0;
+        ULONG_PTR key = 0;
+        OVERLAPPED* overlapped = nullptr;
+        BOOL ok = GetQueuedCompletionStatus(port, &bytes, &key, &overlapped, INFINITE);
+        if (!overlapped) {
+            failed = true;
+            return false;
+        }
+
+        size_t index = reinterpret_cast<Block*>(overlapped) - blocks.data();
+        completed(index, ok != FALSE, bytes);
+        return true;
+    }
+#else
+    int fd = -1;
+    int ringFd = -1;
+    bool registered = false;
+
+    void* sqRing = MAP_FAILED;
+    void* cqRing = MAP_FAILED;
+    size_t sqRingBytes = 0;
+    size_t cqRingBytes = 0;
+    io_uring_sqe* sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+    size_t sqesBytes = 0;
+
+    unsigned* sqTail = nullptr;
+    unsigned* sqMask = nullptr;
+    unsigned* sqArray = nullptr;
+    unsigned* cqHead = nullptr;
+    unsigned* cqTail = nullptr;
+    unsigned* cqMask = nullptr;
+    io_uring_cqe* cqes = nullptr;
+
+    bool openFile(bool unbuffered, bool append)
+    {
+        int flags = O_WRONLY | O_CREAT | (append ? 0 : O_TRUNC);
+#ifdef O_DIRECT
+        if (unbuffered) {
+            flags |= O_DIRECT;
+        }
+#else
+        if (unbuffered) {
+            return false;
+        }
+#endif
+        fd = ::open(filePath.c_str(), flags, 0644);
+        if (fd < 0) {
+            return false;
+        }
+
+        if (append) {
+            off_t end = ::lseek(fd, 0, SEEK_END);
+            startOffset = nextOffset = end > 0 ? static_cast<uint64_t>(end) : 0;
+        }
+        if (unbuffered && startOffset % 4096 != 0) {
+            // Appending direct writes must start on a sector boundary
+            closeFile();
+            return false;
+        }
+        direct = unbuffered;
+        return true;
+    }
+
+    void closeFile()
+    {
+        if (fd >= 0) {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+
+    size_t queryAlignment()
+    {
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_blksize > 4096) {
+            return static_cast<size_t>(st.st_blksize);
+        }
+        return 4096;
+    }
+
+    bool truncateTo(uint64_t size)
+    {
+        return ftruncate(fd, static_cast<off_t>(size)) == 0;
+    }
+
+    template <typename T>
+    T* ringField(void* ring, unsigned offset)
+    {
+        return reinterpret_cast<T*>(static_cast<char*>(ring) + offset);
+    }
+
+    bool startQueue()
+    {
+        // Raw system calls, so the build does not depend on liburing
+        io_uring_params params = {};
+        ringFd = static_cast<int>(syscall(__NR_io_uring_setup, static_cast<unsigned>(blocks.size()), &params));
+        if (ringFd < 0) {
+            std::cerr << "Error: io_uring is not available (" << strerror(errno) << ")" << std::endl;
+            return false;
+        }
+
+        sqRingBytes = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqRingBytes = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool singleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (singleMap) {
+            sqRingBytes = cqRingBytes = std::max(sqRingBytes, cqRingBytes);
+        }
+
+        sqRing = mmap(nullptr, sqRingBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+        if (sqRing == MAP_FAILED) {
+            stopQueue();
+            return false;
+        }
+        cqRing = singleMap ? sqRing :
+            mmap(nullptr, cqRingBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+        sqesBytes = params.sq_entries * sizeof(io_uring_sqe);
+        void* sqeMap = mmap(nullptr, sqesBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+        sqes = static_cast<io_uring_sqe*>(sqeMap);
+        if (cqRing == MAP_FAILED || sqeMap == MAP_FAILED) {
+            stopQueue();
+            return false;
+        }
+
+        sqTail = ringField<unsigned>(sqRing, params.sq_off.tail);
+        sqMask = ringField<unsigned>(sqRing, params.sq_off.ring_mask);
+        sqArray = ringField<unsigned>(sqRing, params.sq_off.array);
+        cqHead = ringField<unsigned>(cqRing, params.cq_off.head);
+        cqTail = ringField<unsigned>(cqRing, params.cq_off.tail);
+        cqMask = ringField<unsigned>(cqRing, params.cq_off.ring_mask);
+        cqes = ringField<io_uring_cqe>(cqRing, params.cq_off.cqes);
+
+        // Pin the block buffers once so each write skips the per-call page
+        // mapping. Fails under a low RLIMIT_MEMLOCK; plain writes still work.
+        std::vector<iovec> iovecs(blocks.size());
+        for (size_t i = 0; i < blocks.size(); ++i) {
+            iovecs[i].iov_base = blocks[i].buffer.data();
+            iovecs[i].iov_len = blocks[i].buffer.size();
+        }
+        registered = syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_BUFFERS,
+            iovecs.data(), static_cast<unsigned>(iovecs.size())) == 0;
+        return true;
+    }
+
+    void stopQueue()
+    {
+        if (sqes != MAP_FAILED) munmap(sqes, sqesBytes);
+        if (cqRing != MAP_FAILED && cqRing != sqRing) munmap(cqRing, cqRingBytes);
+        if (sqRing != MAP_FAILED) munmap(sqRing, sqRingBytes);
+        sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+        sqRing = cqRing = MAP_FAILED;
+        if (ringFd >= 0) {
+            ::close(ringFd);  // Also unregisters the buffers
+            ringFd = -1;
+        }
+    }
+
+    int enter(unsigned toSubmit, unsigned minComplete, unsigned flags)
+    {
+        int result;
+        do {
+            result = static_cast<int>(syscall(__NR_io_uring_enter, ringFd, toSubmit, minComplete, flags, nullptr, 0));
+        } while (result < 0 && errno == EINTR);
+        return result;
+    }
+
+    bool submit(size_t index)
+    {
+        Block& block = blocks[index];
+
+        // Only this thread produces submissions, so the tail needs no CAS
+        unsigned tail = *sqTail;
+        unsigned slot = tail & *sqMask;
+        io_uring_sqe* sqe = &sqes[slot];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = registered ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+        sqe->fd = fd;
+        sqe->addr = reinterpret_cast<uint64_t>(block.buffer.data() + block.done);
+        sqe->len = static_cast<uint32_t>(block.length - block.done);
+        sqe->off = block.offset + block.done;
+        sqe->buf_index = static_cast<uint16_t>(index);
+        sqe->user_data = index;
+        sqArray[slot] = slot;
+        __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+
+        return enter(1, 0, 0) == 1;
+    }
+
+    bool waitForCompletion()
+    {
+        unsigned head = *cqHead;
+        unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+        while (head == tail) {
+            if (enter(0, 1, IORING_ENTER_GETEVENTS) < 0) {
+                failed = true;
+                return false;
+            }
+            tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+        }
+
+        while (head != tail) {
+            io_uring_cqe cqe = cqes[head & *cqMask];
+            head++;
+            __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+            completed(static_cast<size_t>(cqe.user_data), cqe.res >= 0, cqe.res > 0 ? static_cast<size_t>(cqe.res) : 0);
+        }
+        return true;
+    }
+#endif
+};
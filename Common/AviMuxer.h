@@ -0,0 +1,327 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Writes already-compressed MJPEG frames into an AVI file. Frames are written
+// in the order they are passed in; the muxer does no encoding of its own.
+//
+// Long sessions go far past the 1-4 GB a plain AVI can hold, so the file uses
+// the OpenDML extension: the data is split into ~1 GB RIFF segments ('AVI '
+// then 'AVIX'), each ending with its own 'ix00' index, all listed in a super
+// index in the stream header. The first segment also gets a classic 'idx1'
+// so older players can at least read that part.
+class AviMuxer
+{
+public:
+    AviMuxer(const std::string& filePath, size_t width, size_t height, double fps, bool isColor)
+        : width(static_cast<uint32_t>(width)), height(static_cast<uint32_t>(height)), fps(fps), isColor(isColor)
+    {
+        file.open(filePath, std::ios::binary | std::ios::out | std::ios::trunc);
+        if (!file.is_open()) {
+            return;
+        }
+        writeHeaders();
+        beginMovi();
+    }
+
+    ~AviMuxer()
+    {
+        close();
+    }
+
+    bool isOpen() const { return file.is_open() && file.good(); }
+    uint64_t framesWritten() const { return totalFrames; }
+
+    bool writeFrame(const void* jpeg, size_t size)
+    {
+        if (!isOpen()) {
+            return false;
+        }
+
+        uint64_t chunkBytes = 8 + size + (size & 1);
+        if (position() + chunkBytes + indexBytes(segmentIndex.size() + 1) - riffStart > SEGMENT_LIMIT &&
+            !segmentIndex.empty()) {
+            endSegment();
+            beginSegment();
+        }
+
+        uint64_t dataOffset = position() + 8;
+        putFourCC("00dc");
+        put32(static_cast<uint32_t>(size));
+        file.write(static_cast<const char*>(jpeg), static_cast<std::streamsize>(size));
+        if (size & 1) {
+            file.put(0);
+        }
+
+        segmentIndex.push_back({ static_cast<uint32_t>(dataOffset - moviListStart), static_cast<uint32_t>(size) });
+        maxFrameBytes = std::max<uint64_t>(maxFrameBytes, size);
+        totalFrames++;
+        return file.good();
+    }
+
+    // Writes the indexes and patches the headers; safe to call twice
+    bool close()
+    {
+        if (!file.is_open()) {
+            return true;
+        }
+
+        endSegment();
+
+        // Header fields that could only be known at the end
+        patch32(avihTotalFramesPos, static_cast<uint32_t>(firstSegmentFrames));
+        patch32(avihSuggestedBufferPos, static_cast<uint32_t>(maxFrameBytes));
+        patch32(strhLengthPos, static_cast<uint32_t>(totalFrames));
+        patch32(strhSuggestedBufferPos, static_cast<uint32_t>(maxFrameBytes));
+        patch32(dmlhTotalFramesPos, static_cast<uint32_t>(totalFrames));
+
+        // Super index: one entry per segment's ix00
+        patch32(superIndexCountPos, static_cast<uint32_t>(superIndex.size()));
+        file.seekp(static_cast<std::streamoff>(superIndexEntriesPos));
+        for (const auto& entry : superIndex) {
+            put64(entry.offset);
+            put32(entry.size);
+            put32(entry.duration);
+        }
+
+        bool ok = file.good();
+        file.close();
+        return ok && !file.fail();
+    }
+
+private:
+    static const uint64_t SEGMENT_LIMIT = uint64_t(1) << 30;  // Keep every RIFF well inside 32-bit sizes
+    static const uint32_t SUPER_INDEX_ENTRIES = 4096;          // Up to ~4 TB of video
+
+    struct StandardIndexEntry
+    {
+        uint32_t offset;  // From the start of this segment's movi LIST to the frame data
+        uint32_t size;
+    };
+
+    struct SuperIndexEntry
+    {
+        uint64_t offset;  // File offset of an ix00 chunk
+        uint32_t size;
+        uint32_t duration;  // Frames it covers
+    };
+
+    std::ofstream file;
+    uint32_t width;
+    uint32_t height;
+    double fps;
+    bool isColor;
+
+    uint64_t totalFrames = 0;
+    uint64_t firstSegmentFrames = 0;
+    uint64_t maxFrameBytes = 0;
+    bool firstSegment = true;
+
+    uint64_t riffStart = 0;
+    uint64_t riffSizePos = 0;
+    uint64_t moviListStart = 0;
+    uint64_t moviSizePos = 0;
+    std::vector<StandardIndexEntry> segmentIndex;
+    std::vector<SuperIndexEntry> superIndex;
+
+    uint64_t avihTotalFramesPos = 0;
+    uint64_t avihSuggestedBufferPos = 0;
+    uint64_t strhLengthPos = 0;
+    uint64_t strhSuggestedBufferPos = 0;
+    uint64_t dmlhTotalFramesPos = 0;
+    uint64_t superIndexCountPos = 0;
+    uint64_t superIndexEntriesPos = 0;
+
+    uint64_t position() { return static_cast<uint64_t>(file.tellp()); }
+
+    void put16(uint16_t v) { file.write(reinterpret_cast<const char*>(&v), 2); }
+    void put32(uint32_t v) { file.write(reinterpret_cast<const char*>(&v), 4); }
+    void put64(uint64_t v) { file.write(reinterpret_cast<const char*>(&v), 8); }
+    void putFourCC(const char* fourcc) { file.write(fourcc, 4); }
+
+    void patch32(uint64_t at, uint32_t v)
+    {
+        uint64_t back = position();
+        file.seekp(static_cast<std::streamoff>(at));
+        put32(v);
+        file.seekp(static_cast<std::streamoff>(back));
+    }
+
+    // Starts a RIFF or LIST; returns where its size field is
+    uint64_t beginList(const char* type, const char* name)
+    {
+        putFourCC(type);
+        uint64_t sizePos = position();
+        put32(0);
+        putFourCC(name);
+        return sizePos;
+    }
+
+    void endList(uint64_t sizePos)
+    {
+        patch32(sizePos, static_cast<uint32_t>(position() - sizePos - 4));
+    }
+
+    static uint64_t indexBytes(size_t entries)
+    {
+        return 32 + uint64_t(entries) * 8;
+    }
+
+    void writeHeaders()
+    {
+        riffStart = 0;
+        riffSizePos = beginList("RIFF", "AVI ");
+        uint64_t hdrlSizePos = beginList("LIST", "hdrl");
+
+        uint32_t scale = 1000;
+        uint32_t rate = static_cast<uint32_t>(std::lround(fps * scale));
+
+        // Main header (MainAVIHeader)
+        putFourCC("avih");
+        put32(56);
+        put32(fps > 0 ? static_cast<uint32_t>(std::lround(1e6 / fps)) : 0);  // dwMicroSecPerFrame
+        put32(0);                   // dwMaxBytesPerSec
+        put32(0);                   // dwPaddingGranularity
+        put32(0x10 | 0x800);        // AVIF_HASINDEX | AVIF_TRUSTCKTYPE
+        avihTotalFramesPos = position();
+        put32(0);                   // dwTotalFrames (first segment only)
+        put32(0);                   // dwInitialFrames
+        put32(1);                   // dwStreams
+        avihSuggestedBufferPos = position();
+        put32(0);                   // dwSuggestedBufferSize
+        put32(width);
+        put32(height);
+        for (int i = 0; i < 4; ++i) put32(0);
+
+        uint64_t strlSizePos = beginList("LIST", "strl");
+
+        // Stream header (AVIStreamHeader)
+        putFourCC("strh");
+        put32(56);
+        putFourCC("vids");
+        putFourCC("MJPG");
+        put32(0);                   // dwFlags
+        put16(0);                   // wPriority
+        put16(0);                   // wLanguage
+        put32(0);                   // dwInitialFrames
+        put32(scale);
+        put32(rate);
+        put32(0);                   // dwStart
+        strhLengthPos = position();
+        put32(0);                   // dwLength
+        strhSuggestedBufferPos = position();
+        put32(0);                   // dwSuggestedBufferSize
+        put32(0xFFFFFFFF);          // dwQuality: default
+        put32(0);                   // dwSampleSize: varies per frame
+        put16(0);
+        put16(0);
+        put16(static_cast<uint16_t>(width));
+        put16(static_cast<uint16_t>(height));
+
+        // Stream format (BITMAPINFOHEADER)
+        putFourCC("strf");
+        put32(40);
+        put32(40);
+        put32(width);
+        put32(height);
+        put16(1);                   // biPlanes
+        put16(24);                  // biBitCount: decoders take the real layout from the JPEG
+        putFourCC("MJPG");
+        put32(width * height * (isColor ? 3 : 1));
+        put32(0);
+        put32(0);
+        put32(0);
+        put32(0);
+
+        // OpenDML super index, filled in by close()
+        putFourCC("indx");
+        put32(24 + SUPER_INDEX_ENTRIES * 16);
+        put16(4);                   // wLongsPerEntry
+        file.put(0);                // bIndexSubType
+        file.put(0);                // bIndexType: AVI_INDEX_OF_INDEXES
+        superIndexCountPos = position();
+        put32(0);                   // nEntriesInUse
+        putFourCC("00dc");
+        put32(0);
+        put32(0);
+        put32(0);
+        superIndexEntriesPos = position();
+        std::vector<char> empty(SUPER_INDEX_ENTRIES * 16, 0);
+        file.write(empty.data(), static_cast<std::streamsize>(empty.size()));
+
+        endList(strlSizePos);
+
+        // OpenDML extended header: total frames across all segments
+        uint64_t odmlSizePos = beginList("LIST", "odml");
+        putFourCC("dmlh");
+        put32(248);
+        dmlhTotalFramesPos = position();
+        put32(0);
+        std::vector<char> reserved(244, 0);
+        file.write(reserved.data(), static_cast<std::streamsize>(reserved.size()));
+        endList(odmlSizePos);
+
+        endList(hdrlSizePos);
+    }
+
+    void beginMovi()
+    {
+        moviListStart = position();
+        moviSizePos = beginList("LIST", "movi");
+    }
+
+    // Opens the next 'AVIX' RIFF segment
+    void beginSegment()
+    {
+        riffStart = position();
+        riffSizePos = beginList("RIFF", "AVIX");
+        beginMovi();
+    }
+
+    // Writes this segment's ix00 (and idx1 for the first one) and closes it
+    void endSegment()
+    {
+        uint64_t frames = segmentIndex.size();
+
+        uint64_t ixStart = position();
+        putFourCC("ix00");
+        put32(static_cast<uint32_t>(indexBytes(segmentIndex.size()) - 8));
+        put16(2);                   // wLongsPerEntry
+        file.put(0);                // bIndexSubType
+        file.put(1);                // bIndexType: AVI_INDEX_OF_CHUNKS
+        put32(static_cast<uint32_t>(segmentIndex.size()));
+        putFourCC("00dc");
+        put64(moviListStart);       // qwBaseOffset
+        put32(0);
+        for (const auto& entry : segmentIndex) {
+            put32(entry.offset);
+            put32(entry.size);      // Top bit clear: every MJPEG frame is a key frame
+        }
+        superIndex.push_back({ ixStart, static_cast<uint32_t>(indexBytes(segmentIndex.size())), static_cast<uint32_t>(frames) });
+
+        endList(moviSizePos);
+
+        if (firstSegment) {
+            // Legacy index: offsets from the 'movi' FOURCC to each chunk header
+            putFourCC("idx1");
+            put32(static_cast<uint32_t>(segmentIndex.size() * 16));
+            for (const auto& entry : segmentIndex) {
+                putFourCC("00dc");
+                put32(0x10);        // AVIIF_KEYFRAME
+                put32(entry.offset - 16);
+                put32(entry.size);
+            }
+            firstSegmentFrames = frames;
+            firstSegment = false;
+        }
+
+        endList(riffSizePos);
+        segmentIndex.clear();
+    }
+};
@@ -0,0 +1,507 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define BAYER_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+#ifdef __GNUC__
+#define BAYER_TARGET(isa) __attribute__((target(isa)))
+#define BAYER_INLINE inline __attribute__((always_inline))
+#define BAYER_FLATTEN __attribute__((flatten))
+// The kernels are templates over the vector types below, flattened into one
+// function per instruction set that is compiled for that target. GCC notes
+// that the generic instantiations would pass AVX vectors differently; they
+// are never called that way.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpsabi"
+#else
+#define BAYER_TARGET(isa)
+#define BAYER_INLINE __forceinline
+#define BAYER_FLATTEN
+#endif
+
+// Demosaicing of RGGB Bayer frames (the colour camera's BayerRG8) to packed
+// BGR, for the offline converter.
+//
+// Bilinear averages the nearest samples of each missing colour. Edge-aware
+// interpolates green along whichever of the horizontal and vertical
+// directions has the smaller gradient (Hamilton-Adams, with the second-order
+// correction), then fills in red and blue from colour differences against
+// that green; it keeps edges sharp where bilinear leaves colour fringes.
+//
+// Both run as AVX2, SSSE3 or plain C++, picked at runtime, and all three
+// produce identical output. The frame border is handled by mirroring, which
+// keeps the colour pattern intact.
+namespace bayer
+{
+    enum class Method
+    {
+        Bilinear,
+        EdgeAware
+    };
+
+    enum class Isa
+    {
+        Scalar,
+        Ssse3,
+        Avx2
+    };
+
+    inline const char* methodName(Method method)
+    {
+        return method == Method::Bilinear ? "bilinear" : "edge";
+    }
+
+    inline bool parseMethod(const std::string& name, Method& method)
+    {
+        if (name == "bilinear") method = Method::Bilinear;
+        else if (name == "edge") method = Method::EdgeAware;
+        else return false;
+        return true;
+    }
+
+    inline const char* isaName(Isa isa)
+    {
+        switch (isa) {
+        case Isa::Scalar: return "scalar";
+        case Isa::Ssse3: return "SSSE3";
+        case Isa::Avx2: return "AVX2";
+        }
+        return "unknown";
+    }
+}
+
+namespace bayer_detail
+{
+    inline int avg(int a, int b) { return (a + b + 1) >> 1; }
+    inline int clamp8(int v) { return v < 0 ? 0 : (v > 255 ? 255 : v); }
+
+    // Reflect an out-of-range index about the edge; an even distance keeps the Bayer phase
+    inline size_t mirror(ptrdiff_t i, size_t n)
+    {
+        ptrdiff_t last = static_cast<ptrdiff_t>(n) - 1;
+        if (i < 0) i = -i;
+        if (i > last) i = 2 * last - i;
+        return static_cast<size_t>(i < 0 ? 0 : (i > last ? last : i));
+    }
+
+    // Five source rows around the row being produced (mirrored at the top and bottom)
+    struct Rows
+    {
+        const uint8_t* uu;
+        const uint8_t* u;
+        const uint8_t* c;
+        const uint8_t* d;
+        const uint8_t* dd;
+    };
+
+    inline const uint8_t* row(const uint8_t* base, size_t stride, ptrdiff_t y, size_t height)
+    {
+        return base + mirror(y, height) * stride;
+    }
+
+    // One pixel of each kernel, with mirrored columns: the reference that the
+    // vector code matches exactly, and the path for the two columns at each edge.
+    struct Scalar
+    {
+        static void bilinear(const Rows& r, bool evenRow, size_t x, size_t width, uint8_t* out)
+        {
+            size_t xl = mirror(static_cast<ptrdiff_t>(x) - 1, width);
+            size_t xr = mirror(static_cast<ptrdiff_t>(x) + 1, width);
+            int C = r.c[x];
+            int h = avg(r.c[xl], r.c[xr]);
+            int v = avg(r.u[x], r.d[x]);
+            int cross = avg(h, v);
+            int diag = avg(avg(r.u[xl], r.u[xr]), avg(r.d[xl], r.d[xr]));
+
+            bool evenCol = (x & 1) == 0;
+            int red, green, blue;
+            if (evenRow) {
+                red = evenCol ? C : h;
+                green = evenCol ? cross : C;
+                blue = evenCol ? diag : v;
+            }
+            else {
+                red = evenCol ? v : diag;
+                green = evenCol ? C : cross;
+                blue = evenCol ? h : C;
+            }
+            out[3 * x] = static_cast<uint8_t>(blue);
+            out[3 * x + 1] = static_cast<uint8_t>(green);
+            out[3 * x + 2] = static_cast<uint8_t>(red);
+        }
+
+        static void green(const Rows& r, bool evenRow, size_t x, size_t width, uint8_t* g)
+        {
+            bool greenSite = ((x & 1) == 0) != evenRow;
+            if (greenSite) {
+                g[x] = r.c[x];
+                return;
+            }
+            size_t xl = mirror(static_cast<ptrdiff_t>(x) - 1, width);
+            size_t xr = mirror(static_cast<ptrdiff_t>(x) + 1, width);
+            size_t xl2 = mirror(static_cast<ptrdiff_t>(x) - 2, width);
+            size_t xr2 = mirror(static_cast<ptrdiff_t>(x) + 2, width);
+            int C = r.c[x];
+            int L = r.c[xl], R = r.c[xr], U = r.u[x], D = r.d[x];
+            int lapH = 2 * C - r.c[xl2] - r.c[xr2];
+            int lapV = 2 * C - r.uu[x] - r.dd[x];
+            int gradH = std::abs(L - R) + std::abs(lapH);
+            int gradV = std::abs(U - D) + std::abs(lapV);
+            int gh = (2 * (L + R) + lapH) >> 2;
+            int gv = (2 * (U + D) + lapV) >> 2;
+            int value = gradH < gradV ? gh : (gradV < gradH ? gv : (gh + gv) >> 1);
+            g[x] = static_cast<uint8_t>(clamp8(value));
+        }
+
+        static void redBlue(const Rows& r, const Rows& g, bool evenRow, size_t x, size_t width, uint8_t* out)
+        {
+            size_t xl = mirror(static_cast<ptrdiff_t>(x) - 1, width);
+            size_t xr = mirror(static_cast<ptrdiff_t>(x) + 1, width);
+            int C = r.c[x];
+            int G = g.c[x];
+            int hd = ((r.c[xl] - g.c[xl]) + (r.c[xr] - g.c[xr])) >> 1;
+            int vd = ((r.u[x] - g.u[x]) + (r.d[x] - g.d[x])) >> 1;
+            int dd = ((r.u[xl] - g.u[xl]) + (r.u[xr] - g.u[xr]) + (r.d[xl] - g.d[xl]) + (r.d[xr] - g.d[xr])) >> 2;
+
+            bool evenCol = (x & 1) == 0;
+            int red, blue;
+            if (evenRow) {
+                red = evenCol ? C : G + hd;
+                blue = evenCol ? G + dd : G + vd;
+            }
+            else {
+                red = evenCol ? G + vd : G + dd;
+                blue = evenCol ? G + hd : C;
+            }
+            out[3 * x] = static_cast<uint8_t>(clamp8(blue));
+            out[3 * x + 1] = static_cast<uint8_t>(G);
+            out[3 * x + 2] = static_cast<uint8_t>(clamp8(red));
+        }
+    };
+
+#ifdef BAYER_X86
+    // 8 pixels per vector, widened to 16 bits so differences and sums don't overflow
+    struct Ssse3
+    {
+        typedef __m128i V;
+        static const size_t N = 8;
+
+        BAYER_TARGET("ssse3") static inline V load(const uint8_t* p) { return _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p)), _mm_setzero_si128()); }
+        BAYER_TARGET("ssse3") static inline V add(V a, V b) { return _mm_add_epi16(a, b); }
+        BAYER_TARGET("ssse3") static inline V sub(V a, V b) { return _mm_sub_epi16(a, b); }
+        BAYER_TARGET("ssse3") static inline V half(V a) { return _mm_srai_epi16(a, 1); }
+        BAYER_TARGET("ssse3") static inline V quarter(V a) { return _mm_srai_epi16(a, 2); }
+        BAYER_TARGET("ssse3") static inline V avg(V a, V b) { return _mm_avg_epu16(a, b); }
+        BAYER_TARGET("ssse3") static inline V abs(V a) { return _mm_abs_epi16(a); }
+        BAYER_TARGET("ssse3") static inline V less(V a, V b) { return _mm_cmplt_epi16(a, b); }
+        BAYER_TARGET("ssse3") static inline V select(V mask, V a, V b) { return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b)); }
+        BAYER_TARGET("ssse3") static inline V evenLanes() { return _mm_set_epi16(0, -1, 0, -1, 0, -1, 0, -1); }
+
+        BAYER_TARGET("ssse3") static inline void store(uint8_t* p, V a)
+        {
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(p), _mm_packus_epi16(a, a));
+        }
+
+        // Interleave three planes of 8 pixels into 24 bytes of BGR
+        BAYER_TARGET("ssse3") static inline void store3(uint8_t* p, V b, V g, V r)
+        {
+            __m128i bg = _mm_packus_epi16(b, g);  // b0..b7 g0..g7
+            __m128i rr = _mm_packus_epi16(r, r);  // r0..r7 r0..r7
+            __m128i lo = _mm_or_si128(
+                _mm_shuffle_epi8(bg, _mm_setr_epi8(0, 8, -1, 1, 9, -1, 2, 10, -1, 3, 11, -1, 4, 12, -1, 5)),
+                _mm_shuffle_epi8(rr, _mm_setr_epi8(-1, -1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1)));
+            __m128i hi = _mm_or_si128(
+                _mm_shuffle_epi8(bg, _mm_setr_epi8(13, -1, 6, 14, -1, 7, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1)),
+                _mm_shuffle_epi8(rr, _mm_setr_epi8(-1, 5, -1, -1, 6, -1, -1, 7, -1, -1, -1, -1, -1, -1, -1, -1)));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(p), lo);
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(p + 16), hi);
+        }
+    };
+
+    // 16 pixels per vector
+    struct Avx2
+    {
+        typedef __m256i V;
+        static const size_t N = 16;
+
+        BAYER_TARGET("avx2") static inline V load(const uint8_t* p) { return _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p))); }
+        BAYER_TARGET("avx2") static inline V add(V a, V b) { return _mm256_add_epi16(a, b); }
+        BAYER_TARGET("avx2") static inline V sub(V a, V b) { return _mm256_sub_epi16(a, b); }
+        BAYER_TARGET("avx2") static inline V half(V a) { return _mm256_srai_epi16(a, 1); }
+        BAYER_TARGET("avx2") static inline V quarter(V a) { return _mm256_srai_epi16(a, 2); }
+        BAYER_TARGET("avx2") static inline V avg(V a, V b) { return _mm256_avg_epu16(a, b); }
+        BAYER_TARGET("avx2") static inline V abs(V a) { return _mm256_abs_epi16(a); }
+        BAYER_TARGET("avx2") static inline V less(V a, V b) { return _mm256_cmpgt_epi16(b, a); }
+        BAYER_TARGET("avx2") static inline V select(V mask, V a, V b) { return _mm256_blendv_epi8(b, a, mask); }
+        BAYER_TARGET("avx2") static inline V evenLanes() { return _mm256_set_epi16(0, -1, 0, -1, 0, -1, 0, -1, 0, -1, 0, -1, 0, -1, 0, -1); }
+
+        BAYER_TARGET("avx2") static inline void store(uint8_t* p, V a)
+        {
+            // packus works within each 128-bit half; put the halves back in order
+            __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(a, a), 0x08);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(p), _mm256_castsi256_si128(packed));
+        }
+
+        BAYER_TARGET("avx2") static inline void store3(uint8_t* p, V b, V g, V r)
+        {
+            Ssse3::store3(p, _mm256_castsi256_si128(b), _mm256_castsi256_si128(g), _mm256_castsi256_si128(r));
+            Ssse3::store3(p + 24, _mm256_extracti128_si256(b, 1), _mm256_extracti128_si256(g, 1), _mm256_extracti128_si256(r, 1));
+        }
+    };
+#endif
+
+    // Vector kernels: T::N pixels from column x, which must be even and at
+    // least 2 away from either edge. Same arithmetic as Scalar, lane by lane.
+    template <class T>
+    BAYER_INLINE void bilinearSpan(const Rows& r, bool evenRow, size_t x, uint8_t* out)
+    {
+        typedef typename T::V V;
+        V C = T::load(r.c + x);
+        V h = T::avg(T::load(r.c + x - 1), T::load(r.c + x + 1));
+        V v = T::avg(T::load(r.u + x), T::load(r.d + x));
+        V cross = T::avg(h, v);
+        V diag = T::avg(T::avg(T::load(r.u + x - 1), T::load(r.u + x + 1)),
+            T::avg(T::load(r.d + x - 1), T::load(r.d + x + 1)));
+
+        V even = T::evenLanes();
+        if (evenRow) {
+            T::store3(out + 3 * x, T::select(even, diag, v), T::select(even, cross, C), T::select(even, C, h));
+        }
+        else {
+            T::store3(out + 3 * x, T::select(even, h, C), T::select(even, C, cross), T::select(even, v, diag));
+        }
+    }
+
+    template <class T>
+    BAYER_INLINE void greenSpan(const Rows& r, bool evenRow, size_t x, uint8_t* g)
+    {
+        typedef typename T::V V;
+        V C = T::load(r.c + x);
+        V L = T::load(r.c + x - 1);
+        V R = T::load(r.c + x + 1);
+        V U = T::load(r.u + x);
+        V D = T::load(r.d + x);
+        V twoC = T::add(C, C);
+        V lapH = T::sub(T::sub(twoC, T::load(r.c + x - 2)), T::load(r.c + x + 2));
+        V lapV = T::sub(T::sub(twoC, T::load(r.uu + x)), T::load(r.dd + x));
+        V gradH = T::add(T::abs(T::sub(L, R)), T::abs(lapH));
+        V gradV = T::add(T::abs(T::sub(U, D)), T::abs(lapV));
+        V LR = T::add(L, R);
+        V UD = T::add(U, D);
+        V gh = T::quarter(T::add(T::add(LR, LR), lapH));
+        V gv = T::quarter(T::add(T::add(UD, UD), lapV));
+        V value = T::select(T::less(gradH, gradV), gh,
+            T::select(T::less(gradV, gradH), gv, T::half(T::add(gh, gv))));
+
+        // Green sites keep their sample: odd columns on even rows, even columns on odd rows
+        V even = T::evenLanes();
+        T::store(g + x, evenRow ? T::select(even, value, C) : T::select(even, C, value));
+    }
+
+    template <class T>
+    BAYER_INLINE void redBlueSpan(const Rows& r, const Rows& g, bool evenRow, size_t x, uint8_t* out)
+    {
+        typedef typename T::V V;
+        V C = T::load(r.c + x);
+        V G = T::load(g.c + x);
+        V hd = T::half(T::add(T::sub(T::load(r.c + x - 1), T::load(g.c + x - 1)),
+            T::sub(T::load(r.c + x + 1), T::load(g.c + x + 1))));
+        V vd = T::half(T::add(T::sub(T::load(r.u + x), T::load(g.u + x)),
+            T::sub(T::load(r.d + x), T::load(g.d + x))));
+        V dd = T::quarter(T::add(
+            T::add(T::sub(T::load(r.u + x - 1), T::load(g.u + x - 1)), T::sub(T::load(r.u + x + 1), T::load(g.u + x + 1))),
+            T::add(T::sub(T::load(r.d + x - 1), T::load(g.d + x - 1)), T::sub(T::load(r.d + x + 1), T::load(g.d + x + 1)))));
+
+        V even = T::evenLanes();
+        if (evenRow) {
+            T::store3(out + 3 * x, T::select(even, T::add(G, dd), T::add(G, vd)), G, T::select(even, C, T::add(G, hd)));
+        }
+        else {
+            T::store3(out + 3 * x, T::select(even, T::add(G, hd), C), G, T::select(even, T::add(G, vd), T::add(G, dd)));
+        }
+    }
+
+    // Columns [2, end) go through the vector kernel; the rest, one pixel at a time
+    template <class T>
+    size_t vectorEnd(size_t width)
+    {
+        if constexpr (T::N == 0) {
+            return 2;
+        }
+        else {
+            return width < T::N + 4 ? 2 : 2 + (width - 4) / T::N * T::N;
+        }
+    }
+
+    template <class T>
+    BAYER_INLINE void demosaicFrame(const uint8_t* src, size_t srcStride, uint8_t* dst, size_t dstStride,
+        size_t width, size_t height, bayer::Method method)
+    {
+        size_t end = vectorEnd<T>(width);
+        auto rowsAt = [&](const uint8_t* base, size_t stride, ptrdiff_t y) {
+            Rows rows = { row(base, stride, y - 2, height), row(base, stride, y - 1, height), row(base, stride, y, height),
+                row(base, stride, y + 1, height), row(base, stride, y + 2, height) };
+            return rows;
+        };
+
+        if (method == bayer::Method::Bilinear) {
+            for (size_t y = 0; y < height; ++y) {
+                Rows r = rowsAt(src, srcStride, static_cast<ptrdiff_t>(y));
+                bool evenRow = (y & 1) == 0;
+                uint8_t* out = dst + y * dstStride;
+                for (size_t x = 0; x < width; x = x == 1 ? end : x + 1) {
+                    Scalar::bilinear(r, evenRow, x, width, out);
+                }
+                if constexpr (T::N > 0) {
+                    for (size_t x = 2; x < end; x += T::N) {
+                        bilinearSpan<T>(r, evenRow, x, out);
+                    }
+                }
+            }
+            return;
+        }
+
+        // Edge-aware: the whole green plane first, since red and blue are
+        // interpolated from colour differences against the green around them
+        thread_local std::vector<uint8_t> greenPlane;
+        greenPlane.resize(width * height);
+        for (size_t y = 0; y < height; ++y) {
+            Rows r = rowsAt(src, srcStride, static_cast<ptrdiff_t>(y));
+            bool evenRow = (y & 1) == 0;
+            uint8_t* g = greenPlane.data() + y * width;
+            for (size_t x = 0; x < width; x = x == 1 ? end : x + 1) {
+                Scalar::green(r, evenRow, x, width, g);
+            }
+            if constexpr (T::N > 0) {
+                for (size_t x = 2; x < end; x += T::N) {
+                    greenSpan<T>(r, evenRow, x, g);
+                }
+            }
+        }
+        for (size_t y = 0; y < height; ++y) {
+            Rows r = rowsAt(src, srcStride, static_cast<ptrdiff_t>(y));
+            Rows g = rowsAt(greenPlane.data(), width, static_cast<ptrdiff_t>(y));
+            bool evenRow = (y & 1) == 0;
+            uint8_t* out = dst + y * dstStride;
+            for (size_t x = 0; x < width; x = x == 1 ? end : x + 1) {
+                Scalar::redBlue(r, g, evenRow, x, width, out);
+            }
+            if constexpr (T::N > 0) {
+                for (size_t x = 2; x < end; x += T::N) {
+                    redBlueSpan<T>(r, g, evenRow, x, out);
+                }
+            }
+        }
+    }
+
+    struct NoVector
+    {
+        typedef int V;
+        static const size_t N = 0;
+    };
+
+    inline void runScalar(const uint8_t* src, size_t srcStride, uint8_t* dst, size_t dstStride,
+        size_t width, size_t height, bayer::Method method)
+    {
+        demosaicFrame<NoVector>(src, srcStride, dst, dstStride, width, height, method);
+    }
+
+#ifdef BAYER_X86
+    BAYER_TARGET("ssse3") BAYER_FLATTEN
+    inline void runSsse3(const uint8_t* src, size_t srcStride, uint8_t* dst, size_t dstStride,
+        size_t width, size_t height, bayer::Method method)
+    {
+        demosaicFrame<Ssse3>(src, srcStride, dst, dstStride, width, height, method);
+    }
+
+    BAYER_TARGET("avx2") BAYER_FLATTEN
+    inline void runAvx2(const uint8_t* src, size_t srcStride, uint8_t* dst, size_t dstStride,
+        size_t width, size_t height, bayer::Method method)
+    {
+        demosaicFrame<Avx2>(src, srcStride, dst, dstStride, width, height, method);
+    }
+
+    inline bayer::Isa detectIsa()
+    {
+#ifdef _MSC_VER
+        int info[4];
+        __cpuid(info, 1);
+        bool ssse3 = (info[2] & (1 << 9)) != 0;
+        bool osAvx = (info[2] & (1 << 27)) != 0 && (info[2] & (1 << 28)) != 0 && (_xgetbv(0) & 6) == 6;
+        __cpuidex(info, 7, 0);
+        bool avx2 = osAvx && (info[1] & (1 << 5)) != 0;
+#else
+        unsigned eax, ebx, ecx, edx;
+        if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+            return bayer::Isa::Scalar;
+        }
+        bool ssse3 = (ecx & bit_SSSE3) != 0;
+        bool osAvx = false;
+        if ((ecx & bit_OSXSAVE) && (ecx & bit_AVX)) {
+            unsigned xcr0Low, xcr0High;
+            __asm__("xgetbv" : "=a"(xcr0Low), "=d"(xcr0High) : "c"(0));
+            osAvx = (xcr0Low & 6) == 6;
+        }
+        bool avx2 = osAvx && __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) && (ebx & bit_AVX2) != 0;
+#endif
+        return avx2 ? bayer::Isa::Avx2 : (ssse3 ? bayer::Isa::Ssse3 : bayer::Isa::Scalar);
+    }
+#endif
+}
+
+namespace bayer
+{
+    // Fastest instruction set this CPU supports
+    inline Isa bestIsa()
+    {
+#ifdef BAYER_X86
+        static const Isa isa = bayer_detail::detectIsa();
+        return isa;
+#else
+        return Isa::Scalar;
+#endif
+    }
+
+    // RGGB mosaic (one byte per pixel) to packed BGR, three bytes per pixel.
+    // Strides are in bytes. An isa the CPU lacks falls back to the best one it has.
+    inline void demosaicRGGB(const uint8_t* src, size_t srcStride, uint8_t* bgr, size_t bgrStride,
+        size_t width, size_t height, Method method, Isa isa = bestIsa())
+    {
+        if (width == 0 || height == 0) {
+            return;
+        }
+        if (static_cast<int>(isa) > static_cast<int>(bestIsa())) {
+            isa = bestIsa();
+        }
+        switch (isa) {
+#ifdef BAYER_X86
+        case Isa::Avx2:
+            bayer_detail::runAvx2(src, srcStride, bgr, bgrStride, width, height, method);
+            return;
+        case Isa::Ssse3:
+            bayer_detail::runSsse3(src, srcStride, bgr, bgrStride, width, height, method);
+            return;
+#endif
+        default:
+            bayer_detail::runScalar(src, srcStride, bgr, bgrStride, width, height, method);
+            return;
+        }
+    }
+}
+
+#ifdef __GNUC__
+#pragma GCC diagnostic pop
+#endif
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include "MappedFile.h"
+
+// A BMP file mapped into memory, its pixels used where they lie. BMP is a
+// header and uncompressed rows, so there is nothing to decode: parsing the
+// header is all a full image decoder would add, apart from a copy.
+//
+// Handles what cameras and OpenCV write: uncompressed 8-bit greyscale, 24-bit
+// BGR and 32-bit BGRA, stored bottom-up (the usual way) or top-down. Anything
+// else (RLE, bit fields, 1/4/16-bit, colour palettes) is refused with a
+// reason, for the caller to hand to a general decoder instead.
+//
+// Rows are kept 4-byte aligned, so stride() can be more than width() *
+// channels(). storedRow(0) is the first row in the file: the bottom of the
+// picture when bottomUp().
+class BmpImage
+{
+public:
+    // Throws std::runtime_error if the file can't be mapped; check valid()
+    // for whether it could be parsed
+    explicit BmpImage(const std::string& filePath)
+        : file(filePath)
+    {
+        parse();
+    }
+
+    bool valid() const { return problem.empty(); }
+    const std::string& error() const { return problem; }
+
+    int width() const { return imageWidth; }
+    int height() const { return imageHeight; }
+    int channels() const { return imageChannels; }
+    size_t stride() const { return rowBytes; }
+    bool bottomUp() const { return storedBottomUp; }
+    uint64_t fileBytes() const { return file.size(); }
+
+    const uint8_t* storedRow(size_t row) const { return pixels + row * rowBytes; }
+
+    // Row y from the top of the picture
+    const uint8_t* row(size_t y) const
+    {
+        return storedRow(storedBottomUp ? static_cast<size_t>(imageHeight) - 1 - y : y);
+    }
+
+private:
+    static const uint32_t FILE_HEADER_BYTES = 14;
+    static const uint32_t INFO_HEADER_BYTES = 40;  // BITMAPINFOHEADER; V4 and V5 headers extend it
+    static const uint32_t BI_RGB = 0;
+
+    MappedFile file;
+    const uint8_t* pixels = nullptr;
+    int imageWidth = 0;
+    int imageHeight = 0;
+    int imageChannels = 0;
+    size_t rowBytes = 0;
+    bool storedBottomUp = true;
+    std::string problem;
+
+    static uint32_t get32(const uint8_t* p) { return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24); }
+    static uint16_t get16(const uint8_t* p) { return static_cast<uint16_t>(p[0] | (p[1] << 8)); }
+
+    void parse()
+    {
+        const uint8_t* base = reinterpret_cast<const uint8_t*>(file.data());
+        uint64_t size = file.size();
+        if (size < FILE_HEADER_BYTES + INFO_HEADER_BYTES || base[0] != 'B' || base[1] != 'M') {
+            problem = "not a BMP file";
+            return;
+        }
+
+        uint32_t pixelOffset = get32(base + 10);
+        const uint8_t* info = base + FILE_HEADER_BYTES;
+        uint32_t infoBytes = get32(info);
+        int32_t width = static_cast<int32_t>(get32(info + 4));
+        int32_t height = static_cast<int32_t>(get32(info + 8));
+        uint16_t planes = get16(info + 12);
+        uint16_t bitCount = get16(info + 14);
+        uint32_t compression = get32(info + 16);
+        uint32_t coloursUsed = get32(info + 32);
+
+        if (infoBytes < INFO_HEADER_BYTES || planes != 1) {
+            problem = "unsupported BMP header";
+            return;
+        }
+        if (compression != BI_RGB) {
+            problem = "compressed BMP";
+            return;
+        }
+        if (bitCount != 8 && bitCount != 24 && bitCount != 32) {
+            problem = std::to_string(bitCount) + "-bit BMP";
+            return;
+        }
+        if (width <= 0 || height == 0 || height == INT32_MIN) {
+            problem = "bad BMP dimensions";
+            return;
+        }
+
+        if (bitCount == 8) {
+            // The palette follows the header; only a grey ramp means the values are the pixels
+            uint32_t entries = coloursUsed == 0 ? 256 : coloursUsed;
+            uint64_t paletteStart = FILE_HEADER_BYTES + static_cast<uint64_t>(infoBytes);
+            if (entries > 256 || paletteStart + entries * 4 > size) {
+                problem = "bad BMP palette";
+                return;
+            }
+            const uint8_t* palette = base + paletteStart;
+            for (uint32_t i = 0; i < entries; ++i) {
+                const uint8_t* entry = palette + i * 4;  // Blue, green, red, reserved
+                if (entry[0] != i || entry[1] != i || entry[2] != i) {
+                    problem = "colour palette";
+                    return;
+                }
+            }
+        }
+
+        storedBottomUp = height > 0;
+        imageWidth = width;
+        imageHeight = height > 0 ? height : -height;
+        imageChannels = bitCount / 8;
+        rowBytes = (static_cast<size_t>(width) * bitCount + 31) / 32 * 4;
+        if (pixelOffset > size || rowBytes * imageHeight > size - pixelOffset) {
+            problem = "BMP file is truncated";
+            return;
+        }
+        pixels = base + pixelOffset;
+    }
+};
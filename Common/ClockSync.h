@@ -0,0 +1,341 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "Crc32c.h"
+#include "FileSink.h"
+#include "FrameSource.h"
+#include "FrameTable.h"
+
+// Camera clock to host clock synchronisation (_clock_sync.camclock), and
+// lookups from frame ID to host time and back.
+//
+// Every few seconds the recorder latches the camera's timestamp counter and
+// reads both host clocks either side of the latch. A sync point pairs the
+// device time with the system clock (wall time, to line up with data from
+// other machines) and the steady clock (monotonic, to line up with other
+// programs on the same PC). Between points the mapping is linear, so the
+// camera clock's drift is followed; beyond the first and last point the
+// nearest pair is extended.
+//
+//   FileHeader
+//   SyncPoint
+//   ...
+//
+// Every point carries its own CRC; a reader stops at the first bad one. The
+// device clock is assumed to run on through the session, which it does unless
+// the camera loses power. All fields are little-endian.
+namespace clocksync
+{
+    const char FILE_MAGIC[8] = { 'C', 'A', 'M', 'C', 'L', 'K', '0', '1' };
+    const uint32_t FORMAT_VERSION = 1;
+
+#pragma pack(push, 1)
+    struct FileHeader
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t crc;             // Over everything above
+    };
+
+    struct SyncPoint
+    {
+        uint64_t deviceTimestamp;  // Camera clock, ns: the clock of the frames' device timestamps
+        uint64_t systemTimestamp;  // Host system clock, ns since epoch
+        uint64_t steadyTimestamp;  // Host steady clock, ns
+        uint32_t uncertaintyNs;    // How long the latch took; the host times are the middle of it
+        uint32_t crc;              // Over everything above
+    };
+#pragma pack(pop)
+
+    template <typename T>
+    uint32_t structCrc(const T& value)
+    {
+        // Every struct ends with its own CRC field
+        return crc32c(&value, sizeof(T) - sizeof(uint32_t));
+    }
+
+    // Latches the source's clock between two readings of each host clock.
+    // False if the source has no clock to latch.
+    inline bool latch(FrameSource& source, SyncPoint& point)
+    {
+        using namespace std::chrono;
+        auto steadyBefore = steady_clock::now();
+        auto systemBefore = system_clock::now();
+        uint64_t deviceTimestamp = 0;
+        if (!source.latchTimestamp(deviceTimestamp)) {
+            return false;
+        }
+        auto systemAfter = system_clock::now();
+        auto steadyAfter = steady_clock::now();
+
+        point = SyncPoint();
+        point.deviceTimestamp = deviceTimestamp;
+        point.systemTimestamp = static_cast<uint64_t>(
+            duration_cast<nanoseconds>((systemBefore + (systemAfter - systemBefore) / 2).time_since_epoch()).count());
+        point.steadyTimestamp = static_cast<uint64_t>(
+            duration_cast<nanoseconds>((steadyBefore + (steadyAfter - steadyBefore) / 2).time_since_epoch()).count());
+        int64_t took = duration_cast<nanoseconds>(steadyAfter - steadyBefore).count();
+        point.uncertaintyNs = static_cast<uint32_t>(std::min<int64_t>(took, UINT32_MAX));
+        return true;
+    }
+
+    // Appends sync points to a FileSink, flushing each one. Call from one thread only.
+    class Writer
+    {
+    public:
+        explicit Writer(FileSink& sink)
+            : sink(sink)
+        {
+            FileHeader header = {};
+            memcpy(header.magic, FILE_MAGIC, sizeof(header.magic));
+            header.version = FORMAT_VERSION;
+            header.crc = structCrc(header);
+            ok = sink.write(&header, sizeof(header)) && sink.flush();
+        }
+
+        bool append(SyncPoint point)
+        {
+            if (!ok) {
+                return false;
+            }
+            point.crc = structCrc(point);
+            ok = sink.write(&point, sizeof(point)) && sink.flush();
+            count += ok ? 1 : 0;
+            return ok;
+        }
+
+        uint64_t points() const { return count; }
+
+    private:
+        FileSink& sink;
+        uint64_t count = 0;
+        bool ok = true;
+    };
+
+    inline std::vector<SyncPoint> readSyncPoints(const std::string& filePath)
+    {
+        std::ifstream file(filePath, std::ios::in | std::ios::binary);
+        if (!file) {
+            throw std::runtime_error("Unable to open clock sync file: " + filePath);
+        }
+        std::vector<char> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+        FileHeader header = {};
+        if (bytes.size() < sizeof(header)) {
+            throw std::runtime_error("Not a clock sync file: " + filePath);
+        }
+        memcpy(&header, bytes.data(), sizeof(header));
+        if (memcmp(header.magic, FILE_MAGIC, sizeof(header.magic)) != 0 || header.crc != structCrc(header)) {
+            throw std::runtime_error("Not a clock sync file: " + filePath);
+        }
+        if (header.version > FORMAT_VERSION) {
+            throw std::runtime_error("Clock sync file was written by a newer version: " + filePath);
+        }
+
+        std::vector<SyncPoint> points;
+        for (size_t offset = sizeof(header); bytes.size() - offset >= sizeof(SyncPoint); offset += sizeof(SyncPoint)) {
+            SyncPoint point;
+            memcpy(&point, bytes.data() + offset, sizeof(point));
+            if (point.crc != structCrc(point)) {
+                break;
+            }
+            points.push_back(point);
+        }
+        return points;
+    }
+
+    enum class HostClock
+    {
+        System,  // ns since epoch
+        Steady   // ns on the recording PC's steady clock
+    };
+
+    // Piecewise-linear map between the device clock and one host clock
+    class ClockMap
+    {
+    public:
+        ClockMap(const std::vector<SyncPoint>& points, HostClock clock)
+        {
+            for (const SyncPoint& point : points) {
+                // Each segment needs both ends to move forward, or it has no slope
+                uint64_t host = clock == HostClock::System ? point.systemTimestamp : point.steadyTimestamp;
+                if (device.empty() || (point.deviceTimestamp > device.back() && host > this->host.back())) {
+                    device.push_back(point.deviceTimestamp);
+                    this->host.push_back(host);
+                }
+            }
+        }
+
+        bool empty() const { return device.empty(); }
+        uint64_t toHost(uint64_t deviceTimestamp) const { size_t segment = 0; return interpolate(device, host, deviceTimestamp, segment); }
+        uint64_t toDevice(uint64_t hostTimestamp) const { size_t segment = 0; return interpolate(host, device, hostTimestamp, segment); }
+
+        // For runs of nearby times: segment is where the last one was found, and is tried first
+        uint64_t toHost(uint64_t deviceTimestamp, size_t& segment) const { return interpolate(device, host, deviceTimestamp, segment); }
+
+    private:
+        std::vector<uint64_t> device;
+        std::vector<uint64_t> host;
+
+        // Times before either clock's zero come out as 0
+        static uint64_t interpolate(const std::vector<uint64_t>& from, const std::vector<uint64_t>& to, uint64_t x,
+            size_t& segment)
+        {
+            int64_t result;
+            if (from.size() == 1) {
+                result = static_cast<int64_t>(to[0]) + static_cast<int64_t>(x - from[0]);  // Offset only
+            }
+            else {
+                // The segment around x, or the first / last one when x lies outside them all
+                size_t i = segment;
+                bool inSegment = i >= 1 && i < from.size() && (i == 1 || from[i - 1] <= x) &&
+                    (i == from.size() - 1 || x < from[i]);
+                if (!inSegment) {
+                    i = static_cast<size_t>(std::upper_bound(from.begin(), from.end(), x) - from.begin());
+                    i = std::min(std::max(i, size_t(1)), from.size() - 1);
+                    segment = i;
+                }
+                double slope = double(to[i] - to[i - 1]) / double(from[i] - from[i - 1]);
+                double offset = double(static_cast<int64_t>(x - from[i - 1])) * slope;
+                result = static_cast<int64_t>(to[i - 1]) + std::llround(offset);
+            }
+            return result > 0 ? static_cast<uint64_t>(result) : 0;
+        }
+    };
+
+    // A session's frames on a host clock. Frame IDs and times are looked up by
+    // binary search over columns held in memory, so millions of lookups take
+    // milliseconds.
+    //
+    // With sync points, a frame's host time is its device timestamp mapped
+    // through them: when the camera took it. Without (an older session, or a
+    // source that can't latch) it is when the host received the frame, which
+    // also includes the transfer and driver delay.
+    class FrameTimeline
+    {
+    public:
+        FrameTimeline(const frametable::Reader& table, const std::vector<SyncPoint>& points,
+            HostClock clock = HostClock::System)
+            : ids(table.column(frametable::FrameID)),
+            deviceTimes(table.column(frametable::DeviceTimestamp)),
+            receivedTimes(table.column(clock == HostClock::System ? frametable::HostTimestamp : frametable::SteadyTimestamp)),
+            clockMap(points, clock)
+        {
+            // IDs restart if the camera was reset mid-session; search a sorted order of rows then
+            if (!std::is_sorted(ids.begin(), ids.end())) {
+                byID.resize(ids.size());
+                for (size_t i = 0; i < byID.size(); ++i) {
+                    byID[i] = i;
+                }
+                std::stable_sort(byID.begin(), byID.end(), [this](size_t a, size_t b) { return ids[a] < ids[b]; });
+            }
+        }
+
+        size_t frames() const { return ids.size(); }
+        bool synchronised() const { return !clockMap.empty(); }
+
+        uint64_t frameID(size_t row) const { return ids[row]; }
+        uint64_t hostTime(size_t row) const
+        {
+            return clockMap.empty() ? receivedTimes[row] : clockMap.toHost(deviceTimes[row]);
+        }
+
+        // Row of frame `id` in the table (its position in the recording); the
+        // first one if the ID occurs more than once
+        bool findFrame(uint64_t id, size_t& row) const
+        {
+            if (byID.empty()) {
+                auto it = std::lower_bound(ids.begin(), ids.end(), id);
+                if (it == ids.end() || *it != id) {
+                    return false;
+                }
+                row = static_cast<size_t>(it - ids.begin());
+                return true;
+            }
+            auto it = std::lower_bound(byID.begin(), byID.end(), id, [this](size_t r, uint64_t value) { return ids[r] < value; });
+            if (it == byID.end() || ids[*it] != id) {
+                return false;
+            }
+            row = *it;
+            return true;
+        }
+
+        // Host time of frame `id`
+        bool hostTimeOf(uint64_t id, uint64_t& hostTimestamp) const
+        {
+            size_t row;
+            if (!findFrame(id, row)) {
+                return false;
+            }
+            hostTimestamp = hostTime(row);
+            return true;
+        }
+
+        // Host times of many frames, 0 for an ID that isn't in the table. IDs
+        // given in increasing order are found by stepping forward from the
+        // previous one instead of searching the whole table each time.
+        std::vector<uint64_t> hostTimesOf(const std::vector<uint64_t>& frameIDs) const
+        {
+            std::vector<uint64_t> times(frameIDs.size(), 0);
+            size_t segment = 0;
+            size_t row = 0;
+            bool havePrevious = false;
+            for (size_t i = 0; i < frameIDs.size(); ++i) {
+                uint64_t id = frameIDs[i];
+                bool found;
+                if (byID.empty() && havePrevious && ids[row] <= id) {
+                    // Gallop: widen the step until it passes id, then search the last stretch
+                    size_t low = row;
+                    size_t step = 1;
+                    while (low + step < ids.size() && ids[low + step] < id) {
+                        low += step;
+                        step *= 2;
+                    }
+                    size_t high = std::min(low + step + 1, ids.size());
+                    row = static_cast<size_t>(std::lower_bound(ids.begin() + low, ids.begin() + high, id) - ids.begin());
+                    found = row < ids.size() && ids[row] == id;
+                    if (row == ids.size()) {
+                        row = ids.size() - 1;
+                    }
+                }
+                else {
+                    found = findFrame(id, row);
+                }
+                if (found) {
+                    times[i] = clockMap.empty() ? receivedTimes[row] : clockMap.toHost(deviceTimes[row], segment);
+                    havePrevious = true;
+                }
+            }
+            return times;
+        }
+
+        // Row of the last frame taken at or before hostTimestamp; false if it precedes them all
+        bool frameAt(uint64_t hostTimestamp, size_t& row) const
+        {
+            const std::vector<uint64_t>& times = clockMap.empty() ? receivedTimes : deviceTimes;
+            uint64_t t = clockMap.empty() ? hostTimestamp : clockMap.toDevice(hostTimestamp);
+            auto it = std::upper_bound(times.begin(), times.end(), t);
+            if (it == times.begin()) {
+                return false;
+            }
+            row = static_cast<size_t>(it - times.begin()) - 1;
+            return true;
+        }
+
+    private:
+        std::vector<uint64_t> ids;
+        std::vector<uint64_t> deviceTimes;
+        std::vector<uint64_t> receivedTimes;
+        std::vector<size_t> byID;  // Rows sorted by ID, when the rows themselves aren't
+        ClockMap clockMap;
+    };
+}
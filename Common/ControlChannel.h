@@ -0,0 +1,519 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <cerrno>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+// A command the control channel acted on, kept for the session metadata
+struct ControlEvent
+{
+    std::string command;        // "stop", "pause", "resume" or "mark"
+    std::string label;          // Text given after "mark"
+    std::string source;         // "socket", "pipe" or "signal file"
+    uint64_t hostTimestamp = 0; // ns since epoch, the same clock as FrameSlot::hostTimestamp
+};
+
+// Remote control of a recording session, served from a background thread.
+//
+// Commands are lines of text sent to a local endpoint: a Unix domain socket
+// on Linux, a named pipe on Windows.
+//
+//     stop            end the session
+//     pause           keep acquiring but stop writing frames
+//     resume          start writing again
+//     mark [label]    note an event at the current host time
+//
+// Every line gets a one-line reply, "ok <command>" or "error <reason>". A stop
+// is answered once the capture loop has seen it, which is within one frame
+// period; if that takes over a second the reply is "ok stop pending".
+//
+// The startup program's stop_camera_<rig>.signal file still works. Its
+// directory is watched (inotify / ReadDirectoryChangesW) so the file is
+// noticed the moment it appears.
+//
+// The capture loop only ever reads stopRequested() and paused(), each a
+// single atomic load.
+class ControlChannel
+{
+public:
+    // endpoint: socket path or pipe name, empty for none
+    ControlChannel(const std::string& endpoint, const std::string& signalDirectory, const std::string& signalName)
+        : endpoint(endpoint), signalDirectory(signalDirectory),
+        signalPath((std::filesystem::path(signalDirectory) / signalName).string())
+    {
+        open();
+        worker = std::thread(&ControlChannel::serve, this);
+    }
+
+    ~ControlChannel()
+    {
+        shutdown();
+        worker.join();
+        closeAll();
+    }
+
+    ControlChannel(const ControlChannel&) = delete;
+    ControlChannel& operator=(const ControlChannel&) = delete;
+
+    static std::string defaultEndpoint(const std::string& rig)
+    {
+#ifdef _WIN32
+        return "\\\\.\\pipe\\camera_rig_" + rig;
+#else
+        return "/tmp/camera_rig_" + rig + ".sock";
+#endif
+    }
+
+    // Capture thread
+    bool stopRequested() const { return stopFlag.load(std::memory_order_acquire); }
+    bool paused() const { return pauseFlag.load(std::memory_order_relaxed); }
+
+    // Capture thread: it has seen the stop and is winding down
+    void acknowledgeStop()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopSeen = true;
+        stopAcknowledged.notify_all();
+    }
+
+    // Empty if the endpoint couldn't be opened
+    const std::string& listeningOn() const { return listening; }
+
+    std::vector<ControlEvent> events()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        return history;
+    }
+
+private:
+    std::string endpoint;
+    std::string signalDirectory;
+    std::string signalPath;
+    std::string listening;
+    std::thread worker;
+
+    std::atomic<bool> stopFlag{ false };
+    std::atomic<bool> pauseFlag{ false };
+
+    std::mutex lock;
+    std::condition_variable stopAcknowledged;
+    bool stopSeen = false;
+    std::vector<ControlEvent> history;
+
+    const std::chrono::seconds STOP_ACK_TIMEOUT{ 1 };
+
+    // Runs one command line and returns the reply (without the newline)
+    std::string handleCommand(const std::string& line, const char* source)
+    {
+        size_t begin = line.find_first_not_of(" \t");
+        if (begin == std::string::npos) {
+            return "error empty command";
+        }
+        size_t end = line.find_first_of(" \t", begin);
+        std::string command = line.substr(begin, end == std::string::npos ? std::string::npos : end - begin);
+        std::string label;
+        if (end != std::string::npos) {
+            size_t labelBegin = line.find_first_not_of(" \t", end);
+            if (labelBegin != std::string::npos) {
+                label = line.substr(labelBegin, line.find_last_not_of(" \t") + 1 - labelBegin);
+            }
+        }
+
+        if (command == "stop") {
+            requestStop(source);
+            std::unique_lock<std::mutex> guard(lock);
+            bool seen = stopAcknowledged.wait_for(guard, STOP_ACK_TIMEOUT, [&] { return stopSeen; });
+            return seen ? "ok stop" : "ok stop pending";
+        }
+        if (command == "pause" || command == "resume") {
+            pauseFlag.store(command == "pause", std::memory_order_relaxed);
+            record(command, "", source);
+            return "ok " + command;
+        }
+        if (command == "mark") {
+            record(command, label, source);
+            return "ok mark";
+        }
+        return "error unknown command: " + command;
+    }
+
+    void requestStop(const char* source)
+    {
+        if (!stopFlag.exchange(true, std::memory_order_acq_rel)) {
+            record("stop", "", source);
+        }
+    }
+
+    void record(const std::string& command, const std::string& label, const char* source)
+    {
+        ControlEvent event;
+        event.command = command;
+        event.label = label;
+        event.source = source;
+        event.hostTimestamp = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count());
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            history.push_back(event);
+        }
+        std::cout << "Control: " << command << (label.empty() ? "" : " \"" + label + "\"")
+            << " (" << source << ")" << std::endl;
+    }
+
+    void checkSignalFile()
+    {
+        std::error_code error;
+        if (std::filesystem::exists(signalPath, error)) {
+            requestStop("signal file");
+        }
+    }
+
+    // Feeds received bytes through and replies to each complete line
+    template <typename Reply>
+    void consume(std::string& pending, const char* data, size_t bytes, const char* source, Reply reply)
+    {
+        pending.append(data, bytes);
+        size_t newline;
+        while ((newline = pending.find('\n')) != std::string::npos) {
+            std::string line = pending.substr(0, newline);
+            pending.erase(0, newline + 1);
+            if (!line.empty() && line.back() == '\r') {
+                line.pop_back();
+            }
+            reply(handleCommand(line, source) + "\n");
+        }
+        if (pending.size() > 4096) {
+            pending.clear();  // Not a line-based client; drop it rather than grow without bound
+        }
+    }
+
+#ifdef _WIN32
+    HANDLE stopEvent = NULL;
+    HANDLE pipe = INVALID_HANDLE_VALUE;
+    HANDLE directory = INVALID_HANDLE_VALUE;
+    OVERLAPPED pipeIo = {};
+    OVERLAPPED directoryIo = {};
+    bool pipeConnected = false;
+    char pipeBuffer[512];
+    std::string pipePending;
+    DWORD directoryBuffer[1024];  // FILE_NOTIFY_INFORMATION records must be DWORD aligned
+
+    void open()
+    {
+        stopEvent = CreateEventA(NULL, TRUE, FALSE, NULL);
+        pipeIo.hEvent = CreateEventA(NULL, TRUE, FALSE, NULL);
+        directoryIo.hEvent = CreateEventA(NULL, TRUE, FALSE, NULL);
+
+        if (!endpoint.empty()) {
+            pipe = CreateNamedPipeA(endpoint.c_str(), PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED,
+                PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT, 1, 4096, 4096, 0, NULL);
+            if (pipe == INVALID_HANDLE_VALUE) {
+                std::cerr << "Warning: Could not create control pipe " << endpoint
+                    << " (error " << GetLastError() << ")" << std::endl;
+            }
+            else {
+                listening = endpoint;
+            }
+        }
+
+        directory = CreateFileA(signalDirectory.c_str(), FILE_LIST_DIRECTORY,
+            FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING,
+            FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, NULL);
+        if (directory == INVALID_HANDLE_VALUE) {
+            std::cerr << "Warning: Could not watch " << signalDirectory << " for the stop signal file" << std::endl;
+        }
+    }
+
+    void shutdown()
+    {
+        SetEvent(stopEvent);
+    }
+
+    void closeAll()
+    {
+        if (pipe != INVALID_HANDLE_VALUE) {
+            CancelIo(pipe);
+            CloseHandle(pipe);
+        }
+        if (directory != INVALID_HANDLE_VALUE) {
+            CancelIo(directory);
+            CloseHandle(directory);
+        }
+        CloseHandle(pipeIo.hEvent);
+        CloseHandle(directoryIo.hEvent);
+        CloseHandle(stopEvent);
+    }
+
+    // Starts waiting for a client; completion signals pipeIo.hEvent
+    void listenForClient()
+    {
+        pipeConnected = false;
+        pipePending.clear();
+        ResetEvent(pipeIo.hEvent);
+        if (!ConnectNamedPipe(pipe, &pipeIo)) {
+            DWORD error = GetLastError();
+            if (error == ERROR_PIPE_CONNECTED) {
+                SetEvent(pipeIo.hEvent);
+            }
+            else if (error != ERROR_IO_PENDING) {
+                std::cerr << "Warning: Control pipe failed (error " << error << ")" << std::endl;
+                CloseHandle(pipe);
+                pipe = INVALID_HANDLE_VALUE;
+            }
+        }
+    }
+
+    void readFromClient()
+    {
+        ResetEvent(pipeIo.hEvent);
+        if (!ReadFile(pipe, pipeBuffer, sizeof(pipeBuffer), NULL, &pipeIo) && GetLastError() != ERROR_IO_PENDING) {
+            DisconnectNamedPipe(pipe);
+            listenForClient();
+        }
+    }
+
+    void writeToClient(const std::string& reply)
+    {
+        OVERLAPPED io = {};
+        io.hEvent = CreateEventA(NULL, TRUE, FALSE, NULL);
+        DWORD written = 0;
+        if (WriteFile(pipe, reply.data(), static_cast<DWORD>(reply.size()), NULL, &io) || GetLastError() == ERROR_IO_PENDING) {
+            GetOverlappedResult(pipe, &io, &written, TRUE);
+        }
+        CloseHandle(io.hEvent);
+    }
+
+    void watchDirectory()
+    {
+        ResetEvent(directoryIo.hEvent);
+        if (!ReadDirectoryChangesW(directory, directoryBuffer, sizeof(directoryBuffer), FALSE,
+                FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_LAST_WRITE, NULL, &directoryIo, NULL)) {
+            CloseHandle(directory);
+            directory = INVALID_HANDLE_VALUE;
+        }
+    }
+
+    void serve()
+    {
+        if (pipe != INVALID_HANDLE_VALUE) {
+            listenForClient();
+        }
+        if (directory != INVALID_HANDLE_VALUE) {
+            watchDirectory();
+        }
+        checkSignalFile();  // Already there before the watch started
+
+        while (true) {
+            HANDLE handles[3] = { stopEvent };
+            DWORD count = 1;
+            DWORD pipeIndex = MAXDWORD;
+            DWORD directoryIndex = MAXDWORD;
+            if (pipe != INVALID_HANDLE_VALUE) {
+                pipeIndex = count;
+                handles[count++] = pipeIo.hEvent;
+            }
+            if (directory != INVALID_HANDLE_VALUE) {
+                directoryIndex = count;
+                handles[count++] = directoryIo.hEvent;
+            }
+
+            DWORD signalled = WaitForMultipleObjects(count, handles, FALSE, INFINITE) - WAIT_OBJECT_0;
+            if (signalled == 0 || signalled >= count) {
+                return;
+            }
+
+            if (signalled == pipeIndex) {
+                DWORD bytes = 0;
+                if (!pipeConnected) {
+                    pipeConnected = true;
+                    readFromClient();
+                }
+                else if (!GetOverlappedResult(pipe, &pipeIo, &bytes, FALSE)) {
+                    DisconnectNamedPipe(pipe);  // Client went away
+                    listenForClient();
+                }
+                else {
+                    consume(pipePending, pipeBuffer, bytes, "pipe",
+                        [&](const std::string& reply) { writeToClient(reply); });
+                    readFromClient();
+                }
+            }
+            else if (signalled == directoryIndex) {
+                // Any file name change in the directory; see whether it was ours
+                DWORD bytes = 0;
+                GetOverlappedResult(directory, &directoryIo, &bytes, FALSE);
+                checkSignalFile();
+                watchDirectory();
+            }
+        }
+    }
+#else
+    int listenFd = -1;
+    int watchFd = -1;
+    int wakeFds[2] = { -1, -1 };
+    struct Client
+    {
+        int fd;
+        std::string pending;
+    };
+    std::vector<Client> clients;
+
+    void open()
+    {
+        if (pipe(wakeFds) != 0) {
+            wakeFds[0] = wakeFds[1] = -1;
+        }
+
+        if (!endpoint.empty()) {
+            sockaddr_un address = {};
+            address.sun_family = AF_UNIX;
+            if (endpoint.size() >= sizeof(address.sun_path)) {
+                std::cerr << "Warning: Control socket path too long: " << endpoint << std::endl;
+            }
+            else {
+                endpoint.copy(address.sun_path, endpoint.size());
+                // A socket left behind by a session that crashed
+                struct stat info;
+                if (lstat(endpoint.c_str(), &info) == 0 && S_ISSOCK(info.st_mode)) {
+                    unlink(endpoint.c_str());
+                }
+                listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+                if (listenFd < 0 || bind(listenFd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0
+                    || listen(listenFd, 4) != 0) {
+                    std::cerr << "Warning: Could not listen on control socket " << endpoint
+                        << " (errno " << errno << ")" << std::endl;
+                    if (listenFd >= 0) {
+                        close(listenFd);
+                        listenFd = -1;
+                    }
+                }
+                else {
+                    listening = endpoint;
+                }
+            }
+        }
+
+        watchFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (watchFd >= 0 && inotify_add_watch(watchFd, signalDirectory.c_str(), IN_CREATE | IN_MOVED_TO | IN_CLOSE_WRITE) < 0) {
+            close(watchFd);
+            watchFd = -1;
+        }
+        if (watchFd < 0) {
+            std::cerr << "Warning: Could not watch " << signalDirectory << " for the stop signal file" << std::endl;
+        }
+    }
+
+    void shutdown()
+    {
+        char wake = 0;
+        if (wakeFds[1] >= 0 && write(wakeFds[1], &wake, 1) != 1) {
+            std::cerr << "Warning: Could not wake the control thread" << std::endl;
+        }
+    }
+
+    void closeAll()
+    {
+        for (Client& client : clients) {
+            close(client.fd);
+        }
+        clients.clear();
+        if (listenFd >= 0) {
+            close(listenFd);
+            unlink(endpoint.c_str());
+        }
+        if (watchFd >= 0) {
+            close(watchFd);
+        }
+        for (int fd : wakeFds) {
+            if (fd >= 0) {
+                close(fd);
+            }
+        }
+    }
+
+    void serve()
+    {
+        checkSignalFile();  // Already there before the watch started
+
+        std::vector<pollfd> fds;
+        char buffer[512];
+        while (true) {
+            // Wake pipe, listening socket and inotify first, then one entry per client
+            fds.assign(3 + clients.size(), pollfd{ -1, POLLIN, 0 });
+            fds[0].fd = wakeFds[0];
+            fds[1].fd = listenFd;
+            fds[2].fd = watchFd;
+            for (size_t i = 0; i < clients.size(); ++i) {
+                fds[3 + i].fd = clients[i].fd;
+            }
+
+            if (poll(fds.data(), fds.size(), -1) < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                std::cerr << "Warning: Control channel stopped (errno " << errno << ")" << std::endl;
+                return;
+            }
+            if (fds[0].revents) {
+                return;
+            }
+
+            if (fds[2].revents & POLLIN) {
+                // Drain the events; whichever file it was, checking for ours is cheap
+                alignas(inotify_event) char events[4096];
+                while (read(watchFd, events, sizeof(events)) > 0) {
+                }
+                checkSignalFile();
+            }
+
+            // Clients first, before new ones shift the indices
+            for (size_t i = clients.size(); i-- > 0;) {
+                if (!fds[3 + i].revents) {
+                    continue;
+                }
+                Client& client = clients[i];
+                ssize_t bytes = recv(client.fd, buffer, sizeof(buffer), 0);
+                if (bytes <= 0) {
+                    close(client.fd);
+                    clients.erase(clients.begin() + i);
+                    continue;
+                }
+                consume(client.pending, buffer, static_cast<size_t>(bytes), "socket",
+                    [&](const std::string& reply) { send(client.fd, reply.data(), reply.size(), MSG_NOSIGNAL); });
+            }
+
+            if (fds[1].revents & POLLIN) {
+                int fd = accept4(listenFd, NULL, NULL, SOCK_CLOEXEC);
+                if (fd >= 0) {
+                    clients.push_back(Client{ fd, std::string() });
+                }
+            }
+        }
+    }
+#endif
+};
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define CRC32C_X86 1
+#include <nmmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+// CRC-32C (Castagnoli), the checksum on every frame record. Uses the SSE4.2
+// crc32 instruction when the CPU has it (several times faster than the table), so
+// checksumming keeps up with the camera.
+namespace crc32c_detail
+{
+    struct Tables
+    {
+        uint32_t t[8][256];
+
+        Tables()
+        {
+            for (uint32_t i = 0; i < 256; ++i) {
+                uint32_t crc = i;
+                for (int k = 0; k < 8; ++k) {
+                    crc = (crc >> 1) ^ (0x82F63B78u & (0u - (crc & 1u)));
+                }
+                t[0][i] = crc;
+            }
+            for (uint32_t i = 0; i < 256; ++i) {
+                for (int s = 1; s < 8; ++s) {
+                    t[s][i] = (t[s - 1][i] >> 8) ^ t[0][t[s - 1][i] & 0xFF];
+                }
+            }
+        }
+    };
+
+    inline const Tables& tables()
+    {
+        static const Tables instance;
+        return instance;
+    }
+
+    // Slicing-by-8: eight table lookups per 8 input bytes
+    inline uint32_t software(uint32_t crc, const unsigned char* p, size_t size)
+    {
+        const Tables& tab = tables();
+        while (size >= 8) {
+            uint32_t lo;
+            uint32_t hi;
+            memcpy(&lo, p, 4);
+            memcpy(&hi, p + 4, 4);
+            lo ^= crc;
+            crc = tab.t[7][lo & 0xFF] ^ tab.t[6][(lo >> 8) & 0xFF] ^
+                tab.t[5][(lo >> 16) & 0xFF] ^ tab.t[4][lo >> 24] ^
+                tab.t[3][hi & 0xFF] ^ tab.t[2][(hi >> 8) & 0xFF] ^
+                tab.t[1][(hi >> 16) & 0xFF] ^ tab.t[0][hi >> 24];
+            p += 8;
+            size -= 8;
+        }
+        while (size-- > 0) {
+            crc = (crc >> 8) ^ tab.t[0][(crc ^ *p++) & 0xFF];
+        }
+        return crc;
+    }
+
+#ifdef CRC32C_X86
+#if defined(__GNUC__) && !defined(__SSE4_2__)
+    __attribute__((target("sse4.2")))
+#endif
+    inline uint32_t hardware(uint32_t crc, const unsigned char* p, size_t size)
+    {
+#if defined(_M_X64) || defined(__x86_64__)
+        uint64_t crc64 = crc;
+        while (size >= 8) {
+            uint64_t v;
+            memcpy(&v, p, 8);
+            crc64 = _mm_crc32_u64(crc64, v);
+            p += 8;
+            size -= 8;
+        }
+        crc = static_cast<uint32_t>(crc64);
+#endif
+        while (size >= 4) {
+            uint32_t v;
+            memcpy(&v, p, 4);
+            crc = _mm_crc32_u32(crc, v);
+            p += 4;
+            size -= 4;
+        }
+        while (size-- > 0) {
+            crc = _mm_crc32_u8(crc, *p++);
+        }
+        return crc;
+    }
+
+    inline bool cpuHasSse42()
+    {
+#ifdef _MSC_VER
+        int info[4];
+        __cpuid(info, 1);
+        return (info[2] & (1 << 20)) != 0;
+#else
+        unsigned eax, ebx, ecx, edx;
+        return __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_SSE4_2) != 0;
+#endif
+    }
+#endif
+}
+
+inline bool crc32cHardwareAvailable()
+{
+#ifdef CRC32C_X86
+    static const bool available = crc32c_detail::cpuHasSse42();
+    return available;
+#else
+    return false;
+#endif
+}
+
+// Continue a CRC: pass the previous result as crc (0 to start)
+inline uint32_t crc32c(const void* data, size_t size, uint32_t crc = 0)
+{
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    crc = ~crc;
+#ifdef CRC32C_X86
+    if (crc32cHardwareAvailable()) {
+        return ~crc32c_detail::hardware(crc, p, size);
+    }
+#endif
+    return ~crc32c_detail::software(crc, p, size);
+}
@@ -0,0 +1,318 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include "AlignedBuffer.h"
+#include "FileSink.h"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Writes the recording in large sector-aligned blocks that bypass the page
+// cache (FILE_FLAG_NO_BUFFERING / O_DIRECT), into a file whose space was
+// reserved up front. Small frame writes are coalesced into one block-sized
+// buffer, so the disk sees a steady stream of big sequential writes and the
+// recording does not push everything else out of RAM.
+//
+// If the volume refuses unbuffered I/O (or our alignment), the sink falls back
+// to ordinary buffered writes of the same blocks.
+//
+// Only whole blocks reach the disk while recording; the partial last block is
+// written by close(). A crash therefore loses at most one block of frames.
+class DirectFileSink : public FileSink
+{
+public:
+    DirectFileSink(const std::string& filePath, size_t blockBytes, uint64_t preallocateBytes)
+        : filePath(filePath)
+    {
+        if (!openFile(true, true)) {
+            std::cerr << "Warning: Direct I/O not available for " << filePath
+                << ", falling back to buffered writes." << std::endl;
+            if (!openFile(false, true)) {
+                return;
+            }
+        }
+
+        alignment = queryAlignment();
+        blockBytes = std::max(blockBytes, alignment);
+        blockBytes = (blockBytes + alignment - 1) / alignment * alignment;
+        block.allocate(blockBytes, alignment);
+
+        if (preallocateBytes > 0 && !preallocate(preallocateBytes)) {
+            std::cerr << "Warning: Could not preallocate " << (preallocateBytes >> 20)
+                << " MB for " << filePath << "; the file will grow as it is written." << std::endl;
+        }
+    }
+
+    ~DirectFileSink() override
+    {
+        close();
+    }
+
+    bool isOpen() const { return fileOpen; }
+    bool usingDirectIO() const { return direct; }
+    size_t blockSize() const { return block.size(); }
+
+    bool write(const void* data, size_t size) override
+    {
+        const char* src = static_cast<const char*>(data);
+        while (size > 0) {
+            size_t n = std::min(size, block.size() - used);
+            memcpy(block.data() + used, src, n);
+            used += n;
+            src += n;
+            size -= n;
+
+            if (used == block.size()) {
+                if (!writeBlock(block.size())) {
+                    return false;
+                }
+                used = 0;
+            }
+        }
+        return true;
+    }
+
+    // Whole blocks are written as soon as they fill; the partial block can
+    // only be written once, at close(), without breaking alignment.
+    bool flush() override
+    {
+        return fileOpen;
+    }
+
+    bool close() override
+    {
+        if (!fileOpen) {
+            return true;
+        }
+
+        bool ok = true;
+        uint64_t logicalSize = fileOffset + used;
+        if (used > 0) {
+            // Direct I/O can only write whole sectors: pad, write, then trim the file back
+            size_t writeBytes = direct ? (used + alignment - 1) / alignment * alignment : used;
+            memset(block.data() + used, 0, writeBytes - used);
+            ok = writeBlock(writeBytes);
+            used = 0;
+        }
+
+        // Also releases whatever preallocated space was not used
+        ok = truncateTo(logicalSize) && ok;
+        closeHandle();
+        fileOffset = logicalSize;
+        return ok;
+    }
+
+    uint64_t bytesWritten() const override { return fileOffset + used; }
+
+    std::string description() const override
+    {
+        return std::string(direct ? "direct" : "buffered fallback") +
+            " (" + std::to_string(block.size() >> 20) + " MB blocks)";
+    }
+
+private:
+    std::string filePath;
+    AlignedBuffer block;
+    size_t used = 0;
+    size_t alignment = 4096;
+    uint64_t fileOffset = 0;  // Bytes already on disk
+    bool direct = false;
+    bool fileOpen = false;
+
+#ifdef _WIN32
+    HANDLE handle = INVALID_HANDLE_VALUE;
+
+    bool openFile(bool unbuffered, bool truncate)
+    {
+        DWORD flags = FILE_ATTRIBUTE_NORMAL | (unbuffered ? FILE_FLAG_NO_BUFFERING : 0);
+        handle = CreateFileA(filePath.c_str(), GENERIC_WRITE, FILE_SHARE_READ, NULL,
+            truncate ? CREATE_ALWAYS : OPEN_EXISTING, flags, NULL);
+        if (handle == INVALID_HANDLE_VALUE) {
+            return false;
+        }
+
+        if (!truncate) {
+            LARGE_INTEGER position;
+            position.QuadPart = static_cast<LONGLONG>(fileOffset);
+            if (!SetFilePointerEx(handle, position, NULL, FILE_BEGIN)) {
+                closeHandle();
+                return false;
+            }
+        }
+
+        direct = unbuffered;
+        fileOpen = true;
+        return true;
+    }
+
+    void closeHandle()
+    {
+        if (handle != INVALID_HANDLE_VALUE) {
+            CloseHandle(handle);
+            handle = INVALID_HANDLE_VALUE;
+        }
+        fileOpen = false;
+    }
+
+    size_t queryAlignment()
+    {
+        FILE_STORAGE_INFO storageInfo = {};
+        if (GetFileInformationByHandleEx(handle, FileStorageInfo, &storageInfo, sizeof(storageInfo))) {
+            return std::max<size_t>(4096, storageInfo.PhysicalBytesPerSectorForPerformance);
+        }
+        return 4096;
+    }
+
+    bool preallocate(uint64_t bytes)
+    {
+        // Reserves the extents without moving end-of-file or zero-filling
+        FILE_ALLOCATION_INFO allocationInfo = {};
+        allocationInfo.AllocationSize.QuadPart = static_cast<LONGLONG>(bytes);
+        return SetFileInformationByHandle(handle, FileAllocationInfo, &allocationInfo, sizeof(allocationInfo)) != 0;
+    }
+
+    bool truncateTo(uint64_t size)
+    {
+        FILE_END_OF_FILE_INFO endOfFileInfo = {};
+        endOfFileInfo.EndOfFile.QuadPart = static_cast<LONGLONG>(size);
+        return SetFileInformationByHandle(handle, FileEndOfFileInfo, &endOfFileInfo, sizeof(endOfFileInfo)) != 0;
+    }
+
+    bool writeBlock(size_t size)
+    {
+        DWORD written = 0;
+        if (WriteFile(handle, block.data(), static_cast<DWORD>(size), &written, NULL) && written == size) {
+            fileOffset += size;
+            return true;
+        }
+
+        // Unbuffered writes the volume cannot align: carry on buffered
+        if (direct && GetLastError() == ERROR_INVALID_PARAMETER && written == 0) {
+            closeHandle();
+            if (openFile(false, false)) {
+                std::cerr << "Warning: Direct I/O rejected for " << filePath
+                    << ", continuing with buffered writes." << std::endl;
+                return writeBlock(size);
+            }
+        }
+        return false;
+    }
+#else
+    int fd = -1;
+
+    bool openFile(bool unbuffered, bool truncate)
+    {
+        int flags = O_WRONLY | O_CREAT | (truncate ? O_TRUNC : 0);
+#ifdef O_DIRECT
+        if (unbuffered) {
+            flags |= O_DIRECT;
+        }
+#else
+        if (unbuffered) {
+            return false;
+        }
+#endif
+        fd = ::open(filePath.c_str(), flags, 0644);
+        if (fd < 0) {
+            return false;
+        }
+
+        if (!truncate && ::lseek(fd, static_cast<off_t>(fileOffset), SEEK_SET) < 0) {
+            closeHandle();
+            return false;
+        }
+
+        direct = unbuffered;
+        fileOpen = true;
+        return true;
+    }
+
+    void closeHandle()
+    {
+        if (fd >= 0) {
+            ::close(fd);
+            fd = -1;
+        }
+        fileOpen = false;
+    }
+
+    size_t queryAlignment()
+    {
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_blksize > 4096) {
+            return static_cast<size_t>(st.st_blksize);
+        }
+        return 4096;
+    }
+
+    bool preallocate(uint64_t bytes)
+    {
+#ifdef __linux__
+        // Reserves the extents without changing the visible file size
+        return fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, static_cast<off_t>(bytes)) == 0;
+#else
+        (void)bytes;
+        return false;
+#endif
+    }
+
+    bool truncateTo(uint64_t size)
+    {
+        return ftruncate(fd, static_cast<off_t>(size)) == 0;
+    }
+
+    bool writeBlock(size_t size)
+    {
+        size_t done = 0;
+        while (done < size) {
+            ssize_t n = ::write(fd, block.data() + done, size - done);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                // Unbuffered writes the file system cannot align: carry on buffered
+                if (direct && errno == EINVAL && done == 0) {
+                    closeHandle();
+                    if (openFile(false, false)) {
+                        std::cerr << "Warning: Direct I/O rejected for " << filePath
+                            << ", continuing with buffered writes." << std::endl;
+                        return writeBlock(size);
+                    }
+                }
+                return false;
+            }
+            done += static_cast<size_t>(n);
+        }
+
+#ifdef __linux__
+        if (!direct) {
+            // Keep the buffered fallback from filling the page cache: start
+            // writeback of this block and drop the previous one, which has
+            // had a block's worth of time to reach the disk.
+            sync_file_range(fd, static_cast<off_t>(fileOffset), static_cast<off_t>(size), SYNC_FILE_RANGE_WRITE);
+            if (fileOffset >= size) {
+                posix_fadvise(fd, static_cast<off_t>(fileOffset - size), static_cast<off_t>(size), POSIX_FADV_DONTNEED);
+            }
+        }
+#endif
+        fileOffset += size;
+        return true;
+    }
+#endif
+};
@@ -0,0 +1,147 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#if defined(_M_X64) || defined(__SSE2__)
+#define DOWNSCALE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+// Integer-ratio downscaling of 8-bit single-channel images, for the live
+// preview. A k:1 box filter averages each k x k block, so a 6 MP frame
+// shrinks to window size without the aliasing of plain subsampling; the rows
+// are summed 16 pixels at a time with SSE2 (part of every x64 CPU).
+//
+// decimate() only picks every k-th pixel of every k-th row: it reads 1/k of
+// the rows and is what the preview falls back to when the writer is busy.
+namespace downscale
+{
+    // Smallest ratio that makes a width x height image fit in maxWidth x maxHeight
+    inline size_t ratioToFit(size_t width, size_t height, size_t maxWidth, size_t maxHeight)
+    {
+        if (maxWidth == 0 || maxHeight == 0) {
+            return 1;
+        }
+        size_t kx = (width + maxWidth - 1) / maxWidth;
+        size_t ky = (height + maxHeight - 1) / maxHeight;
+        size_t k = kx > ky ? kx : ky;
+        return k < 1 ? 1 : k;
+    }
+
+    // Adds row `src` (width bytes) to the running column sums
+    inline void accumulateRow(const uint8_t* src, size_t width, uint16_t* sums)
+    {
+        size_t x = 0;
+#ifdef DOWNSCALE_SSE2
+        const __m128i zero = _mm_setzero_si128();
+        for (; x + 16 <= width; x += 16) {
+            __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x));
+            __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(sums + x));
+            __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(sums + x + 8));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(sums + x), _mm_add_epi16(lo, _mm_unpacklo_epi8(pixels, zero)));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(sums + x + 8), _mm_add_epi16(hi, _mm_unpackhi_epi8(pixels, zero)));
+        }
+#endif
+        for (; x < width; ++x) {
+            sums[x] = static_cast<uint16_t>(sums[x] + src[x]);
+        }
+    }
+
+#ifdef DOWNSCALE_SSE2
+    // Adds neighbouring pairs of 16-bit sums: 16 in, 8 out
+    inline __m128i pairSums(__m128i a, __m128i b)
+    {
+        const __m128i ones = _mm_set1_epi16(1);
+        return _mm_packs_epi32(_mm_madd_epi16(a, ones), _mm_madd_epi16(b, ones));
+    }
+
+    // Horizontal step for k = 2 and 4, 8 output pixels at a time.
+    // Returns how many pixels it did; the caller finishes the rest.
+    inline size_t sumColumns(const uint16_t* sums, size_t outWidth, size_t k, uint8_t* out)
+    {
+        const __m128i* in = reinterpret_cast<const __m128i*>(sums);
+        __m128i round = _mm_set1_epi16(static_cast<short>(k * k / 2));
+        int shift = k == 2 ? 2 : 4;
+        size_t ox = 0;
+        for (; ox + 8 <= outWidth; ox += 8) {
+            __m128i total;
+            if (k == 2) {
+                total = pairSums(_mm_loadu_si128(in), _mm_loadu_si128(in + 1));
+                in += 2;
+            }
+            else {
+                __m128i a = pairSums(_mm_loadu_si128(in), _mm_loadu_si128(in + 1));
+                __m128i b = pairSums(_mm_loadu_si128(in + 2), _mm_loadu_si128(in + 3));
+                total = pairSums(a, b);
+                in += 4;
+            }
+            total = _mm_srl_epi16(_mm_add_epi16(total, round), _mm_cvtsi32_si128(shift));
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(out + ox), _mm_packus_epi16(total, total));
+        }
+        return ox;
+    }
+#endif
+
+    // k x k box filter; writes (width / k) x (height / k) pixels. Any partial
+    // block at the right or bottom edge is dropped. k is at most 64.
+    inline void box(const uint8_t* src, size_t width, size_t height, size_t srcStride, size_t k,
+        uint8_t* dst, size_t dstStride)
+    {
+        size_t outWidth = width / k;
+        size_t outHeight = height / k;
+        if (k <= 1) {
+            for (size_t y = 0; y < height; ++y) {
+                memcpy(dst + y * dstStride, src + y * srcStride, width);
+            }
+            return;
+        }
+
+        // Rounded division by k*k as a multiply: exact for every sum a 16-bit column total can reach
+        uint32_t area = static_cast<uint32_t>(k * k);
+        uint64_t reciprocal = ((uint64_t(1) << 32) + area - 1) / area;
+
+        thread_local std::vector<uint16_t> sums;
+        sums.resize(outWidth * k);
+        for (size_t oy = 0; oy < outHeight; ++oy) {
+            std::fill(sums.begin(), sums.end(), uint16_t(0));
+            for (size_t i = 0; i < k; ++i) {
+                accumulateRow(src + (oy * k + i) * srcStride, outWidth * k, sums.data());
+            }
+
+            uint8_t* out = dst + oy * dstStride;
+            size_t ox = 0;
+#ifdef DOWNSCALE_SSE2
+            if (k == 2 || k == 4) {
+                ox = sumColumns(sums.data(), outWidth, k, out);
+            }
+#endif
+            const uint16_t* column = sums.data() + ox * k;
+            for (; ox < outWidth; ++ox, column += k) {
+                uint32_t total = area / 2;
+                for (size_t i = 0; i < k; ++i) {
+                    total += column[i];
+                }
+                out[ox] = static_cast<uint8_t>((total * reciprocal) >> 32);
+            }
+        }
+    }
+
+    // Every k-th pixel of every k-th row
+    inline void decimate(const uint8_t* src, size_t width, size_t height, size_t srcStride, size_t k,
+        uint8_t* dst, size_t dstStride)
+    {
+        size_t outWidth = width / (k < 1 ? 1 : k);
+        size_t outHeight = height / (k < 1 ? 1 : k);
+        for (size_t oy = 0; oy < outHeight; ++oy) {
+            const uint8_t* row = src + oy * k * srcStride;
+            uint8_t* out = dst + oy * dstStride;
+            for (size_t ox = 0; ox < outWidth; ++ox) {
+                out[ox] = row[ox * k];
+            }
+        }
+    }
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+
+// Destination for a stream of recording data (the .bin video, frame logs).
+// All calls come from a single writer thread.
+class FileSink
+{
+public:
+    virtual ~FileSink() = default;
+
+    virtual bool write(const void* data, size_t size) = 0;
+
+    // Hand everything written so far to the operating system
+    virtual bool flush() = 0;
+
+    virtual bool close() = 0;
+
+    virtual uint64_t bytesWritten() const = 0;
+
+    virtual std::string description() const = 0;
+};
+
+// Plain std::ofstream, one write per call through the page cache. This is how
+// the .bin has always been written.
+class BufferedFileSink : public FileSink
+{
+public:
+    explicit BufferedFileSink(const std::string& filePath, bool append = false)
+    {
+        file.open(filePath, std::ios::binary | std::ios::out | (append ? std::ios::app : std::ios::trunc));
+    }
+
+    ~BufferedFileSink() override
+    {
+        close();
+    }
+
+    bool isOpen() const { return file.is_open(); }
+
+    bool write(const void* data, size_t size) override
+    {
+        file.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+        if (!file.good()) {
+            return false;
+        }
+        written += size;
+        return true;
+    }
+
+    bool flush() override
+    {
+        file.flush();
+        return file.good();
+    }
+
+    bool close() override
+    {
+        if (!file.is_open()) {
+            return true;
+        }
+        file.close();
+        return !file.fail();
+    }
+
+    uint64_t bytesWritten() const override { return written; }
+
+    std::string description() const override { return "buffered"; }
+
+private:
+    std::ofstream file;
+    uint64_t written = 0;
+};
@@ -0,0 +1,290 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include "nlohmann/json.hpp"
+#include "Crc32c.h"
+#include "FrameJournal.h"
+#include "RecordingFormat.h"
+
+// A recording that is still being written, read as it grows, so a session
+// can be converted while it runs.
+//
+// The frame journal next to the recording says what has been written: its
+// session header gives the geometry, and each record where a frame sits in
+// the file. The journal is written after the frame, but the recorder's
+// writes can finish out of order, so a frame is only handed out once its
+// journal block has been seen for SETTLE_TIME and the file reaches past it.
+// A .camrec frame is also checked against its CRCs; one that doesn't match
+// is tried again for DAMAGED_AFTER before it is skipped as damaged.
+//
+// Frames are copied out with positional reads rather than mapped: a mapping
+// of a growing file has to be replaced as it grows, which would leave frames
+// still being encoded pointing into the old one. Just-written frames are in
+// the OS cache, so the copy is the only cost.
+//
+// The session is over when the recorder's finished signal
+// (rig_<rig>_camera_finished.signal, with the rig from the journal's session
+// header) is in the folder and newer than the journal; the recorder writes it
+// after closing the recording and the journal. Signals from other cameras in
+// the same folder, or left over from an earlier session, don't count. If the
+// journal stops growing and the rig's status file hasn't been updated for
+// IDLE_TIMEOUT, the recorder is taken to have died and the frames so far are
+// all there is.
+//
+// Call from one thread only.
+class FollowedRecording
+{
+public:
+    const std::chrono::milliseconds SETTLE_TIME{ 1000 };
+    const std::chrono::milliseconds POLL_INTERVAL{ 100 };
+    const std::chrono::seconds JOURNAL_WAIT{ 60 };   // For the recorder to start, if it hasn't yet
+    const std::chrono::seconds IDLE_TIMEOUT{ 60 };
+    const std::chrono::seconds DAMAGED_AFTER{ 5 };   // A .camrec frame that still fails its CRCs after this is skipped
+    static constexpr double LIVE_STATUS_SECONDS = 10.0;  // The recorder rewrites its status file every second
+
+    // Throws std::runtime_error if the journal doesn't appear within JOURNAL_WAIT
+    explicit FollowedRecording(const std::string& recordingPath)
+        : recordingPath(recordingPath), folder(std::filesystem::path(recordingPath).parent_path())
+    {
+        std::string prefix = recordingPath;
+        for (const std::string suffix : { "_binary_video.bin", "_video.camrec" }) {
+            if (endsWith(prefix, suffix)) {
+                prefix.resize(prefix.size() - suffix.size());
+                container = suffix == "_video.camrec";
+                break;
+            }
+        }
+        if (prefix == recordingPath) {
+            throw std::runtime_error("Can only follow a <prefix>_binary_video.bin or <prefix>_video.camrec: " + recordingPath);
+        }
+        journalPath = prefix + "_frame_journal.camjournal";
+
+        auto deadline = std::chrono::steady_clock::now() + JOURNAL_WAIT;
+        while (!tail) {
+            try {
+                tail = std::make_unique<journal::Tail>(journalPath);
+                file.open(recordingPath, std::ios::in | std::ios::binary);
+                if (!file) {
+                    tail.reset();
+                    throw std::runtime_error("Unable to open " + recordingPath);
+                }
+            }
+            catch (const std::runtime_error&) {
+                if (std::chrono::steady_clock::now() > deadline) {
+                    throw std::runtime_error("No frame journal for " + recordingPath + " (looked for " + journalPath + ")");
+                }
+                std::this_thread::sleep_for(POLL_INTERVAL);
+            }
+        }
+
+        nlohmann::json session = nlohmann::json::parse(tail->session());
+        imageWidth = session.value("image_width", size_t(0));
+        imageHeight = session.value("image_height", size_t(0));
+        format = session.value("pixel_format", std::string());
+        fps = session.value("frame_rate", 0.0);
+        rig = session.value("rig", std::string());  // Empty in journals from before it was recorded
+        lastGrowth = std::chrono::steady_clock::now();
+    }
+
+    size_t width() const { return imageWidth; }
+    size_t height() const { return imageHeight; }
+    const std::string& pixelFormat() const { return format; }
+    double frameRate() const { return fps; }
+    bool isContainer() const { return container; }
+
+    // Blocks until frame `index` can be read; false once the session is
+    // over and it never will be
+    bool waitForFrame(size_t index)
+    {
+        while (true) {
+            if (index < ready) {
+                return true;
+            }
+            // Checked before the journal, so nothing written before the signal is missed
+            bool over = sessionOver || sessionFinished();
+            refresh(over);
+            if (index < ready) {
+                return true;
+            }
+            if (over) {
+                sessionOver = true;
+                return false;
+            }
+            std::this_thread::sleep_for(POLL_INTERVAL);
+        }
+    }
+
+    // Copies frame `index` into `buffer` and points `data` at it. Call after
+    // waitForFrame(index).
+    bool frame(size_t index, std::vector<char>& buffer, const char*& data, size_t& size, camrec::FrameInfo& info)
+    {
+        if (index >= ready) {
+            return false;
+        }
+        const journal::Record& record = records[index];
+        info = camrec::FrameInfo();
+        info.frameID = record.frameID;
+        info.deviceTimestamp = record.deviceTimestamp;
+        info.hostTimestamp = record.hostTimestamp;
+
+        auto giveUp = std::chrono::steady_clock::now() + DAMAGED_AFTER;
+        while (!readFrame(record, buffer, info)) {
+            if (sessionOver || std::chrono::steady_clock::now() > giveUp) {
+                return false;
+            }
+            std::this_thread::sleep_for(POLL_INTERVAL);
+        }
+        data = buffer.data();
+        size = buffer.size();
+        return true;
+    }
+
+private:
+    struct Block
+    {
+        size_t end;  // Records before this index came with it or earlier
+        std::chrono::steady_clock::time_point seen;
+    };
+
+    std::string recordingPath;
+    std::filesystem::path folder;
+    std::string journalPath;
+    std::string rig;
+    bool container = false;
+    std::unique_ptr<journal::Tail> tail;
+    std::ifstream file;
+    size_t imageWidth = 0;
+    size_t imageHeight = 0;
+    std::string format;
+    double fps = 0;
+
+    std::vector<journal::Record> records;
+    std::deque<Block> settling;
+    size_t settled = 0;  // Records whose blocks have settled
+    size_t ready = 0;    // Of those, the ones the file reaches past
+    bool sessionOver = false;
+    std::chrono::steady_clock::time_point lastGrowth;
+
+    static bool endsWith(const std::string& text, const std::string& suffix)
+    {
+        return text.size() >= suffix.size() && text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+    }
+
+    // Picks up new journal blocks and moves `ready` past what has settled;
+    // with over, everything listed is ready
+    void refresh(bool over)
+    {
+        auto now = std::chrono::steady_clock::now();
+        if (tail->poll(records) > 0) {
+            settling.push_back(Block{ records.size(), now });
+            lastGrowth = now;
+        }
+
+        while (!settling.empty() && (over || now - settling.front().seen >= SETTLE_TIME)) {
+            settled = settling.front().end;
+            settling.pop_front();
+        }
+        uint64_t fileBytes = currentSize();
+        while (ready < settled && frameEnd(records[ready]) <= fileBytes) {
+            ready++;
+        }
+    }
+
+    bool readFrame(const journal::Record& record, std::vector<char>& buffer, camrec::FrameInfo& info)
+    {
+        if (!container) {
+            buffer.resize(static_cast<size_t>(record.bytes));
+            info.rawBytes = static_cast<uint32_t>(record.bytes);
+            return readAt(record.offset, buffer.data(), buffer.size());
+        }
+
+        camrec::FrameRecordHeader header = {};
+        if (!readAt(record.offset, &header, sizeof(header)) || header.magic != camrec::FRAME_MAGIC ||
+            header.headerCrc != camrec::structCrc(header) || header.payloadBytes != record.bytes) {
+            return false;
+        }
+        buffer.resize(header.payloadBytes);
+        if (!readAt(record.offset + sizeof(header), buffer.data(), buffer.size()) ||
+            crc32c(buffer.data(), buffer.size()) != header.payloadCrc) {
+            return false;
+        }
+        info.flags = header.flags;
+        info.codec = static_cast<camrec::Codec>(header.codec);
+        info.rawBytes = header.rawBytes;
+        return true;
+    }
+
+    uint64_t frameEnd(const journal::Record& record) const
+    {
+        return record.offset + record.bytes + (container ? sizeof(camrec::FrameRecordHeader) : 0);
+    }
+
+    // This recorder's file, or with no rig in the journal, any rig's
+    bool isRigFile(const std::string& name, const std::string& suffix) const
+    {
+        if (!rig.empty()) {
+            return name == "rig_" + rig + suffix;
+        }
+        return name.compare(0, 4, "rig_") == 0 && endsWith(name, suffix);
+    }
+
+    bool sessionFinished()
+    {
+        std::error_code error;
+        auto journalWritten = std::filesystem::last_write_time(journalPath, error);
+        if (!error) {
+            for (const auto& entry : std::filesystem::directory_iterator(folder, error)) {
+                std::string name = entry.path().filename().string();
+                std::error_code timeError;
+                if (isRigFile(name, "_camera_finished.signal") && entry.last_write_time(timeError) >= journalWritten && !timeError) {
+                    return true;
+                }
+            }
+        }
+
+        // A recorder that died leaves no signal; stop once nothing has moved for a while
+        auto now = std::chrono::steady_clock::now();
+        if (now - lastGrowth < IDLE_TIMEOUT) {
+            return false;
+        }
+        for (const auto& entry : std::filesystem::directory_iterator(folder, error)) {
+            std::string name = entry.path().filename().string();
+            if (isRigFile(name, "_camera_status.json")) {
+                auto age = std::filesystem::file_time_type::clock::now() - entry.last_write_time(error);
+                if (!error && std::chrono::duration<double>(age).count() < LIVE_STATUS_SECONDS) {
+                    return false;  // Still running, just not writing (paused)
+                }
+            }
+        }
+        std::cerr << "Warning: " << recordingPath << " stopped growing " << IDLE_TIMEOUT.count()
+            << " s ago without its session finishing; ending the video there." << std::endl;
+        return true;
+    }
+
+    // From the open handle: the directory entry of a file being written can lag behind
+    uint64_t currentSize()
+    {
+        file.clear();
+        file.seekg(0, std::ios::end);
+        std::streamoff end = file.tellg();
+        return end > 0 ? static_cast<uint64_t>(end) : 0;
+    }
+
+    bool readAt(uint64_t offset, void* data, size_t size)
+    {
+        file.clear();
+        file.seekg(static_cast<std::streamoff>(offset));
+        file.read(static_cast<char*>(data), static_cast<std::streamsize>(size));
+        return file.gcount() == static_cast<std::streamsize>(size);
+    }
+};
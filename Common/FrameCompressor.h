@@ -0,0 +1,247 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "FrameRing.h"
+#include "LosslessCodec.h"
+#include "TraceRecorder.h"
+#include "WorkerPool.h"
+
+// A frame that has been through the compressor, ready for the writer
+struct CompressedFrame
+{
+    FrameSlot frame;                // Frame ID, timestamps and the original pixels
+    std::vector<char> encoded;
+    size_t encodedBytes = 0;
+    bool compressed = false;        // False if encoding didn't shrink it; write frame.data instead
+    double encodeMs = 0.0;
+};
+
+// Compresses frames on a pool of worker threads between the frame ring and
+// the writer.
+//
+// The writer thread hands frames over with submit() and gets them back with
+// next() in the order it submitted them, however the workers finish, so the
+// frame ID / frame association on disk is unchanged. Submitting swaps the
+// ring slot's buffer with a spare one instead of copying the pixels; buffers
+// circulate between the ring and the pool and nothing is allocated once the
+// first few frames are through.
+class FrameCompressor
+{
+public:
+    struct Stats
+    {
+        uint64_t frames = 0;
+        uint64_t storedRaw = 0;     // Frames that didn't compress and were kept as they were
+        uint64_t rawBytes = 0;
+        uint64_t encodedBytes = 0;  // Bytes actually written, raw fallbacks included
+        double meanEncodeMs = 0.0;
+        double maxEncodeMs = 0.0;
+        size_t threads = 0;
+
+        double ratio() const { return encodedBytes > 0 ? double(rawBytes) / encodedBytes : 0.0; }
+    };
+
+    FrameCompressor(const lossless::Layout& layout, size_t threadCount, TraceRecorder* tracer = nullptr)
+        : FrameCompressor(layout, threadCount + 2, nullptr, tracer)
+    {
+        for (size_t t = 0; t < threadCount; ++t) {
+            workers.emplace_back(&FrameCompressor::workerLoop, this, t);
+        }
+    }
+
+    // Compresses on a pool shared with other compressors (one per camera)
+    FrameCompressor(const lossless::Layout& layout, WorkerPool& pool, TraceRecorder* tracer = nullptr)
+        : FrameCompressor(layout, pool.threads() + 2, &pool, tracer)
+    {
+    }
+
+    ~FrameCompressor()
+    {
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            stopping = true;
+            jobDone.wait(guard, [&] { return pooledTasks == 0; });
+        }
+        workAvailable.notify_all();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+
+    FrameCompressor(const FrameCompressor&) = delete;
+    FrameCompressor& operator=(const FrameCompressor&) = delete;
+
+    // True when every job is taken; call next() before submitting more
+    bool full()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        return submitted - taken == jobs.size();
+    }
+
+    // Writer thread: queue a frame. Its buffer is swapped for a spare one of
+    // the same size, so the ring slot can be released straight away.
+    bool submit(FrameSlot& frame)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (submitted - taken == jobs.size()) {
+            return false;
+        }
+        Job& job = jobs[submitted % jobs.size()];
+        FrameSlot& held = job.output.frame;
+        std::swap(held.data, frame.data);
+        held.frameID = frame.frameID;
+        held.timestamp = frame.timestamp;
+        held.hostTimestamp = frame.hostTimestamp;
+        held.steadyTimestamp = frame.steadyTimestamp;
+        held.size = frame.size;
+        job.done = false;
+        submitted++;
+        if (pool) {
+            pooledTasks++;
+            pool->post([this] { runPooledJob(); });
+        }
+        else {
+            workAvailable.notify_one();
+        }
+        return true;
+    }
+
+    // Writer thread: the oldest submitted frame if it is finished, or null.
+    // With wait, blocks until it is; null then means nothing is outstanding.
+    // Call release() once it has been written.
+    CompressedFrame* next(bool wait)
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        if (taken == submitted) {
+            return nullptr;
+        }
+        Job& job = jobs[taken % jobs.size()];
+        if (wait) {
+            jobDone.wait(guard, [&] { return job.done; });
+        }
+        return job.done ? &job.output : nullptr;
+    }
+
+    void release()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        taken++;
+    }
+
+    Stats stats()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        Stats result = totals;
+        result.meanEncodeMs = totals.frames > 0 ? encodeMsTotal / totals.frames : 0.0;
+        result.threads = pool ? pool->threads() : workers.size();
+        return result;
+    }
+
+private:
+    struct Job
+    {
+        CompressedFrame output;
+        bool done = true;
+    };
+
+    lossless::Layout layout;
+    std::vector<Job> jobs;
+    WorkerPool* pool;  // Shared threads, or null for threads of its own
+    TraceRecorder* tracer;  // Each encode goes in the trace when set
+    std::vector<std::thread> workers;
+
+    std::mutex lock;
+    std::condition_variable workAvailable;
+    std::condition_variable jobDone;
+    uint64_t submitted = 0;  // Jobs handed in by the writer
+    uint64_t claimed = 0;    // Jobs a worker has started
+    uint64_t taken = 0;      // Jobs the writer has written and released
+    uint64_t pooledTasks = 0;  // Posted to the pool and not yet run
+    bool stopping = false;
+
+    Stats totals;
+    double encodeMsTotal = 0.0;
+
+    // Allocates the jobs; the public constructors decide where they run
+    FrameCompressor(const lossless::Layout& layout, size_t jobCount, WorkerPool* pool, TraceRecorder* tracer)
+        : layout(layout), jobs(jobCount), pool(pool), tracer(tracer)
+    {
+        for (auto& job : jobs) {
+            job.output.frame.data.resize(layout.frameBytes());
+            job.output.encoded.resize(lossless::maxEncodedBytes(layout));
+        }
+    }
+
+    void workerLoop(size_t index)
+    {
+        if (tracer) {
+            tracer->nameThread("compress " + std::to_string(index));
+        }
+        while (encodeNext(true)) {
+        }
+    }
+
+    // One task on the shared pool: compress the oldest frame nobody has started
+    void runPooledJob()
+    {
+        encodeNext(false);
+        std::lock_guard<std::mutex> guard(lock);
+        pooledTasks--;
+        jobDone.notify_all();
+    }
+
+    // Compresses the oldest job no worker has started. With wait, blocks
+    // until there is one; false once stopping with nothing left.
+    bool encodeNext(bool wait)
+    {
+        Job* job;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            if (wait) {
+                workAvailable.wait(guard, [&] { return stopping || claimed < submitted; });
+            }
+            if (claimed == submitted) {
+                return false;
+            }
+            job = &jobs[claimed % jobs.size()];
+            claimed++;
+        }
+
+        // A frame that isn't the expected size (the source changed mode) is stored as it is
+        CompressedFrame& output = job->output;
+        auto start = std::chrono::steady_clock::now();
+        output.compressed = false;
+        output.encodedBytes = output.frame.size;
+        if (output.frame.size == layout.frameBytes()) {
+            size_t bytes = lossless::encode(output.frame.data.data(), layout, output.encoded);
+            if (bytes < output.frame.size) {
+                output.encodedBytes = bytes;
+                output.compressed = true;
+            }
+        }
+        auto end = std::chrono::steady_clock::now();
+        output.encodeMs = std::chrono::duration<double, std::milli>(end - start).count();
+        if (tracer) {
+            tracer->span("compress", start, end, static_cast<int64_t>(output.frame.frameID));
+        }
+
+        std::lock_guard<std::mutex> guard(lock);
+        totals.frames++;
+        totals.storedRaw += output.compressed ? 0 : 1;
+        totals.rawBytes += output.frame.size;
+        totals.encodedBytes += output.encodedBytes;
+        totals.maxEncodeMs = std::max(totals.maxEncodeMs, output.encodeMs);
+        encodeMsTotal += output.encodeMs;
+        job->done = true;
+        jobDone.notify_all();
+        return true;
+    }
+};
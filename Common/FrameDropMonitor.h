@@ -0,0 +1,116 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+// Counts frames the camera exposed but the host never received, as they
+// happen. Camera frame IDs go up by one per exposure, so a step of n > 1
+// between consecutive grabs means n - 1 frames were lost on the way (by the
+// camera, the link or the driver's buffer pool). Frames dropped later, by the
+// write queue, are counted by FrameRing instead.
+//
+// The source's own stream counters (lost, dropped and failed buffers, ...)
+// are kept alongside, carried across camera resets.
+//
+// Call from the capture thread only.
+class FrameDropMonitor
+{
+public:
+    static const size_t LENGTH_BUCKETS = 16;  // Gaps of 1, 2, 3-4, 5-8, ... IDs; the last holds everything longer
+    static const size_t MAX_LISTED_GAPS = 1000;  // Gaps kept individually for the metadata
+
+    struct Gap
+    {
+        uint64_t afterFrameID;   // Last ID received before the gap
+        uint64_t missing;        // IDs skipped
+        uint64_t hostTimestamp;  // When the frame after it arrived, ns since epoch
+    };
+
+    struct Stats
+    {
+        uint64_t received = 0;
+        uint64_t missing = 0;
+        uint64_t gaps = 0;
+        uint64_t longestGap = 0;
+        uint64_t incomplete = 0;
+        uint64_t restarts = 0;  // IDs went backwards: the camera was reset, e.g. by a recovery
+        uint64_t gapLengths[LENGTH_BUCKETS] = {};
+        std::vector<Gap> firstGaps;  // The first MAX_LISTED_GAPS gaps
+        std::map<std::string, int64_t> streamCounters;
+    };
+
+    // Returns how many IDs were skipped just before this frame
+    uint64_t frame(uint64_t frameID, bool incomplete, uint64_t hostTimestamp)
+    {
+        uint64_t skipped = 0;
+        if (current.received > 0) {
+            if (frameID <= lastFrameID) {
+                current.restarts++;
+            }
+            else if (frameID - lastFrameID > 1) {
+                skipped = frameID - lastFrameID - 1;
+                recordGap(skipped, hostTimestamp);
+            }
+        }
+        lastFrameID = frameID;
+        current.received++;
+        current.incomplete += incomplete ? 1 : 0;
+        return skipped;
+    }
+
+    // Latest values of the source's stream counters. Counters restart at zero
+    // when the camera is re-initialised; what they had reached is kept.
+    void streamCounters(const std::map<std::string, int64_t>& latest)
+    {
+        for (const auto& counter : latest) {
+            int64_t& last = lastCounters[counter.first];
+            if (counter.second < last) {
+                counterBase[counter.first] += last;
+            }
+            last = counter.second;
+            current.streamCounters[counter.first] = counterBase[counter.first] + counter.second;
+        }
+    }
+
+    const Stats& stats() const { return current; }
+
+    // "1", "2", "3-4", ... for bucket i of Stats::gapLengths
+    static std::string lengthBucketName(size_t bucket)
+    {
+        if (bucket < 2) {
+            return std::to_string(bucket + 1);
+        }
+        uint64_t low = (uint64_t(1) << (bucket - 1)) + 1;
+        if (bucket + 1 == LENGTH_BUCKETS) {
+            return std::to_string(low) + "+";
+        }
+        return std::to_string(low) + "-" + std::to_string(uint64_t(1) << bucket);
+    }
+
+private:
+    Stats current;
+    uint64_t lastFrameID = 0;
+    std::map<std::string, int64_t> lastCounters;
+    std::map<std::string, int64_t> counterBase;
+
+    void recordGap(uint64_t skipped, uint64_t hostTimestamp)
+    {
+        current.missing += skipped;
+        current.gaps++;
+        if (skipped > current.longestGap) {
+            current.longestGap = skipped;
+        }
+
+        size_t bucket = 0;
+        while (bucket + 1 < LENGTH_BUCKETS && (uint64_t(1) << bucket) < skipped) {
+            bucket++;
+        }
+        current.gapLengths[bucket]++;
+
+        if (current.firstGaps.size() < MAX_LISTED_GAPS) {
+            current.firstGaps.push_back({ lastFrameID, skipped, hostTimestamp });
+        }
+    }
+};
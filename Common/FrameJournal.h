@@ -0,0 +1,366 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "Crc32c.h"
+#include "FileSink.h"
+
+// Append-only binary journal of the frames written to the video file, used
+// to rebuild the session metadata if the recorder dies before writing it.
+//
+//   FileHeader + session JSON   (geometry, pixel format, start time, ...)
+//   BlockHeader + records       } repeated
+//
+// Each record holds a frame's ID, device and host timestamps, and where its
+// payload sits in the video file. Records are stored as zigzag varint deltas
+// from the previous record in the same block (a frame ID step of 1 and a
+// steady timestamp step cost a byte or three each), so a block can be decoded
+// on its own. Blocks carry a CRC-32C; a reader stops at the first block that
+// is damaged or was cut short by a crash and keeps everything before it.
+//
+// All fields are little-endian.
+namespace journal
+{
+    const char FILE_MAGIC[8] = { 'C', 'A', 'M', 'J', 'R', 'N', 'L', '1' };
+    const uint32_t FORMAT_VERSION = 1;
+    const uint32_t BLOCK_MAGIC = 0x4B4C424A;  // "JBLK"
+
+#pragma pack(push, 1)
+    struct FileHeader
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t sessionBytes;  // JSON text that follows the header
+        uint32_t sessionCrc;
+        uint32_t crc;           // Over everything above
+    };
+
+    struct BlockHeader
+    {
+        uint32_t magic;
+        uint32_t recordCount;
+        uint32_t payloadBytes;  // Encoded records that follow
+        uint32_t payloadCrc;
+        uint64_t firstRecord;   // Position of the first record in the whole journal
+        uint32_t headerCrc;     // Over everything above
+    };
+#pragma pack(pop)
+
+    struct Record
+    {
+        uint64_t frameID = 0;
+        uint64_t deviceTimestamp = 0;
+        uint64_t hostTimestamp = 0;   // ns since epoch
+        uint64_t offset = 0;          // Where the frame starts in the video file: its record header in a .camrec, the pixels in a raw .bin
+        uint64_t bytes = 0;           // Payload bytes stored there
+    };
+
+    template <typename T>
+    uint32_t structCrc(const T& value)
+    {
+        // Every struct ends with its own CRC field
+        return crc32c(&value, sizeof(T) - sizeof(uint32_t));
+    }
+
+    inline void putVarint(std::vector<char>& out, uint64_t value)
+    {
+        while (value >= 0x80) {
+            out.push_back(static_cast<char>(value | 0x80));
+            value >>= 7;
+        }
+        out.push_back(static_cast<char>(value));
+    }
+
+    inline bool getVarint(const unsigned char*& p, const unsigned char* end, uint64_t& value)
+    {
+        value = 0;
+        for (int shift = 0; shift < 64 && p < end; shift += 7) {
+            unsigned char byte = *p++;
+            value |= uint64_t(byte & 0x7F) << shift;
+            if (!(byte & 0x80)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Differences wrap, so a counter that resets (camera restart) still round-trips
+    inline void putDelta(std::vector<char>& out, uint64_t value, uint64_t previous)
+    {
+        int64_t delta = static_cast<int64_t>(value - previous);
+        putVarint(out, (static_cast<uint64_t>(delta) << 1) ^ static_cast<uint64_t>(delta >> 63));
+    }
+
+    inline bool getDelta(const unsigned char*& p, const unsigned char* end, uint64_t previous, uint64_t& value)
+    {
+        uint64_t zigzag;
+        if (!getVarint(p, end, zigzag)) {
+            return false;
+        }
+        value = previous + ((zigzag >> 1) ^ (0 - (zigzag & 1)));
+        return true;
+    }
+
+    // Writes the journal into a FileSink. Records are gathered into a block
+    // and written when it holds blockRecords of them or its first record is
+    // older than maxBlockAge, so a crash loses at most that much of the journal.
+    // Call from one thread only.
+    class Writer
+    {
+    public:
+        Writer(FileSink& sink, const std::string& session, size_t blockRecords = 256,
+            std::chrono::milliseconds maxBlockAge = std::chrono::milliseconds(1000))
+            : sink(sink), blockRecords(blockRecords > 0 ? blockRecords : 1), maxBlockAge(maxBlockAge)
+        {
+            FileHeader header = {};
+            memcpy(header.magic, FILE_MAGIC, sizeof(header.magic));
+            header.version = FORMAT_VERSION;
+            header.sessionBytes = static_cast<uint32_t>(session.size());
+            header.sessionCrc = crc32c(session.data(), session.size());
+            header.crc = structCrc(header);
+            ok = sink.write(&header, sizeof(header)) && sink.write(session.data(), session.size()) && sink.flush();
+        }
+
+        bool append(const Record& record)
+        {
+            if (!ok) {
+                return false;
+            }
+            if (blockCount == 0) {
+                blockStart = std::chrono::steady_clock::now();
+                previous = Record();
+            }
+            putDelta(encoded, record.frameID, previous.frameID);
+            putDelta(encoded, record.deviceTimestamp, previous.deviceTimestamp);
+            putDelta(encoded, record.hostTimestamp, previous.hostTimestamp);
+            putDelta(encoded, record.offset, previous.offset + previous.bytes);  // 0 for back-to-back frames
+            putDelta(encoded, record.bytes, previous.bytes);
+            previous = record;
+            blockCount++;
+
+            if (blockCount >= blockRecords) {
+                return flush();
+            }
+            return flushIfDue();
+        }
+
+        // Writes out the block being gathered once it is older than
+        // maxBlockAge; call when idle so a paused session isn't left behind
+        bool flushIfDue()
+        {
+            if (blockCount > 0 && std::chrono::steady_clock::now() - blockStart >= maxBlockAge) {
+                return flush();
+            }
+            return ok;
+        }
+
+        // Writes out the block being gathered, however small
+        bool flush()
+        {
+            if (!ok || blockCount == 0) {
+                return ok;
+            }
+            BlockHeader header = {};
+            header.magic = BLOCK_MAGIC;
+            header.recordCount = static_cast<uint32_t>(blockCount);
+            header.payloadBytes = static_cast<uint32_t>(encoded.size());
+            header.payloadCrc = crc32c(encoded.data(), encoded.size());
+            header.firstRecord = recordCount;
+            header.headerCrc = structCrc(header);
+
+            // One write per block, so an asynchronous sink submits it as a unit
+            block.resize(sizeof(header) + encoded.size());
+            memcpy(block.data(), &header, sizeof(header));
+            memcpy(block.data() + sizeof(header), encoded.data(), encoded.size());
+            ok = sink.write(block.data(), block.size()) && sink.flush();
+
+            recordCount += blockCount;
+            blockCount = 0;
+            encoded.clear();
+            return ok;
+        }
+
+        uint64_t recordsWritten() const { return recordCount; }
+
+    private:
+        FileSink& sink;
+        size_t blockRecords;
+        std::chrono::milliseconds maxBlockAge;
+        std::chrono::steady_clock::time_point blockStart;
+        std::vector<char> encoded;
+        std::vector<char> block;
+        Record previous;
+        size_t blockCount = 0;
+        uint64_t recordCount = 0;
+        bool ok = true;
+    };
+
+    // Appends a block's records to `out`; false, leaving `out` as it was, if they don't decode
+    inline bool decodeBlock(const unsigned char* p, const unsigned char* end, uint32_t count, std::vector<Record>& out)
+    {
+        std::vector<Record> decoded;
+        decoded.reserve(count);
+        Record previous;
+        for (uint32_t i = 0; i < count; ++i) {
+            Record record;
+            if (!getDelta(p, end, previous.frameID, record.frameID) ||
+                !getDelta(p, end, previous.deviceTimestamp, record.deviceTimestamp) ||
+                !getDelta(p, end, previous.hostTimestamp, record.hostTimestamp) ||
+                !getDelta(p, end, previous.offset + previous.bytes, record.offset) ||
+                !getDelta(p, end, previous.bytes, record.bytes)) {
+                return false;
+            }
+            decoded.push_back(record);
+            previous = record;
+        }
+        if (p != end) {
+            return false;
+        }
+        out.insert(out.end(), decoded.begin(), decoded.end());
+        return true;
+    }
+
+    // Reads a whole journal, stopping quietly at a damaged or truncated block
+    class Reader
+    {
+    public:
+        explicit Reader(const std::string& filePath)
+        {
+            std::ifstream file(filePath, std::ios::in | std::ios::binary);
+            if (!file) {
+                throw std::runtime_error("Unable to open journal: " + filePath);
+            }
+            std::vector<char> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+            FileHeader header = {};
+            if (bytes.size() < sizeof(header)) {
+                throw std::runtime_error("Not a frame journal: " + filePath);
+            }
+            memcpy(&header, bytes.data(), sizeof(header));
+            if (memcmp(header.magic, FILE_MAGIC, sizeof(header.magic)) != 0 || header.crc != structCrc(header)) {
+                throw std::runtime_error("Not a frame journal: " + filePath);
+            }
+            if (header.version > FORMAT_VERSION) {
+                throw std::runtime_error("Journal was written by a newer version (format " +
+                    std::to_string(header.version) + "): " + filePath);
+            }
+            size_t offset = sizeof(header);
+            if (bytes.size() - offset < header.sessionBytes ||
+                crc32c(bytes.data() + offset, header.sessionBytes) != header.sessionCrc) {
+                throw std::runtime_error("Journal session header is damaged: " + filePath);
+            }
+            sessionText.assign(bytes.data() + offset, header.sessionBytes);
+            offset += header.sessionBytes;
+
+            while (offset < bytes.size()) {
+                BlockHeader block = {};
+                if (bytes.size() - offset < sizeof(block)) {
+                    break;
+                }
+                memcpy(&block, bytes.data() + offset, sizeof(block));
+                if (block.magic != BLOCK_MAGIC || block.headerCrc != structCrc(block) ||
+                    block.firstRecord != entries.size() ||
+                    bytes.size() - offset - sizeof(block) < block.payloadBytes) {
+                    break;
+                }
+                const unsigned char* p = reinterpret_cast<const unsigned char*>(bytes.data() + offset + sizeof(block));
+                const unsigned char* end = p + block.payloadBytes;
+                if (crc32c(p, block.payloadBytes) != block.payloadCrc || !decodeBlock(p, end, block.recordCount, entries)) {
+                    break;
+                }
+                offset += sizeof(block) + block.payloadBytes;
+            }
+            unreadBytes = bytes.size() - offset;
+        }
+
+        const std::string& session() const { return sessionText; }
+        const std::vector<Record>& records() const { return entries; }
+
+        // Bytes after the last good block: a block cut short by a crash, or damage
+        uint64_t trailingBytes() const { return unreadBytes; }
+
+    private:
+        std::string sessionText;
+        std::vector<Record> entries;
+        uint64_t unreadBytes = 0;
+    };
+
+    // Follows a journal that is still being written. Each poll() reads only
+    // what was added since the last one. A block that is cut short or fails
+    // its CRC may just be half written, so it is tried again on the next
+    // poll instead of ending the journal there.
+    class Tail
+    {
+    public:
+        // Throws std::runtime_error until the file and its session header are there
+        explicit Tail(const std::string& filePath)
+            : file(filePath, std::ios::in | std::ios::binary)
+        {
+            if (!file) {
+                throw std::runtime_error("Unable to open journal: " + filePath);
+            }
+            FileHeader header = {};
+            if (!readAt(0, &header, sizeof(header)) ||
+                memcmp(header.magic, FILE_MAGIC, sizeof(header.magic)) != 0 || header.crc != structCrc(header)) {
+                throw std::runtime_error("Not a frame journal (yet): " + filePath);
+            }
+            if (header.version > FORMAT_VERSION) {
+                throw std::runtime_error("Journal was written by a newer version (format " +
+                    std::to_string(header.version) + "): " + filePath);
+            }
+            sessionText.resize(header.sessionBytes);
+            if (!readAt(sizeof(header), &sessionText[0], sessionText.size()) ||
+                crc32c(sessionText.data(), sessionText.size()) != header.sessionCrc) {
+                throw std::runtime_error("Journal session header is damaged: " + filePath);
+            }
+            position = sizeof(header) + header.sessionBytes;
+        }
+
+        const std::string& session() const { return sessionText; }
+
+        // Appends the records of every whole block added since the last call;
+        // returns how many
+        size_t poll(std::vector<Record>& out)
+        {
+            size_t before = out.size();
+            BlockHeader block = {};
+            while (readAt(position, &block, sizeof(block))) {
+                if (block.magic != BLOCK_MAGIC || block.headerCrc != structCrc(block) || block.firstRecord != recordCount) {
+                    break;
+                }
+                payload.resize(block.payloadBytes);
+                if (!readAt(position + sizeof(block), payload.data(), payload.size())) {
+                    break;
+                }
+                const unsigned char* p = reinterpret_cast<const unsigned char*>(payload.data());
+                if (crc32c(p, payload.size()) != block.payloadCrc || !decodeBlock(p, p + payload.size(), block.recordCount, out)) {
+                    break;
+                }
+                position += sizeof(block) + block.payloadBytes;
+                recordCount += block.recordCount;
+            }
+            return out.size() - before;
+        }
+
+    private:
+        std::ifstream file;
+        std::string sessionText;
+        std::vector<char> payload;
+        uint64_t position = 0;
+        uint64_t recordCount = 0;
+
+        bool readAt(uint64_t offset, void* data, size_t size)
+        {
+            file.clear();  // A read that ran into the end of the file last time
+            file.seekg(static_cast<std::streamoff>(offset));
+            file.read(static_cast<char*>(data), static_cast<std::streamsize>(size));
+            return file.gcount() == static_cast<std::streamsize>(size);
+        }
+    };
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+// One 8-bit image in the mailbox
+struct MailboxFrame
+{
+    std::vector<uint8_t> pixels;
+    size_t width = 0;
+    size_t height = 0;
+    uint64_t frameID = 0;
+};
+
+// Single-slot "latest frame wins" hand-off between one producer and one
+// consumer, for the preview.
+//
+// Three buffers rotate between the producer (back), the slot (ready) and the
+// consumer (front). publish() swaps the back buffer into the slot and
+// take() swaps the slot into the front, each with one atomic exchange, so
+// neither side ever waits for the other. A frame the consumer hasn't taken
+// yet is simply replaced by the next one.
+class FrameMailbox
+{
+public:
+    struct Stats
+    {
+        uint64_t published = 0;
+        uint64_t taken = 0;
+        uint64_t overwritten = 0;  // Published but replaced before the consumer got to it
+    };
+
+    // Producer: the buffer to fill before calling publish()
+    MailboxFrame& back()
+    {
+        return frames[backIndex];
+    }
+
+    void publish()
+    {
+        unsigned previous = ready.exchange(backIndex | FRESH, std::memory_order_acq_rel);
+        backIndex = previous & INDEX;
+        published.fetch_add(1, std::memory_order_relaxed);
+        if (previous & FRESH) {
+            overwritten.fetch_add(1, std::memory_order_relaxed);
+        }
+        // Not under the lock, so the producer never blocks on the consumer. A
+        // wakeup that races with the consumer going to sleep is lost, which
+        // only delays that frame until take()'s timeout.
+        arrived.notify_one();
+    }
+
+    // Consumer: the newest frame, or null if none arrives within timeout or
+    // the mailbox is closed. Valid until the next take().
+    const MailboxFrame* take(std::chrono::milliseconds timeout)
+    {
+        if (!(ready.load(std::memory_order_acquire) & FRESH)) {
+            std::unique_lock<std::mutex> guard(lock);
+            arrived.wait_for(guard, timeout, [&] {
+                return closed.load(std::memory_order_acquire) || (ready.load(std::memory_order_acquire) & FRESH) != 0;
+            });
+        }
+        if (closed.load(std::memory_order_acquire) || !(ready.load(std::memory_order_acquire) & FRESH)) {
+            return nullptr;
+        }
+        // Only take() clears FRESH, so the slot still holds a fresh frame here
+        unsigned previous = ready.exchange(frontIndex, std::memory_order_acq_rel);
+        frontIndex = previous & INDEX;
+        taken.fetch_add(1, std::memory_order_relaxed);
+        return &frames[frontIndex];
+    }
+
+    void close()
+    {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            closed.store(true, std::memory_order_release);
+        }
+        arrived.notify_all();
+    }
+
+    bool isClosed() const
+    {
+        return closed.load(std::memory_order_acquire);
+    }
+
+    Stats stats() const
+    {
+        Stats s;
+        s.published = published.load(std::memory_order_relaxed);
+        s.taken = taken.load(std::memory_order_relaxed);
+        s.overwritten = overwritten.load(std::memory_order_relaxed);
+        return s;
+    }
+
+private:
+    static const unsigned INDEX = 3;
+    static const unsigned FRESH = 4;  // Set while the slot holds a frame nobody has taken
+
+    MailboxFrame frames[3];
+    unsigned backIndex = 0;                  // Producer only
+    unsigned frontIndex = 1;                 // Consumer only
+    std::atomic<unsigned> ready{ 2 };
+
+    std::mutex lock;
+    std::condition_variable arrived;
+    std::atomic<bool> closed{ false };
+
+    std::atomic<uint64_t> published{ 0 };
+    std::atomic<uint64_t> taken{ 0 };
+    std::atomic<uint64_t> overwritten{ 0 };
+};
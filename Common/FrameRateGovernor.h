@@ -0,0 +1,276 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "FrameSource.h"
+
+// Makes sure the frame rate asked for is the frame rate recorded. Left to
+// itself, auto-exposure in a dim rig lengthens the exposure past the frame
+// period (5.88 ms at 170 fps) and the camera quietly slows down to fit it.
+//
+// Before recording, limitsFor() works out the longest exposure the requested
+// rate leaves room for; the camera is told to make up the rest of the light
+// with gain, up to a limit. While recording, the governor measures the rate
+// the camera delivers (from frame IDs and camera timestamps, so host jitter
+// doesn't count) and the rate frames reach the host, once a second, and logs
+// every stretch where either falls short.
+//
+// Call from the capture thread only.
+class FrameRateGovernor
+{
+public:
+    static constexpr double EXPOSURE_MARGIN = 0.03;          // Share of the frame period kept clear of the exposure...
+    static constexpr double MIN_EXPOSURE_MARGIN_US = 100.0;  // ...but no less than this
+    static constexpr double CAMERA_TOLERANCE = 0.01;    // Camera rate more than 1% short is a deviation
+    static constexpr double RECORDED_TOLERANCE = 0.02;  // Frames reaching the host: 2%, plus one frame for window edges
+    static const size_t MAX_LISTED_DEVIATIONS = 1000;   // Deviations kept individually for the metadata
+
+    struct Limits
+    {
+        double framePeriodUs = 0;
+        double readoutUs = 0;              // Sensor readout time, 0 if the camera doesn't say
+        double exposureLowerLimitUs = 0;
+        double exposureUpperLimitUs = 0;
+        double gainUpperLimitDb = 0;
+        bool reachable = true;             // False if the readout alone takes longer than a frame
+    };
+
+    // Limits for recording at fps. cameraMaxExposureUs is the camera's own
+    // maximum exposure once the frame rate is set, which allows for its
+    // readout on models that overlap exposure with it; the frame period less
+    // a margin bounds models that don't. The lower limit comes down if it no
+    // longer fits, and the gain limit is kept within the camera's range.
+    static Limits limitsFor(double fps, double readoutUs, double cameraMinExposureUs, double cameraMaxExposureUs,
+        double lowerLimitUs, double gainLimitDb, double cameraMaxGainDb)
+    {
+        Limits limits;
+        limits.framePeriodUs = fps > 0 ? 1e6 / fps : 0;
+        limits.readoutUs = readoutUs;
+        limits.reachable = fps <= 0 || readoutUs <= limits.framePeriodUs;
+
+        double upper = cameraMaxExposureUs;
+        if (fps > 0) {
+            double margin = std::max(MIN_EXPOSURE_MARGIN_US, limits.framePeriodUs * EXPOSURE_MARGIN);
+            upper = std::min(upper, limits.framePeriodUs - margin);
+        }
+        limits.exposureUpperLimitUs = std::max(upper, cameraMinExposureUs);
+        limits.exposureLowerLimitUs = std::min(std::max(lowerLimitUs, cameraMinExposureUs), limits.exposureUpperLimitUs);
+        limits.gainUpperLimitDb = std::min(std::max(gainLimitDb, 0.0), cameraMaxGainDb);
+        return limits;
+    }
+
+    struct Deviation
+    {
+        uint64_t hostTimestamp = 0;    // When it was first seen, ns since epoch
+        std::string cause;             // "camera": the camera slowed down; "lost": frames didn't reach the host
+        double durationS = 0;
+        double lowestCameraFps = 0;
+        double lowestRecordedFps = 0;
+        double longestExposureUs = 0;  // While it lasted; 0 if the source doesn't report exposure
+        double highestGainDb = 0;
+        bool ended = false;
+    };
+
+    struct Stats
+    {
+        double requestedFps = 0;
+        double cameraFps = 0;          // Over the whole session
+        double recordedFps = 0;
+        double lowestCameraFps = 0;    // Of any one-second window
+        double lowestRecordedFps = 0;
+        uint64_t deviations = 0;
+        double secondsShort = 0;       // Time spent in deviations
+        std::vector<Deviation> listed; // The first MAX_LISTED_DEVIATIONS
+    };
+
+    explicit FrameRateGovernor(double fps)
+    {
+        current.requestedFps = fps;
+    }
+
+    // Every grabbed frame, complete or not
+    void frame(uint64_t frameID, uint64_t deviceTimestamp, uint64_t steadyTimestamp)
+    {
+        if (received == 0) {
+            firstSteadyNs = steadyTimestamp;
+        }
+        received++;
+        lastSteadyNs = steadyTimestamp;
+
+        if (haveWindowFrame && (frameID <= lastFrameID || deviceTimestamp <= lastDeviceNs)) {
+            // The camera was reset; measure from here, keeping what was measured so far
+            closeCameraSpan();
+            haveWindowFrame = false;
+        }
+        if (!haveWindowFrame) {
+            windowFrameID = frameID;
+            windowDeviceNs = deviceTimestamp;
+            haveWindowFrame = true;
+        }
+        lastFrameID = frameID;
+        lastDeviceNs = deviceTimestamp;
+    }
+
+    // Measures the window since the last call and starts a new one. Returns
+    // true when a deviation started or ended; it is then lastChange().
+    bool check(uint64_t steadyTimestamp, uint64_t hostTimestamp, const ExposureState* exposure)
+    {
+        if (current.requestedFps <= 0) {
+            return false;  // No rate asked for, so nothing to fall short of
+        }
+        if (windowSteadyNs == 0) {
+            startWindow(steadyTimestamp);
+            return false;
+        }
+
+        double windowS = (steadyTimestamp - windowSteadyNs) / 1e9;
+        double expected = current.requestedFps * windowS;
+        uint64_t frames = received - windowReceived;
+        double recordedFps = windowS > 0 ? frames / windowS : 0;
+        bool recordedShort = frames + 1 < expected * (1.0 - RECORDED_TOLERANCE);
+
+        double cameraFps = 0;
+        bool cameraMeasured = haveWindowFrame && lastFrameID > windowFrameID && lastDeviceNs > windowDeviceNs;
+        if (cameraMeasured) {
+            cameraFps = (lastFrameID - windowFrameID) * 1e9 / (lastDeviceNs - windowDeviceNs);
+            current.lowestCameraFps = current.lowestCameraFps > 0 ? std::min(current.lowestCameraFps, cameraFps) : cameraFps;
+        }
+        bool cameraShort = cameraMeasured && cameraFps < current.requestedFps * (1.0 - CAMERA_TOLERANCE);
+        current.lowestRecordedFps = measuredWindows == 0 ? recordedFps : std::min(current.lowestRecordedFps, recordedFps);
+        measuredWindows++;
+
+        bool changed = false;
+        if (cameraShort || recordedShort) {
+            if (!inDeviation) {
+                inDeviation = true;
+                changed = true;
+                ongoing = Deviation();
+                ongoing.hostTimestamp = hostTimestamp;
+                ongoing.lowestCameraFps = cameraMeasured ? cameraFps : 0;
+                ongoing.lowestRecordedFps = recordedFps;
+                deviationStartNs = windowSteadyNs;
+                current.deviations++;
+            }
+            if (cameraShort) {
+                ongoing.cause = "camera";
+                ongoing.lowestCameraFps = ongoing.lowestCameraFps > 0 ? std::min(ongoing.lowestCameraFps, cameraFps) : cameraFps;
+            }
+            else if (ongoing.cause.empty()) {
+                ongoing.cause = "lost";
+            }
+            ongoing.lowestRecordedFps = std::min(ongoing.lowestRecordedFps, recordedFps);
+            if (exposure) {
+                ongoing.longestExposureUs = std::max(ongoing.longestExposureUs, exposure->exposureUs);
+                ongoing.highestGainDb = std::max(ongoing.highestGainDb, exposure->gainDb);
+            }
+            ongoing.durationS = (steadyTimestamp - deviationStartNs) / 1e9;
+            current.secondsShort += windowS;
+            last = ongoing;
+        }
+        else if (inDeviation) {
+            endDeviation(true);
+            changed = true;
+        }
+
+        windowCameraFps = cameraFps;
+        windowRecordedFps = recordedFps;
+        startWindow(steadyTimestamp);
+        return changed;
+    }
+
+    // The session is over; a deviation still going is listed as it stands
+    void finish()
+    {
+        if (inDeviation) {
+            endDeviation(false);
+        }
+        closeCameraSpan();
+        haveWindowFrame = false;
+    }
+
+    bool deviating() const { return inDeviation; }
+    const Deviation& lastChange() const { return last; }
+    double lastCameraFps() const { return windowCameraFps; }      // Of the last window; 0 if not measured
+    double lastRecordedFps() const { return windowRecordedFps; }
+
+    Stats stats() const
+    {
+        Stats stats = current;
+        uint64_t frames = cameraFrames;
+        uint64_t ns = cameraNs;
+        if (spanStarted && lastFrameID > spanFrameID && lastDeviceNs > spanDeviceNs) {
+            frames += lastFrameID - spanFrameID;
+            ns += lastDeviceNs - spanDeviceNs;
+        }
+        stats.cameraFps = ns > 0 ? frames * 1e9 / ns : 0;
+        stats.recordedFps = lastSteadyNs > firstSteadyNs ? (received - 1) * 1e9 / (lastSteadyNs - firstSteadyNs) : 0;
+        return stats;
+    }
+
+private:
+    Stats current;
+    uint64_t received = 0;
+    uint64_t firstSteadyNs = 0;
+    uint64_t lastSteadyNs = 0;
+    uint64_t measuredWindows = 0;
+
+    // Since the last check
+    uint64_t windowSteadyNs = 0;
+    uint64_t windowReceived = 0;
+    bool haveWindowFrame = false;
+    uint64_t windowFrameID = 0;
+    uint64_t windowDeviceNs = 0;
+    uint64_t lastFrameID = 0;
+    uint64_t lastDeviceNs = 0;
+    double windowCameraFps = 0;
+    double windowRecordedFps = 0;
+
+    // Camera time and frames since the last reset, and before it, for the session rate
+    uint64_t spanFrameID = 0;
+    uint64_t spanDeviceNs = 0;
+    bool spanStarted = false;
+    uint64_t cameraFrames = 0;
+    uint64_t cameraNs = 0;
+
+    bool inDeviation = false;
+    Deviation ongoing;
+    Deviation last;
+    uint64_t deviationStartNs = 0;
+
+    void startWindow(uint64_t steadyTimestamp)
+    {
+        windowSteadyNs = steadyTimestamp;
+        windowReceived = received;
+        if (haveWindowFrame) {
+            if (!spanStarted) {
+                spanFrameID = windowFrameID;
+                spanDeviceNs = windowDeviceNs;
+                spanStarted = true;
+            }
+            windowFrameID = lastFrameID;
+            windowDeviceNs = lastDeviceNs;
+        }
+    }
+
+    void closeCameraSpan()
+    {
+        if (spanStarted && lastFrameID > spanFrameID && lastDeviceNs > spanDeviceNs) {
+            cameraFrames += lastFrameID - spanFrameID;
+            cameraNs += lastDeviceNs - spanDeviceNs;
+        }
+        spanStarted = false;
+    }
+
+    void endDeviation(bool ended)
+    {
+        ongoing.ended = ended;
+        if (current.listed.size() < MAX_LISTED_DEVIATIONS) {
+            current.listed.push_back(ongoing);
+        }
+        last = ongoing;
+        inDeviation = false;
+    }
+};
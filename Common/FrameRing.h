@@ -0,0 +1,276 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+// What the acquisition thread does when every slot in the ring is occupied
+enum class RingFullPolicy
+{
+    Block,       // Wait for the writer thread to free a slot
+    DropNewest,  // Discard the frame that was just acquired
+    DropOldest   // Overwrite the oldest frame the writer has not picked up yet
+};
+
+inline const char* ringFullPolicyName(RingFullPolicy policy)
+{
+    switch (policy) {
+    case RingFullPolicy::Block: return "block";
+    case RingFullPolicy::DropNewest: return "drop_newest";
+    case RingFullPolicy::DropOldest: return "drop_oldest";
+    }
+    return "unknown";
+}
+
+inline bool parseRingFullPolicy(const std::string& name, RingFullPolicy& policy)
+{
+    if (name == "block") policy = RingFullPolicy::Block;
+    else if (name == "drop_newest") policy = RingFullPolicy::DropNewest;
+    else if (name == "drop_oldest") policy = RingFullPolicy::DropOldest;
+    else return false;
+    return true;
+}
+
+// One frame buffer in the ring. The buffer is allocated once up front and
+// reused, so the acquisition thread never allocates while recording.
+struct FrameSlot
+{
+    uint64_t frameID = 0;
+    uint64_t timestamp = 0;  // Device timestamp (ns)
+    uint64_t hostTimestamp = 0;  // Host clock when the frame was acquired (ns since epoch)
+    uint64_t steadyTimestamp = 0;  // Host steady clock at the same moment (ns)
+    size_t size = 0;         // Number of valid bytes in data
+    std::vector<char> data;
+};
+
+// Bounded single-producer/single-consumer frame ring.
+//
+// Each slot carries its own state and the sequence number of the frame it
+// holds, so the producer can reclaim the oldest unread slot (DropOldest)
+// without a lock: when the consumer finds a newer sequence than it expected
+// it skips forward to the oldest frame still in the ring.
+class FrameRing
+{
+public:
+    struct Stats
+    {
+        size_t capacity = 0;
+        size_t depth = 0;
+        size_t highWater = 0;
+        uint64_t pushed = 0;
+        uint64_t popped = 0;
+        uint64_t droppedNewest = 0;
+        uint64_t droppedOldest = 0;
+        double blockedMs = 0.0;  // Time the producer spent waiting (Block policy)
+    };
+
+    FrameRing(size_t capacity, size_t slotBytes, RingFullPolicy policy)
+        : capacity(capacity < 2 ? 2 : capacity), policy(policy),
+        slots(new Slot[capacity < 2 ? 2 : capacity])
+    {
+        for (size_t i = 0; i < this->capacity; ++i) {
+            slots[i].frame.data.resize(slotBytes);  // Touch the memory now rather than mid-session
+        }
+    }
+
+    FrameRing(const FrameRing&) = delete;
+    FrameRing& operator=(const FrameRing&) = delete;
+
+    // Producer: returns a slot to fill, or nullptr if the frame has to be
+    // dropped (or the ring was closed). Every nullptr return while open is
+    // counted as a dropped frame.
+    FrameSlot* beginWrite()
+    {
+        const uint64_t w = writeIndex.load(std::memory_order_relaxed);
+        Slot& slot = slots[w % capacity];
+        auto blockStart = std::chrono::steady_clock::time_point();
+        unsigned spins = 0;
+
+        for (;;) {
+            uint32_t expected = SlotFree;
+            if (slot.state.compare_exchange_strong(expected, SlotWriting, std::memory_order_acquire)) {
+                break;
+            }
+
+            if (expected == SlotReady && policy == RingFullPolicy::DropOldest) {
+                if (slot.state.compare_exchange_strong(expected, SlotWriting, std::memory_order_acquire)) {
+                    droppedOldest.fetch_add(1, std::memory_order_relaxed);
+                    break;
+                }
+                continue;  // The writer claimed it in the meantime; look again
+            }
+
+            // The slot holds an unread frame or the writer is busy with it
+            if (policy != RingFullPolicy::Block || closed.load(std::memory_order_acquire)) {
+                droppedNewest.fetch_add(1, std::memory_order_relaxed);
+                return nullptr;
+            }
+
+            if (spins == 0) {
+                blockStart = std::chrono::steady_clock::now();
+            }
+            backoff(spins++);
+        }
+
+        if (spins > 0) {
+            auto waited = std::chrono::steady_clock::now() - blockStart;
+            blockedNs.fetch_add(static_cast<uint64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(waited).count()),
+                std::memory_order_relaxed);
+        }
+
+        slot.sequence = w;
+        return &slot.frame;
+    }
+
+    // Producer: publish the slot returned by the last beginWrite()
+    void commitWrite()
+    {
+        const uint64_t w = writeIndex.load(std::memory_order_relaxed);
+        slots[w % capacity].state.store(SlotReady, std::memory_order_release);
+        writeIndex.store(w + 1, std::memory_order_release);
+
+        uint64_t r = readIndex.load(std::memory_order_acquire);
+        size_t depth = static_cast<size_t>(w + 1 > r ? w + 1 - r : 0);
+        if (depth > capacity) depth = capacity;
+        if (depth > highWater.load(std::memory_order_relaxed)) {
+            highWater.store(depth, std::memory_order_relaxed);
+        }
+    }
+
+    // Consumer: wait up to timeout for the next frame in order. Returns
+    // nullptr on timeout, or once the ring is closed and fully drained.
+    FrameSlot* beginRead(std::chrono::milliseconds timeout)
+    {
+        uint64_t r = readIndex.load(std::memory_order_relaxed);
+        const auto deadline = std::chrono::steady_clock::now() + timeout;
+        unsigned spins = 0;
+
+        for (;;) {
+            if (r < writeIndex.load(std::memory_order_acquire)) {
+                Slot& slot = slots[r % capacity];
+                uint32_t expected = SlotReady;
+                if (slot.state.compare_exchange_strong(expected, SlotReading, std::memory_order_acquire)) {
+                    if (slot.sequence == r) {
+                        return &slot.frame;
+                    }
+
+                    // The producer overwrote frames we had not read yet. The
+                    // slot now holds the newest frame; resume from the oldest
+                    // one that is still in the ring.
+                    uint64_t oldest = slot.sequence - capacity + 1;
+                    slot.state.store(SlotReady, std::memory_order_release);
+                    r = oldest;
+                    readIndex.store(r, std::memory_order_release);
+                    continue;
+                }
+
+                // The producer is overwriting this slot right now
+                std::this_thread::yield();
+                continue;
+            }
+
+            if (closed.load(std::memory_order_acquire) && r >= writeIndex.load(std::memory_order_acquire)) {
+                return nullptr;
+            }
+            if (std::chrono::steady_clock::now() >= deadline) {
+                return nullptr;
+            }
+            backoff(spins++);
+        }
+    }
+
+    // Consumer: hand the slot returned by the last beginRead() back to the producer
+    void endRead()
+    {
+        const uint64_t r = readIndex.load(std::memory_order_relaxed);
+        slots[r % capacity].state.store(SlotFree, std::memory_order_release);
+        readIndex.store(r + 1, std::memory_order_release);
+        popped.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Stop accepting frames. The consumer keeps receiving what is already queued.
+    void close()
+    {
+        closed.store(true, std::memory_order_release);
+    }
+
+    bool isClosed() const
+    {
+        return closed.load(std::memory_order_acquire);
+    }
+
+    // True once the ring is closed and everything queued has been consumed
+    bool drained() const
+    {
+        return isClosed() &&
+            readIndex.load(std::memory_order_acquire) >= writeIndex.load(std::memory_order_acquire);
+    }
+
+    size_t depth() const
+    {
+        uint64_t w = writeIndex.load(std::memory_order_acquire);
+        uint64_t r = readIndex.load(std::memory_order_acquire);
+        size_t d = static_cast<size_t>(w > r ? w - r : 0);
+        return d > capacity ? capacity : d;
+    }
+
+    // Fraction of the ring in use, 0 to 1
+    double fill() const
+    {
+        return double(depth()) / capacity;
+    }
+
+    Stats stats() const
+    {
+        Stats s;
+        s.capacity = capacity;
+        s.depth = depth();
+        s.highWater = highWater.load(std::memory_order_relaxed);
+        s.pushed = writeIndex.load(std::memory_order_acquire);
+        s.popped = popped.load(std::memory_order_relaxed);
+        s.droppedNewest = droppedNewest.load(std::memory_order_relaxed);
+        s.droppedOldest = droppedOldest.load(std::memory_order_relaxed);
+        s.blockedMs = blockedNs.load(std::memory_order_relaxed) / 1e6;
+        return s;
+    }
+
+    RingFullPolicy fullPolicy() const { return policy; }
+
+private:
+    enum : uint32_t { SlotFree, SlotWriting, SlotReady, SlotReading };
+
+    struct Slot
+    {
+        std::atomic<uint32_t> state{ SlotFree };
+        uint64_t sequence = 0;  // Guarded by state: written while Writing, read while Reading
+        FrameSlot frame;
+    };
+
+    static void backoff(unsigned spins)
+    {
+        if (spins < 64) {
+            std::this_thread::yield();
+        }
+        else {
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+        }
+    }
+
+    const size_t capacity;
+    const RingFullPolicy policy;
+    std::unique_ptr<Slot[]> slots;
+
+    alignas(64) std::atomic<uint64_t> writeIndex{ 0 };
+    alignas(64) std::atomic<uint64_t> readIndex{ 0 };
+    alignas(64) std::atomic<size_t> highWater{ 0 };
+    std::atomic<uint64_t> droppedNewest{ 0 };
+    std::atomic<uint64_t> droppedOldest{ 0 };
+    std::atomic<uint64_t> blockedNs{ 0 };
+    alignas(64) std::atomic<uint64_t> popped{ 0 };
+    std::atomic<bool> closed{ false };
+};
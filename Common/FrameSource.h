@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+
+// One frame handed out by a FrameSource. The pixel data stays valid until the
+// frame is given back with FrameSource::releaseFrame().
+struct GrabbedFrame
+{
+    const void* data = nullptr;
+    size_t size = 0;         // Bytes of pixel data
+    size_t stride = 0;       // Bytes per row
+    uint64_t frameID = 0;
+    uint64_t timestamp = 0;  // Device timestamp (ns)
+    bool incomplete = false;
+    void* handle = nullptr;  // Owned by the source
+};
+
+// A camera's automatic exposure as last read, with the limits it was given
+struct ExposureState
+{
+    double exposureUs = 0;
+    double gainDb = 0;
+    double resultingFrameRate = 0;    // The rate the camera says its settings allow; 0 if unknown
+    double exposureUpperLimitUs = 0;  // 0 if not limited
+    double gainUpperLimitDb = 0;
+};
+
+// Where the capture loop gets its frames from: a real camera, a synthetic
+// generator or a replay of an earlier recording.
+//
+// Sources report camera errors by throwing (std::exception or a subclass such
+// as Spinnaker::Exception); the capture loop decides whether to recover().
+class FrameSource
+{
+public:
+    virtual ~FrameSource() = default;
+
+    virtual size_t width() const = 0;
+    virtual size_t height() const = 0;
+    virtual std::string pixelFormat() const = 0;
+
+    // Rate frames are delivered at (frames/s)
+    virtual double frameRate() const = 0;
+
+    // Human readable name used in logs and metadata
+    virtual std::string description() const = 0;
+
+    virtual void beginAcquisition() = 0;
+    virtual void endAcquisition() = 0;
+
+    // Wait up to timeoutMs for the next frame. Returns false if none arrived.
+    virtual bool grabFrame(GrabbedFrame& frame, uint64_t timeoutMs) = 0;
+    virtual void releaseFrame(GrabbedFrame& frame) = 0;
+
+    // Stop and start the stream without touching the device's settings: the
+    // cheap fix for a stalled stream. False if it couldn't be restarted.
+    virtual bool restartStream()
+    {
+        endAcquisition();
+        beginAcquisition();
+        return true;
+    }
+
+    // Bring the source back into a working state after an error, from scratch
+    // (for a camera: re-initialise it and reapply its settings)
+    virtual bool recover() = 0;
+
+    // True once a finite source (e.g. a replay) has delivered its last frame
+    virtual bool finished() const { return false; }
+
+    // The source's own counters for its stream (buffers lost, dropped, ...), by
+    // name. Cheap enough to poll about once a second. Empty if it keeps none.
+    virtual std::map<std::string, int64_t> streamCounters() { return {}; }
+
+    // Reads the clock the frames' device timestamps come from, right now (ns).
+    // False if the source has no such clock.
+    virtual bool latchTimestamp(uint64_t&) { return false; }
+
+    // Current exposure and gain. Cheap enough to poll about once a second.
+    // False if the source has no exposure to report.
+    virtual bool exposureState(ExposureState&) { return false; }
+};
+
+// Bytes per pixel for the pixel formats the recording path supports
+inline size_t bytesPerPixel(const std::string& pixelFormat)
+{
+    if (pixelFormat == "Mono16" || pixelFormat == "BayerRG16") {
+        return 2;
+    }
+    return 1;  // Mono8, BayerRG8
+}
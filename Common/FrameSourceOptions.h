@@ -0,0 +1,120 @@
+#pragma once
+
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include "FrameSource.h"
+#include "SpinnakerFrameSource.h"
+#include "SyntheticFrameSource.h"
+#include "ReplayFrameSource.h"
+
+enum class FrameSourceType
+{
+    Camera,
+    Synthetic,
+    Replay
+};
+
+inline const char* frameSourceTypeName(FrameSourceType type)
+{
+    switch (type) {
+    case FrameSourceType::Camera: return "camera";
+    case FrameSourceType::Synthetic: return "synthetic";
+    case FrameSourceType::Replay: return "replay";
+    }
+    return "unknown";
+}
+
+struct FrameSourceOptions
+{
+    FrameSourceType type = FrameSourceType::Camera;
+    SyntheticSourceConfig synthetic;
+    std::string replayBinaryPath;
+    std::string replayMetadataPath;
+    double maxGainDb = 18.0;  // Most gain auto-exposure may add once the exposure is at its limit (camera only)
+};
+
+// Handles the --source, --sim_*, --replay_* and --max_gain command-line options. Returns
+// false if arg is not one of them; throws on a bad value.
+inline bool parseFrameSourceOption(const std::string& arg, const std::string& value, FrameSourceOptions& options)
+{
+    if (arg == "--source") {
+        if (value == "camera") options.type = FrameSourceType::Camera;
+        else if (value == "synthetic") options.type = FrameSourceType::Synthetic;
+        else if (value == "replay") options.type = FrameSourceType::Replay;
+        else throw std::invalid_argument("--source must be camera, synthetic or replay");
+    }
+    else if (arg == "--sim_width") {
+        options.synthetic.width = std::stoul(value);
+    }
+    else if (arg == "--sim_height") {
+        options.synthetic.height = std::stoul(value);
+    }
+    else if (arg == "--sim_format") {
+        options.synthetic.pixelFormat = value;
+    }
+    else if (arg == "--sim_incomplete_every") {
+        options.synthetic.incompleteEvery = std::stoull(value);
+    }
+    else if (arg == "--sim_gap_every") {
+        options.synthetic.gapEvery = std::stoull(value);
+    }
+    else if (arg == "--sim_gap_length") {
+        options.synthetic.gapLength = std::stoull(value);
+    }
+    else if (arg == "--sim_stall_every") {
+        options.synthetic.stallEvery = std::stoull(value);
+    }
+    else if (arg == "--sim_stall_needs_reinit") {
+        options.synthetic.stallNeedsReinit = std::stoi(value) != 0;
+    }
+    else if (arg == "--sim_error_every") {
+        options.synthetic.errorEvery = std::stoull(value);
+    }
+    else if (arg == "--sim_restart_ms") {
+        options.synthetic.restartMs = std::stoull(value);
+    }
+    else if (arg == "--sim_reinit_ms") {
+        options.synthetic.reinitMs = std::stoull(value);
+    }
+    else if (arg == "--sim_exposure_us") {
+        options.synthetic.exposureUs = std::stod(value);
+    }
+    else if (arg == "--sim_buffer_frames") {
+        options.synthetic.bufferFrames = std::stoull(value);
+    }
+    else if (arg == "--replay_bin") {
+        options.replayBinaryPath = value;
+    }
+    else if (arg == "--replay_metadata") {
+        options.replayMetadataPath = value;
+    }
+    else if (arg == "--max_gain") {
+        options.maxGainDb = std::stod(value);
+    }
+    else {
+        return false;
+    }
+    return true;
+}
+
+inline std::unique_ptr<FrameSource> createFrameSource(const FrameSourceOptions& options,
+    const std::string& serialNumber, double frameRate)
+{
+    switch (options.type) {
+    case FrameSourceType::Synthetic: {
+        SyntheticSourceConfig config = options.synthetic;
+        config.fps = frameRate;
+        return std::make_unique<SyntheticFrameSource>(config);
+    }
+    case FrameSourceType::Replay:
+        if (options.replayBinaryPath.empty() ||
+            (options.replayMetadataPath.empty() && !camrec::RecordingReader::isRecording(options.replayBinaryPath))) {
+            throw std::invalid_argument("The replay source needs --replay_bin (and --replay_metadata for a legacy .bin)");
+        }
+        return std::make_unique<ReplayFrameSource>(options.replayBinaryPath, options.replayMetadataPath);
+    case FrameSourceType::Camera:
+    default:
+        return std::make_unique<SpinnakerFrameSource>(serialNumber, frameRate, options.maxGainDb);
+    }
+}
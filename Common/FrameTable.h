@@ -0,0 +1,235 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "Crc32c.h"
+#include "FileSink.h"
+#include "MappedFile.h"
+
+// Per-frame table of a session (_frames.camtable), stored by column so a
+// reader that wants only the frame IDs touches only the frame IDs. It
+// replaces the frame_IDs array that used to make up most of the JSON.
+//
+//   FileHeader
+//   ChunkHeader + frame IDs[rows] + device timestamps[rows] + host timestamps[rows]
+//               + host steady clock[rows]
+//   ...
+//
+// The writer appends a chunk every chunkRows frames, so the table grows on
+// disk during capture instead of being held in memory until the end. Every
+// chunk but the last holds exactly chunkRows rows, so row i is found without
+// an index. A chunk cut short by a crash fails its CRC and is ignored.
+// Version 1 tables have no steady clock column; it reads as 0.
+//
+// All fields are little-endian.
+namespace frametable
+{
+    const char FILE_MAGIC[8] = { 'C', 'A', 'M', 'T', 'B', 'L', '0', '1' };
+    const uint32_t FORMAT_VERSION = 2;
+    const uint32_t CHUNK_MAGIC = 0x4B4E4843;  // "CHNK"
+    const uint32_t DEFAULT_CHUNK_ROWS = 4096;
+
+    enum Column
+    {
+        FrameID = 0,
+        DeviceTimestamp = 1,  // Camera clock, ns
+        HostTimestamp = 2,    // ns since epoch
+        SteadyTimestamp = 3,  // Host steady clock, ns; 0 where unknown
+        COLUMN_COUNT = 4
+    };
+    const uint32_t MIN_COLUMNS = 3;  // Version 1
+
+#pragma pack(push, 1)
+    struct FileHeader
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t columnCount;
+        uint32_t chunkRows;
+        uint32_t crc;         // Over everything above
+    };
+
+    struct ChunkHeader
+    {
+        uint32_t magic;
+        uint32_t rows;
+        uint64_t firstRow;
+        uint32_t columnsCrc;  // Over the column data that follows
+        uint32_t headerCrc;   // Over everything above
+    };
+#pragma pack(pop)
+
+    template <typename T>
+    uint32_t structCrc(const T& value)
+    {
+        // Every struct ends with its own CRC field
+        return crc32c(&value, sizeof(T) - sizeof(uint32_t));
+    }
+
+    // Appends rows to a FileSink. Call from one thread only.
+    class Writer
+    {
+    public:
+        explicit Writer(FileSink& sink, uint32_t chunkRows = DEFAULT_CHUNK_ROWS)
+            : sink(sink), chunkRows(chunkRows > 0 ? chunkRows : DEFAULT_CHUNK_ROWS),
+            columns(static_cast<size_t>(COLUMN_COUNT) * this->chunkRows)
+        {
+            FileHeader header = {};
+            memcpy(header.magic, FILE_MAGIC, sizeof(header.magic));
+            header.version = FORMAT_VERSION;
+            header.columnCount = COLUMN_COUNT;
+            header.chunkRows = this->chunkRows;
+            header.crc = structCrc(header);
+            ok = sink.write(&header, sizeof(header));
+        }
+
+        bool append(uint64_t frameID, uint64_t deviceTimestamp, uint64_t hostTimestamp, uint64_t steadyTimestamp = 0)
+        {
+            if (!ok) {
+                return false;
+            }
+            columns[FrameID * chunkRows + pending] = frameID;
+            columns[DeviceTimestamp * chunkRows + pending] = deviceTimestamp;
+            columns[HostTimestamp * chunkRows + pending] = hostTimestamp;
+            columns[SteadyTimestamp * chunkRows + pending] = steadyTimestamp;
+            if (++pending == chunkRows) {
+                return writeChunk();
+            }
+            return true;
+        }
+
+        // Writes out the last, partly filled chunk
+        bool finish()
+        {
+            if (ok && pending > 0) {
+                writeChunk();
+            }
+            return ok && sink.flush();
+        }
+
+        uint64_t rows() const { return written + pending; }
+
+    private:
+        FileSink& sink;
+        uint32_t chunkRows;
+        std::vector<uint64_t> columns;  // COLUMN_COUNT runs of chunkRows values
+        uint32_t pending = 0;
+        uint64_t written = 0;
+        bool ok = true;
+
+        bool writeChunk()
+        {
+            // A short chunk's columns are packed together, so compact them first
+            if (pending < chunkRows) {
+                for (uint32_t c = 1; c < COLUMN_COUNT; ++c) {
+                    memmove(&columns[c * pending], &columns[c * chunkRows], pending * sizeof(uint64_t));
+                }
+            }
+            size_t bytes = static_cast<size_t>(COLUMN_COUNT) * pending * sizeof(uint64_t);
+
+            ChunkHeader header = {};
+            header.magic = CHUNK_MAGIC;
+            header.rows = pending;
+            header.firstRow = written;
+            header.columnsCrc = crc32c(columns.data(), bytes);
+            header.headerCrc = structCrc(header);
+            ok = sink.write(&header, sizeof(header)) && sink.write(columns.data(), bytes);
+
+            written += pending;
+            pending = 0;
+            return ok;
+        }
+    };
+
+    // Reads a table through a memory mapping; values are read in place
+    class Reader
+    {
+    public:
+        explicit Reader(const std::string& filePath)
+            : file(std::make_unique<MappedFile>(filePath))
+        {
+            FileHeader header = {};
+            if (file->size() < sizeof(header)) {
+                throw std::runtime_error("Not a frame table: " + filePath);
+            }
+            memcpy(&header, file->data(), sizeof(header));
+            if (memcmp(header.magic, FILE_MAGIC, sizeof(header.magic)) != 0 || header.crc != structCrc(header) ||
+                header.chunkRows == 0) {
+                throw std::runtime_error("Not a frame table: " + filePath);
+            }
+            if (header.version > FORMAT_VERSION || header.columnCount < MIN_COLUMNS) {
+                throw std::runtime_error("Frame table was written by a newer version: " + filePath);
+            }
+            chunkRows = header.chunkRows;
+            columnCount = header.columnCount;
+
+            // Find the chunks; every one but the last is full
+            uint64_t offset = sizeof(header);
+            while (file->size() - offset >= sizeof(ChunkHeader)) {
+                ChunkHeader chunk = {};
+                memcpy(&chunk, file->data() + offset, sizeof(chunk));
+                uint64_t bytes = uint64_t(columnCount) * chunk.rows * sizeof(uint64_t);
+                if (chunk.magic != CHUNK_MAGIC || chunk.headerCrc != structCrc(chunk) || chunk.firstRow != totalRows ||
+                    chunk.rows == 0 || chunk.rows > chunkRows || file->size() - offset - sizeof(chunk) < bytes ||
+                    crc32c(file->data() + offset + sizeof(chunk), static_cast<size_t>(bytes)) != chunk.columnsCrc) {
+                    break;
+                }
+                chunks.push_back({ offset + sizeof(chunk), chunk.rows });
+                totalRows += chunk.rows;
+                offset += sizeof(chunk) + bytes;
+                if (chunk.rows < chunkRows) {
+                    break;
+                }
+            }
+        }
+
+        uint64_t rows() const { return totalRows; }
+        bool hasColumn(Column column) const { return uint32_t(column) < columnCount; }
+
+        // 0 for a column the table doesn't have
+        uint64_t value(Column column, uint64_t row) const
+        {
+            if (!hasColumn(column)) {
+                return 0;
+            }
+            const Chunk& chunk = chunks[static_cast<size_t>(row / chunkRows)];
+            uint64_t v;
+            memcpy(&v, file->data() + chunk.offset + (uint64_t(column) * chunk.rows + row % chunkRows) * sizeof(uint64_t),
+                sizeof(v));
+            return v;
+        }
+
+        // A whole column, in row order
+        std::vector<uint64_t> column(Column column) const
+        {
+            std::vector<uint64_t> values(static_cast<size_t>(totalRows));
+            if (!hasColumn(column)) {
+                return values;
+            }
+            size_t next = 0;
+            for (const Chunk& chunk : chunks) {
+                memcpy(&values[next], file->data() + chunk.offset + uint64_t(column) * chunk.rows * sizeof(uint64_t),
+                    chunk.rows * sizeof(uint64_t));
+                next += chunk.rows;
+            }
+            return values;
+        }
+
+    private:
+        struct Chunk
+        {
+            uint64_t offset;  // Of the first column
+            uint32_t rows;
+        };
+
+        std::unique_ptr<MappedFile> file;
+        uint32_t chunkRows = 0;
+        uint32_t columnCount = 0;
+        std::vector<Chunk> chunks;
+        uint64_t totalRows = 0;
+    };
+}
@@ -0,0 +1,328 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// Lossless frame compression fast enough to run during capture.
+//
+// Each pixel is predicted from its already-coded neighbours with the LOCO-I /
+// JPEG-LS median edge detector (left, up, up-left). The prediction errors are
+// small for camera images, so they are zigzag-mapped to unsigned values and
+// bit-packed in blocks of 32 at the width of the largest value in the block.
+// Flat regions cost one byte per 32 pixels; sensor noise costs a few bits.
+//
+// Bayer mosaics are predicted from the nearest pixels of the same colour (two
+// apart), which is what keeps them compressible. Every frame is coded on its
+// own, so frames can be encoded on any thread and decoded in any order.
+namespace lossless
+{
+    const uint8_t FORMAT_VERSION = 1;
+    const size_t BLOCK = 32;
+
+#pragma pack(push, 1)
+    struct Header
+    {
+        uint32_t width;
+        uint32_t height;
+        uint8_t bytesPerSample;  // 1 or 2
+        uint8_t step;            // Distance to the same-colour neighbour: 1 mono, 2 Bayer
+        uint8_t blockSize;
+        uint8_t version;
+    };
+#pragma pack(pop)
+
+    // Geometry of the frames being coded, derived from the pixel format
+    struct Layout
+    {
+        size_t width = 0;
+        size_t height = 0;
+        size_t bytesPerSample = 1;
+        size_t step = 1;
+
+        Layout() = default;
+        Layout(size_t width, size_t height, const std::string& pixelFormat)
+            : width(width), height(height),
+            bytesPerSample(pixelFormat == "Mono16" || pixelFormat == "BayerRG16" ? 2 : 1),
+            step(pixelFormat.compare(0, 5, "Bayer") == 0 ? 2 : 1)
+        {}
+
+        size_t frameBytes() const { return width * height * bytesPerSample; }
+    };
+
+    // Largest possible output, for sizing buffers once up front
+    inline size_t maxEncodedBytes(const Layout& layout)
+    {
+        size_t pixels = layout.width * layout.height;
+        size_t blocks = (pixels + BLOCK - 1) / BLOCK;
+        return sizeof(Header) + blocks * (1 + BLOCK * layout.bytesPerSample);
+    }
+
+    namespace detail
+    {
+        // The median edge detector is the median of left, up and left + up - up-left.
+        // Written with min/max it compiles without branches, which matters on
+        // noisy images where a branch on the comparison is mispredicted constantly.
+        inline int median(int a, int b, int c)
+        {
+            int lo = std::min(a, b);
+            int hi = std::max(a, b);
+            return std::max(lo, std::min(hi, a + b - c));
+        }
+
+        template <typename T>
+        inline int predict(const T* row, const T* up, size_t x, size_t step)
+        {
+            if (!up) {
+                return x >= step ? row[x - step] : 0;
+            }
+            if (x < step) {
+                return up[x];
+            }
+            return median(row[x - step], up[x], up[x - step]);
+        }
+
+        template <typename T>
+        inline uint32_t zigzag(int residual)
+        {
+            // Wrap to the sample width first, so every residual fits in T's bits
+            typedef typename std::conditional<sizeof(T) == 1, int8_t, int16_t>::type Signed;
+            Signed d = static_cast<Signed>(residual);
+            return static_cast<T>((static_cast<uint32_t>(d) << 1) ^ static_cast<uint32_t>(d >> (sizeof(T) * 8 - 1)));
+        }
+
+        template <typename T>
+        inline T unzigzag(uint32_t value, int prediction)
+        {
+            int d = static_cast<int>(value >> 1) ^ -static_cast<int>(value & 1);
+            return static_cast<T>(prediction + d);
+        }
+
+        inline uint8_t* packBlock(const uint16_t* values, uint8_t* out)
+        {
+            uint32_t all = 0;
+            for (size_t i = 0; i < BLOCK; ++i) {
+                all |= values[i];
+            }
+            unsigned width = 0;
+            while (all >> width) {
+                width++;
+            }
+
+            *out++ = static_cast<uint8_t>(width);
+            if (width == 0) {
+                return out;
+            }
+
+            // 32 values of `width` bits always fill a whole number of 32-bit words
+            uint64_t acc = 0;
+            unsigned bits = 0;
+            for (size_t i = 0; i < BLOCK; ++i) {
+                acc |= static_cast<uint64_t>(values[i]) << bits;
+                bits += width;
+                if (bits >= 32) {
+                    uint32_t word = static_cast<uint32_t>(acc);
+                    memcpy(out, &word, 4);
+                    out += 4;
+                    acc >>= 32;
+                    bits -= 32;
+                }
+            }
+            return out;
+        }
+
+        inline const uint8_t* unpackBlock(const uint8_t* in, const uint8_t* end, uint16_t* values)
+        {
+            if (in >= end) {
+                return nullptr;
+            }
+            unsigned width = *in++;
+            if (width > 16 || static_cast<size_t>(end - in) < width * BLOCK / 8) {
+                return nullptr;
+            }
+            if (width == 0) {
+                memset(values, 0, BLOCK * sizeof(uint16_t));
+                return in;
+            }
+            uint64_t acc = 0;
+            unsigned bits = 0;
+            uint32_t mask = (1u << width) - 1;
+            for (size_t i = 0; i < BLOCK; ++i) {
+                if (bits < width) {
+                    uint32_t word;
+                    memcpy(&word, in, 4);
+                    in += 4;
+                    acc |= static_cast<uint64_t>(word) << bits;
+                    bits += 32;
+                }
+                values[i] = static_cast<uint16_t>(acc & mask);
+                acc >>= width;
+                bits -= width;
+            }
+            return in;
+        }
+
+        // Residuals of the whole frame are produced first and packed in a
+        // second pass; the prediction loop then has no branches beyond the
+        // median itself, and the compiler can vectorise it
+        template <typename T>
+        size_t encode(const T* src, const Layout& layout, uint8_t* out)
+        {
+            size_t pixels = layout.width * layout.height;
+            size_t step = layout.step;
+            thread_local std::vector<uint16_t> residuals;
+            residuals.resize((pixels + BLOCK - 1) / BLOCK * BLOCK);
+
+            for (size_t y = 0; y < layout.height; ++y) {
+                const T* row = src + y * layout.width;
+                uint16_t* r = residuals.data() + y * layout.width;
+                if (y < step) {
+                    for (size_t x = 0; x < layout.width; ++x) {
+                        r[x] = static_cast<uint16_t>(zigzag<T>(row[x] - predict<T>(row, nullptr, x, step)));
+                    }
+                    continue;
+                }
+                const T* up = row - step * layout.width;
+                size_t edge = step < layout.width ? step : layout.width;
+                for (size_t x = 0; x < edge; ++x) {
+                    r[x] = static_cast<uint16_t>(zigzag<T>(row[x] - up[x]));
+                }
+                for (size_t x = edge; x < layout.width; ++x) {
+                    r[x] = static_cast<uint16_t>(zigzag<T>(row[x] - median(row[x - step], up[x], up[x - step])));
+                }
+            }
+            std::fill(residuals.begin() + pixels, residuals.end(), 0);
+
+            uint8_t* start = out;
+            for (size_t i = 0; i < residuals.size(); i += BLOCK) {
+                out = packBlock(residuals.data() + i, out);
+            }
+            return static_cast<size_t>(out - start);
+        }
+
+        // Decoding is serial along a row: each pixel needs its reconstructed
+        // left neighbour. Keeping those in registers instead of re-reading the
+        // row just written roughly halves the time per pixel.
+        template <typename T, size_t Step>
+        void reconstructRow(T* row, const T* up, const uint16_t* r, size_t width)
+        {
+            int left[Step];
+            int upLeft[Step];
+            for (size_t s = 0; s < Step && s < width; ++s) {
+                left[s] = row[s];
+                upLeft[s] = up[s];
+            }
+            for (size_t x = Step; x < width; x += Step) {
+                for (size_t s = 0; s < Step && x + s < width; ++s) {
+                    int above = up[x + s];
+                    T value = unzigzag<T>(r[x + s], median(left[s], above, upLeft[s]));
+                    row[x + s] = value;
+                    left[s] = value;
+                    upLeft[s] = above;
+                }
+            }
+        }
+
+        template <typename T>
+        bool decode(const uint8_t* in, const uint8_t* end, const Layout& layout, T* dst)
+        {
+            size_t pixels = layout.width * layout.height;
+            size_t step = layout.step;
+            thread_local std::vector<uint16_t> residuals;
+            residuals.resize((pixels + BLOCK - 1) / BLOCK * BLOCK);
+
+            for (size_t i = 0; i < residuals.size(); i += BLOCK) {
+                in = unpackBlock(in, end, residuals.data() + i);
+                if (!in) {
+                    return false;
+                }
+            }
+
+            for (size_t y = 0; y < layout.height; ++y) {
+                T* row = dst + y * layout.width;
+                const uint16_t* r = residuals.data() + y * layout.width;
+                if (y < step) {
+                    for (size_t x = 0; x < layout.width; ++x) {
+                        row[x] = unzigzag<T>(r[x], predict<T>(row, nullptr, x, step));
+                    }
+                    continue;
+                }
+                const T* up = row - step * layout.width;
+                size_t edge = step < layout.width ? step : layout.width;
+                for (size_t x = 0; x < edge; ++x) {
+                    row[x] = unzigzag<T>(r[x], up[x]);
+                }
+                if (step == 1) {
+                    reconstructRow<T, 1>(row, up, r, layout.width);
+                }
+                else if (step == 2) {
+                    reconstructRow<T, 2>(row, up, r, layout.width);
+                }
+                else {
+                    for (size_t x = edge; x < layout.width; ++x) {
+                        row[x] = unzigzag<T>(r[x], median(row[x - step], up[x], up[x - step]));
+                    }
+                }
+            }
+            return true;
+        }
+    }
+
+    // Compresses one frame into `out` (resized to fit; keep it around between
+    // calls and it stops allocating). Returns the encoded size.
+    inline size_t encode(const void* frame, const Layout& layout, std::vector<char>& out)
+    {
+        if (out.size() < maxEncodedBytes(layout)) {
+            out.resize(maxEncodedBytes(layout));
+        }
+
+        Header header;
+        header.width = static_cast<uint32_t>(layout.width);
+        header.height = static_cast<uint32_t>(layout.height);
+        header.bytesPerSample = static_cast<uint8_t>(layout.bytesPerSample);
+        header.step = static_cast<uint8_t>(layout.step);
+        header.blockSize = static_cast<uint8_t>(BLOCK);
+        header.version = FORMAT_VERSION;
+        memcpy(out.data(), &header, sizeof(header));
+
+        uint8_t* body = reinterpret_cast<uint8_t*>(out.data()) + sizeof(header);
+        size_t bodyBytes = layout.bytesPerSample == 2
+            ? detail::encode(static_cast<const uint16_t*>(frame), layout, body)
+            : detail::encode(static_cast<const uint8_t*>(frame), layout, body);
+        return sizeof(header) + bodyBytes;
+    }
+
+    // Decompresses into dst, which must hold dstBytes = width x height x bytes per sample.
+    // Returns false for corrupt or mismatched input.
+    inline bool decode(const void* encoded, size_t size, void* dst, size_t dstBytes)
+    {
+        Header header;
+        if (size < sizeof(header)) {
+            return false;
+        }
+        memcpy(&header, encoded, sizeof(header));
+        if (header.version != FORMAT_VERSION || header.blockSize != BLOCK || header.step == 0 ||
+            (header.bytesPerSample != 1 && header.bytesPerSample != 2)) {
+            return false;
+        }
+
+        Layout layout;
+        layout.width = header.width;
+        layout.height = header.height;
+        layout.bytesPerSample = header.bytesPerSample;
+        layout.step = header.step;
+        if (layout.frameBytes() != dstBytes) {
+            return false;
+        }
+
+        const uint8_t* in = static_cast<const uint8_t*>(encoded) + sizeof(header);
+        const uint8_t* end = static_cast<const uint8_t*>(encoded) + size;
+        return layout.bytesPerSample == 2
+            ? detail::decode(in, end, layout, static_cast<uint16_t*>(dst))
+            : detail::decode(in, end, layout, static_cast<uint8_t*>(dst));
+    }
+}
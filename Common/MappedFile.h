@@ -0,0 +1,233 @@
+#pragma once
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Read-only memory mapping of a whole file. Frames are used in place, so
+// reading a recording costs no allocation or copy; the OS pages the file in
+// as it is touched.
+//
+// For files larger than RAM, walk through them with willNeed() ahead of the
+// read position and release() behind it, so readahead stays ahead of the
+// encoder and pages already used don't push everything else out of memory.
+class MappedFile
+{
+public:
+    explicit MappedFile(const std::string& filePath)
+        : filePath(filePath)
+    {
+        if (!map()) {
+            unmap();
+            throw std::runtime_error("Unable to map file: " + filePath);
+        }
+    }
+
+    ~MappedFile()
+    {
+        unmap();
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* data() const { return base; }
+    uint64_t size() const { return bytes; }
+
+    // Tell the OS the file will be read front to back (more aggressive readahead)
+    void adviseSequential()
+    {
+#ifndef _WIN32
+        if (bytes > 0) {
+            madvise(const_cast<char*>(base), static_cast<size_t>(bytes), MADV_SEQUENTIAL);
+        }
+#endif
+        // Windows: FILE_FLAG_SEQUENTIAL_SCAN was given when the file was opened
+    }
+
+    // Start reading [offset, offset + length) from disk in the background
+    void willNeed(uint64_t offset, uint64_t length)
+    {
+        if (!clamp(offset, length)) {
+            return;
+        }
+#ifdef _WIN32
+        WIN32_MEMORY_RANGE_ENTRY range;
+        range.VirtualAddress = const_cast<char*>(base) + offset;
+        range.NumberOfBytes = static_cast<SIZE_T>(length);
+        PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+#else
+        uint64_t start = pageFloor(offset);
+        madvise(const_cast<char*>(base) + start, static_cast<size_t>(offset + length - start), MADV_WILLNEED);
+#endif
+    }
+
+    // Drop [offset, offset + length) from this process's memory; it is
+    // re-read from disk if touched again
+    void release(uint64_t offset, uint64_t length)
+    {
+        if (!clamp(offset, length)) {
+            return;
+        }
+#ifdef _WIN32
+        // Unlocking pages that were never locked removes them from the working set
+        VirtualUnlock(const_cast<char*>(base) + offset, static_cast<SIZE_T>(length));
+#else
+        // Only whole pages inside the range, so nothing still in use is dropped
+        uint64_t start = pageCeil(offset);
+        uint64_t end = offset + length == bytes ? bytes : pageFloor(offset + length);
+        if (end > start) {
+            madvise(const_cast<char*>(base) + start, static_cast<size_t>(end - start), MADV_DONTNEED);
+        }
+#endif
+    }
+
+private:
+    std::string filePath;
+    const char* base = nullptr;
+    uint64_t bytes = 0;
+
+    bool clamp(uint64_t offset, uint64_t& length) const
+    {
+        if (offset >= bytes || length == 0) {
+            return false;
+        }
+        if (length > bytes - offset) {
+            length = bytes - offset;
+        }
+        return true;
+    }
+
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = NULL;
+
+    bool map()
+    {
+        file = CreateFileA(filePath.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        if (file == INVALID_HANDLE_VALUE) {
+            return false;
+        }
+
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(file, &fileSize)) {
+            return false;
+        }
+        bytes = static_cast<uint64_t>(fileSize.QuadPart);
+        if (bytes == 0) {
+            return true;  // Windows cannot map an empty file; there is nothing to read anyway
+        }
+
+        mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (!mapping) {
+            return false;
+        }
+        base = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+        return base != nullptr;
+    }
+
+    void unmap()
+    {
+        if (base) {
+            UnmapViewOfFile(base);
+            base = nullptr;
+        }
+        if (mapping) {
+            CloseHandle(mapping);
+            mapping = NULL;
+        }
+        if (file != INVALID_HANDLE_VALUE) {
+            CloseHandle(file);
+            file = INVALID_HANDLE_VALUE;
+        }
+    }
+#else
+    int fd = -1;
+
+    static uint64_t pageSize()
+    {
+        static const uint64_t size = static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+        return size;
+    }
+    static uint64_t pageFloor(uint64_t offset) { return offset / pageSize() * pageSize(); }
+    static uint64_t pageCeil(uint64_t offset) { return (offset + pageSize() - 1) / pageSize() * pageSize(); }
+
+    bool map()
+    {
+        fd = ::open(filePath.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            return false;
+        }
+        bytes = static_cast<uint64_t>(st.st_size);
+        if (bytes == 0) {
+            return true;
+        }
+
+        void* p = mmap(nullptr, static_cast<size_t>(bytes), PROT_READ, MAP_SHARED, fd, 0);
+        if (p == MAP_FAILED) {
+            return false;
+        }
+        base = static_cast<const char*>(p);
+        return true;
+    }
+
+    void unmap()
+    {
+        if (base) {
+            munmap(const_cast<char*>(base), static_cast<size_t>(bytes));
+            base = nullptr;
+        }
+        if (fd >= 0) {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+#endif
+};
+
+// Starts reading a whole file into the OS cache in the background, so that
+// whoever opens it shortly after doesn't wait on the disk. Walking this a
+// few dozen files ahead turns many small files into a steady stream of reads.
+inline void prefetchFile(const std::string& filePath)
+{
+#ifdef _WIN32
+    // No fadvise on Windows; a mapping that asks for its pages does the same,
+    // and they stay in the file cache after it is gone
+    try {
+        MappedFile file(filePath);
+        file.willNeed(0, file.size());
+    }
+    catch (const std::runtime_error&) {
+    }
+#else
+    int fd = ::open(filePath.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+#ifdef POSIX_FADV_WILLNEED
+    posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+#endif
+    ::close(fd);
+#endif
+}
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "FrameSource.h"
+#include "FrameTable.h"
+#include "MappedFile.h"
+#include "RecordingFormat.h"
+#include "SessionMetadata.h"
+
+// Frames of a recording as pointers straight into a memory mapping, for the
+// offline tools. Reads .camrec containers and legacy .bin + JSON pairs alike.
+//
+// When frames are read in order it keeps the OS reading ahead of the caller
+// and drops pages it has finished with, so a 100+ GB session streams through
+// a bounded amount of memory.
+class MappedFrameReader
+{
+public:
+    // metadataFilePath is only needed for a legacy .bin
+    explicit MappedFrameReader(const std::string& binaryFilePath, const std::string& metadataFilePath = "")
+    {
+        if (camrec::RecordingReader::isRecording(binaryFilePath)) {
+            container = std::make_unique<camrec::RecordingReader>(binaryFilePath);
+            const camrec::RecordingInfo& info = container->info();
+            imageWidth = info.width;
+            imageHeight = info.height;
+            format = info.pixelFormat;
+            fps = info.frameRate;
+            frames = static_cast<size_t>(container->frameCount());
+        }
+        else {
+            if (metadataFilePath.empty()) {
+                throw std::runtime_error("A legacy .bin needs its metadata file: " + binaryFilePath);
+            }
+
+            // Frame IDs are read from the frame table as needed; older JSONs list them inline
+            SessionMetadata metadata = loadSessionMetadata(metadataFilePath, true);
+            imageWidth = metadata.width;
+            imageHeight = metadata.height;
+            format = metadata.pixelFormat;
+            fps = metadata.frameRate;
+            size_t listed;
+            if (!metadata.frameTablePath.empty()) {
+                table = std::make_unique<frametable::Reader>(metadata.frameTablePath);
+                listed = static_cast<size_t>(table->rows());
+            }
+            else {
+                frameIDs = std::move(metadata.frameIDs);
+                listed = frameIDs.size();
+            }
+
+            raw = std::make_unique<MappedFile>(binaryFilePath);
+            frameBytes = imageWidth * imageHeight * bytesPerPixel(format);
+            frames = listed;
+            if (frameBytes > 0 && raw->size() / frameBytes < frames) {
+                // A crashed session: the metadata lists frames that never reached the .bin
+                frames = static_cast<size_t>(raw->size() / frameBytes);
+                std::cerr << "Warning: " << binaryFilePath << " holds only " << frames << " of "
+                    << listed << " frames listed in the metadata." << std::endl;
+            }
+        }
+
+        mapping().adviseSequential();
+    }
+
+    size_t width() const { return imageWidth; }
+    size_t height() const { return imageHeight; }
+    const std::string& pixelFormat() const { return format; }
+    double frameRate() const { return fps; }
+    size_t frameCount() const { return frames; }
+    bool isContainer() const { return container != nullptr; }
+
+    // Points `data` at frame `index` inside the mapping; nothing is copied.
+    // The pointer stays valid for the reader's lifetime, but pages behind the
+    // read position may be dropped and re-read if they are touched again.
+    // Frames compressed at capture come back as stored (info.codec says so);
+    // camrec::decodeFrame() turns them into pixels.
+    bool frame(size_t index, const char*& data, size_t& size, camrec::FrameInfo& info)
+    {
+        if (index >= frames) {
+            return false;
+        }
+
+        if (container) {
+            if (!container->frameView(index, info, data, size)) {
+                return false;
+            }
+        }
+        else {
+            data = raw->data() + index * frameBytes;
+            size = frameBytes;
+            info = camrec::FrameInfo();
+            info.frameID = table ? table->value(frametable::FrameID, index) : frameIDs[index];
+            info.rawBytes = static_cast<uint32_t>(frameBytes);
+        }
+
+        advance(static_cast<uint64_t>(data - mapping().data()) + size);
+        return true;
+    }
+
+private:
+    static const uint64_t READAHEAD_BYTES = uint64_t(64) << 20;  // Kept requested ahead of the reader
+    static const uint64_t KEEP_BEHIND_BYTES = uint64_t(16) << 20;  // Kept mapped behind it
+
+    std::unique_ptr<camrec::RecordingReader> container;
+    std::unique_ptr<MappedFile> raw;
+    size_t imageWidth = 0;
+    size_t imageHeight = 0;
+    std::string format;
+    double fps = 0;
+    size_t frames = 0;
+    size_t frameBytes = 0;
+    std::unique_ptr<frametable::Reader> table;
+    std::vector<uint64_t> frameIDs;  // Older sessions without a frame table
+
+    uint64_t prefetchedTo = 0;
+    uint64_t releasedTo = 0;
+
+    MappedFile& mapping()
+    {
+        return container ? container->mapping() : *raw;
+    }
+
+    // Slide the readahead / release window to the current read position
+    void advance(uint64_t position)
+    {
+        MappedFile& file = mapping();
+        if (position + READAHEAD_BYTES / 2 > prefetchedTo) {
+            uint64_t from = std::max(prefetchedTo, position);
+            file.willNeed(from, READAHEAD_BYTES);
+            prefetchedTo = from + READAHEAD_BYTES;
+        }
+        if (position > releasedTo + 2 * KEEP_BEHIND_BYTES) {
+            file.release(releasedTo, position - KEEP_BEHIND_BYTES - releasedTo);
+            releasedTo = position - KEEP_BEHIND_BYTES;
+        }
+    }
+};
@@ -0,0 +1,218 @@
+#pragma once
+
+#include <GLFW/glfw3.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Downscale.h"
+#include "FrameMailbox.h"
+#include "LatencyHistogram.h"
+#include "TraceRecorder.h"
+
+// Live preview window drawn on its own thread.
+//
+// The acquisition thread calls due() every frame and, when it says so,
+// publish(): that shrinks the frame by an integer ratio straight into the
+// mailbox and returns. The render thread draws whatever is newest, so a slow
+// swap or a busy GPU costs preview frames, never camera frames.
+//
+// The preview rate backs off as the write queue fills, and once it is three
+// quarters full frames are decimated rather than box filtered, leaving the
+// acquisition thread as free as possible for the writer to catch up.
+//
+// GLFW wants window creation and event polling on the main thread; the
+// constructor, pollEvents() and the destructor must be called from it.
+class PreviewWindow
+{
+public:
+    struct Stats
+    {
+        uint64_t published = 0;   // Frames handed to the render thread
+        uint64_t displayed = 0;
+        uint64_t overwritten = 0; // Replaced by a newer frame before they were drawn
+        double fps = 0.0;         // Current target rate
+        bool decimating = false;
+    };
+
+    PreviewWindow(int width, int height, const std::string& title, double maxFps, TraceRecorder* tracer = nullptr)
+        : width(width), height(height), maxFps(maxFps), tracer(tracer)
+    {
+        if (!glfwInit()) {
+            std::cerr << "Error: Failed to initialize GLFW" << std::endl;
+            return;
+        }
+
+        window = glfwCreateWindow(width, height, title.c_str(), NULL, NULL);
+        if (!window) {
+            std::cerr << "Error: Failed to create GLFW window" << std::endl;
+            glfwTerminate();
+            return;
+        }
+
+        // The context belongs to the render thread from here on
+        glfwMakeContextCurrent(NULL);
+        renderThread = std::thread(&PreviewWindow::renderLoop, this);
+    }
+
+    ~PreviewWindow()
+    {
+        if (!window) {
+            return;
+        }
+        mailbox.close();
+        renderThread.join();
+        glfwDestroyWindow(window);
+        glfwTerminate();
+    }
+
+    PreviewWindow(const PreviewWindow&) = delete;
+    PreviewWindow& operator=(const PreviewWindow&) = delete;
+
+    bool isOpen() const { return window != nullptr; }
+
+    // Acquisition thread: whether it is time for another preview frame, given
+    // how full the write queue is (0 to 1)
+    bool due(double queueFill)
+    {
+        double fps = maxFps;
+        if (queueFill >= 0.75) {
+            fps = 1.0;
+        }
+        else if (queueFill >= 0.5) {
+            fps = maxFps / 6;
+        }
+        else if (queueFill >= 0.25) {
+            fps = maxFps / 2;
+        }
+        targetFps.store(fps, std::memory_order_relaxed);
+        decimating.store(queueFill >= 0.75, std::memory_order_relaxed);
+
+        auto now = std::chrono::steady_clock::now();
+        if (now - lastPublish < std::chrono::duration<double>(1.0 / fps)) {
+            return false;
+        }
+        lastPublish = now;
+        return true;
+    }
+
+    // Acquisition thread: shrink a frame to fit the window and hand it to the
+    // render thread. 16-bit frames are shown by their high byte.
+    void publish(const void* data, size_t frameWidth, size_t frameHeight, size_t stride,
+        size_t bytesPerPixel, uint64_t frameID)
+    {
+        const uint8_t* pixels = static_cast<const uint8_t*>(data);
+        if (bytesPerPixel == 2) {
+            wide.resize(frameWidth * frameHeight);
+            for (size_t y = 0; y < frameHeight; ++y) {
+                const uint16_t* row = reinterpret_cast<const uint16_t*>(pixels + y * stride);
+                for (size_t x = 0; x < frameWidth; ++x) {
+                    wide[y * frameWidth + x] = static_cast<uint8_t>(row[x] >> 8);
+                }
+            }
+            pixels = wide.data();
+            stride = frameWidth;
+        }
+
+        size_t k = downscale::ratioToFit(frameWidth, frameHeight, size_t(width), size_t(height));
+        MailboxFrame& out = mailbox.back();
+        out.width = frameWidth / k;
+        out.height = frameHeight / k;
+        out.frameID = frameID;
+        out.pixels.resize(out.width * out.height);
+        if (decimating.load(std::memory_order_relaxed) || k > 64) {
+            downscale::decimate(pixels, frameWidth, frameHeight, stride, k, out.pixels.data(), out.width);
+        }
+        else {
+            downscale::box(pixels, frameWidth, frameHeight, stride, k, out.pixels.data(), out.width);
+        }
+        mailbox.publish();
+    }
+
+    // Main thread: process window events. Returns false once the user has
+    // pressed Esc or closed the window.
+    bool pollEvents()
+    {
+        glfwPollEvents();
+        return !(glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS || glfwWindowShouldClose(window));
+    }
+
+    Stats stats() const
+    {
+        FrameMailbox::Stats counts = mailbox.stats();
+        Stats s;
+        s.published = counts.published;
+        s.displayed = displayed.load(std::memory_order_relaxed);
+        s.overwritten = counts.overwritten;
+        s.fps = targetFps.load(std::memory_order_relaxed);
+        s.decimating = decimating.load(std::memory_order_relaxed);
+        return s;
+    }
+
+    // Time the render thread takes to draw and swap one frame
+    const LatencyHistogram& drawLatency() const { return drawTime; }
+
+private:
+    GLFWwindow* window = nullptr;
+    int width;
+    int height;
+    double maxFps;
+
+    FrameMailbox mailbox;
+    std::thread renderThread;
+    std::atomic<uint64_t> displayed{ 0 };
+    LatencyHistogram drawTime;
+    TraceRecorder* tracer;  // Draws go in the trace when set
+
+    // Acquisition thread
+    std::chrono::steady_clock::time_point lastPublish;
+    std::vector<uint8_t> wide;  // High bytes of a 16-bit frame
+    std::atomic<double> targetFps{ 0.0 };
+    std::atomic<bool> decimating{ false };
+
+    void renderLoop()
+    {
+        glfwMakeContextCurrent(window);
+        glfwSwapInterval(0);  // Don't let vsync hold up the next frame
+        glViewport(0, 0, width, height);
+        glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        if (tracer) {
+            tracer->nameThread("preview");
+        }
+
+        while (true) {
+            const MailboxFrame* frame = mailbox.take(std::chrono::milliseconds(100));
+            if (!frame) {
+                if (mailbox.isClosed()) {
+                    break;
+                }
+                continue;
+            }
+            if (frame->width == 0 || frame->height == 0) {
+                continue;
+            }
+
+            auto drawStart = std::chrono::steady_clock::now();
+            glClear(GL_COLOR_BUFFER_BIT);
+
+            // Stretch to the window and flip vertically
+            glPixelZoom(float(width) / frame->width, -float(height) / frame->height);
+            glRasterPos2i(-1, 1);
+            glDrawPixels(int(frame->width), int(frame->height), GL_LUMINANCE, GL_UNSIGNED_BYTE, frame->pixels.data());
+
+            glfwSwapBuffers(window);
+            auto drawEnd = std::chrono::steady_clock::now();
+            drawTime.record(drawEnd - drawStart);
+            if (tracer) {
+                tracer->span("draw", drawStart, drawEnd, static_cast<int64_t>(frame->frameID));
+            }
+            displayed.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        glfwMakeContextCurrent(NULL);
+    }
+};
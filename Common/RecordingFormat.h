@@ -0,0 +1,532 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "Crc32c.h"
+#include "FileSink.h"
+#include "LosslessCodec.h"
+#include "MappedFile.h"
+
+// Self-describing recording container (.camrec), written as a stream so it
+// works with any FileSink:
+//
+//   FileHeader
+//   FrameRecordHeader + payload      } repeated; after every indexInterval
+//   ...                              } frames an IndexBlock lists their offsets
+//   IndexBlock
+//   ...
+//   master index (uint64 offset of every IndexBlock)
+//   Footer (fixed size, last bytes of the file)
+//
+// A reader seeks to frame i in O(1): Footer -> master index[i / interval] ->
+// IndexBlock entry i % interval. Every record carries its own magic and CRCs,
+// so a file that was never closed (no footer) can still be read by scanning
+// forward until the first damaged or truncated record.
+//
+// All fields are little-endian.
+namespace camrec
+{
+    const char FILE_MAGIC[8] = { 'C', 'A', 'M', 'R', 'E', 'C', '0', '1' };
+    const uint32_t FORMAT_VERSION = 1;
+    const uint32_t FRAME_MAGIC = 0x454D5246;   // "FRME"
+    const uint32_t INDEX_MAGIC = 0x58444E49;   // "INDX"
+    const uint32_t FOOTER_MAGIC = 0x544F4F46;  // "FOOT"
+    const uint32_t DEFAULT_INDEX_INTERVAL = 1024;
+
+    // How a frame payload is stored
+    enum class Codec : uint16_t
+    {
+        Raw = 0,
+        Lossless = 1  // LosslessCodec.h: median prediction + bit packing
+    };
+
+#pragma pack(push, 1)
+    struct FileHeader
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t headerBytes;
+        uint32_t width;
+        uint32_t height;
+        uint32_t bytesPerPixel;
+        char pixelFormat[16];   // Spinnaker symbolic name, zero padded
+        double frameRate;
+        uint32_t indexInterval;
+        uint64_t startTimeNs;   // Host clock when the file was opened (ns since epoch)
+        uint32_t reserved[3];
+        uint32_t crc;           // Over everything above
+    };
+
+    struct FrameRecordHeader
+    {
+        uint32_t magic;
+        uint16_t codec;
+        uint16_t flags;            // None defined yet; written as 0
+        uint64_t frameID;
+        uint64_t deviceTimestamp;  // Camera clock (ns)
+        uint64_t hostTimestamp;    // Host clock at acquisition (ns since epoch)
+        uint32_t rawBytes;         // Frame size once decoded
+        uint32_t payloadBytes;     // Bytes that follow this header
+        uint32_t payloadCrc;
+        uint32_t headerCrc;        // Over everything above
+    };
+
+    struct IndexEntry
+    {
+        uint64_t offset;   // File offset of the FrameRecordHeader
+        uint64_t frameID;
+    };
+
+    struct IndexBlockHeader
+    {
+        uint32_t magic;
+        uint32_t entryCount;
+        uint64_t firstFrame;           // Position of the first entry in the recording
+        uint64_t previousIndexOffset;  // 0 for the first block
+        uint32_t entriesCrc;
+        uint32_t headerCrc;
+    };
+
+    struct Footer
+    {
+        uint32_t magic;
+        uint32_t indexBlockCount;
+        uint64_t frameCount;
+        uint64_t masterIndexOffset;
+        uint32_t masterIndexCrc;
+        uint32_t crc;
+    };
+#pragma pack(pop)
+
+    static_assert(sizeof(FileHeader) == 80, "FileHeader layout changed");
+    static_assert(sizeof(FrameRecordHeader) == 48, "FrameRecordHeader layout changed");
+    static_assert(sizeof(IndexEntry) == 16, "IndexEntry layout changed");
+    static_assert(sizeof(IndexBlockHeader) == 32, "IndexBlockHeader layout changed");
+    static_assert(sizeof(Footer) == 32, "Footer layout changed");
+
+    template <typename T>
+    uint32_t structCrc(const T& value)
+    {
+        // Every struct ends with its own CRC field
+        return crc32c(&value, sizeof(T) - sizeof(uint32_t));
+    }
+
+    // Geometry shared by writer and reader
+    struct RecordingInfo
+    {
+        uint32_t width = 0;
+        uint32_t height = 0;
+        uint32_t bytesPerPixel = 1;
+        std::string pixelFormat;
+        double frameRate = 0;
+        uint32_t indexInterval = DEFAULT_INDEX_INTERVAL;
+        uint64_t startTimeNs = 0;
+
+        size_t frameBytes() const { return size_t(width) * height * bytesPerPixel; }
+    };
+
+    // Metadata for one frame, as passed to the writer and returned by the reader
+    struct FrameInfo
+    {
+        uint64_t frameID = 0;
+        uint64_t deviceTimestamp = 0;
+        uint64_t hostTimestamp = 0;
+        uint16_t flags = 0;
+        Codec codec = Codec::Raw;
+        uint32_t rawBytes = 0;
+    };
+
+    // Size of a frame once decoded
+    inline size_t decodedBytes(const FrameInfo& frame, size_t payloadBytes)
+    {
+        return frame.codec == Codec::Raw ? payloadBytes : frame.rawBytes;
+    }
+
+    // Turns a stored payload back into pixels in dst, which holds dstBytes.
+    // False for an unknown codec, bad data, or a frame that doesn't fit.
+    inline bool decodeFrame(const FrameInfo& frame, const char* payload, size_t payloadBytes, char* dst, size_t dstBytes)
+    {
+        if (decodedBytes(frame, payloadBytes) > dstBytes) {
+            return false;
+        }
+        switch (frame.codec) {
+        case Codec::Raw:
+            memcpy(dst, payload, payloadBytes);
+            return true;
+        case Codec::Lossless:
+            return lossless::decode(payload, payloadBytes, dst, frame.rawBytes);
+        }
+        return false;
+    }
+
+    // Streams a recording into a FileSink. Call from one thread only.
+    class RecordingWriter
+    {
+    public:
+        RecordingWriter(FileSink& sink, const RecordingInfo& info)
+            : sink(sink), interval(info.indexInterval > 0 ? info.indexInterval : DEFAULT_INDEX_INTERVAL)
+        {
+            FileHeader header = {};
+            memcpy(header.magic, FILE_MAGIC, sizeof(header.magic));
+            header.version = FORMAT_VERSION;
+            header.headerBytes = sizeof(FileHeader);
+            header.width = info.width;
+            header.height = info.height;
+            header.bytesPerPixel = info.bytesPerPixel;
+            strncpy(header.pixelFormat, info.pixelFormat.c_str(), sizeof(header.pixelFormat) - 1);
+            header.frameRate = info.frameRate;
+            header.indexInterval = interval;
+            header.startTimeNs = info.startTimeNs;
+            header.crc = structCrc(header);
+            ok = put(&header, sizeof(header));
+            pending.reserve(interval);
+        }
+
+        bool writeFrame(const FrameInfo& frame, const void* payload, size_t payloadBytes)
+        {
+            if (!ok || finished) {
+                return false;
+            }
+
+            FrameRecordHeader record = {};
+            record.magic = FRAME_MAGIC;
+            record.codec = static_cast<uint16_t>(frame.codec);
+            record.flags = frame.flags;
+            record.frameID = frame.frameID;
+            record.deviceTimestamp = frame.deviceTimestamp;
+            record.hostTimestamp = frame.hostTimestamp;
+            record.rawBytes = frame.rawBytes > 0 ? frame.rawBytes : static_cast<uint32_t>(payloadBytes);
+            record.payloadBytes = static_cast<uint32_t>(payloadBytes);
+            record.payloadCrc = crc32c(payload, payloadBytes);
+            record.headerCrc = structCrc(record);
+
+            pending.push_back({ position, frame.frameID });
+            ok = put(&record, sizeof(record)) && put(payload, payloadBytes);
+            frameCount++;
+
+            if (ok && pending.size() >= interval) {
+                ok = writeIndexBlock();
+            }
+            return ok;
+        }
+
+        // Writes the last index block, the master index and the footer.
+        // The sink itself is left open.
+        bool finish()
+        {
+            if (finished) {
+                return ok;
+            }
+            finished = true;
+            if (!ok) {
+                return false;
+            }
+            if (!pending.empty() && !writeIndexBlock()) {
+                return false;
+            }
+
+            Footer footer = {};
+            footer.magic = FOOTER_MAGIC;
+            footer.indexBlockCount = static_cast<uint32_t>(indexOffsets.size());
+            footer.frameCount = frameCount;
+            footer.masterIndexOffset = position;
+            footer.masterIndexCrc = crc32c(indexOffsets.data(), indexOffsets.size() * sizeof(uint64_t));
+            footer.crc = structCrc(footer);
+
+            ok = put(indexOffsets.data(), indexOffsets.size() * sizeof(uint64_t)) && put(&footer, sizeof(footer));
+            return ok;
+        }
+
+        uint64_t framesWritten() const { return frameCount; }
+        uint64_t bytesWritten() const { return position; }
+
+    private:
+        FileSink& sink;
+        uint32_t interval;
+        uint64_t position = 0;
+        uint64_t frameCount = 0;
+        std::vector<IndexEntry> pending;
+        std::vector<uint64_t> indexOffsets;
+        bool ok = true;
+        bool finished = false;
+
+        bool put(const void* data, size_t size)
+        {
+            if (size > 0 && !sink.write(data, size)) {
+                return false;
+            }
+            position += size;
+            return true;
+        }
+
+        bool writeIndexBlock()
+        {
+            IndexBlockHeader header = {};
+            header.magic = INDEX_MAGIC;
+            header.entryCount = static_cast<uint32_t>(pending.size());
+            header.firstFrame = frameCount - pending.size();
+            header.previousIndexOffset = indexOffsets.empty() ? 0 : indexOffsets.back();
+            header.entriesCrc = crc32c(pending.data(), pending.size() * sizeof(IndexEntry));
+            header.headerCrc = structCrc(header);
+
+            indexOffsets.push_back(position);
+            bool written = put(&header, sizeof(header)) && put(pending.data(), pending.size() * sizeof(IndexEntry));
+            pending.clear();
+            return written;
+        }
+    };
+
+    // Random access to a .camrec file through a memory mapping. Uses the footer
+    // index when the file was closed cleanly; otherwise rebuilds the index by
+    // scanning the records.
+    class RecordingReader
+    {
+    public:
+        explicit RecordingReader(const std::string& filePath)
+            : filePath(filePath), file(filePath), fileBytes(file.size())
+        {
+
+            FileHeader header = {};
+            if (!readAt(0, &header, sizeof(header)) || memcmp(header.magic, FILE_MAGIC, sizeof(header.magic)) != 0) {
+                throw std::runtime_error("Not a recording container: " + filePath);
+            }
+            if (header.crc != structCrc(header)) {
+                throw std::runtime_error("Recording header is damaged: " + filePath);
+            }
+            if (header.version > FORMAT_VERSION) {
+                throw std::runtime_error("Recording was written by a newer version (format " +
+                    std::to_string(header.version) + "): " + filePath);
+            }
+
+            recordingInfo.width = header.width;
+            recordingInfo.height = header.height;
+            recordingInfo.bytesPerPixel = header.bytesPerPixel;
+            recordingInfo.pixelFormat = std::string(header.pixelFormat, strnlen(header.pixelFormat, sizeof(header.pixelFormat)));
+            recordingInfo.frameRate = header.frameRate;
+            recordingInfo.indexInterval = header.indexInterval > 0 ? header.indexInterval : DEFAULT_INDEX_INTERVAL;
+            recordingInfo.startTimeNs = header.startTimeNs;
+            dataStart = header.headerBytes;
+
+            if (!loadFooter()) {
+                scanRecords();
+            }
+        }
+
+        // True if the file starts with the container magic
+        static bool isRecording(const std::string& filePath)
+        {
+            std::ifstream probe(filePath, std::ios::in | std::ios::binary);
+            char magic[sizeof(FILE_MAGIC)] = {};
+            return probe.read(magic, sizeof(magic)) && memcmp(magic, FILE_MAGIC, sizeof(magic)) == 0;
+        }
+
+        const RecordingInfo& info() const { return recordingInfo; }
+        uint64_t frameCount() const { return frames; }
+
+        // False when the file was not closed cleanly and was recovered by scanning
+        bool complete() const { return hasFooter; }
+
+        // Points `payload` at frame `index` (0-based position in the file)
+        // inside the mapping, after checking its CRCs. The pointer stays valid
+        // for the reader's lifetime.
+        bool frameView(uint64_t index, FrameInfo& frame, const char*& payload, size_t& payloadBytes)
+        {
+            if (index >= frames) {
+                return false;
+            }
+
+            IndexEntry entry;
+            if (!lookup(index, entry)) {
+                return false;
+            }
+
+            FrameRecordHeader record = {};
+            if (!readAt(entry.offset, &record, sizeof(record)) || record.magic != FRAME_MAGIC ||
+                record.headerCrc != structCrc(record) ||
+                entry.offset + sizeof(record) + record.payloadBytes > fileBytes) {
+                std::cerr << "Error: Damaged frame record " << index << " in " << filePath << std::endl;
+                return false;
+            }
+
+            payload = file.data() + entry.offset + sizeof(record);
+            payloadBytes = record.payloadBytes;
+            if (crc32c(payload, payloadBytes) != record.payloadCrc) {
+                std::cerr << "Error: Checksum mismatch in frame " << index << " (ID " << record.frameID << ")" << std::endl;
+                return false;
+            }
+
+            frame.frameID = record.frameID;
+            frame.deviceTimestamp = record.deviceTimestamp;
+            frame.hostTimestamp = record.hostTimestamp;
+            frame.flags = record.flags;
+            frame.codec = static_cast<Codec>(record.codec);
+            frame.rawBytes = record.rawBytes;
+            return true;
+        }
+
+        // Frame ID and timestamps of frame `index`, from its record header alone
+        bool frameHeader(uint64_t index, FrameInfo& frame)
+        {
+            IndexEntry entry;
+            FrameRecordHeader record = {};
+            if (index >= frames || !lookup(index, entry) || !readAt(entry.offset, &record, sizeof(record)) ||
+                record.magic != FRAME_MAGIC || record.headerCrc != structCrc(record)) {
+                return false;
+            }
+            frame.frameID = record.frameID;
+            frame.deviceTimestamp = record.deviceTimestamp;
+            frame.hostTimestamp = record.hostTimestamp;
+            frame.flags = record.flags;
+            frame.codec = static_cast<Codec>(record.codec);
+            frame.rawBytes = record.rawBytes;
+            return true;
+        }
+
+        // Same as frameView(), but copies the frame out, decoded if it was compressed
+        bool readFrame(uint64_t index, FrameInfo& frame, std::vector<char>& pixels)
+        {
+            const char* data = nullptr;
+            size_t size = 0;
+            if (!frameView(index, frame, data, size)) {
+                return false;
+            }
+            pixels.resize(decodedBytes(frame, size));
+            if (!decodeFrame(frame, data, size, pixels.data(), pixels.size())) {
+                std::cerr << "Error: Could not decode frame " << index << " (ID " << frame.frameID << ")" << std::endl;
+                return false;
+            }
+            return true;
+        }
+
+        // The underlying mapping, for readahead hints
+        MappedFile& mapping() { return file; }
+
+        // Frame IDs of every frame, in file order
+        std::vector<uint64_t> frameIDs()
+        {
+            std::vector<uint64_t> ids;
+            ids.reserve(static_cast<size_t>(frames));
+            IndexEntry entry;
+            for (uint64_t i = 0; i < frames && lookup(i, entry); ++i) {
+                ids.push_back(entry.frameID);
+            }
+            return ids;
+        }
+
+    private:
+        std::string filePath;
+        MappedFile file;
+        uint64_t fileBytes = 0;
+        uint64_t dataStart = 0;
+        RecordingInfo recordingInfo;
+        uint64_t frames = 0;
+        bool hasFooter = false;
+
+        std::vector<uint64_t> indexOffsets;       // From the footer
+        std::vector<IndexEntry> cachedBlock;      // The index block last used
+        uint64_t cachedBlockNumber = UINT64_MAX;
+        std::vector<IndexEntry> scannedEntries;   // Used instead when there is no footer
+
+        bool readAt(uint64_t offset, void* data, size_t size)
+        {
+            if (offset + size > fileBytes) {
+                return false;
+            }
+            if (size > 0) {
+                memcpy(data, file.data() + offset, size);
+            }
+            return true;
+        }
+
+        bool loadFooter()
+        {
+            Footer footer = {};
+            if (fileBytes < dataStart + sizeof(footer) || !readAt(fileBytes - sizeof(footer), &footer, sizeof(footer)) ||
+                footer.magic != FOOTER_MAGIC || footer.crc != structCrc(footer)) {
+                return false;
+            }
+
+            indexOffsets.resize(footer.indexBlockCount);
+            if (!readAt(footer.masterIndexOffset, indexOffsets.data(), indexOffsets.size() * sizeof(uint64_t)) ||
+                crc32c(indexOffsets.data(), indexOffsets.size() * sizeof(uint64_t)) != footer.masterIndexCrc) {
+                indexOffsets.clear();
+                return false;
+            }
+
+            frames = footer.frameCount;
+            hasFooter = true;
+            return true;
+        }
+
+        // Rebuild the index of a file that was never closed
+        void scanRecords()
+        {
+            uint64_t offset = dataStart;
+            while (offset + sizeof(uint32_t) <= fileBytes) {
+                uint32_t magic = 0;
+                readAt(offset, &magic, sizeof(magic));
+
+                if (magic == FRAME_MAGIC) {
+                    FrameRecordHeader record = {};
+                    if (!readAt(offset, &record, sizeof(record)) || record.headerCrc != structCrc(record) ||
+                        offset + sizeof(record) + record.payloadBytes > fileBytes) {
+                        break;
+                    }
+                    scannedEntries.push_back({ offset, record.frameID });
+                    offset += sizeof(record) + record.payloadBytes;
+                }
+                else if (magic == INDEX_MAGIC) {
+                    IndexBlockHeader header = {};
+                    if (!readAt(offset, &header, sizeof(header)) || header.headerCrc != structCrc(header)) {
+                        break;
+                    }
+                    offset += sizeof(header) + uint64_t(header.entryCount) * sizeof(IndexEntry);
+                }
+                else {
+                    break;
+                }
+            }
+
+            frames = scannedEntries.size();
+            std::cerr << "Warning: " << filePath << " was not closed cleanly; recovered "
+                << frames << " frames by scanning." << std::endl;
+        }
+
+        bool lookup(uint64_t index, IndexEntry& entry)
+        {
+            if (!hasFooter) {
+                entry = scannedEntries[static_cast<size_t>(index)];
+                return true;
+            }
+
+            uint64_t block = index / recordingInfo.indexInterval;
+            if (block != cachedBlockNumber) {
+                IndexBlockHeader header = {};
+                if (block >= indexOffsets.size() || !readAt(indexOffsets[block], &header, sizeof(header)) ||
+                    header.magic != INDEX_MAGIC || header.headerCrc != structCrc(header)) {
+                    std::cerr << "Error: Damaged index block " << block << " in " << filePath << std::endl;
+                    return false;
+                }
+                cachedBlock.resize(header.entryCount);
+                if (!readAt(indexOffsets[block] + sizeof(header), cachedBlock.data(), cachedBlock.size() * sizeof(IndexEntry)) ||
+                    crc32c(cachedBlock.data(), cachedBlock.size() * sizeof(IndexEntry)) != header.entriesCrc) {
+                    cachedBlockNumber = UINT64_MAX;
+                    return false;
+                }
+                cachedBlockNumber = block;
+            }
+
+            size_t slot = static_cast<size_t>(index % recordingInfo.indexInterval);
+            if (slot >= cachedBlock.size()) {
+                return false;
+            }
+            entry = cachedBlock[slot];
+            return true;
+        }
+    };
+}
@@ -0,0 +1,230 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Decides how hard to try to get the camera going again after a fault, and
+// keeps a record of every time it had to. Faults escalate through tiers:
+//   1. Skip: an incomplete frame is dropped and capture carries on.
+//   2. Restart the stream (end and begin acquisition): tens of ms.
+//   3. Re-initialise the camera, waiting twice as long before each attempt.
+// The next complete frame ends the episode. It is logged as one event with
+// the frame ID gap across it and the time from the first fault to that
+// frame, and the tiers start over.
+//
+// Call from the capture thread only.
+class RecoveryPolicy
+{
+public:
+    enum class Fault
+    {
+        Incomplete,  // A frame arrived damaged
+        Timeout,     // No frame arrived in time
+        Error        // The source threw, or a recovery step failed
+    };
+
+    enum class Action
+    {
+        Skip = 1,
+        RestartStream = 2,
+        Reinitialise = 3,
+        GiveUp = 4
+    };
+
+    struct Settings
+    {
+        uint32_t skipsBeforeRestart = 10;  // Incomplete frames in a row that are skipped before restarting the stream
+        uint32_t restartsBeforeReinit = 2;  // Stream restarts that don't bring frames back before re-initialising
+        uint32_t maxReinits = 5;  // Re-initialisations before giving up
+        std::chrono::milliseconds firstBackoff{ 250 };  // Wait before the first re-initialisation; doubles each time
+        std::chrono::milliseconds maxBackoff{ 8000 };
+    };
+
+    struct Event
+    {
+        Action tier = Action::Skip;  // Deepest tier reached
+        std::string firstFault;      // What started it
+        uint64_t hostTimestamp = 0;  // First fault, ns since epoch
+        uint64_t lastFrameID = 0;    // Last complete frame before it
+        uint64_t nextFrameID = 0;    // First complete frame after it
+        uint64_t missingFrames = 0;  // Frames not recorded in between, skipped ones included
+        bool idReset = false;        // Frame IDs started again, so missingFrames is estimated from the host clock
+        uint64_t skipped = 0;        // Incomplete frames dropped
+        uint32_t restarts = 0;
+        uint32_t reinits = 0;
+        double durationMs = 0;       // First fault to the next complete frame (or the end of the session)
+        bool recovered = false;
+    };
+
+    struct Totals
+    {
+        uint64_t episodes = 0;
+        uint64_t unrecovered = 0;
+        uint64_t skipped = 0;
+        uint64_t restarts = 0;
+        uint64_t reinits = 0;
+        uint64_t missingFrames = 0;
+        double maxDurationMs = 0;
+        double totalDurationMs = 0;
+    };
+
+    static const size_t MAX_LISTED_EVENTS = 1000;  // Events kept individually for the metadata
+
+    explicit RecoveryPolicy(double fps)
+        : fps(fps)
+    {
+    }
+
+    RecoveryPolicy(double fps, const Settings& settings)
+        : fps(fps), settings(settings)
+    {
+    }
+
+    // What to do about a fault. Report a failed restart or re-initialisation
+    // as another fault; it escalates from there.
+    Action fault(Fault fault, const std::string& detail, uint64_t hostTimestamp, uint64_t steadyTimestamp)
+    {
+        if (!inEpisode) {
+            inEpisode = true;
+            current = Event();
+            current.firstFault = faultName(fault) + (detail.empty() ? "" : ": " + detail);
+            current.hostTimestamp = hostTimestamp;
+            current.lastFrameID = lastFrameID;
+            episodeStartNs = steadyTimestamp;
+        }
+
+        Action action;
+        if (fault == Fault::Incomplete && ++consecutiveSkips <= settings.skipsBeforeRestart) {
+            current.skipped++;
+            action = Action::Skip;
+        }
+        else {
+            consecutiveSkips = 0;
+            action = escalate();
+        }
+        current.tier = std::max(current.tier, action);
+        return action;
+    }
+
+    // How long to wait before the re-initialisation fault() just asked for
+    std::chrono::milliseconds backoff() const
+    {
+        auto wait = settings.firstBackoff;
+        for (uint32_t i = 1; i < current.reinits && wait < settings.maxBackoff; ++i) {
+            wait *= 2;
+        }
+        return std::min(wait, settings.maxBackoff);
+    }
+
+    // A complete frame arrived. Returns true if it ended an episode; the
+    // event is then lastEvent().
+    bool frame(uint64_t frameID, uint64_t steadyTimestamp)
+    {
+        bool ended = false;
+        if (inEpisode) {
+            current.nextFrameID = frameID;
+            current.recovered = true;
+            if (haveFrame && frameID > lastFrameID) {
+                current.missingFrames = frameID - lastFrameID - 1;
+            }
+            else if (haveFrame) {
+                // Re-initialising restarted the IDs; count frame periods instead
+                current.idReset = true;
+                double periods = (steadyTimestamp - lastFrameNs) * fps / 1e9;
+                current.missingFrames = static_cast<uint64_t>(std::max(0.0, std::round(periods) - 1));
+            }
+            close(steadyTimestamp);
+            ended = true;
+        }
+        lastFrameID = frameID;
+        lastFrameNs = steadyTimestamp;
+        haveFrame = true;
+        return ended;
+    }
+
+    // The session is over; an episode still open goes down as unrecovered
+    void finish(uint64_t steadyTimestamp)
+    {
+        if (inEpisode) {
+            close(steadyTimestamp);
+        }
+    }
+
+    bool recovering() const { return inEpisode; }
+    uint32_t reinitAttempt() const { return current.reinits; }  // Of the episode in progress
+    const Event& lastEvent() const { return last; }
+    const std::vector<Event>& events() const { return listed; }
+    const Totals& totals() const { return sums; }
+    const Settings& limits() const { return settings; }
+
+    static const char* actionName(Action action)
+    {
+        switch (action) {
+        case Action::Skip: return "skip";
+        case Action::RestartStream: return "restart_stream";
+        case Action::Reinitialise: return "reinitialise";
+        case Action::GiveUp: return "give_up";
+        }
+        return "unknown";
+    }
+
+private:
+    double fps;
+    Settings settings;
+    bool inEpisode = false;
+    Event current;
+    Event last;
+    uint64_t episodeStartNs = 0;
+    uint32_t consecutiveSkips = 0;
+    bool haveFrame = false;
+    uint64_t lastFrameID = 0;
+    uint64_t lastFrameNs = 0;
+    std::vector<Event> listed;
+    Totals sums;
+
+    Action escalate()
+    {
+        if (current.restarts < settings.restartsBeforeReinit) {
+            current.restarts++;
+            return Action::RestartStream;
+        }
+        if (current.reinits < settings.maxReinits) {
+            current.reinits++;
+            return Action::Reinitialise;
+        }
+        return Action::GiveUp;
+    }
+
+    void close(uint64_t steadyTimestamp)
+    {
+        current.durationMs = (steadyTimestamp - std::min(steadyTimestamp, episodeStartNs)) / 1e6;
+        sums.episodes++;
+        sums.unrecovered += current.recovered ? 0 : 1;
+        sums.skipped += current.skipped;
+        sums.restarts += current.restarts;
+        sums.reinits += current.reinits;
+        sums.missingFrames += current.missingFrames;
+        sums.maxDurationMs = std::max(sums.maxDurationMs, current.durationMs);
+        sums.totalDurationMs += current.durationMs;
+        if (listed.size() < MAX_LISTED_EVENTS) {
+            listed.push_back(current);
+        }
+        last = current;
+        inEpisode = false;
+        consecutiveSkips = 0;
+    }
+
+    static std::string faultName(Fault fault)
+    {
+        switch (fault) {
+        case Fault::Incomplete: return "incomplete";
+        case Fault::Timeout: return "timeout";
+        case Fault::Error: return "error";
+        }
+        return "unknown";
+    }
+};
@@ -0,0 +1,156 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include "FrameSource.h"
+#include "RecordingFormat.h"
+#include "SessionMetadata.h"
+
+// Streams an existing recording back at the rate it was recorded: either a
+// .camrec container, or a legacy _binary_video.bin + _Tracker_data.json pair.
+// Frames are paced by frame ID, so gaps in the original recording show up as
+// gaps in time as well.
+class ReplayFrameSource : public FrameSource
+{
+public:
+    ReplayFrameSource(const std::string& binaryFilePath, const std::string& metadataFilePath)
+        : binaryFilePath(binaryFilePath)
+    {
+        if (camrec::RecordingReader::isRecording(binaryFilePath)) {
+            // The container carries its own geometry and frame IDs; no JSON needed
+            recording = std::make_unique<camrec::RecordingReader>(binaryFilePath);
+            const camrec::RecordingInfo& info = recording->info();
+            imageWidth = info.width;
+            imageHeight = info.height;
+            format = info.pixelFormat;
+            recordedRate = info.frameRate;
+            frameIDs = recording->frameIDs();
+        }
+        else {
+            SessionMetadata metadata = loadSessionMetadata(metadataFilePath, true);
+            imageWidth = metadata.width;
+            imageHeight = metadata.height;
+            format = metadata.pixelFormat;
+            recordedRate = metadata.frameRate;
+            frameIDs = loadFrameIDs(metadata);
+        }
+        if (recordedRate <= 0) {
+            throw std::runtime_error("Replay metadata has no usable frame_rate");
+        }
+
+        frameBytes = imageWidth * imageHeight * bytesPerPixel(format);
+        frame.resize(frameBytes);
+
+        if (!recording) {
+            binaryFile.open(binaryFilePath, std::ios::in | std::ios::binary);
+            if (!binaryFile.is_open()) {
+                throw std::runtime_error("Unable to open replay binary file: " + binaryFilePath);
+            }
+        }
+    }
+
+    size_t width() const override { return imageWidth; }
+    size_t height() const override { return imageHeight; }
+    std::string pixelFormat() const override { return format; }
+    double frameRate() const override { return recordedRate; }
+    std::string description() const override { return "replay " + binaryFilePath; }
+
+    void beginAcquisition() override
+    {
+        startTime = std::chrono::steady_clock::now();
+        acquiring = true;
+    }
+
+    void endAcquisition() override
+    {
+        acquiring = false;
+    }
+
+    bool grabFrame(GrabbedFrame& grabbed, uint64_t timeoutMs) override
+    {
+        if (!acquiring) {
+            throw std::runtime_error("Replay source is not acquiring");
+        }
+        if (finished()) {
+            return false;
+        }
+
+        uint64_t frameID = frameIDs[nextIndex];
+        auto due = startTime + std::chrono::nanoseconds(static_cast<int64_t>(
+            (frameID - frameIDs.front()) * 1e9 / recordedRate));
+        if (due > std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs)) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(timeoutMs));
+            return false;
+        }
+        std::this_thread::sleep_until(due);
+
+        if (recording) {
+            camrec::FrameInfo info;
+            if (!recording->readFrame(nextIndex, info, frame) || frame.size() != frameBytes) {
+                // Damaged record: skip it, as a dropped frame would be
+                frame.resize(frameBytes);
+                nextIndex++;
+                return false;
+            }
+        }
+        else {
+            binaryFile.read(frame.data(), frameBytes);
+            if (!binaryFile.good()) {
+                // The .bin is shorter than the metadata says (e.g. a crashed session)
+                nextIndex = frameIDs.size();
+                return false;
+            }
+        }
+
+        grabbed.data = frame.data();
+        grabbed.size = frameBytes;
+        grabbed.stride = imageWidth * bytesPerPixel(format);
+        grabbed.frameID = frameID;
+        grabbed.timestamp = static_cast<uint64_t>((frameID - frameIDs.front()) * 1e9 / recordedRate);
+        grabbed.incomplete = false;
+        grabbed.handle = nullptr;
+        nextIndex++;
+        return true;
+    }
+
+    void releaseFrame(GrabbedFrame&) override {}
+
+    // Restarting would rewind the schedule; carry on from the same frame instead
+    bool restartStream() override
+    {
+        acquiring = true;
+        return true;
+    }
+
+    bool recover() override
+    {
+        acquiring = true;
+        return true;
+    }
+
+    bool finished() const override
+    {
+        return nextIndex >= frameIDs.size();
+    }
+
+private:
+    std::string binaryFilePath;
+    std::ifstream binaryFile;
+    std::unique_ptr<camrec::RecordingReader> recording;  // Set for .camrec files
+    size_t imageWidth = 0;
+    size_t imageHeight = 0;
+    std::string format;
+    double recordedRate = 0.0;
+    std::vector<uint64_t> frameIDs;
+    size_t frameBytes = 0;
+    std::vector<char> frame;
+    size_t nextIndex = 0;
+    std::chrono::steady_clock::time_point startTime;
+    bool acquiring = false;
+};
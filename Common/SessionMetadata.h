@@ -0,0 +1,165 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "nlohmann/json.hpp"
+#include "FrameTable.h"
+
+// The parts of a _Tracker_data.json the offline tools use.
+//
+// The JSON is read with a SAX handler that keeps only top-level scalars and
+// never builds a document. Current sessions keep their per-frame data in a
+// frame table next to the JSON (see FrameTable.h). Older ones list every
+// frame ID inline; those are counted, and collected into a plain vector only
+// when asked for.
+struct SessionMetadata
+{
+    size_t width = 0;
+    size_t height = 0;
+    std::string pixelFormat;
+    double frameRate = 0;
+    uint64_t frameCount = 0;
+    std::string frameTablePath;         // Resolved against the JSON's directory; empty for older sessions
+    std::string clockSyncPath;          // Likewise
+    std::vector<uint64_t> frameIDs;     // Older sessions only, and only if requested
+};
+
+namespace sessionmeta
+{
+    class Handler : public nlohmann::json_sax<nlohmann::json>
+    {
+    public:
+        Handler(SessionMetadata& metadata, bool collectFrameIDs)
+            : metadata(metadata), collectFrameIDs(collectFrameIDs)
+        {
+        }
+
+        std::string frameTable;
+        std::string clockSync;
+        uint64_t inlineFrameIDs = 0;
+        bool frameCountGiven = false;
+        bool haveWidth = false, haveHeight = false, haveFormat = false, haveRate = false;
+
+        bool null() override { return true; }
+        bool boolean(bool) override { return true; }
+        bool number_integer(number_integer_t value) override { return number(static_cast<double>(value), static_cast<uint64_t>(value)); }
+        bool number_unsigned(number_unsigned_t value) override { return number(static_cast<double>(value), value); }
+        bool number_float(number_float_t value, const string_t&) override { return number(value, static_cast<uint64_t>(value)); }
+        bool binary(binary_t&) override { return true; }
+
+        bool string(string_t& value) override
+        {
+            if (depth == 1 && currentKey == "pixel_format") {
+                metadata.pixelFormat = value;
+                haveFormat = true;
+            }
+            else if (depth == 1 && currentKey == "frame_table") {
+                frameTable = value;
+            }
+            else if (depth == 1 && currentKey == "clock_sync") {
+                clockSync = value;
+            }
+            return true;
+        }
+
+        bool start_object(std::size_t) override { depth++; return true; }
+        bool end_object() override { depth--; return true; }
+
+        bool start_array(std::size_t) override
+        {
+            depth++;
+            inFrameIDs = depth == 2 && currentKey == "frame_IDs";
+            return true;
+        }
+
+        bool end_array() override
+        {
+            depth--;
+            inFrameIDs = false;
+            return true;
+        }
+
+        bool key(string_t& value) override
+        {
+            if (depth == 1) {
+                currentKey = value;
+            }
+            return true;
+        }
+
+        bool parse_error(std::size_t position, const std::string&, const nlohmann::detail::exception& error) override
+        {
+            throw std::runtime_error("Metadata is not valid JSON at byte " + std::to_string(position) + ": " + error.what());
+        }
+
+    private:
+        SessionMetadata& metadata;
+        bool collectFrameIDs;
+        int depth = 0;
+        std::string currentKey;
+        bool inFrameIDs = false;
+
+        bool number(double value, uint64_t whole)
+        {
+            if (inFrameIDs) {
+                inlineFrameIDs++;
+                if (collectFrameIDs) {
+                    metadata.frameIDs.push_back(whole);
+                }
+            }
+            else if (depth == 1) {
+                if (currentKey == "image_width") { metadata.width = static_cast<size_t>(whole); haveWidth = true; }
+                else if (currentKey == "image_height") { metadata.height = static_cast<size_t>(whole); haveHeight = true; }
+                else if (currentKey == "frame_rate") { metadata.frameRate = value; haveRate = true; }
+                else if (currentKey == "frame_count") { metadata.frameCount = whole; frameCountGiven = true; }
+            }
+            return true;
+        }
+    };
+}
+
+// Reads the fields above from a metadata file. collectFrameIDs fills
+// frameIDs for an older session that lists them inline.
+inline SessionMetadata loadSessionMetadata(const std::string& filePath, bool collectFrameIDs = false)
+{
+    std::ifstream file(filePath, std::ios::in | std::ios::binary);
+    if (!file.is_open()) {
+        throw std::runtime_error("Unable to open metadata file: " + filePath);
+    }
+
+    SessionMetadata metadata;
+    sessionmeta::Handler handler(metadata, collectFrameIDs);
+    nlohmann::json::sax_parse(file, &handler);
+    if (!handler.haveWidth || !handler.haveHeight || !handler.haveFormat || !handler.haveRate) {
+        throw std::runtime_error("Metadata lacks image_width, image_height, pixel_format or frame_rate: " + filePath);
+    }
+    if (!handler.frameCountGiven) {
+        metadata.frameCount = handler.inlineFrameIDs;
+    }
+
+    // Side files are named relative to the JSON
+    auto resolve = [&filePath](const std::string& name) {
+        std::filesystem::path file(name);
+        if (!name.empty() && file.is_relative()) {
+            file = std::filesystem::path(filePath).parent_path() / file;
+        }
+        return file.string();
+    };
+    metadata.frameTablePath = resolve(handler.frameTable);
+    metadata.clockSyncPath = resolve(handler.clockSync);
+    return metadata;
+}
+
+// Every frame ID of a session, from its frame table or, for an older session,
+// the inline list (load the metadata with collectFrameIDs for that)
+inline std::vector<uint64_t> loadFrameIDs(const SessionMetadata& metadata)
+{
+    if (metadata.frameTablePath.empty()) {
+        return metadata.frameIDs;
+    }
+    return frametable::Reader(metadata.frameTablePath).column(frametable::FrameID);
+}
@@ -0,0 +1,615 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#include <winioctl.h>
+#else
+#include <cerrno>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+#endif
+
+// Paces every conversion a scheduler runs, all of them together. The reader
+// of each conversion calls admit() before each frame.
+class ConversionGate
+{
+public:
+    // Frames per second over all conversions: negative for no limit, 0 to pause
+    void setRate(double framesPerSecond)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        rate = framesPerSecond;
+        changed.notify_all();
+    }
+
+    // Waits while paused or ahead of the rate; false once cancelled
+    bool admit()
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        while (true) {
+            if (cancelled) {
+                return false;
+            }
+            if (rate < 0) {
+                return true;
+            }
+            if (rate == 0) {
+                changed.wait(guard);
+                continue;
+            }
+            auto now = std::chrono::steady_clock::now();
+            auto period = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1.0 / rate));
+            if (nextSlot <= now) {
+                nextSlot = std::max(nextSlot, now - period) + period;  // No saving up while idle
+                return true;
+            }
+            changed.wait_until(guard, nextSlot);
+        }
+    }
+
+    void cancel()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        cancelled = true;
+        changed.notify_all();
+    }
+
+private:
+    std::mutex lock;
+    std::condition_variable changed;
+    double rate = -1;
+    std::chrono::steady_clock::time_point nextSlot;
+    bool cancelled = false;
+};
+
+// A recording waiting for conversion, and where its video goes
+struct SessionRecording
+{
+    std::string sessionDirectory;
+    std::string recordingPath;  // _video.camrec or _binary_video.bin
+    std::string metadataPath;   // _Tracker_data.json for a .bin; empty for a .camrec
+    std::string outputPath;     // The .avi next to the recording
+    std::string disk;           // Physical disk the recording is on
+};
+
+// Converts the backlog of finished sessions under a set of root folders, and
+// keeps converting new ones as their sessions finish.
+//
+// A session folder is each root and each folder directly inside one. It is
+// finished once it holds a rig_<rig>_camera_finished.signal for every
+// rig_<rig>_camera_status.json in it; each recording in it whose .avi
+// doesn't exist yet is then queued, in name order (oldest first, for names
+// that start with the date). The roots are watched
+// (inotify / ReadDirectoryChangesW) so a signal file is seen as it appears,
+// and rescanned every few seconds anyway, which covers network drives that
+// don't report changes.
+//
+// At most maxJobs conversions run at once, and at most readersPerDisk from
+// any one physical disk, so conversions on different disks run side by side
+// instead of seeking against each other. While any session under the roots
+// is recording (its status file updated in the last few seconds, and no
+// finished signal), the gate holds all conversions to recordingRate frames
+// per second, 0 pausing them, and no new ones start if paused.
+//
+// A video is written under <name>.avi.converting and renamed when complete,
+// so an .avi that exists is always whole. One scheduler per set of roots.
+class SessionScheduler
+{
+public:
+    static constexpr double LIVE_STATUS_SECONDS = 10.0;  // The recorder rewrites its status file every second
+    const std::chrono::seconds RESCAN_INTERVAL{ 5 };
+
+    // Converts one recording into partialPath, its reader admitted frame by
+    // frame through the gate; true on success
+    using Convert = std::function<bool(const SessionRecording& recording, const std::string& partialPath, ConversionGate& gate)>;
+
+    SessionScheduler(const std::vector<std::string>& roots, size_t maxJobs, size_t readersPerDisk,
+        double recordingRate, Convert convert)
+        : roots(roots), maxJobs(std::max<size_t>(maxJobs, 1)), readersPerDisk(std::max<size_t>(readersPerDisk, 1)),
+        recordingRate(recordingRate), convert(convert)
+    {
+        openWatcher();
+    }
+
+    ~SessionScheduler()
+    {
+        gate.cancel();
+        for (auto& job : running) {
+            job->thread.join();
+        }
+        closeWatcher();
+    }
+
+    SessionScheduler(const SessionScheduler&) = delete;
+    SessionScheduler& operator=(const SessionScheduler&) = delete;
+
+    struct Totals
+    {
+        size_t converted = 0;
+        size_t failed = 0;
+    };
+
+    // Runs until stopped from another thread, or with untilIdle, until
+    // nothing is queued or converting
+    Totals run(bool untilIdle)
+    {
+        lowerPriority();
+        while (!stopFlag.load()) {
+            reap();
+            scan();
+            launch();
+            if (untilIdle && running.empty() && queued.empty()) {
+                break;
+            }
+            waitForChange();
+        }
+        return totals;
+    }
+
+    void stop()
+    {
+        stopFlag.store(true);
+        wake();
+    }
+
+    // The disk a path is on: the physical disk where it can be found,
+    // otherwise the volume
+    static std::string diskOf(const std::string& path)
+    {
+#ifdef _WIN32
+        char volume[MAX_PATH];
+        if (!GetVolumePathNameA(path.c_str(), volume, MAX_PATH)) {
+            return std::filesystem::path(path).root_name().string();
+        }
+        char volumeName[MAX_PATH];
+        if (GetVolumeNameForVolumeMountPointA(volume, volumeName, MAX_PATH)) {
+            // "\\?\Volume{...}\" without the trailing backslash opens the volume itself
+            std::string device(volumeName);
+            if (!device.empty() && device.back() == '\\') {
+                device.pop_back();
+            }
+            HANDLE handle = CreateFileA(device.c_str(), 0, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, 0, NULL);
+            if (handle != INVALID_HANDLE_VALUE) {
+                STORAGE_DEVICE_NUMBER number = {};
+                DWORD bytes = 0;
+                bool found = DeviceIoControl(handle, IOCTL_STORAGE_GET_DEVICE_NUMBER, NULL, 0,
+                    &number, sizeof(number), &bytes, NULL) != 0;
+                CloseHandle(handle);
+                if (found) {
+                    return "PhysicalDrive" + std::to_string(number.DeviceNumber);
+                }
+            }
+        }
+        return volume;  // Spanned and network volumes have no single disk
+#else
+        struct stat info;
+        if (stat(path.c_str(), &info) != 0) {
+            return path;
+        }
+        std::string device = std::to_string(major(info.st_dev)) + ":" + std::to_string(minor(info.st_dev));
+        // /sys/dev/block/<major>:<minor> leads to the partition, whose parent is the disk
+        std::error_code error;
+        std::filesystem::path block = std::filesystem::canonical("/sys/dev/block/" + device, error);
+        if (error) {
+            return device;
+        }
+        if (std::filesystem::exists(block / "partition", error)) {
+            block = block.parent_path();
+        }
+        return block.filename().string();
+#endif
+    }
+
+private:
+    struct Job
+    {
+        SessionRecording recording;
+        std::thread thread;
+        bool converted = false;
+        std::atomic<bool> done{ false };  // Set after converted
+        std::chrono::steady_clock::time_point started;
+    };
+
+    std::vector<std::string> roots;
+    size_t maxJobs;
+    size_t readersPerDisk;
+    double recordingRate;
+    Convert convert;
+    ConversionGate gate;
+    std::atomic<bool> stopFlag{ false };
+
+    std::vector<SessionRecording> queued;    // In name order
+    std::list<std::unique_ptr<Job>> running;
+    std::set<std::string> failed;            // Recordings not retried until restart
+    std::set<std::string> reported;          // Sessions already mentioned, so they aren't on every scan
+    std::map<std::string, std::string> disks;
+    bool paused = false;
+    bool live = false;
+    Totals totals;
+
+    static bool endsWith(const std::string& text, const std::string& suffix)
+    {
+        return text.size() >= suffix.size() && text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+    }
+
+    // "rig_<rig><suffix>" -> "<rig>", or empty
+    static std::string rigOf(const std::string& name, const std::string& suffix)
+    {
+        if (name.compare(0, 4, "rig_") != 0 || !endsWith(name, suffix) || name.size() <= 4 + suffix.size()) {
+            return "";
+        }
+        return name.substr(4, name.size() - 4 - suffix.size());
+    }
+
+    void scan()
+    {
+        std::vector<std::string> folders;
+        std::error_code error;
+        for (const std::string& root : roots) {
+            folders.push_back(root);
+            for (const auto& entry : std::filesystem::directory_iterator(root, error)) {
+                if (entry.is_directory(error)) {
+                    folders.push_back(entry.path().string());
+                    watchFolder(entry.path().string());
+                }
+            }
+        }
+
+        bool nowLive = false;
+        std::string liveFolder;
+        queued.clear();
+        for (const std::string& folder : folders) {
+            std::set<std::string> statusRigs;
+            std::set<std::string> finishedRigs;
+            bool recent = false;
+            std::vector<std::filesystem::path> recordings;
+            for (const auto& entry : std::filesystem::directory_iterator(folder, error)) {
+                std::string name = entry.path().filename().string();
+                std::string rig = rigOf(name, "_camera_status.json");
+                if (!rig.empty()) {
+                    statusRigs.insert(rig);
+                    auto age = std::filesystem::file_time_type::clock::now() - entry.last_write_time(error);
+                    if (!error && std::chrono::duration<double>(age).count() < LIVE_STATUS_SECONDS) {
+                        recent = true;
+                    }
+                }
+                rig = rigOf(name, "_camera_finished.signal");
+                if (!rig.empty()) {
+                    finishedRigs.insert(rig);
+                }
+                if (endsWith(name, "_video.camrec") || endsWith(name, "_binary_video.bin")) {
+                    recordings.push_back(entry.path());
+                }
+            }
+
+            bool finished = !finishedRigs.empty();
+            for (const std::string& rig : statusRigs) {
+                finished = finished && finishedRigs.count(rig) > 0;
+            }
+            if (!finished) {
+                if (recent) {
+                    nowLive = true;
+                    liveFolder = folder;
+                }
+                else if (!statusRigs.empty() && reported.insert(folder).second) {
+                    std::cout << "Not converting " << folder << ": its session stopped without finishing"
+                        << " (salvage_recording can recover it)" << std::endl;
+                }
+                continue;
+            }
+            for (const auto& path : recordings) {
+                queue(folder, path);
+            }
+        }
+
+        std::sort(queued.begin(), queued.end(), [](const SessionRecording& a, const SessionRecording& b) {
+            return a.recordingPath < b.recordingPath;
+        });
+
+        if (nowLive != live) {
+            if (nowLive) {
+                std::cout << "Recording in " << liveFolder << ": conversions "
+                    << (recordingRate == 0 ? std::string("paused") : "held to " + std::to_string(static_cast<int>(recordingRate)) + " frames/s")
+                    << " until it finishes" << std::endl;
+            }
+            else {
+                std::cout << "No recording running: conversions at full speed" << std::endl;
+            }
+        }
+        live = nowLive;
+        paused = live && recordingRate == 0;
+        gate.setRate(live ? recordingRate : -1);
+    }
+
+    void queue(const std::string& folder, const std::filesystem::path& path)
+    {
+        std::string recordingPath = path.string();
+        std::error_code error;
+        SessionRecording recording;
+        recording.sessionDirectory = folder;
+        recording.recordingPath = recordingPath;
+        recording.outputPath = std::filesystem::path(path).replace_extension(".avi").string();
+        if (endsWith(recordingPath, "_binary_video.bin")) {
+            recording.metadataPath = recordingPath.substr(0, recordingPath.size() - std::string("_binary_video.bin").size())
+                + "_Tracker_data.json";
+            if (!std::filesystem::exists(recording.metadataPath, error)) {
+                if (reported.insert(recordingPath).second) {
+                    std::cerr << "Warning: Not converting " << recordingPath << ": no " << recording.metadataPath << std::endl;
+                }
+                return;
+            }
+        }
+        if (std::filesystem::exists(recording.outputPath, error) || failed.count(recordingPath) > 0) {
+            return;
+        }
+        for (const auto& job : running) {
+            if (job->recording.recordingPath == recordingPath) {
+                return;
+            }
+        }
+        auto known = disks.find(recordingPath);
+        if (known == disks.end()) {
+            known = disks.emplace(recordingPath, diskOf(recordingPath)).first;
+        }
+        recording.disk = known->second;
+        queued.push_back(recording);
+    }
+
+    void launch()
+    {
+        if (paused) {
+            return;
+        }
+        for (auto next = queued.begin(); next != queued.end() && running.size() < maxJobs;) {
+            size_t onDisk = 0;
+            for (const auto& job : running) {
+                onDisk += job->recording.disk == next->disk ? 1 : 0;
+            }
+            if (onDisk >= readersPerDisk) {
+                ++next;
+                continue;
+            }
+
+            auto job = std::make_unique<Job>();
+            job->recording = *next;
+            job->started = std::chrono::steady_clock::now();
+            Job* started = job.get();
+            std::cout << "Converting " << started->recording.recordingPath << " (disk " << started->recording.disk << ", "
+                << queued.size() - 1 << " more queued)" << std::endl;
+            started->thread = std::thread([this, started]() {
+                std::string partialPath = started->recording.outputPath + ".converting";
+                bool converted = false;
+                try {
+                    converted = convert(started->recording, partialPath, gate);
+                }
+                catch (const std::exception& e) {
+                    std::cerr << "Error converting " << started->recording.recordingPath << ": " << e.what() << std::endl;
+                }
+                std::error_code error;
+                if (converted) {
+                    std::filesystem::rename(partialPath, started->recording.outputPath, error);
+                    converted = !error;
+                }
+                if (!converted) {
+                    std::filesystem::remove(partialPath, error);
+                }
+                started->converted = converted;
+                started->done.store(true);
+                wake();
+            });
+            running.push_back(std::move(job));
+            next = queued.erase(next);
+        }
+    }
+
+    void reap()
+    {
+        for (auto job = running.begin(); job != running.end();) {
+            if (!(*job)->done.load()) {
+                ++job;
+                continue;
+            }
+            (*job)->thread.join();
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - (*job)->started).count();
+            if ((*job)->converted) {
+                totals.converted++;
+                std::cout << "Converted " << (*job)->recording.outputPath << " in " << seconds << " s" << std::endl;
+            }
+            else {
+                totals.failed++;
+                failed.insert((*job)->recording.recordingPath);
+                std::cerr << "Error: Could not convert " << (*job)->recording.recordingPath << "; not retrying it" << std::endl;
+            }
+            job = running.erase(job);
+        }
+    }
+
+    // Lower priority than any capture on the same PC, so conversions use what it leaves
+    static void lowerPriority()
+    {
+#ifdef _WIN32
+        SetPriorityClass(GetCurrentProcess(), BELOW_NORMAL_PRIORITY_CLASS);
+#else
+        errno = 0;
+        if (nice(10) == -1 && errno != 0) {
+            std::cerr << "Warning: Could not lower the scheduler's priority" << std::endl;
+        }
+#endif
+    }
+
+#ifdef _WIN32
+    HANDLE wakeEvent = NULL;
+    std::vector<HANDLE> directories;
+    std::vector<OVERLAPPED> directoryIo;
+    std::vector<std::vector<DWORD>> directoryBuffers;  // FILE_NOTIFY_INFORMATION records must be DWORD aligned
+
+    void openWatcher()
+    {
+        wakeEvent = CreateEventA(NULL, FALSE, FALSE, NULL);
+        directoryIo.resize(roots.size());
+        directoryBuffers.resize(roots.size(), std::vector<DWORD>(1024));
+        for (size_t i = 0; i < roots.size(); ++i) {
+            directoryIo[i] = {};
+            directoryIo[i].hEvent = CreateEventA(NULL, TRUE, FALSE, NULL);
+            HANDLE directory = CreateFileA(roots[i].c_str(), FILE_LIST_DIRECTORY,
+                FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING,
+                FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, NULL);
+            if (directory == INVALID_HANDLE_VALUE) {
+                std::cerr << "Warning: Could not watch " << roots[i] << "; checking it every "
+                    << RESCAN_INTERVAL.count() << " s instead" << std::endl;
+            }
+            directories.push_back(directory);
+            watchDirectory(i);
+        }
+    }
+
+    // Session folders are under the root, so one watch of the whole tree covers them
+    void watchFolder(const std::string&)
+    {
+    }
+
+    void watchDirectory(size_t i)
+    {
+        if (directories[i] == INVALID_HANDLE_VALUE) {
+            return;
+        }
+        ResetEvent(directoryIo[i].hEvent);
+        if (!ReadDirectoryChangesW(directories[i], directoryBuffers[i].data(), static_cast<DWORD>(directoryBuffers[i].size() * sizeof(DWORD)),
+                TRUE, FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME | FILE_NOTIFY_CHANGE_LAST_WRITE, NULL, &directoryIo[i], NULL)) {
+            CloseHandle(directories[i]);
+            directories[i] = INVALID_HANDLE_VALUE;
+        }
+    }
+
+    void wake()
+    {
+        SetEvent(wakeEvent);
+    }
+
+    void waitForChange()
+    {
+        std::vector<HANDLE> handles = { wakeEvent };
+        std::vector<size_t> watched;
+        for (size_t i = 0; i < directories.size() && handles.size() < MAXIMUM_WAIT_OBJECTS; ++i) {
+            if (directories[i] != INVALID_HANDLE_VALUE) {
+                handles.push_back(directoryIo[i].hEvent);
+                watched.push_back(i);
+            }
+        }
+        DWORD signalled = WaitForMultipleObjects(static_cast<DWORD>(handles.size()), handles.data(), FALSE,
+            static_cast<DWORD>(std::chrono::duration_cast<std::chrono::milliseconds>(RESCAN_INTERVAL).count())) - WAIT_OBJECT_0;
+        if (signalled >= 1 && signalled < handles.size()) {
+            size_t i = watched[signalled - 1];
+            DWORD bytes = 0;
+            GetOverlappedResult(directories[i], &directoryIo[i], &bytes, FALSE);
+            watchDirectory(i);
+        }
+    }
+
+    void closeWatcher()
+    {
+        for (size_t i = 0; i < directories.size(); ++i) {
+            if (directories[i] != INVALID_HANDLE_VALUE) {
+                CancelIo(directories[i]);
+                CloseHandle(directories[i]);
+            }
+            CloseHandle(directoryIo[i].hEvent);
+        }
+        CloseHandle(wakeEvent);
+    }
+#else
+    int watchFd = -1;
+    int wakeFds[2] = { -1, -1 };
+    std::set<std::string> watched;
+
+    void openWatcher()
+    {
+        if (pipe(wakeFds) != 0) {
+            wakeFds[0] = wakeFds[1] = -1;
+        }
+        watchFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        for (const std::string& root : roots) {
+            watchFolder(root);
+        }
+    }
+
+    // inotify doesn't watch subfolders, so each session folder gets its own watch
+    void watchFolder(const std::string& folder)
+    {
+        if (!watched.insert(folder).second) {
+            return;
+        }
+        if (watchFd < 0 || inotify_add_watch(watchFd, folder.c_str(), IN_CREATE | IN_MOVED_TO | IN_CLOSE_WRITE) < 0) {
+            std::cerr << "Warning: Could not watch " << folder << "; checking it every "
+                << RESCAN_INTERVAL.count() << " s instead" << std::endl;
+        }
+    }
+
+    void wake()
+    {
+        char wake = 0;
+        if (wakeFds[1] >= 0 && write(wakeFds[1], &wake, 1) != 1) {
+            std::cerr << "Warning: Could not wake the scheduler" << std::endl;
+        }
+    }
+
+    void waitForChange()
+    {
+        pollfd fds[2] = { { wakeFds[0], POLLIN, 0 }, { watchFd, POLLIN, 0 } };
+        int timeoutMs = static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(RESCAN_INTERVAL).count());
+        if (poll(fds, 2, timeoutMs) <= 0) {
+            return;
+        }
+        // Drain both; whatever changed, the next scan sees it
+        char buffer[4096];
+        if (fds[0].revents & POLLIN) {
+            if (read(wakeFds[0], buffer, sizeof(buffer)) < 0) {
+                std::cerr << "Warning: Could not read the scheduler's wake pipe" << std::endl;
+            }
+        }
+        if (fds[1].revents & POLLIN) {
+            alignas(inotify_event) char events[4096];
+            while (read(watchFd, events, sizeof(events)) > 0) {
+            }
+        }
+    }
+
+    void closeWatcher()
+    {
+        if (watchFd >= 0) {
+            close(watchFd);
+        }
+        for (int fd : wakeFds) {
+            if (fd >= 0) {
+                close(fd);
+            }
+        }
+    }
+#endif
+};
@@ -0,0 +1,572 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Frames handed to other processes on this machine through shared memory, for
+// online analysis that can't wait for the recording to reach disk.
+//
+// The recorder writes each published frame into the next slot of a ring and
+// never waits for anyone: a reader that falls more than a ring behind misses
+// frames, it doesn't hold up capture. Each slot is guarded by a sequence lock.
+// The sequence is odd while the slot is being written and even once it's
+// done, so a reader that sees the same even sequence before and after looking
+// at a slot knows what it saw was one whole frame. Readers map the region
+// read-only and never write to it, so there can be any number of them.
+//
+// The region is a POSIX shared memory object /camera_frames_<name>, or the
+// named file mapping Local\camera_frames_<name> on Windows. A region header
+// gives the geometry, then come the slots: a SlotHeader and the pixels,
+// each slot starting on a page boundary.
+//
+// Timestamps ending in SteadyNs are std::chrono::steady_clock, which is
+// system-wide (CLOCK_MONOTONIC, QueryPerformanceCounter), so a reader can
+// subtract them from its own clock to see how old a frame is.
+namespace shm {
+
+const char MAGIC[8] = { 'C', 'A', 'M', 'S', 'H', 'M', '1', '\0' };
+const uint32_t VERSION = 1;
+const size_t REGION_HEADER_BYTES = 4096;
+const size_t SLOT_ALIGNMENT = 4096;
+
+enum RegionState : uint32_t
+{
+    LIVE = 1,
+    CLOSED = 2  // The recorder has stopped; nothing more will be published
+};
+
+struct RegionHeader
+{
+    char magic[8];  // Written last, once everything else is in place
+    uint32_t version;
+    uint32_t slotCount;
+    uint64_t slotBytes;  // Header and payload, rounded up to SLOT_ALIGNMENT
+    uint64_t payloadCapacity;
+    uint32_t width;
+    uint32_t height;
+    uint32_t bytesPerPixel;
+    uint32_t publishEvery;  // Every Nth frame the camera delivers is published
+    char pixelFormat[32];
+    double frameRate;  // Of the camera; published frames come at frameRate / publishEvery
+    std::atomic<uint64_t> published;  // Frames published so far; frame n is in slot n % slotCount
+    std::atomic<uint32_t> state;
+};
+
+struct SlotHeader
+{
+    std::atomic<uint64_t> sequence;  // Odd while the slot is being written
+    uint64_t number;  // Position in the published stream, from 0
+    uint64_t frameID;
+    uint64_t deviceTimestamp;  // Camera clock (ns)
+    uint64_t hostTimestamp;  // System clock when grabbed (ns since the epoch)
+    uint64_t grabSteadyNs;  // Steady clock when grabbed
+    uint64_t publishSteadyNs;  // Steady clock when the slot was complete
+    uint32_t bytes;
+    uint32_t stride;  // Bytes per row
+};
+
+// Readers map the region read-only, so these must be plain loads and stores
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "Shared frame ring needs lock-free 64-bit atomics");
+static_assert(std::atomic<uint32_t>::is_always_lock_free, "Shared frame ring needs lock-free 32-bit atomics");
+static_assert(sizeof(RegionHeader) <= REGION_HEADER_BYTES, "Region header must fit in its page");
+static_assert(sizeof(SlotHeader) == 64, "Slot header is one cache line");
+
+inline uint64_t steadyNs()
+{
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+inline std::string regionName(const std::string& name)
+{
+    if (name.empty() || name.find_first_of("/\\") != std::string::npos) {
+        throw std::invalid_argument("Shared frame ring name must be non-empty and contain no slashes: " + name);
+    }
+#ifdef _WIN32
+    return "Local\\camera_frames_" + name;
+#else
+    return "/camera_frames_" + name;
+#endif
+}
+
+// A mapping of a named region, created by the publisher or opened read-only by a reader
+class SharedRegion
+{
+public:
+    SharedRegion() = default;
+    ~SharedRegion() { close(); }
+
+    SharedRegion(const SharedRegion&) = delete;
+    SharedRegion& operator=(const SharedRegion&) = delete;
+
+    char* data() const { return base; }
+    size_t size() const { return bytes; }
+
+    // Replaces any region of the same name left by a recorder that died.
+    // Returns false with the reason in `error` if it can't be made.
+    bool create(const std::string& regionName, size_t size, std::string& error)
+    {
+        name = regionName;
+        bytes = size;
+#ifdef _WIN32
+        mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+            static_cast<DWORD>(static_cast<uint64_t>(size) >> 32), static_cast<DWORD>(size & 0xFFFFFFFF), name.c_str());
+        if (!mapping) {
+            error = "CreateFileMapping failed (" + std::to_string(GetLastError()) + ")";
+            return false;
+        }
+        if (GetLastError() == ERROR_ALREADY_EXISTS) {
+            // A reader still holds the last session's region open; its size can't be changed
+            error = "a reader is still attached to the previous session's frames";
+            close();
+            return false;
+        }
+        base = static_cast<char*>(MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, size));
+#else
+        shm_unlink(name.c_str());  // Readers still attached keep the old one until they let go
+        descriptor = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+        if (descriptor < 0) {
+            error = "shm_open failed";
+            return false;
+        }
+        owner = true;
+        if (ftruncate(descriptor, static_cast<off_t>(size)) != 0) {
+            error = "unable to size the region";
+            remove();
+            close();
+            return false;
+        }
+        void* mapped = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, descriptor, 0);
+        base = mapped == MAP_FAILED ? nullptr : static_cast<char*>(mapped);
+#endif
+        if (!base) {
+            error = "unable to map the region";
+            remove();
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    // Read-only; false if there is no such region
+    bool open(const std::string& regionName)
+    {
+        name = regionName;
+#ifdef _WIN32
+        mapping = OpenFileMappingA(FILE_MAP_READ, FALSE, name.c_str());
+        if (!mapping) {
+            return false;
+        }
+        base = static_cast<char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+        MEMORY_BASIC_INFORMATION info;
+        if (base && VirtualQuery(base, &info, sizeof(info)) == sizeof(info)) {
+            bytes = info.RegionSize;
+        }
+#else
+        descriptor = shm_open(name.c_str(), O_RDONLY, 0);
+        if (descriptor < 0) {
+            return false;
+        }
+        struct stat status;
+        if (fstat(descriptor, &status) != 0 || status.st_size <= 0) {
+            close();
+            return false;
+        }
+        bytes = static_cast<size_t>(status.st_size);
+        void* mapped = mmap(nullptr, bytes, PROT_READ, MAP_SHARED, descriptor, 0);
+        base = mapped == MAP_FAILED ? nullptr : static_cast<char*>(mapped);
+#endif
+        if (!base) {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    // The name goes at once; readers already attached keep their mapping
+    void remove()
+    {
+#ifndef _WIN32
+        if (owner) {
+            shm_unlink(name.c_str());
+            owner = false;
+        }
+#endif
+        // Windows: the mapping goes when the last handle to it is closed
+    }
+
+    void close()
+    {
+#ifdef _WIN32
+        if (base) {
+            UnmapViewOfFile(base);
+        }
+        if (mapping) {
+            CloseHandle(mapping);
+        }
+        mapping = NULL;
+#else
+        if (base) {
+            munmap(base, bytes);
+        }
+        if (descriptor >= 0) {
+            ::close(descriptor);
+        }
+        descriptor = -1;
+#endif
+        base = nullptr;
+        bytes = 0;
+    }
+
+private:
+    std::string name;
+    char* base = nullptr;
+    size_t bytes = 0;
+#ifdef _WIN32
+    HANDLE mapping = NULL;
+#else
+    int descriptor = -1;
+    bool owner = false;
+#endif
+};
+
+} // namespace shm
+
+// The recorder's end: copies frames into the ring from the capture thread.
+// publish() is a copy and a few stores; nothing a reader does can delay it.
+class SharedFramePublisher
+{
+public:
+    // Check isOpen() and error(); recording goes on without publishing if the region can't be made
+    SharedFramePublisher(const std::string& name, size_t slots, size_t width, size_t height,
+        size_t bytesPerPixel, const std::string& pixelFormat, double frameRate, size_t publishEvery)
+    {
+        payloadCapacity = width * height * bytesPerPixel;
+        slotCount = slots < 2 ? 2 : slots;
+        slotBytes = roundUp(sizeof(shm::SlotHeader) + payloadCapacity, shm::SLOT_ALIGNMENT);
+        try {
+            if (!region.create(shm::regionName(name), shm::REGION_HEADER_BYTES + slotCount * slotBytes, problem)) {
+                return;
+            }
+        }
+        catch (const std::invalid_argument& e) {
+            problem = e.what();
+            return;
+        }
+
+        header = new (region.data()) shm::RegionHeader();
+        header->version = shm::VERSION;
+        header->slotCount = static_cast<uint32_t>(slotCount);
+        header->slotBytes = slotBytes;
+        header->payloadCapacity = payloadCapacity;
+        header->width = static_cast<uint32_t>(width);
+        header->height = static_cast<uint32_t>(height);
+        header->bytesPerPixel = static_cast<uint32_t>(bytesPerPixel);
+        header->publishEvery = static_cast<uint32_t>(publishEvery);
+        memcpy(header->pixelFormat, pixelFormat.data(), std::min(pixelFormat.size(), sizeof(header->pixelFormat) - 1));
+        header->frameRate = frameRate;
+        header->published.store(0, std::memory_order_relaxed);
+        header->state.store(shm::LIVE, std::memory_order_relaxed);
+        for (size_t i = 0; i < slotCount; ++i) {
+            new (slot(i)) shm::SlotHeader();
+        }
+        std::atomic_thread_fence(std::memory_order_release);
+        memcpy(header->magic, shm::MAGIC, sizeof(shm::MAGIC));
+    }
+
+    ~SharedFramePublisher()
+    {
+        close();
+    }
+
+    SharedFramePublisher(const SharedFramePublisher&) = delete;
+    SharedFramePublisher& operator=(const SharedFramePublisher&) = delete;
+
+    bool isOpen() const { return header != nullptr; }  // Until close()
+    const std::string& error() const { return problem; }
+    size_t slots() const { return slotCount; }
+    uint64_t published() const { return count; }
+    uint64_t oversized() const { return tooLarge; }
+
+    // Tells readers nothing more is coming and takes the name away; the counts stay
+    void close()
+    {
+        if (header) {
+            header->state.store(shm::CLOSED, std::memory_order_release);
+            header = nullptr;
+        }
+        region.remove();
+    }
+
+    // False if the frame is larger than the geometry it was set up for
+    bool publish(const void* data, size_t bytes, size_t stride, uint64_t frameID, uint64_t deviceTimestamp,
+        uint64_t hostTimestamp, uint64_t grabSteadyNs)
+    {
+        if (!header) {
+            return false;
+        }
+        if (bytes > payloadCapacity) {
+            tooLarge++;
+            return false;
+        }
+
+        shm::SlotHeader* target = slot(static_cast<size_t>(count % slotCount));
+        uint64_t sequence = target->sequence.load(std::memory_order_relaxed);
+        target->sequence.store(sequence + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);  // Odd before any of the frame changes
+
+        target->number = count;
+        target->frameID = frameID;
+        target->deviceTimestamp = deviceTimestamp;
+        target->hostTimestamp = hostTimestamp;
+        target->grabSteadyNs = grabSteadyNs;
+        target->bytes = static_cast<uint32_t>(bytes);
+        target->stride = static_cast<uint32_t>(stride);
+        memcpy(reinterpret_cast<char*>(target) + sizeof(shm::SlotHeader), data, bytes);
+        target->publishSteadyNs = shm::steadyNs();
+
+        target->sequence.store(sequence + 2, std::memory_order_release);
+        count++;
+        header->published.store(count, std::memory_order_release);
+        return true;
+    }
+
+private:
+    shm::SharedRegion region;
+    std::string problem;
+    shm::RegionHeader* header = nullptr;
+    size_t slotCount = 0;
+    size_t slotBytes = 0;
+    size_t payloadCapacity = 0;
+    uint64_t count = 0;
+    uint64_t tooLarge = 0;
+
+    static size_t roundUp(size_t value, size_t multiple) { return (value + multiple - 1) / multiple * multiple; }
+
+    shm::SlotHeader* slot(size_t index)
+    {
+        return reinterpret_cast<shm::SlotHeader*>(region.data() + shm::REGION_HEADER_BYTES + index * slotBytes);
+    }
+};
+
+// A reader's end, for analysis in another process. Attach with the name the
+// recorder was given (--publish); read() and next() copy a frame out, view()
+// hands over the slot in place.
+//
+// Once closed() the recorder has gone; a new session publishes to a new
+// region, so make a new subscriber to follow it. Use from one thread; each
+// thread that reads needs its own subscriber.
+class SharedFrameSubscriber
+{
+public:
+    const std::chrono::microseconds SPIN_TIME{ 200 };  // next() yields this long before it sleeps between looks
+    const std::chrono::microseconds POLL_SLEEP{ 100 };
+    static const int TORN_RETRIES = 4;  // Reads that find a slot being rewritten before giving up on it
+
+    struct Frame
+    {
+        uint64_t number = 0;
+        uint64_t frameID = 0;
+        uint64_t deviceTimestamp = 0;
+        uint64_t hostTimestamp = 0;
+        uint64_t grabSteadyNs = 0;
+        uint64_t publishSteadyNs = 0;
+        size_t stride = 0;
+        std::vector<char> data;
+    };
+
+    // A slot as it lies in the region, valid only inside view()
+    struct View
+    {
+        uint64_t number;
+        uint64_t frameID;
+        uint64_t deviceTimestamp;
+        uint64_t hostTimestamp;
+        uint64_t grabSteadyNs;
+        uint64_t publishSteadyNs;
+        size_t stride;
+        const char* data;
+        size_t bytes;
+    };
+
+    // Throws std::runtime_error if nothing is being published under `name`
+    explicit SharedFrameSubscriber(const std::string& name)
+    {
+        if (!region.open(shm::regionName(name)) || region.size() < shm::REGION_HEADER_BYTES) {
+            throw std::runtime_error("No frames are being published as " + name);
+        }
+        header = reinterpret_cast<const shm::RegionHeader*>(region.data());
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (memcmp(header->magic, shm::MAGIC, sizeof(shm::MAGIC)) != 0 || header->version != shm::VERSION) {
+            throw std::runtime_error("Frames published as " + name + " are not in a format this reader knows");
+        }
+        if (shm::REGION_HEADER_BYTES + uint64_t(header->slotCount) * header->slotBytes > region.size()) {
+            throw std::runtime_error("Frames published as " + name + " have a truncated region");
+        }
+        // Start with the frames published from now on
+        nextNumber = published();
+    }
+
+    size_t width() const { return header->width; }
+    size_t height() const { return header->height; }
+    size_t bytesPerPixel() const { return header->bytesPerPixel; }
+    std::string pixelFormat() const { return std::string(header->pixelFormat, strnlen(header->pixelFormat, sizeof(header->pixelFormat))); }
+    double frameRate() const { return header->frameRate; }
+    size_t publishEvery() const { return header->publishEvery; }
+    size_t slots() const { return header->slotCount; }
+
+    uint64_t published() const { return header->published.load(std::memory_order_acquire); }
+    bool closed() const { return header->state.load(std::memory_order_acquire) == shm::CLOSED; }
+    uint64_t missed() const { return skipped; }  // Frames next() passed over because the ring had moved on
+
+    // Calls use(const View&) on frame `number` where it lies, then checks it
+    // wasn't overwritten meanwhile. Only if this returns true was what use()
+    // saw a whole frame; anything it worked out should be thrown away otherwise.
+    template <typename Use>
+    bool view(uint64_t number, Use use) const
+    {
+        const shm::SlotHeader* source = slot(number);
+        uint64_t sequence = source->sequence.load(std::memory_order_acquire);
+        if ((sequence & 1) != 0 || source->number != number || sequence == 0) {
+            return false;
+        }
+        View frame;
+        frame.number = number;
+        frame.frameID = source->frameID;
+        frame.deviceTimestamp = source->deviceTimestamp;
+        frame.hostTimestamp = source->hostTimestamp;
+        frame.grabSteadyNs = source->grabSteadyNs;
+        frame.publishSteadyNs = source->publishSteadyNs;
+        frame.stride = source->stride;
+        frame.bytes = source->bytes < header->payloadCapacity ? source->bytes : static_cast<size_t>(header->payloadCapacity);
+        frame.data = reinterpret_cast<const char*>(source) + sizeof(shm::SlotHeader);
+        use(frame);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return source->sequence.load(std::memory_order_relaxed) == sequence;
+    }
+
+    // Copies frame `number` out; false if it isn't published yet or has been overwritten
+    bool read(uint64_t number, Frame& frame) const
+    {
+        for (int attempt = 0; attempt < TORN_RETRIES; ++attempt) {
+            bool whole = view(number, [&frame](const View& source) {
+                frame.number = source.number;
+                frame.frameID = source.frameID;
+                frame.deviceTimestamp = source.deviceTimestamp;
+                frame.hostTimestamp = source.hostTimestamp;
+                frame.grabSteadyNs = source.grabSteadyNs;
+                frame.publishSteadyNs = source.publishSteadyNs;
+                frame.stride = source.stride;
+                frame.data.assign(source.data, source.data + source.bytes);
+            });
+            if (whole) {
+                return true;
+            }
+            if (number >= published() || slotNumber(number) > number) {
+                return false;  // Not there yet, or gone for good
+            }
+            std::this_thread::yield();  // Being written as we looked
+        }
+        return false;
+    }
+
+    // The newest frame; false if there isn't one yet
+    bool latest(Frame& frame)
+    {
+        for (int attempt = 0; attempt < TORN_RETRIES; ++attempt) {
+            uint64_t count = published();
+            if (count == 0) {
+                return false;
+            }
+            if (read(count - 1, frame)) {
+                nextNumber = count;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // The frame after the last one returned, waiting up to `timeout` for it.
+    // A reader more than a ring behind skips to the oldest frame still there,
+    // counting the frames it passed over in missed(). False on timeout or
+    // once the recorder has closed and everything it published has been read.
+    bool next(Frame& frame, std::chrono::microseconds timeout)
+    {
+        auto start = std::chrono::steady_clock::now();
+        while (true) {
+            uint64_t count = published();
+            if (nextNumber < count) {
+                uint64_t oldest = count > header->slotCount ? count - header->slotCount : 0;
+                if (nextNumber < oldest) {
+                    skipped += oldest - nextNumber;
+                    nextNumber = oldest;
+                }
+                if (read(nextNumber, frame)) {
+                    nextNumber++;
+                    return true;
+                }
+                // Overwritten while we read it, so the oldest has moved on. A
+                // recorder that died partway through the slot leaves it odd for
+                // good, so give up on the timeout rather than retrying forever.
+            }
+            if (closed()) {
+                return false;
+            }
+            auto waited = std::chrono::steady_clock::now() - start;
+            if (waited >= timeout) {
+                return false;
+            }
+            if (waited < SPIN_TIME) {
+                std::this_thread::yield();
+            }
+            else {
+                std::this_thread::sleep_for(POLL_SLEEP);
+            }
+        }
+    }
+
+private:
+    shm::SharedRegion region;
+    const shm::RegionHeader* header = nullptr;
+    uint64_t nextNumber = 0;
+    uint64_t skipped = 0;
+
+    const shm::SlotHeader* slot(uint64_t number) const
+    {
+        return reinterpret_cast<const shm::SlotHeader*>(region.data() + shm::REGION_HEADER_BYTES
+            + static_cast<size_t>(number % header->slotCount) * header->slotBytes);
+    }
+
+    // What the slot for `number` holds now; good enough to tell overwritten from not yet written
+    uint64_t slotNumber(uint64_t number) const
+    {
+        const shm::SlotHeader* source = slot(number);
+        uint64_t sequence = source->sequence.load(std::memory_order_acquire);
+        uint64_t held = source->number;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return source->sequence.load(std::memory_order_relaxed) == sequence ? held : number;
+    }
+};
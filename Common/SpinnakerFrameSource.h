@@ -0,0 +1,483 @@
+#pragma once
+
+#include "Spinnaker.h"
+#include "SpinGenApi/SpinnakerGenApi.h"
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include "FrameRateGovernor.h"
+#include "FrameSource.h"
+
+// FrameSource backed by a FLIR camera through the Spinnaker SDK. Owns the
+// camera from Init() to DeInit() and applies the rig's standard settings.
+// Auto-exposure is bounded so that it can't slow the camera below the frame
+// rate (see FrameRateGovernor); auto-gain makes up the light, up to maxGainDb.
+class SpinnakerFrameSource : public FrameSource
+{
+public:
+    static constexpr double EXPOSURE_LOWER_LIMIT_US = 4000.0;
+
+    SpinnakerFrameSource(const std::string& serialNumber, double frameRate, double maxGainDb)
+        : serialNumber(serialNumber), rate(frameRate), maxGainDb(maxGainDb)
+    {
+        system = Spinnaker::System::GetInstance();
+        Spinnaker::CameraList camList = system->GetCameras();
+
+        // Use GetBySerial to get the camera
+        pCam = camList.GetBySerial(serialNumber);
+        camList.Clear();
+
+        if (!pCam) {
+            std::cerr << "Error: Camera can't open\nexit" << std::endl;
+            system->ReleaseInstance();
+            throw std::runtime_error("Camera can't open");
+        }
+
+        // The destructor won't run if this throws; leave the camera and the
+        // system free for the next open (recovery, or another camera)
+        bool initialised = false;
+        try {
+            pCam->Init();
+            initialised = true;
+
+            // Print host controller information
+            std::cout << "===== Host Controller Information =====" << std::endl;
+            printHostControllerInfo();
+            std::cout << "=======================================" << std::endl;
+
+            applySettings();
+
+            imageWidth = static_cast<size_t>(pCam->Width.GetValue());
+            imageHeight = static_cast<size_t>(pCam->Height.GetValue());
+            format = pCam->PixelFormat.GetCurrentEntry()->GetSymbolic().c_str();
+        }
+        catch (...) {
+            if (initialised) {
+                try {
+                    pCam->DeInit();
+                }
+                catch (const Spinnaker::Exception& e) {
+                    std::cerr << "Error releasing camera: " << e.what() << std::endl;
+                }
+            }
+            pCam = nullptr;
+            system->ReleaseInstance();
+            throw;
+        }
+    }
+
+    ~SpinnakerFrameSource() override
+    {
+        try {
+            if (streaming) {
+                pCam->EndAcquisition();
+            }
+            pCam->DeInit();
+        }
+        catch (const Spinnaker::Exception& e) {
+            std::cerr << "Error releasing camera: " << e.what() << std::endl;
+        }
+        pCam = nullptr;
+        system->ReleaseInstance();
+    }
+
+    size_t width() const override { return imageWidth; }
+    size_t height() const override { return imageHeight; }
+    std::string pixelFormat() const override { return format; }
+    double frameRate() const override { return rate; }
+    std::string description() const override { return "camera " + serialNumber; }
+
+    void beginAcquisition() override
+    {
+        pCam->BeginAcquisition();
+        streaming = true;
+    }
+
+    void endAcquisition() override
+    {
+        if (streaming) {
+            streaming = false;
+            pCam->EndAcquisition();
+        }
+    }
+
+    bool grabFrame(GrabbedFrame& frame, uint64_t timeoutMs) override
+    {
+        Spinnaker::ImagePtr pResultImage = pCam->GetNextImage(timeoutMs);
+        if (!pResultImage) {
+            return false;
+        }
+
+        frame.incomplete = pResultImage->IsIncomplete();
+        frame.data = pResultImage->GetData();
+        frame.size = pResultImage->GetImageSize();
+        frame.stride = pResultImage->GetStride();
+        frame.frameID = pResultImage->GetFrameID();
+        frame.timestamp = pResultImage->GetTimeStamp();
+
+        // Keep the image alive until releaseFrame(); the ImagePtr itself goes out of scope here
+        currentImage = pResultImage;
+        frame.handle = &currentImage;
+        return true;
+    }
+
+    void releaseFrame(GrabbedFrame& frame) override
+    {
+        if (frame.handle) {
+            currentImage->Release();
+            currentImage = nullptr;
+            frame.handle = nullptr;
+        }
+    }
+
+    bool restartStream() override
+    {
+        try {
+            endAcquisition();
+            beginAcquisition();
+            return true;
+        }
+        catch (const Spinnaker::Exception& e) {
+            std::cerr << "Stream restart failed: " << e.what() << std::endl;
+            return false;
+        }
+    }
+
+    // The capture loop's next grab tells whether frames are flowing again;
+    // the caller waits between attempts
+    bool recover() override
+    {
+        try {
+            endAcquisition();
+
+            // Reset camera settings
+            pCam->DeInit();
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+            pCam->Init();
+            applySettings();
+
+            beginAcquisition();
+            return true;
+        }
+        catch (const Spinnaker::Exception& e) {
+            std::cerr << "Recovery attempt failed: " << e.what() << std::endl;
+            return false;
+        }
+    }
+
+    std::map<std::string, int64_t> streamCounters() override
+    {
+        using namespace Spinnaker::GenApi;
+        std::map<std::string, int64_t> counters;
+
+        // Transport layer stream statistics; which of them exist depends on the interface and SDK version
+        INodeMap& streamNodeMap = pCam->GetTLStreamNodeMap();
+        for (const char* name : { "StreamTotalBufferCount", "StreamLostFrameCount", "StreamDroppedFrameCount",
+            "StreamIncompleteFrameCount", "StreamFailedBufferCount", "StreamBufferUnderrunCount" }) {
+            CIntegerPtr ptrCounter = streamNodeMap.GetNode(name);
+            if (IsReadable(ptrCounter)) {
+                counters[name] = ptrCounter->GetValue();
+            }
+        }
+        return counters;
+    }
+
+    bool latchTimestamp(uint64_t& deviceTimestamp) override
+    {
+        using namespace Spinnaker::GenApi;
+        INodeMap& nodeMap = pCam->GetNodeMap();
+
+        // Copies the camera's timestamp counter, in ns, the clock GetTimeStamp() uses
+        CCommandPtr ptrTimestampLatch = nodeMap.GetNode("TimestampLatch");
+        CIntegerPtr ptrTimestampLatchValue = nodeMap.GetNode("TimestampLatchValue");
+        if (!IsWritable(ptrTimestampLatch) || !IsReadable(ptrTimestampLatchValue)) {
+            return false;
+        }
+        ptrTimestampLatch->Execute();
+        deviceTimestamp = static_cast<uint64_t>(ptrTimestampLatchValue->GetValue());
+        return true;
+    }
+
+    bool exposureState(ExposureState& state) override
+    {
+        using namespace Spinnaker::GenApi;
+        INodeMap& nodeMap = pCam->GetNodeMap();
+
+        CFloatPtr ptrExposureTime = nodeMap.GetNode("ExposureTime");
+        if (!IsReadable(ptrExposureTime)) {
+            return false;
+        }
+        state.exposureUs = ptrExposureTime->GetValue();
+        CFloatPtr ptrGain = nodeMap.GetNode("Gain");
+        state.gainDb = IsReadable(ptrGain) ? ptrGain->GetValue() : 0.0;
+        CFloatPtr ptrResultingFrameRate = nodeMap.GetNode("AcquisitionResultingFrameRate");
+        state.resultingFrameRate = IsReadable(ptrResultingFrameRate) ? ptrResultingFrameRate->GetValue() : 0.0;
+        state.exposureUpperLimitUs = limits.exposureUpperLimitUs;
+        state.gainUpperLimitDb = limits.gainUpperLimitDb;
+        return true;
+    }
+
+    const FrameRateGovernor::Limits& exposureLimits() const { return limits; }
+
+    Spinnaker::CameraPtr camera() const { return pCam; }
+
+private:
+    std::string serialNumber;
+    double rate;
+    double maxGainDb;
+    FrameRateGovernor::Limits limits;
+    Spinnaker::SystemPtr system;
+    Spinnaker::CameraPtr pCam;
+    Spinnaker::ImagePtr currentImage;
+    bool streaming = false;
+    size_t imageWidth = 0;
+    size_t imageHeight = 0;
+    std::string format;
+
+    void applySettings()
+    {
+        setCameraFrameRate(rate);         // Set the frame rate
+        setGPIOLine2ToOutput();           // Set GPIO Line 2 to output
+        setExposureLimits();              // Keep auto-exposure within the frame period
+        setAcquisitionModeContinuous();
+    }
+
+    void setAcquisitionModeContinuous()
+    {
+        using namespace Spinnaker::GenApi;
+        INodeMap& nodeMap = pCam->GetNodeMap();
+
+        CEnumerationPtr ptrAcquisitionMode = nodeMap.GetNode("AcquisitionMode");
+        if (!IsReadable(ptrAcquisitionMode) || !IsWritable(ptrAcquisitionMode)) {
+            std::cerr << "Error: Unable to set acquisition mode to continuous." << std::endl;
+            throw std::runtime_error("Unable to set acquisition mode to continuous");
+        }
+
+        CEnumEntryPtr ptrAcquisitionModeContinuous =
+            ptrAcquisitionMode->GetEntryByName("Continuous");
+        if (!IsReadable(ptrAcquisitionModeContinuous)) {
+            std::cerr << "Error: Unable to get or set acquisition mode to continuous." << std::endl;
+            throw std::runtime_error("Unable to set acquisition mode to continuous");
+        }
+
+        const int64_t acquisitionModeContinuous = ptrAcquisitionModeContinuous->GetValue();
+        ptrAcquisitionMode->SetIntValue(acquisitionModeContinuous);
+    }
+
+    void setCameraFrameRate(double frameRate)
+    {
+        using namespace Spinnaker::GenApi;
+        INodeMap& nodeMap = pCam->GetNodeMap();
+        CBooleanPtr ptrFrameRateEnable = nodeMap.GetNode("AcquisitionFrameRateEnable");
+        if (IsWritable(ptrFrameRateEnable)) {
+            ptrFrameRateEnable->SetValue(true);
+        }
+        else {
+            throw std::runtime_error("Unable to enable frame rate");
+        }
+
+        CFloatPtr ptrFrameRate = nodeMap.GetNode("AcquisitionFrameRate");
+        if (IsWritable(ptrFrameRate)) {
+            ptrFrameRate->SetValue(frameRate);
+        }
+        else {
+            throw std::runtime_error("Unable to set frame rate");
+        }
+    }
+
+    void setGPIOLine2ToOutput()
+    {
+        using namespace Spinnaker::GenApi;
+        INodeMap& nodeMap = pCam->GetNodeMap();
+
+        // Select Line 2
+        CEnumerationPtr ptrLineSelector = nodeMap.GetNode("LineSelector");
+        if (IsWritable(ptrLineSelector)) {
+            CEnumEntryPtr ptrLine2 = ptrLineSelector->GetEntryByName("Line2");
+            if (IsReadable(ptrLine2)) {
+                ptrLineSelector->SetIntValue(ptrLine2->GetValue());
+            }
+            else {
+                throw std::runtime_error("Unable to select Line 2");
+            }
+        }
+        else {
+            throw std::runtime_error("Unable to access LineSelector");
+        }
+
+        // Set Line Mode to Output
+        CEnumerationPtr ptrLineMode = nodeMap.GetNode("LineMode");
+        if (IsWritable(ptrLineMode)) {
+            CEnumEntryPtr ptrOutput = ptrLineMode->GetEntryByName("Output");
+            if (IsReadable(ptrOutput)) {
+                ptrLineMode->SetIntValue(ptrOutput->GetValue());
+            }
+            else {
+                throw std::runtime_error("Unable to set line mode to output");
+            }
+        }
+        else {
+            throw std::runtime_error("Unable to access LineMode");
+        }
+    }
+
+    // Works out the exposure and gain limits for the frame rate (set just
+    // before this, so the camera's maximum exposure already reflects it)
+    void setExposureLimits()
+    {
+        using namespace Spinnaker::GenApi;
+        INodeMap& nodeMap = pCam->GetNodeMap();
+
+        CFloatPtr ptrExposureTime = nodeMap.GetNode("ExposureTime");
+        if (!IsReadable(ptrExposureTime)) {
+            throw std::runtime_error("Unable to read ExposureTime");
+        }
+        CFloatPtr ptrReadoutTime = nodeMap.GetNode("SensorReadoutTime");
+        double readoutUs = IsReadable(ptrReadoutTime) ? ptrReadoutTime->GetValue() : 0.0;
+        CFloatPtr ptrGain = nodeMap.GetNode("Gain");
+        double cameraMaxGain = IsReadable(ptrGain) ? ptrGain->GetMax() : 0.0;
+
+        limits = FrameRateGovernor::limitsFor(rate, readoutUs, ptrExposureTime->GetMin(), ptrExposureTime->GetMax(),
+            EXPOSURE_LOWER_LIMIT_US, maxGainDb, cameraMaxGain);
+        if (!limits.reachable) {
+            std::cerr << "Warning: sensor readout takes " << readoutUs << " us, longer than a frame at " << rate
+                << " fps; the camera can't keep up at this resolution" << std::endl;
+        }
+
+        // The lower limit can't go above the upper one, whichever order they are set in, so drop it first
+        setExposureTimeLowerLimit(0.0);
+        setExposureTimeUpperLimit(limits.exposureUpperLimitUs);
+        setExposureTimeLowerLimit(limits.exposureLowerLimitUs);
+        setGainUpperLimit(limits.gainUpperLimitDb);
+
+        std::cout << "Exposure " << limits.exposureLowerLimitUs << "-" << limits.exposureUpperLimitUs
+            << " us (frame period " << limits.framePeriodUs << " us, readout "
+            << (readoutUs > 0 ? std::to_string(static_cast<int>(readoutUs)) + " us" : "unknown")
+            << "), gain up to " << limits.gainUpperLimitDb << " dB" << std::endl;
+    }
+
+    void setExposureTimeUpperLimit(double exposureTimeUpperLimit)
+    {
+        using namespace Spinnaker::GenApi;
+        INodeMap& nodeMap = pCam->GetNodeMap();
+
+        CFloatPtr ptrExposureTimeUpperLimit =
+            nodeMap.GetNode("AutoExposureExposureTimeUpperLimit");
+        if (!IsAvailable(ptrExposureTimeUpperLimit) || !IsWritable(ptrExposureTimeUpperLimit)) {
+            throw std::runtime_error("Unable to access AutoExposureExposureTimeUpperLimit");
+        }
+
+        exposureTimeUpperLimit = std::max(exposureTimeUpperLimit, ptrExposureTimeUpperLimit->GetMin());
+        exposureTimeUpperLimit = std::min(exposureTimeUpperLimit, ptrExposureTimeUpperLimit->GetMax());
+        ptrExposureTimeUpperLimit->SetValue(exposureTimeUpperLimit);
+    }
+
+    // Auto-gain takes over where the exposure limit stops auto-exposure.
+    // Older models without these nodes keep their own gain settings.
+    void setGainUpperLimit(double gainUpperLimit)
+    {
+        using namespace Spinnaker::GenApi;
+        INodeMap& nodeMap = pCam->GetNodeMap();
+
+        CEnumerationPtr ptrGainAuto = nodeMap.GetNode("GainAuto");
+        CFloatPtr ptrGainUpperLimit = nodeMap.GetNode("AutoExposureGainUpperLimit");
+        if (!IsWritable(ptrGainAuto) || !IsWritable(ptrGainUpperLimit)) {
+            std::cerr << "Warning: Unable to set the auto gain limit; gain left as it is" << std::endl;
+            return;
+        }
+        CEnumEntryPtr ptrGainAutoContinuous = ptrGainAuto->GetEntryByName("Continuous");
+        if (IsReadable(ptrGainAutoContinuous)) {
+            ptrGainAuto->SetIntValue(ptrGainAutoContinuous->GetValue());
+        }
+
+        gainUpperLimit = std::max(gainUpperLimit, ptrGainUpperLimit->GetMin());
+        gainUpperLimit = std::min(gainUpperLimit, ptrGainUpperLimit->GetMax());
+        ptrGainUpperLimit->SetValue(gainUpperLimit);
+        limits.gainUpperLimitDb = gainUpperLimit;
+    }
+
+    void setExposureTimeLowerLimit(double exposureTimeLowerLimit)
+    {
+        using namespace Spinnaker::GenApi;
+        INodeMap& nodeMap = pCam->GetNodeMap();
+
+        // Set ExposureAuto to Continuous
+        CEnumerationPtr ptrExposureAuto = nodeMap.GetNode("ExposureAuto");
+        if (IsWritable(ptrExposureAuto)) {
+            CEnumEntryPtr ptrExposureAutoContinuous =
+                ptrExposureAuto->GetEntryByName("Continuous");
+            if (IsReadable(ptrExposureAutoContinuous)) {
+                ptrExposureAuto->SetIntValue(ptrExposureAutoContinuous->GetValue());
+            }
+            else {
+                throw std::runtime_error("Unable to set ExposureAuto to Continuous");
+            }
+        }
+        else {
+            throw std::runtime_error("Unable to access ExposureAuto");
+        }
+
+        // Set AutoExposureExposureTimeLowerLimit
+        CFloatPtr ptrExposureTimeLowerLimit =
+            nodeMap.GetNode("AutoExposureExposureTimeLowerLimit");
+        if (!IsAvailable(ptrExposureTimeLowerLimit) || !IsWritable(ptrExposureTimeLowerLimit)) {
+            throw std::runtime_error("Unable to access AutoExposureExposureTimeLowerLimit");
+        }
+
+        double minExposureTimeLowerLimit = ptrExposureTimeLowerLimit->GetMin();
+        double maxExposureTimeLowerLimit = ptrExposureTimeLowerLimit->GetMax();
+
+        if (exposureTimeLowerLimit < minExposureTimeLowerLimit)
+            exposureTimeLowerLimit = minExposureTimeLowerLimit;
+        else if (exposureTimeLowerLimit > maxExposureTimeLowerLimit)
+            exposureTimeLowerLimit = maxExposureTimeLowerLimit;
+
+        ptrExposureTimeLowerLimit->SetValue(exposureTimeLowerLimit);
+    }
+
+    void printHostControllerInfo()
+    {
+        using namespace Spinnaker::GenApi;
+
+        // Access the Transport Layer node map
+        INodeMap& TLNodeMap = pCam->GetTLDeviceNodeMap();
+
+        // Get HostAdapterName
+        CStringPtr ptrHostAdapterName = TLNodeMap.GetNode("HostAdapterName");
+        if (IsReadable(ptrHostAdapterName))
+        {
+            std::cout << "Host Adapter Name: " << ptrHostAdapterName->GetValue() << std::endl;
+        }
+        else
+        {
+            std::cout << "Host Adapter Name: Not available" << std::endl;
+        }
+
+        // Get HostAdapterVendor
+        CStringPtr ptrHostAdapterVendor = TLNodeMap.GetNode("HostAdapterVendor");
+        if (IsReadable(ptrHostAdapterVendor))
+        {
+            std::cout << "Host Adapter Vendor: " << ptrHostAdapterVendor->GetValue() << std::endl;
+        }
+        else
+        {
+            std::cout << "Host Adapter Vendor: Not available" << std::endl;
+        }
+
+        // Get HostAdapterDriverVersion
+        CStringPtr ptrHostAdapterDriverVersion = TLNodeMap.GetNode("HostAdapterDriverVersion");
+        if (IsReadable(ptrHostAdapterDriverVersion))
+        {
+            std::cout << "Host Adapter Driver Version: " << ptrHostAdapterDriverVersion->GetValue() << std::endl;
+        }
+        else
+        {
+            std::cout << "Host Adapter Driver Version: Not available" << std::endl;
+        }
+    }
+};
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Starts acquisition on several cameras together. Each camera's thread
+// arrives once it is ready to record; when the last one arrives, a start
+// time LEAD later is set and every thread sleeps until it, then spins for
+// the last stretch, so the scheduler's wake-up delay doesn't add to the
+// skew. The cameras aren't hardware triggered, so each thread reports when
+// its BeginAcquisition() returned and when its first frame arrived, and the
+// spread of each is what gets recorded.
+class StartGate
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    static constexpr std::chrono::milliseconds LEAD{ 50 };
+    static constexpr std::chrono::microseconds SPIN{ 2000 };
+
+    struct Skew
+    {
+        size_t cameras = 0;
+        size_t started = 0;       // Cameras whose acquisition began
+        size_t firstFrames = 0;   // Cameras that delivered a frame
+        double startUs = 0;       // Spread of the acquisition start times
+        double firstFrameUs = 0;  // Spread of the first frames' arrival
+    };
+
+    explicit StartGate(size_t cameras)
+        : expected(cameras), startedAt(cameras), firstFrameAt(cameras), present(cameras, true)
+    {
+    }
+
+    // Blocks until every camera still taking part has arrived and the common
+    // start time has come
+    Clock::time_point arriveAndWait(size_t camera)
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        arrived.push_back(camera);
+        release();
+        allArrived.wait(guard, [&] { return released; });
+        Clock::time_point start = startTime;
+        guard.unlock();
+
+        std::this_thread::sleep_until(start - SPIN);
+        while (Clock::now() < start) {
+        }
+        return start;
+    }
+
+    // A camera that stops before arriving (it failed to open its files, say)
+    // must say so, or the others would wait for it forever
+    void leave(size_t camera)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (!present[camera]) {
+            return;
+        }
+        present[camera] = false;
+        if (std::find(arrived.begin(), arrived.end(), camera) == arrived.end()) {
+            expected--;
+            release();
+        }
+    }
+
+    // Returns true for the last camera to start, which can report the skew
+    bool started(size_t camera, Clock::time_point when)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        startedAt[camera] = when;
+        startedCount++;
+        return startedCount == expected;
+    }
+
+    void firstFrame(size_t camera, Clock::time_point when)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        firstFrameAt[camera] = when;
+        firstFrameCount++;
+    }
+
+    Skew skew()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        Skew s;
+        s.cameras = startedAt.size();
+        s.started = startedCount;
+        s.firstFrames = firstFrameCount;
+        s.startUs = spreadUs(startedAt);
+        s.firstFrameUs = spreadUs(firstFrameAt);
+        return s;
+    }
+
+    // Host steady clock in ns, as in the frame table, or 0 if it hasn't happened
+    uint64_t startedNs(size_t camera) { return toNs(camera, startedAt); }
+    uint64_t firstFrameNs(size_t camera) { return toNs(camera, firstFrameAt); }
+
+private:
+    std::mutex lock;
+    std::condition_variable allArrived;
+    size_t expected;
+    std::vector<size_t> arrived;
+    bool released = false;
+    Clock::time_point startTime;
+    std::vector<Clock::time_point> startedAt;     // Epoch (zero) until it happens
+    std::vector<Clock::time_point> firstFrameAt;
+    std::vector<bool> present;
+    size_t startedCount = 0;
+    size_t firstFrameCount = 0;
+
+    void release()
+    {
+        if (!released && arrived.size() >= expected) {
+            released = true;
+            startTime = Clock::now() + LEAD;
+            allArrived.notify_all();
+        }
+    }
+
+    uint64_t toNs(size_t camera, const std::vector<Clock::time_point>& times)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            times[camera].time_since_epoch()).count());
+    }
+
+    static double spreadUs(const std::vector<Clock::time_point>& times)
+    {
+        Clock::time_point earliest = Clock::time_point::max();
+        Clock::time_point latest = Clock::time_point::min();
+        for (const auto& time : times) {
+            if (time == Clock::time_point()) {
+                continue;
+            }
+            earliest = std::min(earliest, time);
+            latest = std::max(latest, time);
+        }
+        if (earliest > latest) {
+            return 0.0;
+        }
+        return std::chrono::duration<double, std::micro>(latest - earliest).count();
+    }
+};
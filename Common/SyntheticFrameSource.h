@@ -0,0 +1,236 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include "FrameSource.h"
+
+// Settings for the synthetic generator
+struct SyntheticSourceConfig
+{
+    size_t width = 1440;
+    size_t height = 1080;
+    std::string pixelFormat = "Mono8";
+    double fps = 170.0;          // <= 0 generates frames as fast as they are consumed
+    uint64_t incompleteEvery = 0;  // Mark every Nth frame incomplete (0 = never)
+    uint64_t gapEvery = 0;         // Skip frame IDs after every Nth frame (0 = never)
+    uint64_t gapLength = 1;        // How many IDs each gap skips
+    uint64_t stallEvery = 0;       // Stop delivering frames after every Nth frame (0 = never)...
+    bool stallNeedsReinit = false; // ...until the stream is restarted, or with this, until recover()
+    uint64_t errorEvery = 0;       // Throw instead of delivering every Nth frame (0 = never)
+    uint64_t restartMs = 20;       // Time a stream restart takes
+    uint64_t reinitMs = 1000;      // Time recover() takes
+    double exposureUs = 0;         // Like an unbounded auto-exposure: past the frame period, it slows the rate down
+    uint64_t bufferFrames = 10;    // Frames held for a consumer that falls behind; older ones are lost, as from a camera's buffer pool
+};
+
+// Generates a moving test pattern at a fixed rate so the recording path can be
+// load-tested without a camera. Incomplete frames, frame-ID gaps, stalls and
+// errors can be injected to exercise recovery and drop accounting. Like a
+// camera, it keeps exposing through a stall, so the frame IDs skip the frames
+// lost; recover() restarts the IDs and timestamps from zero. A consumer more
+// than bufferFrames behind loses the oldest frames the same way, and each
+// frame is stamped with the time it was due rather than the time it was taken.
+class SyntheticFrameSource : public FrameSource
+{
+public:
+    explicit SyntheticFrameSource(const SyntheticSourceConfig& config)
+        : config(config), bpp(bytesPerPixel(config.pixelFormat))
+    {
+        if (config.width == 0 || config.height == 0) {
+            throw std::runtime_error("Synthetic source needs a non-zero resolution");
+        }
+
+        rowBytes = config.width * bpp;
+        frame.resize(rowBytes * config.height);
+
+        // A diagonal ramp twice as wide as a row; each frame copies rows out
+        // of it at a shifting offset, which is much cheaper than drawing.
+        pattern.resize(rowBytes * 2);
+        for (size_t i = 0; i < pattern.size(); ++i) {
+            pattern[i] = static_cast<char>(i / bpp);
+        }
+    }
+
+    size_t width() const override { return config.width; }
+    size_t height() const override { return config.height; }
+    std::string pixelFormat() const override { return config.pixelFormat; }
+    double frameRate() const override { return config.fps; }
+    std::string description() const override { return "synthetic " + std::to_string(config.width) + "x" + std::to_string(config.height); }
+
+    void beginAcquisition() override
+    {
+        startTime = std::chrono::steady_clock::now();
+        nextDue = startTime;
+        acquiring = true;
+    }
+
+    void endAcquisition() override
+    {
+        acquiring = false;
+    }
+
+    bool grabFrame(GrabbedFrame& grabbed, uint64_t timeoutMs) override
+    {
+        if (!acquiring) {
+            throw std::runtime_error("Synthetic source is not acquiring");
+        }
+        if (stalled) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(timeoutMs));
+            return false;
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        auto due = now;
+        if (config.fps > 0) {
+            if (nextDue > now + std::chrono::milliseconds(timeoutMs)) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(timeoutMs));
+                return false;
+            }
+            std::chrono::nanoseconds period(static_cast<int64_t>(1e9 / resultingFrameRate()));
+
+            // Frames the buffer pool couldn't hold were overwritten before they were taken
+            uint64_t behind = now > nextDue ? static_cast<uint64_t>((now - nextDue) / period) : 0;
+            if (behind > config.bufferFrames) {
+                uint64_t lost = behind - config.bufferFrames;
+                nextDue += period * static_cast<int64_t>(lost);
+                nextFrameID += lost;
+                framesSkipped += lost;
+                overruns += lost;
+            }
+
+            std::this_thread::sleep_until(nextDue);
+            due = nextDue;
+            nextDue += period;
+        }
+
+        framesGenerated++;
+        if (config.errorEvery > 0 && framesGenerated % config.errorEvery == 0) {
+            nextFrameID++;
+            errors++;
+            throw std::runtime_error("Synthetic camera error (injected)");
+        }
+        if (config.stallEvery > 0 && framesGenerated % config.stallEvery == 0) {
+            stalled = true;
+            stalls++;
+            stallStart = std::chrono::steady_clock::now();
+            std::this_thread::sleep_for(std::chrono::milliseconds(timeoutMs));  // Noticed only when the grab times out
+            return false;
+        }
+
+        renderFrame();
+
+        grabbed.data = frame.data();
+        grabbed.size = frame.size();
+        grabbed.stride = rowBytes;
+        grabbed.frameID = nextFrameID++;
+        grabbed.timestamp = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            due - startTime).count());
+        grabbed.incomplete = config.incompleteEvery > 0 && framesGenerated % config.incompleteEvery == 0;
+        grabbed.handle = nullptr;
+
+        if (config.gapEvery > 0 && framesGenerated % config.gapEvery == 0) {
+            nextFrameID += config.gapLength;
+            framesSkipped += config.gapLength;
+        }
+        return true;
+    }
+
+    void releaseFrame(GrabbedFrame&) override {}
+
+    // Frame timestamps are time since beginAcquisition()
+    bool latchTimestamp(uint64_t& deviceTimestamp) override
+    {
+        if (!acquiring) {
+            return false;
+        }
+        deviceTimestamp = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - startTime).count());
+        return true;
+    }
+
+    bool exposureState(ExposureState& state) override
+    {
+        state.exposureUs = config.exposureUs;
+        state.resultingFrameRate = resultingFrameRate();
+        return true;
+    }
+
+    // What was injected, to check the drop accounting against
+    std::map<std::string, int64_t> streamCounters() override
+    {
+        return {
+            { "SyntheticSkippedFrameIDs", static_cast<int64_t>(framesSkipped) },  // Injected gaps and buffer overruns
+            { "SyntheticBufferOverruns", static_cast<int64_t>(overruns) },
+            { "SyntheticStalls", static_cast<int64_t>(stalls) },
+            { "SyntheticErrors", static_cast<int64_t>(errors) }
+        };
+    }
+
+    bool restartStream() override
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(config.restartMs));
+        if (stalled && !config.stallNeedsReinit) {
+            // The frames exposed while nothing was delivered are lost
+            stalled = false;
+            if (config.fps > 0) {
+                nextFrameID += static_cast<uint64_t>(std::chrono::duration<double>(
+                    std::chrono::steady_clock::now() - stallStart).count() * config.fps);
+            }
+        }
+        nextDue = std::chrono::steady_clock::now();
+        acquiring = true;
+        return true;
+    }
+
+    bool recover() override
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(config.reinitMs));
+        stalled = false;
+        nextFrameID = 0;
+        startTime = std::chrono::steady_clock::now();
+        nextDue = startTime;
+        acquiring = true;
+        return true;
+    }
+
+private:
+    SyntheticSourceConfig config;
+    size_t bpp;
+    size_t rowBytes = 0;
+    std::vector<char> frame;
+    std::vector<char> pattern;
+    std::chrono::steady_clock::time_point startTime;
+    std::chrono::steady_clock::time_point nextDue;
+    uint64_t nextFrameID = 0;
+    uint64_t framesGenerated = 0;
+    uint64_t framesSkipped = 0;
+    uint64_t overruns = 0;
+    uint64_t stalls = 0;
+    uint64_t errors = 0;
+    bool acquiring = false;
+    bool stalled = false;
+    std::chrono::steady_clock::time_point stallStart;
+
+    double resultingFrameRate() const
+    {
+        if (config.exposureUs > 0 && config.exposureUs * config.fps > 1e6) {
+            return 1e6 / config.exposureUs;
+        }
+        return config.fps;
+    }
+
+    void renderFrame()
+    {
+        size_t shift = static_cast<size_t>(framesGenerated * 4 * bpp) % rowBytes;
+        for (size_t y = 0; y < config.height; ++y) {
+            size_t offset = (shift + y * bpp) % rowBytes;
+            memcpy(frame.data() + y * rowBytes, pattern.data() + offset, rowBytes);
+        }
+    }
+};
@@ -0,0 +1,355 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Timeline of what every thread was doing, written as Chrome trace JSON
+// (open it in https://ui.perfetto.dev or chrome://tracing). Where the stage
+// latency histograms say that some write took 300 ms, the trace says which
+// frame it was, when, and what the capture thread was doing meanwhile.
+//
+// Each thread records into its own chunk of events without locking or
+// allocating; a full chunk (4096 events) is handed to a background thread
+// that appends it to the file, so memory stays bounded however long the
+// session runs. If the file falls behind by MAX_QUEUED_CHUNKS chunks, new
+// chunks are dropped and counted rather than held.
+//
+// Timestamps are the host steady clock, the same clock as the frame table's
+// SteadyTimestamp column. Event names must be string literals (or otherwise
+// outlive the recorder); they are written without escaping.
+//
+// The file is a JSON array whose closing bracket is optional in the trace
+// format, so a trace cut short by a crash still opens.
+class TraceRecorder
+{
+public:
+    typedef std::chrono::steady_clock::time_point TimePoint;
+
+    static const size_t CHUNK_EVENTS = 4096;
+    static const size_t MAX_QUEUED_CHUNKS = 64;  // About 10 MB waiting for the disk
+    static const int64_t NO_FRAME = -1;
+
+    struct Stats
+    {
+        uint64_t events = 0;   // Written to the file
+        uint64_t dropped = 0;  // Lost because the file fell behind
+        size_t threads = 0;
+    };
+
+    TraceRecorder(const std::string& filePath, const std::string& processName)
+        : file(filePath, std::ios::binary | std::ios::trunc),
+        generation(nextGeneration())
+    {
+        if (!file) {
+            return;
+        }
+        file << "[\n";
+        pendingText.push_back("{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"" +
+            processName + "\"}}");
+        flusher = std::thread(&TraceRecorder::flushLoop, this);
+    }
+
+    ~TraceRecorder() { finish(); }
+
+    TraceRecorder(const TraceRecorder&) = delete;
+    TraceRecorder& operator=(const TraceRecorder&) = delete;
+
+    bool isOpen() const { return flusher.joinable() || finished; }
+
+    // Names the calling thread in the trace
+    void nameThread(const std::string& name)
+    {
+        ThreadBuffer& thread = currentThread();
+        std::lock_guard<std::mutex> guard(lock);
+        pendingText.push_back("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" +
+            std::to_string(thread.tid) + ",\"args\":{\"name\":\"" + name + "\"}}");
+        workReady.notify_one();
+    }
+
+    // The calling thread spent [begin, end) in `name`, working on `frame`
+    void span(const char* name, TimePoint begin, TimePoint end, int64_t frame = NO_FRAME)
+    {
+        uint64_t beginNs = toNs(begin);
+        uint64_t endNs = toNs(end);
+        push('X', name, beginNs, endNs > beginNs ? endNs - beginNs : 0, frame);
+    }
+
+    // A value over time, such as a queue depth; drawn as its own track
+    void counter(const char* name, int64_t value)
+    {
+        push('C', name, toNs(std::chrono::steady_clock::now()), 0, value);
+    }
+
+    // Something that happened at one moment on the calling thread
+    void instant(const char* name)
+    {
+        push('i', name, toNs(std::chrono::steady_clock::now()), 0, NO_FRAME);
+    }
+
+    // Writes out what every thread still holds and closes the file. Threads
+    // must have stopped recording by now; anything they record afterwards
+    // is ignored.
+    Stats finish()
+    {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (finished || !flusher.joinable()) {
+                return totals;
+            }
+            for (auto& thread : threads) {
+                if (thread->chunk && thread->chunk->count > 0) {
+                    queued.push_back(std::move(thread->chunk));
+                }
+            }
+            stopping = true;
+        }
+        workReady.notify_one();
+        flusher.join();
+
+        file << "\n]\n";
+        file.close();
+        std::lock_guard<std::mutex> guard(lock);
+        finished = true;
+        totals.threads = threads.size();
+        return totals;
+    }
+
+    bool failed() const { return writeFailed.load(); }
+
+private:
+    struct Event
+    {
+        uint64_t timeNs;
+        uint64_t durationNs;
+        int64_t value;  // Frame for a span, the value for a counter
+        const char* name;
+        char type;      // Chrome trace phase: 'X' span, 'C' counter, 'i' instant
+    };
+
+    struct Chunk
+    {
+        Event events[CHUNK_EVENTS];
+        size_t count = 0;
+        uint32_t tid = 0;
+    };
+
+    struct ThreadBuffer
+    {
+        uint32_t tid = 0;
+        std::unique_ptr<Chunk> chunk;
+    };
+
+    std::ofstream file;
+    uint64_t generation;  // Tells this recorder's thread buffers from an earlier one's
+    std::thread flusher;
+
+    std::mutex lock;
+    std::condition_variable workReady;
+    std::vector<std::unique_ptr<ThreadBuffer>> threads;
+    std::vector<std::unique_ptr<Chunk>> queued;      // Full chunks for the flusher
+    std::vector<std::unique_ptr<Chunk>> spareChunks; // Written chunks, for reuse
+    std::vector<std::string> pendingText;             // Metadata events for the flusher
+    bool stopping = false;
+    bool finished = false;
+    Stats totals;
+    std::atomic<bool> writeFailed{ false };
+
+    static uint64_t nextGeneration()
+    {
+        static std::atomic<uint64_t> counter{ 0 };
+        return ++counter;
+    }
+
+    static uint64_t toNs(TimePoint time)
+    {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count());
+    }
+
+    // The calling thread's buffer, created on its first event
+    ThreadBuffer& currentThread()
+    {
+        struct Current
+        {
+            uint64_t generation = 0;
+            ThreadBuffer* buffer = nullptr;
+        };
+        static thread_local Current current;
+        if (current.generation != generation) {
+            std::lock_guard<std::mutex> guard(lock);
+            threads.push_back(std::unique_ptr<ThreadBuffer>(new ThreadBuffer()));
+            threads.back()->tid = static_cast<uint32_t>(threads.size());
+            current.generation = generation;
+            current.buffer = threads.back().get();
+        }
+        return *current.buffer;
+    }
+
+    void push(char type, const char* name, uint64_t timeNs, uint64_t durationNs, int64_t value)
+    {
+        ThreadBuffer& thread = currentThread();
+        if (!thread.chunk) {
+            thread.chunk = takeChunk(thread.tid);
+        }
+        Chunk& chunk = *thread.chunk;
+        Event& event = chunk.events[chunk.count++];
+        event.timeNs = timeNs;
+        event.durationNs = durationNs;
+        event.value = value;
+        event.name = name;
+        event.type = type;
+        if (chunk.count == CHUNK_EVENTS) {
+            handOff(thread);
+        }
+    }
+
+    std::unique_ptr<Chunk> takeChunk(uint32_t tid)
+    {
+        std::unique_ptr<Chunk> chunk;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (!spareChunks.empty()) {
+                chunk = std::move(spareChunks.back());
+                spareChunks.pop_back();
+            }
+        }
+        if (!chunk) {
+            chunk.reset(new Chunk());
+        }
+        chunk->count = 0;
+        chunk->tid = tid;
+        return chunk;
+    }
+
+    void handOff(ThreadBuffer& thread)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (stopping || queued.size() >= MAX_QUEUED_CHUNKS) {
+            // Keep the chunk and start it again; these events are lost
+            totals.dropped += stopping ? 0 : thread.chunk->count;
+            thread.chunk->count = 0;
+            return;
+        }
+        queued.push_back(std::move(thread.chunk));
+        workReady.notify_one();
+    }
+
+    void flushLoop()
+    {
+        std::vector<std::unique_ptr<Chunk>> chunks;
+        std::vector<std::string> text;
+        std::string out;
+        bool first = true;
+        while (true) {
+            bool last;
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                for (auto& chunk : chunks) {
+                    spareChunks.push_back(std::move(chunk));
+                }
+                chunks.clear();
+                workReady.wait(guard, [&] { return stopping || !queued.empty() || !pendingText.empty(); });
+                chunks.swap(queued);
+                text.swap(pendingText);
+                last = stopping;
+            }
+
+            out.clear();
+            for (const std::string& line : text) {
+                out += first ? "" : ",\n";
+                out += line;
+                first = false;
+            }
+            text.clear();
+            uint64_t events = 0;
+            for (const auto& chunk : chunks) {
+                for (size_t i = 0; i < chunk->count; ++i) {
+                    out += first ? "" : ",\n";
+                    appendEvent(out, chunk->events[i], chunk->tid);
+                    first = false;
+                }
+                events += chunk->count;
+            }
+            file.write(out.data(), static_cast<std::streamsize>(out.size()));
+            if (!file) {
+                writeFailed.store(true);
+            }
+
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                totals.events += events;
+            }
+            if (last) {
+                return;
+            }
+        }
+    }
+
+    static void appendEvent(std::string& out, const Event& event, uint32_t tid)
+    {
+        // Microseconds with three decimals, printed from integers so nanoseconds survive
+        char line[256];
+        unsigned long long ts = event.timeNs / 1000;
+        unsigned tsFraction = static_cast<unsigned>(event.timeNs % 1000);
+        switch (event.type) {
+        case 'X':
+            if (event.value == NO_FRAME) {
+                std::snprintf(line, sizeof(line), "{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%llu.%03u,\"dur\":%llu.%03u,\"pid\":1,\"tid\":%u}",
+                    event.name, ts, tsFraction, static_cast<unsigned long long>(event.durationNs / 1000),
+                    static_cast<unsigned>(event.durationNs % 1000), tid);
+            }
+            else {
+                std::snprintf(line, sizeof(line), "{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%llu.%03u,\"dur\":%llu.%03u,\"pid\":1,\"tid\":%u,\"args\":{\"frame\":%lld}}",
+                    event.name, ts, tsFraction, static_cast<unsigned long long>(event.durationNs / 1000),
+                    static_cast<unsigned>(event.durationNs % 1000), tid, static_cast<long long>(event.value));
+            }
+            break;
+        case 'C':
+            std::snprintf(line, sizeof(line), "{\"name\":\"%s\",\"ph\":\"C\",\"ts\":%llu.%03u,\"pid\":1,\"args\":{\"value\":%lld}}",
+                event.name, ts, tsFraction, static_cast<long long>(event.value));
+            break;
+        default:
+            std::snprintf(line, sizeof(line), "{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%llu.%03u,\"pid\":1,\"tid\":%u}",
+                event.name, ts, tsFraction, tid);
+            break;
+        }
+        out += line;
+    }
+};
+
+// Records the enclosing scope as a span; does nothing without a recorder
+class TraceSpan
+{
+public:
+    TraceSpan(TraceRecorder* recorder, const char* name, int64_t frame = TraceRecorder::NO_FRAME)
+        : recorder(recorder), name(name), frame(frame)
+    {
+        if (recorder) {
+            begin = std::chrono::steady_clock::now();
+        }
+    }
+
+    ~TraceSpan()
+    {
+        if (recorder) {
+            recorder->span(name, begin, std::chrono::steady_clock::now(), frame);
+        }
+    }
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+private:
+    TraceRecorder* recorder;
+    const char* name;
+    int64_t frame;
+    TraceRecorder::TimePoint begin;
+};
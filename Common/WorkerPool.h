@@ -0,0 +1,81 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "TraceRecorder.h"
+
+// Fixed set of threads running short tasks in the order they were posted.
+// Several FrameCompressors share one so that cameras recorded by the same
+// process split the CPU between them instead of each bringing its own
+// threads.
+class WorkerPool
+{
+public:
+    WorkerPool(size_t threadCount, const std::string& name, TraceRecorder* tracer = nullptr)
+    {
+        for (size_t t = 0; t < (threadCount > 0 ? threadCount : 1); ++t) {
+            workers.emplace_back([this, t, name, tracer] {
+                if (tracer) {
+                    tracer->nameThread(name + " " + std::to_string(t));
+                }
+                run();
+            });
+        }
+    }
+
+    // Runs whatever is still queued, then stops the threads
+    ~WorkerPool()
+    {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stopping = true;
+        }
+        taskAvailable.notify_all();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    void post(std::function<void()> task)
+    {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            tasks.push_back(std::move(task));
+        }
+        taskAvailable.notify_one();
+    }
+
+    size_t threads() const { return workers.size(); }
+
+private:
+    std::vector<std::thread> workers;
+    std::mutex lock;
+    std::condition_variable taskAvailable;
+    std::deque<std::function<void()>> tasks;
+    bool stopping = false;
+
+    void run()
+    {
+        while (true) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                taskAvailable.wait(guard, [&] { return stopping || !tasks.empty(); });
+                if (tasks.empty()) {
+                    return;
+                }
+                task = std::move(tasks.front());
+                tasks.pop_front();
+            }
+            task();
+        }
+    }
+};
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "TraceRecorder.h"
+
+// Writer threads shared by several recordings. Each recording adds a
+// stream: a step function that writes whatever its queue holds, up to a
+// batch, without waiting for more. The pool's threads go round the streams
+// calling each step. A stream is only ever stepped by one thread at a time,
+// so its frames are written in order, but a slow disk write on one camera
+// no longer leaves another camera's frames waiting.
+//
+// Producers call wake() after queueing a frame; a thread that found nothing
+// to do sleeps until then, or for IDLE_WAIT at most.
+class WriterPool
+{
+public:
+    enum class Step
+    {
+        Wrote,    // Made progress; there may be more
+        Idle,     // Nothing queued right now
+        Finished  // Done for good; the step is not called again
+    };
+
+    static constexpr std::chrono::milliseconds IDLE_WAIT{ 2 };
+
+    WriterPool(size_t threadCount, TraceRecorder* tracer = nullptr)
+    {
+        for (size_t t = 0; t < (threadCount > 0 ? threadCount : 1); ++t) {
+            workers.emplace_back([this, t, tracer] {
+                if (tracer) {
+                    tracer->nameThread("writer pool " + std::to_string(t));
+                }
+                run(t);
+            });
+        }
+    }
+
+    // Every stream must have finished
+    ~WriterPool()
+    {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stopping = true;
+        }
+        workAvailable.notify_all();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+
+    WriterPool(const WriterPool&) = delete;
+    WriterPool& operator=(const WriterPool&) = delete;
+
+    // Returns the stream's number, for waitFinished()
+    size_t add(std::function<Step()> step)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        streams.push_back(std::unique_ptr<Stream>(new Stream()));
+        streams.back()->step = std::move(step);
+        workAvailable.notify_all();
+        return streams.size() - 1;
+    }
+
+    void wake()
+    {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            woken = true;
+        }
+        workAvailable.notify_one();
+    }
+
+    void waitFinished(size_t stream)
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        streamFinished.wait(guard, [&] { return streams[stream]->finished; });
+    }
+
+    size_t threads() const { return workers.size(); }
+
+private:
+    struct Stream
+    {
+        std::function<Step()> step;
+        bool busy = false;
+        bool finished = false;
+    };
+
+    std::vector<std::thread> workers;
+    std::mutex lock;
+    std::condition_variable workAvailable;
+    std::condition_variable streamFinished;
+    std::vector<std::unique_ptr<Stream>> streams;
+    bool woken = false;
+    bool stopping = false;
+
+    void run(size_t thread)
+    {
+        size_t next = thread;  // Threads start their rounds on different streams
+        std::unique_lock<std::mutex> guard(lock);
+        while (!stopping) {
+            bool progress = false;
+            size_t count = streams.size();
+            for (size_t i = 0; i < count; ++i) {
+                Stream& stream = *streams[(next + i) % count];
+                if (stream.busy || stream.finished) {
+                    continue;
+                }
+                stream.busy = true;
+                guard.unlock();
+                Step result = stream.step();
+                guard.lock();
+                stream.busy = false;
+                if (result == Step::Finished) {
+                    stream.finished = true;
+                    streamFinished.notify_all();
+                }
+                progress = progress || result != Step::Idle;
+            }
+            next++;
+
+            if (!progress) {
+                workAvailable.wait_for(guard, IDLE_WAIT, [&] { return woken || stopping; });
+                woken = false;
+            }
+        }
+    }
+};
@@ -5,16 +5,20 @@
 #include <opencv2/opencv.hpp>
 #include <thread>
 #include <mutex>
-#include <cstdlib>
+#include <condition_variable>
+#include <atomic>
+#include <deque>
+#include <map>
+#include <chrono>
 #include <fstream>
 #include <algorithm>
+#include "../Common/AviMuxer.h"
+#include "../Common/BmpImage.h"
+#include "../Common/MappedFile.h"
 
 using namespace std;
 namespace fs = std::filesystem;
 
-mutex frameMutex;
-atomic<int> videoIndex(0);
-
 // Function to list and sort BMP files
 vector<fs::path> ListBmpFiles(const string& directory, const string& prefix)
 {
@@ -32,60 +36,230 @@ vector<fs::path> ListBmpFiles(const string& directory, const string& prefix)
     return bmpFiles;
 }
 
-// Function to determine dimensions of the video
-cv::Size GetVideoDimensions(const fs::path& filePath)
+// The first image sets the video's dimensions; for a BMP only the header is read
+void ReadVideoFormat(const fs::path& filePath, int& width, int& height, int& channels)
 {
+    try
+    {
+        BmpImage image(filePath.string());
+        if (image.valid())
+        {
+            width = image.width();
+            height = image.height();
+            channels = image.channels();
+            return;
+        }
+    }
+    catch (const runtime_error&)
+    {
+        // Left to OpenCV, which says what is wrong with it
+    }
+
     cv::Mat firstImage = cv::imread(filePath.string(), cv::IMREAD_UNCHANGED);
     if (firstImage.empty())
     {
         throw runtime_error("Error: Could not open or find the image: " + filePath.string());
     }
-    return cv::Size(firstImage.cols, firstImage.rows);
+    width = firstImage.cols;
+    height = firstImage.rows;
+    channels = firstImage.channels();
 }
 
-// Function to process a chunk of BMP files into an AVI file
-void ProcessVideoChunk(const vector<fs::path>& chunk, int chunkIndex, const fs::path& tempVideoDir, double fps, const cv::Size& frameSize)
+// Reads a whole file; false if it couldn't be
+bool ReadFile(const fs::path& filePath, vector<char>& bytes)
 {
-    string tempVideoFilename = (tempVideoDir / ("chunk_" + to_string(chunkIndex) + ".avi")).string();
-    cv::VideoWriter videoWriter(tempVideoFilename, cv::VideoWriter::fourcc('M', 'J', 'P', 'G'), fps, frameSize, true);
+    ifstream file(filePath, ios::binary);
+    if (!file)
+    {
+        return false;
+    }
+    error_code error;
+    uintmax_t size = fs::file_size(filePath, error);
+    if (error)
+    {
+        return false;
+    }
+    bytes.resize(static_cast<size_t>(size));
+    file.read(bytes.data(), static_cast<streamsize>(bytes.size()));
+    return !bytes.empty() && file.gcount() == static_cast<streamsize>(bytes.size());
+}
+
+// An image waiting for an encoder: a mapped BMP used in place, or, for a
+// file BmpImage can't handle, the whole file for OpenCV to decode
+struct FrameJob
+{
+    size_t sequence = 0;
+    unique_ptr<BmpImage> bmp;
+    vector<char> bytes;  // Empty if the file could not be read
+};
+
+// Time a stage's threads spent working, summed over the threads
+struct StageTime
+{
+    atomic<int64_t> busyNs{ 0 };
+    atomic<uint64_t> items{ 0 };
+
+    void add(chrono::steady_clock::duration busy)
+    {
+        busyNs += chrono::duration_cast<chrono::nanoseconds>(busy).count();
+        items++;
+    }
 
-    if (!videoWriter.isOpened())
+    // Share of the stage's thread time spent working
+    double utilisation(double seconds, size_t threads) const
     {
-        cerr << "Error: Could not open the video writer: " + tempVideoFilename << endl;
-        return;
+        return seconds > 0 && threads > 0 ? busyNs.load() / 1e9 / (seconds * threads) : 0.0;
     }
+};
+
+// Encoder work, one queue per encoder thread. Readers deal frames out round
+// the queues; an encoder takes from its own queue first and, when that is
+// empty, steals from the others, so a thread held up by a large or slow frame
+// doesn't leave the rest idle while its queue waits. Thieves take the oldest
+// frame, the one the muxer will want soonest.
+class StealingQueues
+{
+public:
+    explicit StealingQueues(size_t workers) : queues(workers > 0 ? workers : 1) {}
 
-    for (const auto& bmpPath : chunk)
+    void push(FrameJob&& job)
     {
-        cv::Mat frame = cv::imread(bmpPath.string(), cv::IMREAD_UNCHANGED);
-        if (frame.empty())
+        Queue& queue = queues[job.sequence % queues.size()];
         {
-            cerr << "Error: Could not open or find the image: " + bmpPath.string() << endl;
-            continue;
+            lock_guard<mutex> guard(queue.lock);
+            queue.jobs.push_back(move(job));
         }
-        videoWriter.write(frame);
+        {
+            lock_guard<mutex> guard(lock);
+            pending++;
+        }
+        workAvailable.notify_one();
     }
 
-    videoWriter.release();
-}
+    void finishInput()
+    {
+        lock_guard<mutex> guard(lock);
+        inputDone = true;
+        workAvailable.notify_all();
+    }
 
-// Function to concatenate multiple AVI files into one using ffmpeg
-void ConcatenateAviFiles(const vector<string>& inputFilenames, const string& outputFilename)
+    // Encoder threads: false once the input is finished and drained
+    bool pop(size_t worker, FrameJob& job, bool& stolen)
+    {
+        while (true) {
+            for (size_t i = 0; i < queues.size(); ++i) {
+                if (tryTake(queues[(worker + i) % queues.size()], job)) {
+                    stolen = i > 0;
+                    steals += stolen ? 1 : 0;
+                    return true;
+                }
+            }
+            unique_lock<mutex> guard(lock);
+            workAvailable.wait(guard, [&] { return pending > 0 || inputDone || aborted; });
+            if (aborted || (pending == 0 && inputDone)) {
+                return false;
+            }
+        }
+    }
+
+    void abort()
+    {
+        lock_guard<mutex> guard(lock);
+        aborted = true;
+        workAvailable.notify_all();
+    }
+
+    uint64_t stolenJobs() const { return steals.load(); }
+
+private:
+    struct Queue
+    {
+        mutex lock;
+        deque<FrameJob> jobs;
+    };
+
+    vector<Queue> queues;
+    mutex lock;
+    condition_variable workAvailable;
+    size_t pending = 0;  // Jobs in all the queues
+    bool inputDone = false;
+    bool aborted = false;
+    atomic<uint64_t> steals{ 0 };
+
+    bool tryTake(Queue& queue, FrameJob& job)
+    {
+        {
+            lock_guard<mutex> guard(queue.lock);
+            if (queue.jobs.empty()) {
+                return false;
+            }
+            job = move(queue.jobs.front());
+            queue.jobs.pop_front();
+        }
+        lock_guard<mutex> guard(lock);
+        pending--;
+        return true;
+    }
+};
+
+// Encoded frames on their way back into order. Encoders finish in any order;
+// the muxer takes frames in sequence. Readers wait before reading a frame
+// more than maxInFlight ahead of the muxer, which bounds memory however far
+// behind the encoders or the disk get.
+class ReorderBuffer
 {
-    // Create a temporary text file with the list of video files to concatenate
-    string listFilename = "file_list.txt";
-    ofstream listFile(listFilename);
-    for (const auto& inputFilename : inputFilenames)
+public:
+    explicit ReorderBuffer(size_t maxInFlight) : maxInFlight(maxInFlight) {}
+
+    // Readers: false if the pipeline was aborted. The readahead thread
+    // waits the same way, a further `ahead` frames on.
+    bool waitForSlot(size_t sequence, size_t ahead = 0)
     {
-        listFile << "file '" << inputFilename << "'\n";
+        unique_lock<mutex> guard(lock);
+        slotFree.wait(guard, [&] { return aborted || sequence < nextToTake + maxInFlight + ahead; });
+        return !aborted;
     }
-    listFile.close();
 
-    string ffmpegCmd = "ffmpeg -f concat -safe 0 -i \"" + listFilename + "\" -c copy -pix_fmt yuv420p \"" + outputFilename + "\"";
-    system(ffmpegCmd.c_str());
+    // An empty result means the frame is skipped
+    void complete(size_t sequence, vector<uchar>&& jpeg)
+    {
+        lock_guard<mutex> guard(lock);
+        results[sequence] = move(jpeg);
+        resultReady.notify_all();
+    }
 
-    fs::remove(listFilename);
-}
+    // Muxer: waits for frame `sequence`, which must be the next one
+    bool take(size_t sequence, vector<uchar>& jpeg)
+    {
+        unique_lock<mutex> guard(lock);
+        resultReady.wait(guard, [&] { return aborted || results.count(sequence) > 0; });
+        if (aborted) {
+            return false;
+        }
+        jpeg = move(results[sequence]);
+        results.erase(sequence);
+        nextToTake = sequence + 1;
+        slotFree.notify_all();
+        return true;
+    }
+
+    void abort()
+    {
+        lock_guard<mutex> guard(lock);
+        aborted = true;
+        slotFree.notify_all();
+        resultReady.notify_all();
+    }
+
+private:
+    mutex lock;
+    condition_variable slotFree;
+    condition_variable resultReady;
+    map<size_t, vector<uchar>> results;
+    size_t maxInFlight;
+    size_t nextToTake = 0;
+    bool aborted = false;
+};
 
 // Function to delete BMP files
 void DeleteBmpFiles(const vector<fs::path>& bmpFiles)
@@ -98,15 +272,59 @@ void DeleteBmpFiles(const vector<fs::path>& bmpFiles)
 
 int main(int argc, char** argv)
 {
-    if (argc != 4)
+    // Options can go anywhere; everything else is positional
+    unsigned encoderCount = thread::hardware_concurrency();
+    unsigned readerCount = 2;
+    size_t prefetchFiles = 64;
+    int jpegQuality = 95;
+    double fps = 170.0; // Frames per second
+    bool keepImages = false;
+    vector<string> positional;
+    for (int i = 1; i < argc; ++i)
     {
-        cout << "Usage: " << argv[0] << " <image_directory> <prefix> <output_video_filename>" << endl;
+        string arg = argv[i];
+        if (arg == "--threads" && i + 1 < argc)
+        {
+            encoderCount = static_cast<unsigned>(stoul(argv[++i]));
+        }
+        else if (arg == "--readers" && i + 1 < argc)
+        {
+            readerCount = static_cast<unsigned>(stoul(argv[++i]));
+        }
+        else if (arg == "--prefetch" && i + 1 < argc)
+        {
+            prefetchFiles = stoul(argv[++i]);
+        }
+        else if (arg == "--quality" && i + 1 < argc)
+        {
+            jpegQuality = stoi(argv[++i]);
+        }
+        else if (arg == "--fps" && i + 1 < argc)
+        {
+            fps = stod(argv[++i]);
+        }
+        else if (arg == "--keep_images")
+        {
+            keepImages = true;
+        }
+        else
+        {
+            positional.push_back(arg);
+        }
+    }
+    encoderCount = max(encoderCount, 1u);
+    readerCount = max(readerCount, 1u);
+
+    if (positional.size() != 3)
+    {
+        cout << "Usage: " << argv[0] << " <image_directory> <prefix> <output_video_filename> [options]" << endl;
+        cout << "Options: --threads N, --readers N, --prefetch N, --quality 0-100, --fps N, --keep_images" << endl;
         return -1;
     }
 
-    string imageDirectory = argv[1];
-    string prefix = argv[2];
-    string outputVideoFilename = argv[3];
+    string imageDirectory = positional[0];
+    string prefix = positional[1];
+    string outputVideoFilename = positional[2];
 
     try
     {
@@ -119,59 +337,238 @@ int main(int argc, char** argv)
             return -1;
         }
 
-        // Determine video dimensions
-        cv::Size frameSize = GetVideoDimensions(bmpFiles[0]);
-        double fps = 170.0; // Frames per second
-
-        // Temporary video directory
-        fs::path tempVideoDir = fs::path(imageDirectory) / "temp_videos";
-        fs::create_directory(tempVideoDir);
-
-        // Split BMP files into chunks
-        int numThreads = thread::hardware_concurrency();
-        int numImages = bmpFiles.size();
-        int imagesPerThread = (numImages + numThreads - 1) / numThreads;
-
-        vector<thread> threads;
-        vector<string> tempVideoFilenames;
-
-        for (int i = 0; i < numThreads; ++i)
+        // Determine video dimensions; every frame must match the first
+        int frameWidth = 0;
+        int frameHeight = 0;
+        int frameChannels = 0;
+        ReadVideoFormat(bmpFiles[0], frameWidth, frameHeight, frameChannels);
+        bool isColor = frameChannels > 1;
+        size_t totalFrames = bmpFiles.size();
+
+        // MJPEG frames go straight into one AVI, in file order
+        AviMuxer muxer(outputVideoFilename, frameWidth, frameHeight, fps, isColor);
+        if (!muxer.isOpen())
         {
-            int startIdx = i * imagesPerThread;
-            int endIdx = min(startIdx + imagesPerThread - 1, numImages - 1);
+            cerr << "Error: Could not open output file: " << outputVideoFilename << endl;
+            return -1;
+        }
 
-            if (startIdx > endIdx)
+        cout << "Encoding " << totalFrames << " images (" << frameWidth << "x" << frameHeight << ") with "
+            << readerCount << " readers and " << encoderCount << " encoder threads" << endl;
+
+        StealingQueues queues(encoderCount);
+        ReorderBuffer reorder(encoderCount * 4);
+        StageTime readTime, encodeTime, writeTime;
+        atomic<uint64_t> bytesRead{ 0 };
+        atomic<uint64_t> failedFrames{ 0 };
+        atomic<size_t> nextToRead{ 0 };
+        atomic<unsigned> readersLeft{ readerCount };
+        atomic<bool> fallbackReported{ false };
+
+        // Readahead: has the OS start reading each file from disk a little
+        // before a reader maps it, so many small files become a steady stream
+        thread prefetchThread([&]() {
+            for (size_t sequence = 0; sequence < totalFrames && prefetchFiles > 0; ++sequence)
             {
-                break;
+                if (!reorder.waitForSlot(sequence, prefetchFiles))
+                {
+                    break;
+                }
+                prefetchFile(bmpFiles[sequence].string());
             }
+        });
 
-            tempVideoFilenames.push_back((tempVideoDir / ("chunk_" + to_string(i) + ".avi")).string());
+        // Reader stage: each reader claims the next file, maps it (or, if it
+        // isn't a BMP that can be used in place, reads it whole) and deals it
+        // to an encoder, staying no more than the window ahead
+        vector<thread> readerThreads;
+        for (unsigned r = 0; r < readerCount; ++r)
+        {
+            readerThreads.emplace_back([&]() {
+                while (true)
+                {
+                    size_t sequence = nextToRead++;
+                    if (sequence >= totalFrames || !reorder.waitForSlot(sequence))
+                    {
+                        break;
+                    }
+                    FrameJob job;
+                    job.sequence = sequence;
+                    auto readStart = chrono::steady_clock::now();
+                    try
+                    {
+                        job.bmp = make_unique<BmpImage>(bmpFiles[sequence].string());
+                    }
+                    catch (const runtime_error&)
+                    {
+                        job.bmp.reset();
+                    }
+                    if (job.bmp && job.bmp->valid())
+                    {
+                        bytesRead += job.bmp->fileBytes();
+                    }
+                    else
+                    {
+                        if (job.bmp && !fallbackReported.exchange(true))
+                        {
+                            cout << bmpFiles[sequence].filename().string() << ": " << job.bmp->error()
+                                << "; images like it are decoded by OpenCV" << endl;
+                        }
+                        job.bmp.reset();
+                        if (!ReadFile(bmpFiles[sequence], job.bytes))
+                        {
+                            cerr << "Error: Could not read " << bmpFiles[sequence].string() << endl;
+                            job.bytes.clear();
+                        }
+                        bytesRead += job.bytes.size();
+                    }
+                    readTime.add(chrono::steady_clock::now() - readStart);
+                    queues.push(move(job));
+                }
+                if (--readersLeft == 0)
+                {
+                    queues.finishInput();
+                }
+            });
+        }
 
-            vector<fs::path> chunk(bmpFiles.begin() + startIdx, bmpFiles.begin() + endIdx + 1);
-            threads.emplace_back(ProcessVideoChunk, chunk, i, tempVideoDir, fps, frameSize);
+        // Encoder stage: compress each image to JPEG. A mapped BMP is used in
+        // place; one stored bottom-up is flipped into a buffer first, which is
+        // the only copy its pixels see.
+        vector<thread> encoderThreads;
+        for (unsigned t = 0; t < encoderCount; ++t)
+        {
+            encoderThreads.emplace_back([&, t]() {
+                vector<int> params = { cv::IMWRITE_JPEG_QUALITY, jpegQuality };
+                cv::Mat flipped;  // Reused for every bottom-up BMP on this thread
+                FrameJob job;
+                bool stolen = false;
+                while (queues.pop(t, job, stolen))
+                {
+                    auto encodeStart = chrono::steady_clock::now();
+                    vector<uchar> jpeg;
+                    try
+                    {
+                        cv::Mat frame;
+                        if (job.bmp)
+                        {
+                            const BmpImage& bmp = *job.bmp;
+                            cv::Mat stored(bmp.height(), bmp.width(), CV_8UC(bmp.channels()),
+                                const_cast<uint8_t*>(bmp.storedRow(0)), bmp.stride());
+                            if (bmp.bottomUp())
+                            {
+                                cv::flip(stored, flipped, 0);
+                                frame = flipped;
+                            }
+                            else
+                            {
+                                frame = stored;
+                            }
+                        }
+                        else if (!job.bytes.empty())
+                        {
+                            frame = cv::imdecode(cv::Mat(1, static_cast<int>(job.bytes.size()), CV_8UC1, job.bytes.data()),
+                                cv::IMREAD_UNCHANGED);
+                        }
+                        if (frame.empty() && !job.bmp && !job.bytes.empty())
+                        {
+                            cerr << "Error: Could not decode the image: " << bmpFiles[job.sequence].string() << endl;
+                        }
+                        else if (frame.empty())
+                        {
+                            // Already reported by the reader
+                        }
+                        else if (frame.cols != frameWidth || frame.rows != frameHeight)
+                        {
+                            cerr << "Error: " << bmpFiles[job.sequence].string() << " is " << frame.cols << "x"
+                                << frame.rows << ", not " << frameWidth << "x" << frameHeight << "; skipped" << endl;
+                        }
+                        else
+                        {
+                            cv::imencode(".jpg", frame, jpeg, params);
+                        }
+                    }
+                    catch (const cv::Exception& e)
+                    {
+                        cerr << "Error encoding " << bmpFiles[job.sequence].string() << ": " << e.what() << endl;
+                        jpeg.clear();
+                    }
+                    failedFrames += jpeg.empty() ? 1 : 0;
+                    job.bmp.reset();  // Unmap the BMP before waiting on the muxer
+                    job.bytes = vector<char>();
+                    encodeTime.add(chrono::steady_clock::now() - encodeStart);
+                    reorder.complete(job.sequence, move(jpeg));
+                }
+            });
         }
 
-        for (auto& t : threads)
+        // Muxer stage (this thread): write frames back in order
+        auto startTime = chrono::steady_clock::now();
+        bool writeFailed = false;
+        vector<uchar> jpeg;
+        for (size_t frameIndex = 0; frameIndex < totalFrames; ++frameIndex)
         {
-            if (t.joinable())
+            if (!reorder.take(frameIndex, jpeg))
             {
-                t.join();
+                break;
+            }
+            auto writeStart = chrono::steady_clock::now();
+            bool written = jpeg.empty() || muxer.writeFrame(jpeg.data(), jpeg.size());
+            writeTime.add(chrono::steady_clock::now() - writeStart);
+            if (!written)
+            {
+                cerr << "Error: Failed writing to " << outputVideoFilename << endl;
+                writeFailed = true;
+                reorder.abort();
+                queues.abort();
+                break;
             }
-        }
 
-        // Concatenate the temporary video files into the final output video using ffmpeg
-        ConcatenateAviFiles(tempVideoFilenames, outputVideoFilename);
+            // Progress indicator
+            if (frameIndex % 1000 == 0 && frameIndex > 0)
+            {
+                double seconds = chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+                cout << "Processed frame " << frameIndex << " / " << totalFrames
+                    << " (" << static_cast<int>(frameIndex / seconds) << " frames/s)" << endl;
+            }
+        }
 
-        // Cleanup temporary video files
-        for (const auto& tempVideoFilename : tempVideoFilenames)
+        for (auto& readerThread : readerThreads)
         {
-            fs::remove(tempVideoFilename);
+            readerThread.join();
+        }
+        prefetchThread.join();
+        for (auto& encoderThread : encoderThreads)
+        {
+            encoderThread.join();
         }
 
-        fs::remove(tempVideoDir);
+        if (!muxer.close() || writeFailed)
+        {
+            cerr << "Error: Could not finish writing " << outputVideoFilename << endl;
+            return -1;
+        }
 
-        // Delete BMP files
-        DeleteBmpFiles(bmpFiles);
+        // Throughput, and how busy each stage was: the stage near 100% is the one to speed up
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+        double safeSeconds = seconds > 0 ? seconds : 1;
+        cout << "Encoded " << muxer.framesWritten() << " frames in " << seconds << " s ("
+            << static_cast<int>(muxer.framesWritten() / safeSeconds) << " frames/s, "
+            << static_cast<int>(bytesRead.load() / safeSeconds / (1 << 20)) << " MB/s read)" << endl;
+        cout << "Stage utilisation: open " << static_cast<int>(readTime.utilisation(seconds, readerCount) * 100)
+            << "% of " << readerCount << " threads, encode " << static_cast<int>(encodeTime.utilisation(seconds, encoderCount) * 100)
+            << "% of " << encoderCount << " threads, write " << static_cast<int>(writeTime.utilisation(seconds, 1) * 100)
+            << "%; " << queues.stolenJobs() << " frames stolen between encoders" << endl;
+
+        // Delete BMP files, unless some of them didn't make it into the video
+        if (failedFrames.load() > 0)
+        {
+            cerr << failedFrames.load() << " of " << totalFrames << " images could not be encoded; keeping the images." << endl;
+        }
+        else if (!keepImages)
+        {
+            DeleteBmpFiles(bmpFiles);
+        }
 
         cout << "Video saved at " << outputVideoFilename << endl;
     }
@@ -0,0 +1,263 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <exception>
+#include <memory>
+#include "../Common/SharedFrameRing.h"
+#include "../Common/LatencyHistogram.h"
+
+using namespace std;
+using namespace std::chrono;
+
+// Reads the frames Camera_to_binary publishes with --publish and measures how
+// long they take to arrive: from the slot being complete to this process
+// having the frame (publish_to_read), and from the camera handing the frame to
+// the recorder (grab_to_read). Doubles as an example of a reader.
+//
+// --publish_test stands in for the recorder, publishing synthetic frames at a
+// fixed rate, so the numbers can be had without a camera.
+
+struct Settings
+{
+    string name;
+    double seconds = 10;  // How long to read (or publish) for; 0 = until the recorder stops
+    bool zeroCopy = false;  // Look at frames where they lie instead of copying them out
+    bool publishTest = false;
+    double fps = 200;
+    size_t width = 1440;
+    size_t height = 1080;
+    size_t slots = 8;
+};
+
+void printLatency(const string& stage, const LatencyHistogram& histogram)
+{
+    LatencySummary summary = histogram.snapshot().summary();
+    cout << "  " << stage << ": p50 " << summary.p50Us << " us, p99 " << summary.p99Us << " us, p99.9 "
+        << summary.p999Us << " us, max " << summary.maxUs << " us (" << summary.count << " frames)" << endl;
+}
+
+// A few bytes from every page, so a frame is actually touched as analysis would
+uint64_t touch(const char* data, size_t bytes)
+{
+    uint64_t sum = 0;
+    for (size_t i = 0; i < bytes; i += 4096)
+    {
+        sum += static_cast<unsigned char>(data[i]);
+    }
+    return sum;
+}
+
+int publishTest(const Settings& settings)
+{
+    SharedFramePublisher publisher(settings.name, settings.slots, settings.width, settings.height, 1, "Mono8",
+        settings.fps, 1);
+    if (!publisher.isOpen())
+    {
+        cerr << "Error: Unable to publish as " << settings.name << ": " << publisher.error() << endl;
+        return -1;
+    }
+    cout << "Publishing " << settings.width << "x" << settings.height << " Mono8 at " << settings.fps << " fps as "
+        << settings.name << endl;
+
+    vector<char> frame(settings.width * settings.height);
+    LatencyHistogram publishTime;
+    auto period = duration_cast<steady_clock::duration>(duration<double>(1.0 / settings.fps));
+    auto start = steady_clock::now();
+    auto end = start + duration_cast<steady_clock::duration>(duration<double>(settings.seconds));
+    auto due = start;
+    for (uint64_t frameID = 0; settings.seconds <= 0 || due < end; ++frameID)
+    {
+        this_thread::sleep_until(due);
+        frame[static_cast<size_t>(frameID % frame.size())] = static_cast<char>(frameID);
+        uint64_t grabbed = shm::steadyNs();
+        uint64_t host = static_cast<uint64_t>(duration_cast<nanoseconds>(system_clock::now().time_since_epoch()).count());
+        auto publishStart = steady_clock::now();
+        publisher.publish(frame.data(), frame.size(), settings.width, frameID, grabbed, host, grabbed);
+        publishTime.record(steady_clock::now() - publishStart);
+        due += period;
+    }
+    publisher.close();
+
+    cout << "Published " << publisher.published() << " frames" << endl;
+    printLatency("publish", publishTime);
+    return 0;
+}
+
+int readFrames(const Settings& settings)
+{
+    // The recorder may not have started yet
+    unique_ptr<SharedFrameSubscriber> subscriber;
+    auto giveUp = steady_clock::now() + seconds(30);
+    while (!subscriber)
+    {
+        try
+        {
+            subscriber = make_unique<SharedFrameSubscriber>(settings.name);
+        }
+        catch (const std::runtime_error& e)
+        {
+            if (steady_clock::now() > giveUp)
+            {
+                cerr << "Error: " << e.what() << endl;
+                return -1;
+            }
+            this_thread::sleep_for(milliseconds(100));
+        }
+    }
+    cout << "Reading " << subscriber->width() << "x" << subscriber->height() << " " << subscriber->pixelFormat()
+        << " frames published as " << settings.name << " (" << subscriber->slots() << " slots, "
+        << subscriber->frameRate() / subscriber->publishEvery() << " fps)"
+        << (settings.zeroCopy ? " in place" : "") << endl;
+
+    LatencyHistogram publishToRead;
+    LatencyHistogram grabToRead;
+    uint64_t frames = 0;
+    uint64_t torn = 0;
+    uint64_t missed = 0;
+    uint64_t checksum = 0;
+    auto start = steady_clock::now();
+    auto end = start + duration_cast<steady_clock::duration>(duration<double>(settings.seconds));
+
+    if (settings.zeroCopy)
+    {
+        // What next() does, but using each frame where it lies
+        uint64_t number = subscriber->published();
+        while (settings.seconds <= 0 || steady_clock::now() < end)
+        {
+            uint64_t published = subscriber->published();
+            if (number >= published)
+            {
+                if (subscriber->closed())
+                {
+                    break;
+                }
+                this_thread::yield();
+                continue;
+            }
+            uint64_t oldest = published > subscriber->slots() ? published - subscriber->slots() : 0;
+            if (number < oldest)
+            {
+                missed += oldest - number;
+                number = oldest;
+            }
+
+            uint64_t publishNs = 0;
+            uint64_t grabNs = 0;
+            uint64_t sum = 0;
+            bool whole = subscriber->view(number, [&](const SharedFrameSubscriber::View& frame)
+            {
+                sum = touch(frame.data, frame.bytes);
+                publishNs = frame.publishSteadyNs;
+                grabNs = frame.grabSteadyNs;
+            });
+            uint64_t readNs = shm::steadyNs();
+            if (!whole)
+            {
+                torn++;  // Overwritten while we looked; the oldest has moved past it
+                continue;
+            }
+            checksum += sum;
+            publishToRead.record(readNs - publishNs);
+            grabToRead.record(readNs - grabNs);
+            frames++;
+            number++;
+        }
+    }
+    else
+    {
+        SharedFrameSubscriber::Frame frame;
+        while (settings.seconds <= 0 || steady_clock::now() < end)
+        {
+            if (!subscriber->next(frame, milliseconds(100)))
+            {
+                if (subscriber->closed())
+                {
+                    break;
+                }
+                continue;
+            }
+            uint64_t readNs = shm::steadyNs();
+            checksum += touch(frame.data.data(), frame.data.size());
+            publishToRead.record(readNs - frame.publishSteadyNs);
+            grabToRead.record(readNs - frame.grabSteadyNs);
+            frames++;
+        }
+        missed = subscriber->missed();
+    }
+
+    double elapsed = duration<double>(steady_clock::now() - start).count();
+    cout << "Read " << frames << " frames in " << elapsed << " s (" << frames / elapsed << " fps), missed " << missed;
+    if (settings.zeroCopy)
+    {
+        cout << ", " << torn << " overwritten while being read";
+    }
+    cout << (subscriber->closed() ? "; the recorder has stopped" : "") << endl;
+    printLatency("publish_to_read", publishToRead);
+    printLatency("grab_to_read", grabToRead);
+    if (checksum == 1)
+    {
+        cout << endl;  // Keeps the reads from being optimised away
+    }
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    Settings settings;
+    for (int i = 1; i < argc; ++i)
+    {
+        string arg = argv[i];
+        if (arg == "--seconds" && i + 1 < argc)
+        {
+            settings.seconds = stod(argv[++i]);
+        }
+        else if (arg == "--zero_copy")
+        {
+            settings.zeroCopy = true;
+        }
+        else if (arg == "--publish_test")
+        {
+            settings.publishTest = true;
+        }
+        else if (arg == "--fps" && i + 1 < argc)
+        {
+            settings.fps = stod(argv[++i]);
+        }
+        else if (arg == "--width" && i + 1 < argc)
+        {
+            settings.width = stoul(argv[++i]);
+        }
+        else if (arg == "--height" && i + 1 < argc)
+        {
+            settings.height = stoul(argv[++i]);
+        }
+        else if (arg == "--slots" && i + 1 < argc)
+        {
+            settings.slots = stoul(argv[++i]);
+        }
+        else if (settings.name.empty())
+        {
+            settings.name = arg;
+        }
+    }
+
+    if (settings.name.empty() || settings.fps <= 0)
+    {
+        cerr << "Usage: frame_subscriber <name> [--seconds N] [--zero_copy]" << endl;
+        cerr << "       frame_subscriber <name> --publish_test [--fps F] [--width W] [--height H] [--slots S] [--seconds N]" << endl;
+        cerr << "<name> is what Camera_to_binary was given with --publish (with _<rig> added when it records several cameras)." << endl;
+        return -1;
+    }
+
+    try
+    {
+        return settings.publishTest ? publishTest(settings) : readFrames(settings);
+    }
+    catch (const std::exception& e)
+    {
+        cerr << "Error: " << e.what() << endl;
+        return -1;
+    }
+}
@@ -1,5 +1,3 @@
-#include "Spinnaker.h"
-#include "SpinGenApi/SpinnakerGenApi.h"
 #include <opencv2/opencv.hpp>
 #include "nlohmann/json.hpp"
 #include <iostream>
@@ -9,187 +7,784 @@
 #include <filesystem>
 #include <exception>
 #include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <chrono>
+#include <functional>
+#include <iomanip>
+#include <sstream>
+#include <algorithm>
+#include <atomic>
+#include "../Common/MappedFrameReader.h"
+#include "../Common/AviMuxer.h"
+#include "../Common/BayerDemosaic.h"
+#include "../Common/ClockSync.h"
+#include "../Common/SessionMetadata.h"
+#include "../Common/TraceRecorder.h"
+#include "../Common/SessionScheduler.h"
+#include "../Common/FollowedRecording.h"
 
 namespace fs = std::filesystem;
 
-using namespace Spinnaker;
-using namespace Spinnaker::GenApi;
 using namespace std;
 using json = nlohmann::json;
 
-int main(int argc, char** argv)
+// A frame handed from the reader to the encoder threads
+struct EncodeJob
+{
+    size_t sequence;
+    const char* data;  // Points into the mapped recording; null if the frame could not be read
+    size_t size;
+    camrec::FrameInfo info;  // Says whether data is raw pixels or needs decoding first
+};
+
+// Frames in flight between the reader, the encoder threads and the muxer.
+// Encoders finish in any order; the muxer takes frames back in sequence, and
+// the reader waits once maxInFlight frames are ahead of the muxer, which
+// bounds memory however far the encoders get behind.
+class EncodePipeline
 {
-    // Check for proper usage
-    if (argc < 3)
+public:
+    explicit EncodePipeline(size_t maxInFlight) : maxInFlight(maxInFlight) {}
+
+    bool push(const EncodeJob& job)
     {
-        cout << "Usage: " << argv[0] << " <binary_file_path> <metadata_file_path> [output_video_path]" << endl;
-        return -1;
+        unique_lock<mutex> guard(lock);
+        slotFree.wait(guard, [&] { return aborted || job.sequence < nextToTake + maxInFlight; });
+        if (aborted) {
+            return false;
+        }
+        jobs.push_back(job);
+        pushed++;
+        jobAvailable.notify_one();
+        return true;
     }
 
-    // Parse command-line arguments
-    string binaryFilePath = argv[1];
-    string metadataFilePath = argv[2];
-    string outputVideoPath;
-
-    if (argc >= 4)
+    void finishInput()
     {
-        outputVideoPath = argv[3];
+        lock_guard<mutex> guard(lock);
+        inputDone = true;
+        jobAvailable.notify_all();
+        resultReady.notify_all();
     }
-    else
+
+    // Encoder threads: false once the input is finished and drained
+    bool pop(EncodeJob& job)
     {
-        // Default output video path
-        outputVideoPath = fs::path(binaryFilePath).replace_extension(".avi").string();
+        unique_lock<mutex> guard(lock);
+        jobAvailable.wait(guard, [&] { return aborted || inputDone || !jobs.empty(); });
+        if (aborted || jobs.empty()) {
+            return false;
+        }
+        job = jobs.front();
+        jobs.pop_front();
+        return true;
     }
 
-    try
+    // An empty result means the frame is skipped
+    void complete(size_t sequence, vector<uchar>&& jpeg)
     {
-        // Initialize Spinnaker system
-        SystemPtr system = System::GetInstance();
+        lock_guard<mutex> guard(lock);
+        results[sequence] = move(jpeg);
+        resultReady.notify_all();
+    }
 
-        // Read metadata from JSON file
-        ifstream metadataFile(metadataFilePath);
-        if (!metadataFile.is_open())
-        {
-            cerr << "Error: Unable to open metadata file: " << metadataFilePath << endl;
-            return -1;
+    // Muxer: waits for frame `sequence`, which must be the next one; false
+    // if the input finished before it
+    bool take(size_t sequence, vector<uchar>& jpeg)
+    {
+        unique_lock<mutex> guard(lock);
+        resultReady.wait(guard, [&] { return aborted || results.count(sequence) > 0 || (inputDone && sequence >= pushed); });
+        if (aborted || results.count(sequence) == 0) {
+            return false;
         }
+        jpeg = move(results[sequence]);
+        results.erase(sequence);
+        nextToTake = sequence + 1;
+        slotFree.notify_all();
+        return true;
+    }
 
-        json metadataJson;
-        metadataFile >> metadataJson;
-        metadataFile.close();
+    void abort()
+    {
+        lock_guard<mutex> guard(lock);
+        aborted = true;
+        jobAvailable.notify_all();
+        slotFree.notify_all();
+        resultReady.notify_all();
+    }
 
-        // Extract metadata
-        size_t imageWidth = metadataJson.at("image_width").get<size_t>();
-        size_t imageHeight = metadataJson.at("image_height").get<size_t>();
-        string pixelFormatStr = metadataJson.at("pixel_format").get<string>();
-        double fps = metadataJson.at("frame_rate").get<double>();
-        size_t totalFrames = metadataJson.at("frame_IDs").size();
+private:
+    mutex lock;
+    condition_variable jobAvailable;
+    condition_variable slotFree;
+    condition_variable resultReady;
+    deque<EncodeJob> jobs;
+    map<size_t, vector<uchar>> results;
+    size_t maxInFlight;
+    size_t nextToTake = 0;
+    size_t pushed = 0;
+    bool inputDone = false;
+    bool aborted = false;
+};
 
-        // Determine pixel format
-        PixelFormatEnums pixelFormat;
-        size_t imageSize;
+// Times each demosaic path against cv::cvtColor on the first frames of a
+// BayerRG8 recording, then exits without converting anything
+int benchmarkDemosaic(MappedFrameReader& reader, size_t maxFrames)
+{
+    size_t width = reader.width();
+    size_t height = reader.height();
+    if (reader.pixelFormat() != "BayerRG8")
+    {
+        cerr << "Error: --bench_demosaic needs a BayerRG8 recording, not " << reader.pixelFormat() << endl;
+        return -1;
+    }
 
-        if (pixelFormatStr == "Mono8")
+    // Load the frames up front so the disk isn't part of the timing
+    vector<vector<char>> frames;
+    camrec::FrameInfo info;
+    for (size_t i = 0; i < reader.frameCount() && frames.size() < maxFrames; ++i)
+    {
+        const char* data = nullptr;
+        size_t size = 0;
+        vector<char> pixels(width * height);
+        // Only whole frames of the recording's size; a raw .bin can end in a partial one
+        if (reader.frame(i, data, size, info) && camrec::decodedBytes(info, size) == pixels.size() &&
+            camrec::decodeFrame(info, data, size, pixels.data(), pixels.size()))
         {
-            pixelFormat = PixelFormat_Mono8;
-            imageSize = imageWidth * imageHeight;
+            frames.push_back(move(pixels));
         }
-        else if (pixelFormatStr == "BayerRG8")
+    }
+    if (frames.empty())
+    {
+        cerr << "Error: No readable frames to benchmark." << endl;
+        return -1;
+    }
+
+    cout << "Demosaic benchmark: " << frames.size() << " frames of " << width << "x" << height
+        << " (best instruction set: " << bayer::isaName(bayer::bestIsa()) << ")" << endl;
+
+    auto timeIt = [&](const function<void(const cv::Mat&, cv::Mat&)>& demosaic)
+    {
+        cv::Mat output;
+        auto start = chrono::steady_clock::now();
+        for (auto& frame : frames)
         {
-            pixelFormat = PixelFormat_BayerRG8;
-            imageSize = imageWidth * imageHeight;
+            cv::Mat image(static_cast<int>(height), static_cast<int>(width), CV_8UC1, frame.data());
+            demosaic(image, output);
         }
-        else
+        return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() / frames.size();
+    };
+
+    double opencvMs = timeIt([](const cv::Mat& image, cv::Mat& output)
+    {
+        cv::cvtColor(image, output, cv::COLOR_BayerBG2BGR);
+    });
+    cout << "  " << left << setw(18) << "cv::cvtColor" << right << opencvMs << " ms/frame" << endl;
+
+    for (bayer::Method method : { bayer::Method::Bilinear, bayer::Method::EdgeAware })
+    {
+        for (bayer::Isa isa : { bayer::Isa::Scalar, bayer::Isa::Ssse3, bayer::Isa::Avx2 })
         {
-            cerr << "Error: Unsupported pixel format: " << pixelFormatStr << endl;
-            return -1;
+            if (static_cast<int>(isa) > static_cast<int>(bayer::bestIsa()))
+            {
+                continue;
+            }
+            double ms = timeIt([&](const cv::Mat& image, cv::Mat& output)
+            {
+                output.create(image.rows, image.cols, CV_8UC3);
+                bayer::demosaicRGGB(image.data, image.step, output.data, output.step, width, height, method, isa);
+            });
+            string label = string(bayer::methodName(method)) + " " + bayer::isaName(isa);
+            cout << "  " << left << setw(18) << label << right << ms << " ms/frame ("
+                << opencvMs / ms << "x cvtColor)" << endl;
         }
+    }
 
-        // Open binary file
-        fstream rawFile(binaryFilePath, ios::in | ios::binary);
-        if (!rawFile.is_open())
+    // Bilinear should agree with OpenCV's (also bilinear) up to rounding and the border
+    cv::Mat image(static_cast<int>(height), static_cast<int>(width), CV_8UC1, frames[0].data());
+    cv::Mat ours(image.rows, image.cols, CV_8UC3);
+    cv::Mat theirs;
+    bayer::demosaicRGGB(image.data, image.step, ours.data, ours.step, width, height, bayer::Method::Bilinear);
+    cv::cvtColor(image, theirs, cv::COLOR_BayerBG2BGR);
+    cv::Rect inner(2, 2, image.cols - 4, image.rows - 4);
+    cv::Mat difference;
+    cv::absdiff(ours(inner), theirs(inner), difference);
+    cv::Scalar channelMeans = cv::mean(difference);
+    cout << "  Bilinear vs cvtColor: mean absolute difference "
+        << (channelMeans[0] + channelMeans[1] + channelMeans[2]) / 3 << " (first frame, border excluded)" << endl;
+    return 0;
+}
+
+// Writes each frame's ID and host times to a CSV, one row per frame of the
+// recording (in order), then exits without converting anything
+int writeFrameTimes(const string& metadataFilePath, const string& csvPath)
+{
+    SessionMetadata metadata = loadSessionMetadata(metadataFilePath);
+    if (metadata.frameTablePath.empty())
+    {
+        cerr << "Error: " << metadataFilePath << " has no frame table; the session predates per-frame timestamps." << endl;
+        return -1;
+    }
+
+    auto startTime = chrono::steady_clock::now();
+    frametable::Reader table(metadata.frameTablePath);
+    vector<clocksync::SyncPoint> points;
+    if (!metadata.clockSyncPath.empty())
+    {
+        points = clocksync::readSyncPoints(metadata.clockSyncPath);
+    }
+    clocksync::FrameTimeline wallClock(table, points, clocksync::HostClock::System);
+    clocksync::FrameTimeline steadyClock(table, points, clocksync::HostClock::Steady);
+    double loadSeconds = chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+
+    ofstream csv(csvPath);
+    if (!csv)
+    {
+        cerr << "Error: Could not open " << csvPath << endl;
+        return -1;
+    }
+    csv << "frame,frame_id,device_timestamp_ns,host_time_ns,host_steady_ns\n";
+    for (size_t row = 0; row < wallClock.frames(); ++row)
+    {
+        csv << row << ',' << wallClock.frameID(row) << ',' << table.value(frametable::DeviceTimestamp, row) << ','
+            << wallClock.hostTime(row) << ',';
+        if (table.hasColumn(frametable::SteadyTimestamp) || steadyClock.synchronised())
         {
-            cerr << "Error: Could not open binary file: " << binaryFilePath << endl;
-            return -1;
+            csv << steadyClock.hostTime(row);
         }
+        csv << '\n';
+    }
+    csv.close();
+    if (!csv)
+    {
+        cerr << "Error: Failed writing to " << csvPath << endl;
+        return -1;
+    }
+
+    cout << "Frame times for " << wallClock.frames() << " frames written to " << csvPath << endl;
+    if (wallClock.synchronised())
+    {
+        cout << "Host times are the camera timestamps mapped through " << points.size()
+            << " clock sync points (loaded in " << loadSeconds * 1000 << " ms)." << endl;
+    }
+    else
+    {
+        cout << "No clock sync points: host times are when the host received each frame." << endl;
+    }
+    return 0;
+}
+
+// The metadata written next to a <prefix>_video.camrec
+string metadataForRecording(const string& recordingPath)
+{
+    const string suffix = "_video.camrec";
+    if (recordingPath.size() <= suffix.size() ||
+        recordingPath.compare(recordingPath.size() - suffix.size(), suffix.size(), suffix) != 0)
+    {
+        return "";
+    }
+    return recordingPath.substr(0, recordingPath.size() - suffix.size()) + "_Tracker_data.json";
+}
+
+// How a recording is converted; the same for every recording in a batch
+struct ConversionSettings
+{
+    unsigned threadCount = 1;
+    int jpegQuality = 95;
+    bayer::Method demosaicMethod = bayer::Method::EdgeAware;
+    bool useOpenCVDemosaic = false;
+    string tracePath;
+    string label;  // Starts the progress lines when several conversions share the console
+    bool follow = false;  // The recording is still being written; see FollowedRecording.h
+};
+
+// Encodes a recording into an MJPEG AVI. With a gate, the reader waits on it
+// before each frame, and the conversion fails if it is cancelled. Following
+// a recording, frames are encoded as they are written, until its session ends.
+int convertRecording(const ConversionSettings& settings, const string& binaryFilePath, const string& metadataFilePath,
+    const string& outputVideoPath, ConversionGate* gate)
+{
+    // Map the recording; frames are read in place, without copies. One still
+    // being written is followed instead, and its frames copied out as they land.
+    unique_ptr<MappedFrameReader> mapped;
+    unique_ptr<FollowedRecording> followed;
+    size_t imageWidth, imageHeight, totalFrames;
+    string pixelFormatStr;
+    double fps;
+    if (settings.follow)
+    {
+        followed = make_unique<FollowedRecording>(binaryFilePath);
+        imageWidth = followed->width();
+        imageHeight = followed->height();
+        pixelFormatStr = followed->pixelFormat();
+        fps = followed->frameRate();
+        totalFrames = 0;  // Not known until the session ends
+    }
+    else
+    {
+        mapped = make_unique<MappedFrameReader>(binaryFilePath, metadataFilePath);
+        imageWidth = mapped->width();
+        imageHeight = mapped->height();
+        pixelFormatStr = mapped->pixelFormat();
+        fps = mapped->frameRate();
+        totalFrames = mapped->frameCount();
+    }
+
+    // Determine pixel format
+    bool isColor;
+    size_t imageSize;
+
+    if (pixelFormatStr == "Mono8")
+    {
+        isColor = false;
+        imageSize = imageWidth * imageHeight;
+    }
+    else if (pixelFormatStr == "BayerRG8")
+    {
+        isColor = true;
+        imageSize = imageWidth * imageHeight;
+    }
+    else
+    {
+        cerr << "Error: Unsupported pixel format: " << pixelFormatStr << endl;
+        return -1;
+    }
 
-        // Prepare OpenCV VideoWriter
-        int fourcc = cv::VideoWriter::fourcc('M', 'J', 'P', 'G');
-        cv::Size frameSize(static_cast<int>(imageWidth), static_cast<int>(imageHeight));
+    // MJPEG frames are written straight into the AVI, in frame order
+    AviMuxer muxer(outputVideoPath, imageWidth, imageHeight, fps, isColor);
+    if (!muxer.isOpen())
+    {
+        cerr << "Error: Could not open output file: " << outputVideoPath << endl;
+        return -1;
+    }
+
+    cout << "Processing binary video file..." << endl;
+    if (followed)
+    {
+        cout << "Following the recording as it is written, encoder threads: " << settings.threadCount << endl;
+    }
+    else
+    {
+        cout << "Total frames: " << totalFrames << ", encoder threads: " << settings.threadCount << endl;
+    }
+    if (isColor)
+    {
+        cout << "Demosaic: " << (settings.useOpenCVDemosaic ? string("cv::cvtColor")
+            : string(bayer::methodName(settings.demosaicMethod)) + " (" + bayer::isaName(bayer::bestIsa()) + ")") << endl;
+    }
 
-        bool isColor = (pixelFormat == PixelFormat_BayerRG8);
-        cv::VideoWriter videoWriter(outputVideoPath, fourcc, fps, frameSize, isColor);
-        if (!videoWriter.isOpened())
+    // Optional timeline of every stage of every frame, for finding where a slow conversion waits
+    unique_ptr<TraceRecorder> tracer;
+    if (!settings.tracePath.empty())
+    {
+        tracer = make_unique<TraceRecorder>(settings.tracePath, "process_bin_vid " + fs::path(binaryFilePath).filename().string());
+        if (!tracer->isOpen())
         {
-            cerr << "Error: Could not open VideoWriter for output file: " << outputVideoPath << endl;
+            cerr << "Error: Could not open trace file: " << settings.tracePath << endl;
             return -1;
         }
+        tracer->nameThread("muxer");
+    }
+    TraceRecorder* trace = tracer.get();
 
-        cout << "Processing binary video file..." << endl;
-        cout << "Total frames: " << totalFrames << endl;
+    size_t pipelineDepth = settings.threadCount * 4;
+    EncodePipeline pipeline(pipelineDepth);
+    atomic<bool> cancelled{ false };
 
-        // Move to the beginning of the file
-        rawFile.seekg(0);
+    // Followed frames are copied out, into one of these in turn. A copy is
+    // only reused once the reader has pushed pipelineDepth more frames, which
+    // the pipeline allows only after the muxer has taken the frame in it.
+    vector<vector<char>> copies(followed ? pipelineDepth + 1 : 0);
 
-        for (size_t frameIndex = 0; frameIndex < totalFrames; ++frameIndex)
+    // Reader stage: CRC-checks each frame and hands out a pointer into the mapping
+    thread readerThread([&]() {
+        if (trace)
         {
-            // Read image into buffer
-            shared_ptr<char> pBuffer(new char[imageSize], default_delete<char[]>());
-
-            rawFile.read(pBuffer.get(), imageSize);
-
-            // Check if reading is successful
-            if (!rawFile.good())
+            trace->nameThread("reader");
+        }
+        camrec::FrameInfo frameInfo;
+        for (size_t frameIndex = 0; followed || frameIndex < totalFrames; ++frameIndex)
+        {
+            if (gate && !gate->admit())
             {
-                cerr << "Error reading image " << frameIndex << ". Aborting..." << endl;
-                return -1;
+                cancelled = true;
+                pipeline.abort();
+                break;
             }
-
-            // Create Spinnaker image from buffer
-            ImagePtr pImage = Image::Create(
-                imageWidth,
-                imageHeight,
-                0,
-                0,
-                pixelFormat,
-                pBuffer.get());
-
-            if (!pImage || !pImage->IsValid())
+            if (followed && !followed->waitForFrame(frameIndex))
             {
-                cerr << "Error: Invalid image at frame " << frameIndex << endl;
-                continue;
+                break;  // The session ended
             }
+            const char* frameData = nullptr;
+            size_t frameBytes = 0;
 
-            // Convert image to Mono8 or BGR8 as needed
-            if (pixelFormat == PixelFormat_Mono8)
+            // Damaged frames in a .camrec are skipped; the CRC tells us which ones they are
+            auto readStart = chrono::steady_clock::now();
+            bool frameRead = followed
+                ? followed->frame(frameIndex, copies[frameIndex % copies.size()], frameData, frameBytes, frameInfo)
+                : mapped->frame(frameIndex, frameData, frameBytes, frameInfo);
+            auto readEnd = chrono::steady_clock::now();
+            if (trace)
             {
-                // For Mono8, no conversion needed
+                trace->span("read", readStart, readEnd, static_cast<int64_t>(frameIndex));
             }
-            else
+            if (!frameRead)
             {
-                cerr << "Error: Unsupported pixel format during processing." << endl;
-                continue;
+                cerr << "Error reading frame " << frameIndex << ", skipping." << endl;
+                frameData = nullptr;
             }
-
-            // Create OpenCV Mat from Spinnaker image
-            cv::Mat image;
-            if (pixelFormat == PixelFormat_Mono8)
+            else if (frameInfo.codec == camrec::Codec::Raw ? frameBytes != imageSize : frameInfo.rawBytes != imageSize)
             {
-                image = cv::Mat(static_cast<int>(imageHeight), static_cast<int>(imageWidth), CV_8UC1, pImage->GetData(), pImage->GetStride());
+                cerr << "Error: Unexpected frame size at frame " << frameIndex << endl;
+                frameData = nullptr;
             }
-            else if (pixelFormat == PixelFormat_BayerRG8)
+
+            // Blocks while the encoders (or the muxer) are too far behind
+            TraceSpan queued(trace, "queue_wait", static_cast<int64_t>(frameIndex));
+            if (!pipeline.push({ frameIndex, frameData, frameBytes, frameInfo }))
             {
-                image = cv::Mat(static_cast<int>(imageHeight), static_cast<int>(imageWidth), CV_8UC3, pImage->GetData(), pImage->GetStride());
+                break;
             }
+        }
+        pipeline.finishInput();
+    });
 
-            if (image.empty())
+    // Encoder stage: frames are independent, so any thread can take any frame
+    vector<thread> encoderThreads;
+    for (unsigned t = 0; t < settings.threadCount; ++t)
+    {
+        encoderThreads.emplace_back([&, t]() {
+            if (trace)
             {
-                cerr << "Error: Empty image at frame " << frameIndex << endl;
-                continue;
+                trace->nameThread("encoder " + to_string(t));
             }
-
-            // Write frame to video
-            videoWriter.write(image);
-
-            // Progress indicator
-            if (frameIndex % 100 == 0)
+            vector<int> params = { cv::IMWRITE_JPEG_QUALITY, settings.jpegQuality };
+            cv::Mat colorImage;  // Reused for every demosaiced frame on this thread
+            vector<char> decoded;  // Reused for every compressed frame on this thread
+            EncodeJob job;
+            while (pipeline.pop(job))
             {
-                cout << "Processed frame " << frameIndex << " / " << totalFrames << endl;
+                vector<uchar> jpeg;
+                int64_t traceFrame = static_cast<int64_t>(job.sequence);
+                if (job.data && job.info.codec != camrec::Codec::Raw)
+                {
+                    TraceSpan span(trace, "decode", traceFrame);
+                    // Compressed at capture time: decode here, so decoding runs on every encoder thread
+                    decoded.resize(imageSize);
+                    if (camrec::decodeFrame(job.info, job.data, job.size, decoded.data(), decoded.size()))
+                    {
+                        job.data = decoded.data();
+                    }
+                    else
+                    {
+                        cerr << "Error decoding frame " << job.sequence << ", skipping." << endl;
+                        job.data = nullptr;
+                    }
+                }
+                if (job.data)
+                {
+                    try
+                    {
+                        // View the frame as a cv::Mat; nothing writes to it
+                        cv::Mat image(static_cast<int>(imageHeight), static_cast<int>(imageWidth), CV_8UC1,
+                            const_cast<char*>(job.data));
+                        if (isColor && settings.useOpenCVDemosaic)
+                        {
+                            TraceSpan span(trace, "demosaic", traceFrame);
+                            // RGGB sensor order is what OpenCV calls BayerBG
+                            cv::cvtColor(image, colorImage, cv::COLOR_BayerBG2BGR);
+                            image = colorImage;
+                        }
+                        else if (isColor)
+                        {
+                            TraceSpan span(trace, "demosaic", traceFrame);
+                            colorImage.create(image.rows, image.cols, CV_8UC3);
+                            bayer::demosaicRGGB(image.data, image.step, colorImage.data, colorImage.step,
+                                imageWidth, imageHeight, settings.demosaicMethod);
+                            image = colorImage;
+                        }
+                        TraceSpan span(trace, "jpeg_encode", traceFrame);
+                        cv::imencode(".jpg", image, jpeg, params);
+                    }
+                    catch (const cv::Exception& e)
+                    {
+                        cerr << "Error encoding frame " << job.sequence << ": " << e.what() << endl;
+                        jpeg.clear();
+                    }
+                }
+                pipeline.complete(job.sequence, move(jpeg));
             }
+        });
+    }
+
+    // Muxer stage (this thread): write frames back in order
+    auto startTime = chrono::steady_clock::now();
+    bool writeFailed = false;
+    vector<uchar> jpeg;
+    for (size_t frameIndex = 0; followed || frameIndex < totalFrames; ++frameIndex)
+    {
+        auto waitStart = chrono::steady_clock::now();
+        if (!pipeline.take(frameIndex, jpeg))
+        {
+            break;
+        }
+        auto writeStart = chrono::steady_clock::now();
+        bool written = jpeg.empty() || muxer.writeFrame(jpeg.data(), jpeg.size());
+        if (trace)
+        {
+            trace->span("wait_for_frame", waitStart, writeStart, static_cast<int64_t>(frameIndex));
+            trace->span("mux_write", writeStart, chrono::steady_clock::now(), static_cast<int64_t>(frameIndex));
+        }
+        if (!written)
+        {
+            cerr << "Error: Failed writing to " << outputVideoPath << endl;
+            writeFailed = true;
+            pipeline.abort();
+            break;
+        }
+
+        // Progress indicator
+        if (frameIndex % 1000 == 0 && frameIndex > 0)
+        {
+            double seconds = chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+            cout << settings.label << "Processed frame " << frameIndex << (followed ? string() : " / " + to_string(totalFrames))
+                << " (" << static_cast<int>(frameIndex / seconds) << " frames/s)" << endl;
+        }
+    }
+
+    readerThread.join();
+    for (auto& encoderThread : encoderThreads)
+    {
+        encoderThread.join();
+    }
+    if (tracer)
+    {
+        TraceRecorder::Stats traceStats = tracer->finish();
+        cout << "Trace: " << traceStats.events << " events from " << traceStats.threads << " threads written to "
+            << settings.tracePath << endl;
+        if (traceStats.dropped > 0)
+        {
+            cerr << "Warning: " << traceStats.dropped << " trace events dropped because the trace file fell behind." << endl;
+        }
+        if (tracer->failed())
+        {
+            cerr << "Error: Failed to write the trace file " << settings.tracePath << endl;
+        }
+    }
+
+    if (cancelled)
+    {
+        cerr << settings.label << "Conversion cancelled: " << outputVideoPath << " is incomplete" << endl;
+        muxer.close();
+        return -1;
+    }
+
+    // Release resources
+    if (!muxer.close() || writeFailed)
+    {
+        cerr << "Error: Could not finish writing " << outputVideoPath << endl;
+        return -1;
+    }
+
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+    cout << "Encoded " << muxer.framesWritten() << " frames in " << seconds << " s ("
+        << static_cast<int>(muxer.framesWritten() / (seconds > 0 ? seconds : 1)) << " frames/s, "
+        << settings.threadCount << " threads)" << endl;
+    cout << "Video conversion completed successfully. Output file: " << outputVideoPath << endl;
+    return 0;
+}
+
+// Converts every finished session under the roots, and each new one as it
+// finishes, until stopped or, with once, until the backlog is done
+int watchSessions(const vector<string>& roots, ConversionSettings settings, size_t jobs, size_t diskReaders,
+    double recordingFps, bool once)
+{
+    for (const string& root : roots)
+    {
+        if (!fs::is_directory(root))
+        {
+            cerr << "Error: Not a folder: " << root << endl;
+            return -1;
         }
+    }
+    // The cores are shared between the conversions running at once
+    settings.threadCount = max(1u, settings.threadCount / static_cast<unsigned>(max<size_t>(jobs, 1)));
 
-        // Release resources
-        videoWriter.release();
-        rawFile.close();
-        system->ReleaseInstance();
+    SessionScheduler scheduler(roots, jobs, diskReaders, recordingFps,
+        [&](const SessionRecording& recording, const string& partialPath, ConversionGate& gate) {
+            ConversionSettings job = settings;
+            job.label = "[" + fs::path(recording.recordingPath).filename().string() + "] ";
+            return convertRecording(job, recording.recordingPath, recording.metadataPath, partialPath, &gate) == 0;
+        });
+    cout << "Watching " << roots.size() << " folder(s) for finished sessions: " << jobs << " conversion(s) at once, "
+        << diskReaders << " per disk, " << settings.threadCount << " encoder threads each" << endl;
+
+    SessionScheduler::Totals totals = scheduler.run(once);
+    cout << "Converted " << totals.converted << " recording(s), " << totals.failed << " failed" << endl;
+    return totals.failed > 0 ? -1 : 0;
+}
+
+int main(int argc, char** argv)
+{
+    // Options can go anywhere; everything else is positional
+    ConversionSettings settings;
+    settings.threadCount = thread::hardware_concurrency();
+    string demosaicName = "edge";
+    size_t benchFrames = 0;
+    string frameTimesPath;
+    string watchRoots;
+    size_t jobs = 2;
+    size_t diskReaders = 1;
+    double recordingFps = 0;
+    bool once = false;
+    vector<string> positional;
+    for (int i = 1; i < argc; ++i)
+    {
+        string arg = argv[i];
+        if (arg == "--threads" && i + 1 < argc)
+        {
+            settings.threadCount = static_cast<unsigned>(stoul(argv[++i]));
+        }
+        else if (arg == "--quality" && i + 1 < argc)
+        {
+            settings.jpegQuality = stoi(argv[++i]);
+        }
+        else if (arg == "--demosaic" && i + 1 < argc)
+        {
+            demosaicName = argv[++i];
+        }
+        else if (arg == "--bench_demosaic" && i + 1 < argc)
+        {
+            benchFrames = stoul(argv[++i]);
+        }
+        else if (arg == "--frame_times" && i + 1 < argc)
+        {
+            frameTimesPath = argv[++i];
+        }
+        else if (arg == "--trace" && i + 1 < argc)
+        {
+            settings.tracePath = argv[++i];
+        }
+        else if (arg == "--watch" && i + 1 < argc)
+        {
+            watchRoots = argv[++i];
+        }
+        else if (arg == "--jobs" && i + 1 < argc)
+        {
+            jobs = stoul(argv[++i]);
+        }
+        else if (arg == "--disk_readers" && i + 1 < argc)
+        {
+            diskReaders = stoul(argv[++i]);
+        }
+        else if (arg == "--recording_fps" && i + 1 < argc)
+        {
+            recordingFps = stod(argv[++i]);
+        }
+        else if (arg == "--once")
+        {
+            once = true;
+        }
+        else if (arg == "--follow")
+        {
+            settings.follow = true;
+        }
+        else
+        {
+            positional.push_back(arg);
+        }
+    }
+    if (settings.threadCount == 0)
+    {
+        settings.threadCount = 1;
+    }
+    settings.useOpenCVDemosaic = demosaicName == "opencv";
+    if (!settings.useOpenCVDemosaic && !bayer::parseMethod(demosaicName, settings.demosaicMethod))
+    {
+        cerr << "Error: --demosaic must be edge, bilinear or opencv" << endl;
+        return -1;
+    }
 
-        cout << "Video conversion completed successfully. Output file: " << outputVideoPath << endl;
+    if (!watchRoots.empty())
+    {
+        if (!settings.tracePath.empty())
+        {
+            cerr << "Error: --trace is for converting a single recording, not with --watch" << endl;
+            return -1;
+        }
+        vector<string> roots;
+        stringstream list(watchRoots);
+        string root;
+        while (getline(list, root, ','))
+        {
+            roots.push_back(root);
+        }
+        try
+        {
+            return watchSessions(roots, settings, jobs, diskReaders, recordingFps, once);
+        }
+        catch (const std::exception& e)
+        {
+            cerr << "Standard Exception: " << e.what() << endl;
+            return -1;
+        }
     }
-    catch (const Spinnaker::Exception& e)
+
+    // Check for proper usage: a .camrec carries its own metadata, a legacy .bin needs the JSON.
+    // A recording being followed has no JSON yet; its frame journal stands in for it.
+    bool isContainer = !positional.empty() && camrec::RecordingReader::isRecording(positional[0]);
+    bool needsMetadata = !isContainer && !settings.follow;
+    if (positional.empty() || (needsMetadata && positional.size() < 2))
     {
-        cerr << "Spinnaker Exception: " << e.what() << endl;
+        cout << "Usage: " << argv[0] << " <recording.camrec> [output_video_path] [options]" << endl;
+        cout << "       " << argv[0] << " <binary_file_path> <metadata_file_path> [output_video_path] [options]" << endl;
+        cout << "       " << argv[0] << " <recording being written> --follow [output_video_path] [options]" << endl;
+        cout << "       " << argv[0] << " --watch <folder>[,<folder>...] [--jobs N] [--disk_readers N] [--recording_fps N] [--once] [options]" << endl;
+        cout << "Options: --threads N, --quality 0-100, --demosaic edge|bilinear|opencv, --bench_demosaic <frames>, --frame_times <csv>, --trace <json>" << endl;
         return -1;
     }
+
+    // Parse command-line arguments
+    string binaryFilePath = positional[0];
+    string metadataFilePath = needsMetadata ? positional[1] : "";
+    string outputVideoPath;
+    size_t outputArg = needsMetadata ? 2 : 1;
+
+    if (positional.size() > outputArg)
+    {
+        outputVideoPath = positional[outputArg];
+    }
+    else
+    {
+        // Default output video path
+        outputVideoPath = fs::path(binaryFilePath).replace_extension(".avi").string();
+    }
+
+    try
+    {
+        if (!frameTimesPath.empty())
+        {
+            string metadataPath = isContainer ? metadataForRecording(binaryFilePath) : metadataFilePath;
+            if (metadataPath.empty() || !fs::exists(metadataPath))
+            {
+                cerr << "Error: --frame_times needs the session's _Tracker_data.json next to " << binaryFilePath << endl;
+                return -1;
+            }
+            return writeFrameTimes(metadataPath, frameTimesPath);
+        }
+
+        if (benchFrames > 0)
+        {
+            MappedFrameReader reader(binaryFilePath, metadataFilePath);
+            return benchmarkDemosaic(reader, benchFrames);
+        }
+
+        return convertRecording(settings, binaryFilePath, metadataFilePath, outputVideoPath, nullptr);
+    }
     catch (const json::exception& e)
     {
         cerr << "JSON Exception: " << e.what() << endl;
@@ -0,0 +1,247 @@
+#include "nlohmann/json.hpp"
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <filesystem>
+#include <exception>
+#include <ctime>
+#include "../Common/FrameJournal.h"
+#include "../Common/FrameSource.h"
+#include "../Common/FrameTable.h"
+#include "../Common/RecordingFormat.h"
+
+namespace fs = std::filesystem;
+
+using namespace std;
+using json = nlohmann::json;
+
+const string JOURNAL_SUFFIX = "_frame_journal.camjournal";
+
+// Same format as the recorder's start and end times
+string formatHostTime(uint64_t hostTimestamp)
+{
+    time_t seconds = static_cast<time_t>(hostTimestamp / 1000000000ull);
+    tm localTime;
+    localtime_s(&localTime, &seconds);
+    char buffer[80];
+    strftime(buffer, sizeof(buffer), "%y%m%d_%H%M%S", &localTime);
+    return string(buffer);
+}
+
+// Copies what the recorder wrote to <path>.before_salvage before it is replaced;
+// an earlier salvage's copy is left alone
+void keepBeforeSalvage(const string& path, const string& what)
+{
+    if (fs::exists(path))
+    {
+        string previous = path + ".before_salvage";
+        if (!fs::exists(previous))
+        {
+            fs::copy_file(path, previous);
+            cout << "Previous " << what << " kept as " << previous << endl;
+        }
+    }
+}
+
+// The video written alongside a journal: <prefix>_video.camrec or <prefix>_binary_video.bin
+string findVideo(const string& prefix)
+{
+    for (const string& suffix : { string("_video.camrec"), string("_binary_video.bin") })
+    {
+        if (fs::exists(prefix + suffix))
+        {
+            return prefix + suffix;
+        }
+    }
+    return "";
+}
+
+int main(int argc, char** argv)
+{
+    // Options can go anywhere; everything else is positional
+    string videoPath;
+    string outputPath;
+    vector<string> positional;
+    for (int i = 1; i < argc; ++i)
+    {
+        string arg = argv[i];
+        if (arg == "--video" && i + 1 < argc)
+        {
+            videoPath = argv[++i];
+        }
+        else if (arg == "--out" && i + 1 < argc)
+        {
+            outputPath = argv[++i];
+        }
+        else
+        {
+            positional.push_back(arg);
+        }
+    }
+
+    if (positional.size() != 1)
+    {
+        cout << "Usage: " << argv[0] << " <session" << JOURNAL_SUFFIX << "> [--video <file>] [--out <metadata.json>]" << endl;
+        cout << "Rebuilds {date_time}_{mouse_id}_Tracker_data.json from the frame journal and the video after a crash." << endl;
+        return -1;
+    }
+
+    string journalPath = positional[0];
+    string prefix = journalPath;
+    if (prefix.size() > JOURNAL_SUFFIX.size() &&
+        prefix.compare(prefix.size() - JOURNAL_SUFFIX.size(), JOURNAL_SUFFIX.size(), JOURNAL_SUFFIX) == 0)
+    {
+        prefix.erase(prefix.size() - JOURNAL_SUFFIX.size());
+    }
+    if (videoPath.empty())
+    {
+        videoPath = findVideo(prefix);
+    }
+    if (outputPath.empty())
+    {
+        outputPath = prefix + "_Tracker_data.json";
+    }
+
+    try
+    {
+        journal::Reader journalReader(journalPath);
+        const vector<journal::Record>& records = journalReader.records();
+        cout << "Journal: " << records.size() << " frames";
+        if (journalReader.trailingBytes() > 0)
+        {
+            cout << ", " << journalReader.trailingBytes() << " bytes of an unfinished block dropped";
+        }
+        cout << endl;
+
+        json data = json::parse(journalReader.session());
+
+        if (videoPath.empty() || !fs::exists(videoPath))
+        {
+            cerr << "Error: Could not find the video for " << journalPath << "; give it with --video." << endl;
+            return -1;
+        }
+
+        // The video decides which frames survived; the journal supplies what it can't
+        vector<journal::Record> frames;
+        uint64_t unjournaledFrames = 0;
+        uint64_t mismatchedIDs = 0;
+
+        if (camrec::RecordingReader::isRecording(videoPath))
+        {
+            // Every frame record has its ID and timestamps, so the container alone gives the list
+            camrec::RecordingReader video(videoPath);
+            for (uint64_t i = 0; i < video.frameCount(); ++i)
+            {
+                camrec::FrameInfo info;
+                if (!video.frameHeader(i, info))
+                {
+                    break;
+                }
+                journal::Record frame;
+                frame.frameID = info.frameID;
+                frame.deviceTimestamp = info.deviceTimestamp;
+                frame.hostTimestamp = info.hostTimestamp;
+                frames.push_back(frame);
+            }
+            size_t common = min(frames.size(), records.size());
+            for (size_t i = 0; i < common; ++i)
+            {
+                mismatchedIDs += records[i].frameID != frames[i].frameID ? 1 : 0;
+            }
+            unjournaledFrames = frames.size() - common;
+        }
+        else
+        {
+            // A raw .bin has nothing but pixels: keep the journaled frames that made it to disk
+            uint64_t videoBytes = fs::file_size(videoPath);
+            for (const journal::Record& record : records)
+            {
+                if (record.offset + record.bytes > videoBytes)
+                {
+                    break;
+                }
+                frames.push_back(record);
+            }
+
+            uint64_t frameBytes = data.value("image_width", uint64_t(0)) * data.value("image_height", uint64_t(0)) *
+                bytesPerPixel(data.value("pixel_format", string("Mono8")));
+            uint64_t framesOnDisk = frameBytes > 0 ? videoBytes / frameBytes : 0;
+            if (framesOnDisk > frames.size())
+            {
+                unjournaledFrames = framesOnDisk - frames.size();
+            }
+        }
+
+        cout << "Video: " << frames.size() << " frames recovered from " << videoPath << endl;
+        if (unjournaledFrames > 0)
+        {
+            cerr << "Warning: " << unjournaledFrames << " frames at the end of the video have no journal entry"
+                << (camrec::RecordingReader::isRecording(videoPath) ? "; their IDs come from the container."
+                    : " and are left out, since a raw .bin doesn't record frame IDs.") << endl;
+        }
+        if (mismatchedIDs > 0)
+        {
+            cerr << "Warning: " << mismatchedIDs << " frame IDs differ between the journal and the container; "
+                << "the container's are used." << endl;
+        }
+
+        // Per-frame data goes in a frame table next to the JSON, as the recorder writes it
+        string tablePath = prefix + "_frames.camtable";
+        keepBeforeSalvage(tablePath, "frame table");  // May hold rows the journal never got
+        BufferedFileSink tableSink(tablePath);
+        frametable::Writer table(tableSink);
+        for (const journal::Record& frame : frames)
+        {
+            table.append(frame.frameID, frame.deviceTimestamp, frame.hostTimestamp);
+        }
+        if (!tableSink.isOpen() || !table.finish() || !tableSink.close())
+        {
+            cerr << "Error: Could not write " << tablePath << endl;
+            return -1;
+        }
+
+        data["frame_count"] = frames.size();
+        data["first_frame_id"] = frames.empty() ? 0 : frames.front().frameID;
+        data["last_frame_id"] = frames.empty() ? 0 : frames.back().frameID;
+        data["frame_table"] = fs::path(tablePath).filename().string();
+        if (data.value("end_time", string()).empty() && !frames.empty())
+        {
+            data["end_time"] = formatHostTime(frames.back().hostTimestamp);
+        }
+        data["salvage"] = {
+            {"journal", fs::path(journalPath).filename().string()},
+            {"journal_frames", records.size()},
+            {"journal_bytes_dropped", journalReader.trailingBytes()},
+            {"video", fs::path(videoPath).filename().string()},
+            {"frames_recovered", frames.size()},
+            {"frames_without_journal", unjournaledFrames},
+            {"mismatched_ids", mismatchedIDs}
+        };
+
+        // Keep whatever metadata the recorder did manage to write
+        keepBeforeSalvage(outputPath, "metadata");
+
+        ofstream file(outputPath);
+        file << data.dump(4);  // Pretty print with 4 spaces
+        file.close();
+        if (!file)
+        {
+            cerr << "Error: Could not write " << outputPath << endl;
+            return -1;
+        }
+        cout << "Metadata written to " << outputPath << endl;
+    }
+    catch (const json::exception& e)
+    {
+        cerr << "JSON Error: " << e.what() << endl;
+        return -1;
+    }
+    catch (const exception& e)
+    {
+        cerr << "Error: " << e.what() << endl;
+        return -1;
+    }
+
+    return 0;
+}